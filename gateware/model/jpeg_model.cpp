@@ -0,0 +1,313 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "mkjpeg_model.h"
+#include "quant_tables.h"
+#include "rtl_tables.h"
+#include "video_model.h"
+
+using namespace std;
+
+static const int kNumChan = 4;              // striped_encoders num_chan
+static const uint16_t kMaxLineWidth = 512;  // jpeg_pkg.vhd C_MAX_LINE_WIDTH
+
+static void usage(const char *name)
+{
+    cerr << "Usage: " << name << " [-j JPEG_ENC_DIR] [-x W -y H] [-q QUALITY] [-o PREFIX] FRAME.data [REF_ch0.jpg ...]" << endl
+         << "       " << name << " [-j JPEG_ENC_DIR] -t" << endl
+         << "       " << name << " [-c CYCLES] -g -x W -y H | -m" << endl
+         << "  Encodes a raw RGB frame (as read by video_capture_tb, 1280x720 by default) the way" << endl
+         << "  striped_encoders does, and writes PREFIX_chN.jpg. Reference stripes, e.g. the" << endl
+         << "  cap_img_*_chN.jpg files written by the simulation, are compared byte for byte." << endl
+         << "  -t checks that the Huffman ROMs agree with the DHT segments in header.data, and" << endl
+         << "  qrom_lum_chr with the built-in qualities (quant_tables.h)." << endl
+         << "  -q encodes with the tables of an IJG quality (1 to 100) instead of qrom_lum_chr." << endl
+         << "  -g prints the stripe geometry, buffering and JPEG sizes of a mode, -m checks all" << endl
+         << "  VESA/CEA modes; -c sets the encoder clock cycles per pixel (2 by default)." << endl;
+}
+
+static bool readFile(const string &path, vector<uint8_t> &data)
+{
+    ifstream file(path, ios::binary);
+    if (!file) {
+        return false;
+    }
+    data.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    return true;
+}
+
+static int checkTables(const RtlTables &tables)
+{
+    vector<string> problems = checkHuffmanTables(tables);
+    for (const string &p : problems) {
+        cout << p << endl;
+    }
+    for (int d = 2; d < 256; d++) {
+        if (tables.romr[d] != (65536 + d / 2) / d) {
+            cout << "romr entry " << d << " is " << tables.romr[d] << ", not round(65536 / " << d << ")" << endl;
+        }
+    }
+    cout << (problems.empty() ? "Huffman ROMs match header.data" : "Huffman ROMs do not match header.data") << endl;
+    uint8_t builtin[128];
+    builtinQuantTables(builtin);
+    bool quantOk = memcmp(builtin, tables.qrom, sizeof(builtin)) == 0;
+    cout << (quantOk ? "qrom_lum_chr matches" : "qrom_lum_chr does not match") << " the IJG tables of quality "
+         << kBuiltinLumQuality << " (luminance) and " << kBuiltinChrQuality << " (chrominance)" << endl;
+    return problems.empty() && quantOk ? 0 : 1;
+}
+
+static const char *captureStatus(const CaptureAnalysis &a)
+{
+    if (!a.clockOk) {
+        return "pixel clock outside clk_activity_detect window";
+    }
+    if (a.badRes) {
+        return "fault_bad_res: res_y not a multiple of 8";
+    }
+    if (a.tooWide) {
+        return "stripe wider than RES_X_MAX";
+    }
+    if (a.overflow) {
+        return "pixel FIFO overflow";
+    }
+    return "ok";
+}
+
+static int printGeometry(uint16_t resX, uint16_t resY, const CaptureConfig &config)
+{
+    VideoMode mode = { "", resX, resY, 0, 0, 0 };
+    for (const VideoMode &m : standardModes()) {
+        if (m.resX == resX && m.resY == resY) {
+            mode = m;
+            break;
+        }
+    }
+    CaptureAnalysis a = analyzeCapture(mode, config);
+    cout << resX << "x" << resY;
+    if (a.timed) {
+        cout << ", timing of " << mode.name << ": " << mode.hTotal << "x" << mode.vTotal << " at "
+             << mode.pxClockMhz << " MHz";
+    } else {
+        cout << ", no standard timing";
+    }
+    cout << endl;
+    cout << "ch  start  res_x_out  res_x_nopad_out  MCUs  fifo_lines  jpeg";
+    if (a.timed) {
+        cout << "       margin  peak_backlog  done_us";
+    }
+    cout << endl;
+    for (size_t ch = 0; ch < a.stripes.size(); ch++) {
+        const StripeTiming &t = a.stripes[ch];
+        const StripeGeometry &g = t.geometry;
+        ostringstream jpeg;
+        jpeg << g.widthNopad << "x" << resY;
+        cout << setw(2) << ch << setw(7) << g.start << setw(11) << g.width << setw(17) << g.widthNopad
+             << setw(6) << (g.width / 16) * (resY / 8) << setw(12) << t.fifoLines << "  ";
+        if (!a.timed) {
+            cout << jpeg.str();
+        } else {
+            cout << left << setw(10) << jpeg.str() << right << fixed << setprecision(2) << setw(7) << t.margin << setw(14) << t.peakBacklog
+                 << setprecision(0) << setw(9) << t.encodeDoneUs << defaultfloat;
+        }
+        cout << endl;
+    }
+    cout << "buf_fifo " << config.bufFifoLines << " lines of " << config.maxLineWidth
+         << ", pixel FIFO " << config.pxFifoDepth << " pixels per stripe" << endl;
+    if (a.timed) {
+        cout << "capture every " << a.framesPerCapture << " frame(s), " << setprecision(3)
+             << a.captureFps << " fps" << endl;
+    }
+    cout << captureStatus(a) << endl;
+    return a.ok() ? 0 : 1;
+}
+
+static int sweepModes(const CaptureConfig &config)
+{
+    cout << left << setw(22) << "mode" << right << setw(8) << "MHz" << setw(10) << "stripe"
+         << setw(8) << "margin" << setw(8) << "fps" << "  status" << endl;
+    for (const VideoMode &m : standardModes()) {
+        CaptureAnalysis a = analyzeCapture(m, config);
+        const StripeGeometry &last = a.stripes.back().geometry;
+        ostringstream stripe;
+        stripe << last.widthNopad << "/" << last.width;
+        cout << left << setw(22) << m.name << right << fixed << setprecision(2) << setw(8) << m.pxClockMhz
+             << setw(10) << stripe.str() << setw(8) << a.margin << setprecision(1) << setw(8)
+             << (a.ok() ? a.captureFps : 0.0) << defaultfloat << "  " << captureStatus(a) << endl;
+    }
+    return 0;
+}
+
+// reports the first difference, if any
+static bool compareStripe(int chan, const vector<uint8_t> &model, const string &refPath)
+{
+    vector<uint8_t> ref;
+    if (!readFile(refPath, ref)) {
+        cout << "ch" << chan << ": could not read " << refPath << endl;
+        return false;
+    }
+    size_t n = min(model.size(), ref.size());
+    size_t pos = 0;
+    while (pos < n && model[pos] == ref[pos]) {
+        pos++;
+    }
+    if (pos == n && model.size() == ref.size()) {
+        cout << "ch" << chan << ": identical, " << ref.size() << " bytes" << endl;
+        return true;
+    }
+    cout << "ch" << chan << ": differs at byte " << pos << " (model " << model.size()
+         << " bytes, reference " << ref.size() << " bytes)";
+    if (pos < n) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), ": 0x%02X vs 0x%02X", model[pos], ref[pos]);
+        cout << buf;
+    }
+    cout << endl;
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    string jpegEncDir = "../jpeg_enc";
+    string prefix;
+    uint16_t resX = 1280;
+    uint16_t resY = 720;
+    bool check = false;
+    bool geometry = false;
+    bool sweep = false;
+    int quality = 0;
+    CaptureConfig config;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:x:y:q:o:tgmc:")) != -1) {
+        switch (opt) {
+        case 'j':
+            jpegEncDir = optarg;
+            break;
+        case 'x':
+            resX = atoi(optarg);
+            break;
+        case 'y':
+            resY = atoi(optarg);
+            break;
+        case 'q':
+            quality = atoi(optarg);
+            if (quality < 1 || quality > 100) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'o':
+            prefix = optarg;
+            break;
+        case 't':
+            check = true;
+            break;
+        case 'g':
+            geometry = true;
+            break;
+        case 'm':
+            sweep = true;
+            break;
+        case 'c':
+            config.encCyclesPerPx = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (sweep) {
+        return sweepModes(config);
+    }
+    if (geometry) {
+        return printGeometry(resX, resY, config);
+    }
+
+    RtlTables tables;
+    string error;
+    if (!loadRtlTables(jpegEncDir, tables, error)) {
+        cerr << error << endl;
+        return 1;
+    }
+    if (check) {
+        return checkTables(tables);
+    }
+    if (quality > 0) {
+        scaleQuantTables(quality, tables.qrom);
+    }
+
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    string framePath = argv[optind++];
+    vector<string> refs(argv + optind, argv + argc);
+    if (!refs.empty() && refs.size() != kNumChan) {
+        cerr << "Expected " << kNumChan << " reference stripes" << endl;
+        return 1;
+    }
+    if (prefix.empty()) {
+        prefix = framePath.substr(0, framePath.rfind(".data"));
+    }
+
+    // image_stripe.vhd fault_bad_res
+    if (resX < kNumChan || resY == 0 || resY % 8 != 0) {
+        cerr << "Vertical resolution must be a non-zero multiple of 8" << endl;
+        return 1;
+    }
+    vector<StripeGeometry> stripes = stripeGeometry(resX, kNumChan);
+    for (const StripeGeometry &s : stripes) {
+        if (s.width > kMaxLineWidth) {
+            cerr << "Stripe width " << s.width << " exceeds C_MAX_LINE_WIDTH" << endl;
+            return 1;
+        }
+    }
+
+    vector<uint8_t> rgb;
+    if (!readFile(framePath, rgb) || rgb.size() != static_cast<size_t>(resX) * resY * 3) {
+        cerr << "Could not read " << resX << "x" << resY << " RGB frame from " << framePath << endl;
+        return 1;
+    }
+
+    auto t0 = chrono::steady_clock::now();
+    vector<uint32_t> frame(static_cast<size_t>(resX) * resY);
+    for (size_t i = 0; i < frame.size(); i++) {
+        frame[i] = cscPixel(rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2]);
+    }
+
+    MkJpegModel model(tables);
+    vector<vector<uint8_t>> jpegs;
+    for (const StripeGeometry &s : stripes) {
+        vector<uint32_t> px = extractStripe(frame, resX, resY, s);
+        jpegs.push_back(model.encode(px.data(), s.width, s.width, resY, s.widthNopad, resY));
+    }
+    auto t1 = chrono::steady_clock::now();
+    cout << "Encoded " << resX << "x" << resY << " in "
+         << chrono::duration_cast<chrono::microseconds>(t1 - t0).count() / 1000.0 << " ms" << endl;
+
+    bool same = true;
+    for (int ch = 0; ch < kNumChan; ch++) {
+        string outPath = prefix + "_ch" + to_string(ch) + ".jpg";
+        ofstream out(outPath, ios::binary);
+        out.write(reinterpret_cast<const char *>(jpegs[ch].data()), jpegs[ch].size());
+        if (!out) {
+            cerr << "Could not write " << outPath << endl;
+            return 1;
+        }
+        if (!refs.empty()) {
+            same = compareStripe(ch, jpegs[ch], refs[ch]) && same;
+        }
+    }
+    return same ? 0 : 1;
+}
@@ -0,0 +1,276 @@
+#include "mkjpeg_model.h"
+
+#include <cstdlib>
+
+namespace {
+
+// mdct_pkg.vhd
+const int kIpBits = 8;
+const int kRamDataBits = 10;        // DCT1D output, kept in the transpose RAM
+const int kDaBits = 14 + kIpBits;   // ROMDATA_W + IP_W
+const int kDa2Bits = kDaBits + 2;
+const int kFracBits = 12;
+const int kCoefBits = 12;           // DCT2D output, quantizer input and output
+const int kLevelShift = 128;
+
+// zigzag.vhd
+const uint8_t kZigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// two's complement wrap-around to a signal of the given width
+inline int64_t wrap(int64_t value, int bits)
+{
+    uint64_t mask = (1ull << bits) - 1;
+    uint64_t v = static_cast<uint64_t>(value) & mask;
+    return (v & (1ull << (bits - 1))) ? static_cast<int64_t>(v | ~mask) : static_cast<int64_t>(v);
+}
+
+// size_reg in rle.vhd: position of the highest set bit of |value|
+inline int vliSize(int32_t value)
+{
+    uint32_t v = std::abs(value);
+    int size = 0;
+    while (v) {
+        size++;
+        v >>= 1;
+    }
+    return size;
+}
+
+}
+
+void MkJpegModel::BitWriter::put(uint32_t value, int size)
+{
+    // codes are at most 16 bits and VLIs 12, so acc never overflows
+    acc = acc << size | (value & ((1u << size) - 1));
+    bits += size;
+    while (bits >= 8) {
+        bits -= 8;
+        bytes.push_back(static_cast<uint8_t>(acc >> bits));
+    }
+    acc &= (1u << bits) - 1;
+}
+
+// huffman.vhd PAD state: the last byte of the image is filled up with ones
+void MkJpegModel::BitWriter::pad()
+{
+    if (bits != 0) {
+        put((1u << (8 - bits)) - 1, 8 - bits);
+    }
+}
+
+MkJpegModel::MkJpegModel(const RtlTables &tables) :
+    m_tables { tables },
+    m_prevDc { 0, 0, 0 },
+    m_huff { {}, 0, 0 }
+{
+    // ROME/ROMO hold the sums of these for each combination of the 4 input
+    // bits; distributed arithmetic over all bit slices yields the dot product
+    const int *c = tables.dctCoef;
+    const int32_t even[4][4] = {
+        { c[kAP],  c[kAP],  c[kAP],  c[kAP] },
+        { c[kBP],  c[kCP], -c[kCP], -c[kBP] },
+        { c[kAP], -c[kAP], -c[kAP],  c[kAP] },
+        { c[kCP], -c[kBP],  c[kBP], -c[kCP] },
+    };
+    const int32_t odd[4][4] = {
+        { c[kDP],  c[kEP],  c[kFP],  c[kGP] },
+        { c[kEP], -c[kGP], -c[kDP], -c[kFP] },
+        { c[kFP], -c[kDP],  c[kGP],  c[kEP] },
+        { c[kGP], -c[kFP],  c[kEP], -c[kDP] },
+    };
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            m_even[i][j] = even[i][j];
+            m_odd[i][j] = odd[i][j];
+        }
+    }
+}
+
+int32_t MkJpegModel::finitePrecRnd(int64_t value, int inBits, int outBits, int fracBits)
+{
+    bool sign = wrap(value, inBits) < 0;
+    int64_t rounded = wrap(value + (1ll << (fracBits - 1)), inBits) >> fracBits;
+    int roundedBits = inBits - fracBits;
+    int64_t max = (1ll << (outBits - 1)) - 1;
+
+    bool clip;
+    if (roundedBits != outBits) {
+        // the bits above the output MSB are not a sign extension
+        int64_t upper = rounded >> (outBits - 1);
+        clip = upper != 0 && upper != -1;
+    } else {
+        // rounding overflowed into the sign bit
+        clip = (rounded < 0) != sign && rounded != 0;
+    }
+    if (clip) {
+        return static_cast<int32_t>(sign ? -max : max);
+    }
+    return static_cast<int32_t>(wrap(rounded, outBits));
+}
+
+// one pass of DCT1D/DCT2D: butterfly into databuf_reg, then distributed
+// arithmetic over the even (ROME) and odd (ROMO) halves
+void MkJpegModel::dctRow(const int32_t in[8], int inBits, int32_t out[8], int daBits, int outBits) const
+{
+    int64_t d[8];
+    for (int j = 0; j < 4; j++) {
+        d[j] = wrap(in[j] + in[7 - j], inBits + 1);
+        d[4 + j] = wrap(in[j] - in[7 - j], inBits + 1);
+    }
+    for (int k = 0; k < 4; k++) {
+        int64_t even = 0;
+        int64_t odd = 0;
+        for (int j = 0; j < 4; j++) {
+            even += m_even[k][j] * d[j];
+            odd += m_odd[k][j] * d[4 + j];
+        }
+        out[2 * k] = finitePrecRnd(wrap(even, daBits), daBits, outBits, kFracBits);
+        out[2 * k + 1] = finitePrecRnd(wrap(odd, daBits), daBits, outBits, kFracBits);
+    }
+}
+
+void MkJpegModel::fdct(const uint8_t in[64], int16_t out[64]) const
+{
+    // DCT1D writes coefficient u of row r to RAM address u * 8 + r
+    int32_t ram[64];
+    for (int r = 0; r < 8; r++) {
+        int32_t x[8];
+        for (int c = 0; c < 8; c++) {
+            x[c] = in[r * 8 + c] - kLevelShift;
+        }
+        int32_t coef[8];
+        dctRow(x, kIpBits, coef, kDaBits, kRamDataBits);
+        for (int u = 0; u < 8; u++) {
+            ram[u * 8 + r] = coef[u];
+        }
+    }
+    // DCT2D reads it back one horizontal frequency at a time; FDCT stores
+    // the outputs transposed again, so DBUF ends up row-major
+    for (int u = 0; u < 8; u++) {
+        int32_t coef[8];
+        dctRow(&ram[u * 8], kRamDataBits, coef, kDa2Bits, kCoefBits);
+        for (int v = 0; v < 8; v++) {
+            out[v * 8 + u] = static_cast<int16_t>(coef[v]);
+        }
+    }
+}
+
+int16_t MkJpegModel::quantize(int16_t coef, uint8_t qval) const
+{
+    // 12 bit dividend times 17 bit reciprocal, 29 bit product
+    int64_t product = wrap(static_cast<int64_t>(coef) * m_tables.romr[qval], 29);
+    int64_t quotient = wrap(product >> 16, kCoefBits);
+    int64_t round = (product >> 15) & 1;
+    return static_cast<int16_t>(wrap(quotient + round, kCoefBits));
+}
+
+void MkJpegModel::encodeBlock(const uint8_t in[64], Component cmp)
+{
+    int16_t coef[64];
+    fdct(in, coef);
+
+    // zigzag read-out, then the quantizer RAM is indexed by arrival order
+    bool chroma = cmp == kCb || cmp == kCr;
+    const uint8_t *qtable = m_tables.qrom + (chroma ? 64 : 0);
+    int16_t q[64];
+    for (int k = 0; k < 64; k++) {
+        q[k] = quantize(coef[kZigzag[k]], qtable[k]);
+    }
+
+    // rle.vhd and huffman.vhd; Y1/Y2 share the DC predictor
+    const HuffCode *dcRom = m_tables.dc[chroma];
+    const HuffCode *acRom = m_tables.ac[chroma];
+    int pred = cmp == kCr ? 2 : (cmp == kCb ? 1 : 0);
+
+    auto emit = [this](const HuffCode &hc, int32_t acc) {
+        int size = vliSize(acc);
+        uint32_t vli = static_cast<uint32_t>(acc >= 0 ? acc : acc - 1) & 0xFFF;
+        m_huff.put(hc.code, hc.size);
+        m_huff.put(vli & ((1u << size) - 1), size);
+    };
+
+    int32_t diff = static_cast<int32_t>(wrap(q[0] - m_prevDc[pred], kCoefBits + 1));
+    m_prevDc[pred] = q[0];
+    int dcSize = vliSize(diff);
+    emit(dcSize < 16 ? dcRom[dcSize] : HuffCode { 0, 0 }, diff);
+
+    int zeros = 0;
+    for (int k = 1; k < 64; k++) {
+        if (q[k] == 0) {
+            if (k == 63) {
+                emit(acRom[0x00], 0);   // EOB
+            } else {
+                zeros++;
+            }
+            continue;
+        }
+        while (zeros > 15) {
+            emit(acRom[0xF0], 0);       // ZRL
+            zeros -= 16;
+        }
+        emit(acRom[zeros << 4 | vliSize(q[k])], q[k]);
+        zeros = 0;
+    }
+}
+
+std::vector<uint8_t> MkJpegModel::encode(const uint32_t *px, size_t stride,
+                                         uint16_t width, uint16_t height,
+                                         uint16_t widthNopad, uint16_t heightNopad)
+{
+    m_prevDc[0] = m_prevDc[1] = m_prevDc[2] = 0;
+    m_huff.bytes.clear();
+    m_huff.acc = 0;
+    m_huff.bits = 0;
+
+    // CtrlSM/FDCT: 16x8 MCUs, two luminance blocks, then Cb and Cr
+    // decimated by 2 horizontally (even columns, no averaging)
+    for (uint32_t y = 0; y < height; y += 8) {
+        for (uint32_t x = 0; x < width; x += 16) {
+            uint8_t blk[4][64];
+            for (int r = 0; r < 8; r++) {
+                const uint32_t *line = px + (y + r) * stride + x;
+                for (int c = 0; c < 8; c++) {
+                    blk[kY1][r * 8 + c] = line[c] & 0xFF;
+                    blk[kY2][r * 8 + c] = line[8 + c] & 0xFF;
+                    blk[kCb][r * 8 + c] = (line[2 * c] >> 8) & 0xFF;
+                    blk[kCr][r * 8 + c] = (line[2 * c] >> 16) & 0xFF;
+                }
+            }
+            for (int cmp = kY1; cmp <= kCr; cmp++) {
+                encodeBlock(blk[cmp], static_cast<Component>(cmp));
+            }
+        }
+    }
+    m_huff.pad();
+
+    // JFIFGen: header.data, with the size and quantization tables written
+    // by HostIF_emu, then ByteStuffer output and EOI
+    std::vector<uint8_t> out(m_tables.header);
+    out[kSizeYOffset] = heightNopad >> 8;
+    out[kSizeYOffset + 1] = heightNopad & 0xFF;
+    out[kSizeXOffset] = widthNopad >> 8;
+    out[kSizeXOffset + 1] = widthNopad & 0xFF;
+    for (int i = 0; i < 64; i++) {
+        out[kQLumBase + i] = m_tables.qrom[i];
+        out[kQChrBase + i] = m_tables.qrom[64 + i];
+    }
+    out.reserve(out.size() + m_huff.bytes.size() * 2 + 2);
+    for (uint8_t b : m_huff.bytes) {
+        out.push_back(b);
+        if (b == 0xFF) {
+            out.push_back(0x00);
+        }
+    }
+    out.push_back(0xFF);
+    out.push_back(0xD9);
+    return out;
+}
@@ -0,0 +1,67 @@
+#ifndef MKJPEG_MODEL_H
+#define MKJPEG_MODEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "rtl_tables.h"
+
+/*
+ * Bit-exact model of the mkjpeg encoder as instantiated by buffered_encoder:
+ * YCbCr input (C_YUV_INPUT = '1'), 4:2:2 MCUs of 16x8, one JPEG per image.
+ * Each stage does the same arithmetic as its RTL counterpart, with the same
+ * word widths, so intermediate values can be compared against a simulation.
+ *
+ * Pixels are in the format of the pixel bus into the encoder, i.e. the output
+ * of colorspace_conv: Y in bits 7:0, Cb in 15:8, Cr in 23:16.
+ */
+
+class MkJpegModel
+{
+public:
+    explicit MkJpegModel(const RtlTables &tables);
+
+    // width is the padded stripe width (multiple of 16), height a multiple
+    // of 8; widthNopad/heightNopad go into SOF0, as in hostif_emu
+    std::vector<uint8_t> encode(const uint32_t *px, size_t stride,
+                                uint16_t width, uint16_t height,
+                                uint16_t widthNopad, uint16_t heightNopad);
+
+    // FinitePrecRndNrst.v
+    static int32_t finitePrecRnd(int64_t value, int inBits, int outBits, int fracBits);
+
+    // MDCT: DCT1D (rows) and DCT2D (columns), level shift included;
+    // out is row-major, as written to the FDCT DBUF
+    void fdct(const uint8_t in[64], int16_t out[64]) const;
+
+    // r_divider, qval as in the quantizer RAM
+    int16_t quantize(int16_t coef, uint8_t qval) const;
+
+private:
+    enum Component {
+        kY1, kY2, kCb, kCr
+    };
+
+    struct BitWriter
+    {
+        std::vector<uint8_t> bytes;
+        uint32_t acc;
+        int bits;
+
+        void put(uint32_t value, int size);
+        void pad();
+    };
+
+    void dctRow(const int32_t in[8], int inBits, int32_t out[8], int daBits, int outBits) const;
+
+    void encodeBlock(const uint8_t in[64], Component cmp);
+
+    const RtlTables &m_tables;
+    int32_t m_even[4][4];   // ROME
+    int32_t m_odd[4][4];    // ROMO
+    int16_t m_prevDc[3];
+    BitWriter m_huff;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#include "quant_tables.h"
+
+namespace {
+
+// ITU T.81 Annex K.1, in zigzag order
+const uint8_t kBase[2][64] = {
+    {
+         16,  11,  12,  14,  12,  10,  16,  14,
+         13,  14,  18,  17,  16,  19,  24,  40,
+         26,  24,  22,  22,  24,  49,  35,  37,
+         29,  40,  58,  51,  61,  60,  57,  51,
+         56,  55,  64,  72,  92,  78,  64,  68,
+         87,  69,  55,  56,  80, 109,  81,  87,
+         95,  98, 103, 104, 103,  62,  77, 113,
+        121, 112, 100, 120,  92, 101, 103,  99,
+    },
+    {
+         17,  18,  18,  24,  21,  24,  47,  26,
+         26,  47,  99,  66,  56,  66,  99,  99,
+         99,  99,  99,  99,  99,  99,  99,  99,
+         99,  99,  99,  99,  99,  99,  99,  99,
+         99,  99,  99,  99,  99,  99,  99,  99,
+         99,  99,  99,  99,  99,  99,  99,  99,
+         99,  99,  99,  99,  99,  99,  99,  99,
+         99,  99,  99,  99,  99,  99,  99,  99,
+    },
+};
+
+}
+
+void scaleQuantTables(int quality, uint8_t table[128])
+{
+    int scale = quality < 50 ? 5000 / quality : 200 - 2 * quality;
+    for (int c = 0; c < 2; c++) {
+        for (int k = 0; k < 64; k++) {
+            int q = (kBase[c][k] * scale + 50) / 100;
+            table[c * 64 + k] = static_cast<uint8_t>(q < 1 ? 1 : (q > 255 ? 255 : q));
+        }
+    }
+}
+
+void builtinQuantTables(uint8_t table[128])
+{
+    uint8_t chroma[128];
+    scaleQuantTables(kBuiltinLumQuality, table);
+    scaleQuantTables(kBuiltinChrQuality, chroma);
+    for (int k = 64; k < 128; k++) {
+        table[k] = chroma[k];
+    }
+}
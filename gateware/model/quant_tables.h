@@ -0,0 +1,25 @@
+#ifndef QUANT_TABLES_H
+#define QUANT_TABLES_H
+
+#include <cstdint>
+
+/*
+ * IJG scaling of the ITU T.81 Annex K tables to quality (1 to 100): 64
+ * luminance, then 64 chrominance entries in zigzag order, the layout of
+ * hostif_emu.vhd qrom_lum_chr (which is quality 85 for luminance, 50 for
+ * chrominance).
+ */
+void scaleQuantTables(int quality, uint8_t table[128]);
+
+/*
+ * The tables the encoder is built with, luminance at quality 85 and
+ * chrominance at 50: what qrom_lum_chr must hold (jpeg_model -t checks it)
+ * and what getimg's software encoder writes, so the failover stripes are
+ * quantized as the hardware ones.
+ */
+static const int kBuiltinLumQuality = 85;
+static const int kBuiltinChrQuality = 50;
+
+void builtinQuantTables(uint8_t table[128]);
+
+#endif // QUANT_TABLES_H
@@ -0,0 +1,294 @@
+#include "rtl_tables.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <regex>
+#include <sstream>
+
+namespace {
+
+bool readSource(const std::string &path, std::string &text, std::string &error)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        error = "could not open " + path;
+        return false;
+    }
+    std::stringstream ss;
+    ss << file.rdbuf();
+    text = ss.str();
+    text.erase(std::remove(text.begin(), text.end(), '\r'), text.end());
+    return true;
+}
+
+// VHDL comments run from "--" to the end of the line
+std::string stripComments(const std::string &text)
+{
+    std::string out;
+    std::istringstream in(text);
+    std::string line;
+    while (std::getline(in, line)) {
+        out += line.substr(0, line.find("--"));
+        out += '\n';
+    }
+    return out;
+}
+
+// the parenthesized aggregate following the first occurrence of name
+std::string aggregate(const std::string &text, const std::string &name)
+{
+    size_t pos = text.find(name);
+    if (pos == std::string::npos) {
+        return std::string();
+    }
+    size_t begin = text.find('(', pos);
+    size_t end = text.find(");", begin);
+    if (begin == std::string::npos || end == std::string::npos) {
+        return std::string();
+    }
+    return text.substr(begin + 1, end - begin - 1);
+}
+
+bool loadHeader(const std::string &dir, RtlTables &tables, std::string &error)
+{
+    std::string text;
+    if (!readSource(dir + "/jfifgen/header.data", text, error)) {
+        return false;
+    }
+    std::istringstream in(text);
+    std::string token;
+    tables.header.clear();
+    while (in >> token) {
+        tables.header.push_back(static_cast<uint8_t>(strtoul(token.c_str(), nullptr, 16)));
+    }
+    if (tables.header.size() != kHdrSize) {
+        error = "header.data: expected " + std::to_string(kHdrSize) + " bytes, got " +
+                std::to_string(tables.header.size());
+        return false;
+    }
+    return true;
+}
+
+bool loadQrom(const std::string &dir, RtlTables &tables, std::string &error)
+{
+    std::string text;
+    if (!readSource(dir + "/hostif/hostif_emu.vhd", text, error)) {
+        return false;
+    }
+    std::string agg = aggregate(stripComments(text), "qrom_lum_chr");
+    std::regex hex("X\"([0-9A-Fa-f]{2})\"");
+    size_t n = 0;
+    for (std::sregex_iterator it(agg.begin(), agg.end(), hex), end; it != end; ++it) {
+        if (n < sizeof(tables.qrom)) {
+            tables.qrom[n] = static_cast<uint8_t>(strtoul((*it)[1].str().c_str(), nullptr, 16));
+        }
+        n++;
+    }
+    if (n != sizeof(tables.qrom)) {
+        error = "hostif_emu.vhd: expected 128 qrom_lum_chr entries, got " + std::to_string(n);
+        return false;
+    }
+    return true;
+}
+
+bool loadRomr(const std::string &dir, RtlTables &tables, std::string &error)
+{
+    std::string text;
+    if (!readSource(dir + "/quantizer/romr.vhd", text, error)) {
+        return false;
+    }
+    std::string agg = aggregate(stripComments(text), "constant rom ");
+    std::istringstream in(agg);
+    std::string token;
+    size_t n = 0;
+    while (std::getline(in, token, ',')) {
+        if (n < 256) {
+            tables.romr[n] = static_cast<uint16_t>(atoi(token.c_str()));
+        }
+        n++;
+    }
+    if (n != 256) {
+        error = "romr.vhd: expected 256 entries, got " + std::to_string(n);
+        return false;
+    }
+    return true;
+}
+
+bool loadDctCoef(const std::string &dir, RtlTables &tables, std::string &error)
+{
+    std::string text;
+    if (!readSource(dir + "/mdct/mdct_pkg.vhd", text, error)) {
+        return false;
+    }
+    static const char *const kNames[] = { "AP", "BP", "CP", "DP", "EP", "FP", "GP" };
+    for (int i = 0; i < 7; i++) {
+        std::regex re(std::string("constant\\s+") + kNames[i] + "\\s*:\\s*integer\\s*:=\\s*(-?[0-9]+)",
+                      std::regex::icase);
+        std::smatch m;
+        if (!std::regex_search(text, m, re)) {
+            error = std::string("mdct_pkg.vhd: no constant ") + kNames[i];
+            return false;
+        }
+        tables.dctCoef[i] = atoi(m[1].str().c_str());
+    }
+    return true;
+}
+
+/*
+ * The Huffman ROMs are case statements on VLI_size (DC) or on runlength and
+ * then VLI_size (AC), each branch assigning the code length and then the
+ * code, e.g.
+ *     when X"1" =>
+ *       VLC_AC_size <= to_unsigned(2, VLC_AC_size'length);
+ *       VLC_AC      <= resize("00", VLC_AC'length);
+ */
+bool loadHuffRom(const std::string &path, HuffCode *rom, size_t romSize, bool ac, std::string &error)
+{
+    std::string text;
+    if (!readSource(path, text, error)) {
+        return false;
+    }
+    std::fill(rom, rom + romSize, HuffCode { 0, 0 });
+
+    std::regex caseRe("^\\s*case\\s+(\\w+)\\s+is", std::regex::icase);
+    std::regex endCaseRe("^\\s*end\\s+case", std::regex::icase);
+    std::regex whenRe("^\\s*when\\s+(X\"([0-9A-Fa-f])\"|others)", std::regex::icase);
+    std::regex sizeRe("_size\\s*<=\\s*(X\"([0-9A-Fa-f])\"|to_unsigned\\(([0-9]+))", std::regex::icase);
+    std::regex codeRe("<=\\s*resize\\(\"([01]+)\"", std::regex::icase);
+
+    std::vector<std::string> cases;
+    int run = 0;
+    int vliSize = -1;
+    int codeSize = -1;
+    std::istringstream in(stripComments(text));
+    std::string line;
+    int lineNr = 0;
+    while (std::getline(in, line)) {
+        lineNr++;
+        std::smatch m;
+        if (std::regex_search(line, m, caseRe)) {
+            cases.push_back(m[1].str());
+            vliSize = -1;
+        } else if (std::regex_search(line, m, endCaseRe)) {
+            if (!cases.empty()) {
+                cases.pop_back();
+            }
+            vliSize = -1;
+        } else if (std::regex_search(line, m, whenRe)) {
+            int value = m[2].matched ? static_cast<int>(strtoul(m[2].str().c_str(), nullptr, 16)) : -1;
+            if (!cases.empty() && strcasecmp(cases.back().c_str(), "runlength") == 0) {
+                run = value;
+            } else {
+                vliSize = value;
+            }
+            codeSize = -1;
+        } else if (std::regex_search(line, m, sizeRe)) {
+            codeSize = m[2].matched ? strtoul(m[2].str().c_str(), nullptr, 16) : atoi(m[3].str().c_str());
+        } else if (std::regex_search(line, m, codeRe)) {
+            // "when others" branches (and the reset values) carry no code
+            if (vliSize < 0 || run < 0 || codeSize <= 0) {
+                continue;
+            }
+            std::string bits = m[1].str();
+            if (static_cast<int>(bits.size()) != codeSize) {
+                error = path + ":" + std::to_string(lineNr) + ": code length does not match size";
+                return false;
+            }
+            size_t index = ac ? (run << 4 | vliSize) : vliSize;
+            if (index >= romSize) {
+                error = path + ":" + std::to_string(lineNr) + ": entry out of range";
+                return false;
+            }
+            rom[index].code = static_cast<uint16_t>(strtoul(bits.c_str(), nullptr, 2));
+            rom[index].size = static_cast<uint8_t>(codeSize);
+        }
+    }
+    return true;
+}
+
+// canonical Huffman codes of a DHT table (JPEG Annex C)
+void dhtCodes(const uint8_t *dht, HuffCode *codes, size_t numCodes)
+{
+    std::fill(codes, codes + numCodes, HuffCode { 0, 0 });
+    const uint8_t *values = dht + 16;
+    uint16_t code = 0;
+    for (int len = 1; len <= 16; len++) {
+        for (int i = 0; i < dht[len - 1]; i++) {
+            if (*values < numCodes) {
+                codes[*values] = HuffCode { code, static_cast<uint8_t>(len) };
+            }
+            values++;
+            code++;
+        }
+        code <<= 1;
+    }
+}
+
+}
+
+bool loadRtlTables(const std::string &jpegEncDir, RtlTables &tables, std::string &error)
+{
+    return loadHeader(jpegEncDir, tables, error) &&
+           loadQrom(jpegEncDir, tables, error) &&
+           loadRomr(jpegEncDir, tables, error) &&
+           loadDctCoef(jpegEncDir, tables, error) &&
+           loadHuffRom(jpegEncDir + "/huffman/dc_rom.vhd", tables.dc[0], 16, false, error) &&
+           loadHuffRom(jpegEncDir + "/huffman/dc_cr_rom.vhd", tables.dc[1], 16, false, error) &&
+           loadHuffRom(jpegEncDir + "/huffman/ac_rom.vhd", tables.ac[0], 256, true, error) &&
+           loadHuffRom(jpegEncDir + "/huffman/ac_cr_rom.vhd", tables.ac[1], 256, true, error);
+}
+
+std::vector<std::string> checkHuffmanTables(const RtlTables &tables)
+{
+    std::vector<std::string> problems;
+    bool seen[2][2] = {};
+    const std::vector<uint8_t> &hdr = tables.header;
+
+    size_t pos = 2;
+    while (pos + 4 <= hdr.size() && hdr[pos] == 0xFF && hdr[pos + 1] != 0xDA) {
+        size_t end = pos + 2 + (hdr[pos + 2] << 8 | hdr[pos + 3]);
+        if (hdr[pos + 1] == 0xC4) {
+            size_t p = pos + 4;
+            while (p + 17 <= end) {
+                int tc = hdr[p] >> 4;
+                int th = hdr[p] & 0x0F;
+                size_t count = 0;
+                for (int i = 1; i <= 16; i++) {
+                    count += hdr[p + i];
+                }
+                if (tc > 1 || th > 1) {
+                    problems.push_back("unexpected DHT class/id " + std::to_string(hdr[p]));
+                } else {
+                    HuffCode codes[256];
+                    dhtCodes(&hdr[p + 1], codes, tc ? 256 : 16);
+                    const HuffCode *rom = tc ? tables.ac[th] : tables.dc[th];
+                    const char *name = tc ? (th ? "ac_cr_rom" : "ac_rom") : (th ? "dc_cr_rom" : "dc_rom");
+                    for (int s = 0; s < (tc ? 256 : 16); s++) {
+                        if (rom[s].size != codes[s].size || rom[s].code != codes[s].code) {
+                            std::ostringstream msg;
+                            msg << name << " symbol 0x" << std::hex << s << ": ROM "
+                                << std::dec << int(rom[s].size) << " bits 0x" << std::hex << rom[s].code
+                                << ", DHT " << std::dec << int(codes[s].size) << " bits 0x"
+                                << std::hex << codes[s].code;
+                            problems.push_back(msg.str());
+                        }
+                    }
+                    seen[tc][th] = true;
+                }
+                p += 17 + count;
+            }
+        }
+        pos = end;
+    }
+    for (int tc = 0; tc < 2; tc++) {
+        for (int th = 0; th < 2; th++) {
+            if (!seen[tc][th]) {
+                problems.push_back(std::string("no DHT for ") + (tc ? "AC" : "DC") + " table " + std::to_string(th));
+            }
+        }
+    }
+    return problems;
+}
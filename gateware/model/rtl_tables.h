@@ -0,0 +1,47 @@
+#ifndef RTL_TABLES_H
+#define RTL_TABLES_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Constant tables of the mkjpeg encoder, read from the RTL sources under
+ * gateware/jpeg_enc rather than copied into the model, so that editing a ROM
+ * or the quantization tables in the VHDL is picked up by the model as well.
+ */
+
+struct HuffCode
+{
+    uint16_t code;
+    uint8_t size;       // 0: no entry in the ROM ("when others")
+};
+
+struct RtlTables
+{
+    std::vector<uint8_t> header;    // jfifgen/header.data
+    uint8_t qrom[128];              // hostif/hostif_emu.vhd qrom_lum_chr, zigzag order
+    uint16_t romr[256];             // quantizer/romr.vhd reciprocals
+    int dctCoef[7];                 // mdct/mdct_pkg.vhd AP..GP
+    HuffCode dc[2][16];             // huffman/dc_rom.vhd, dc_cr_rom.vhd by VLI size
+    HuffCode ac[2][256];            // huffman/ac_rom.vhd, ac_cr_rom.vhd by runlength << 4 | VLI size
+};
+
+enum DctCoef {
+    kAP, kBP, kCP, kDP, kEP, kFP, kGP
+};
+
+// jfifgen.vhd / jpeg_pkg.vhd
+static const uint32_t kHdrSize = 623;
+static const uint32_t kSizeYOffset = 25;
+static const uint32_t kSizeXOffset = 27;
+static const uint32_t kQLumBase = 44;
+static const uint32_t kQChrBase = 113;
+
+bool loadRtlTables(const std::string &jpegEncDir, RtlTables &tables, std::string &error);
+
+// compares the Huffman ROMs against the DHT segments of the header, i.e.
+// what the encoder writes against what a decoder will use
+std::vector<std::string> checkHuffmanTables(const RtlTables &tables);
+
+#endif
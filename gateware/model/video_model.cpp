@@ -0,0 +1,142 @@
+#include "video_model.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// res_pad() in image_stripe.vhd
+inline uint16_t resPad(uint16_t numPx, uint16_t step)
+{
+    return (numPx + step - 1) & ~(step - 1);
+}
+
+}
+
+std::vector<StripeGeometry> stripeGeometry(uint16_t resX, int numChan)
+{
+    std::vector<StripeGeometry> stripes(numChan);
+    uint16_t start = 0;
+    for (int i = 0; i < numChan; i++) {
+        uint16_t nopad = resX / numChan;
+        if (i == numChan - 1) {
+            nopad += resX % numChan;
+        }
+        stripes[i].start = start;
+        stripes[i].widthNopad = nopad;
+        stripes[i].width = resPad(nopad, 16);
+        start += nopad;
+    }
+    return stripes;
+}
+
+std::vector<uint32_t> extractStripe(const std::vector<uint32_t> &frame, uint16_t resX, uint16_t resY,
+                                    const StripeGeometry &stripe, uint32_t fill)
+{
+    std::vector<uint32_t> px(static_cast<size_t>(stripe.width) * resY, fill);
+    for (uint32_t y = 0; y < resY; y++) {
+        for (uint32_t x = 0; x < stripe.width && stripe.start + x < resX; x++) {
+            px[y * stripe.width + x] = frame[y * resX + stripe.start + x];
+        }
+    }
+    return px;
+}
+
+const std::vector<VideoMode> &standardModes()
+{
+    static const std::vector<VideoMode> modes = {
+        { "640x480@60", 640, 480, 800, 525, 25.175 },
+        { "640x480@75", 640, 480, 840, 500, 31.5 },
+        { "720x480@60 (480p)", 720, 480, 858, 525, 27.0 },
+        { "720x576@50 (576p)", 720, 576, 864, 625, 27.0 },
+        { "800x600@56", 800, 600, 1024, 625, 36.0 },
+        { "800x600@60", 800, 600, 1056, 628, 40.0 },
+        { "800x600@72", 800, 600, 1040, 666, 50.0 },
+        { "800x600@75", 800, 600, 1056, 625, 49.5 },
+        { "800x600@85", 800, 600, 1048, 631, 56.25 },
+        { "1024x768@60", 1024, 768, 1344, 806, 65.0 },
+        { "1024x768@70", 1024, 768, 1328, 806, 75.0 },
+        { "1024x768@75", 1024, 768, 1312, 800, 78.75 },
+        { "1024x768@85", 1024, 768, 1376, 808, 94.5 },
+        { "1152x864@75", 1152, 864, 1600, 900, 108.0 },
+        { "1280x720@50 (720p)", 1280, 720, 1980, 750, 74.25 },
+        { "1280x720@60 (720p)", 1280, 720, 1650, 750, 74.25 },
+        { "1280x768@60 RB", 1280, 768, 1440, 790, 68.25 },
+        { "1280x768@60", 1280, 768, 1664, 798, 79.5 },
+        { "1280x800@60 RB", 1280, 800, 1440, 823, 71.0 },
+        { "1280x800@60", 1280, 800, 1680, 831, 83.5 },
+        { "1280x960@60", 1280, 960, 1800, 1000, 108.0 },
+        { "1280x1024@60", 1280, 1024, 1688, 1066, 108.0 },
+        { "1280x1024@75", 1280, 1024, 1688, 1066, 135.0 },
+        { "1360x768@60", 1360, 768, 1792, 795, 85.5 },
+        { "1366x768@60", 1366, 768, 1792, 798, 85.5 },
+        { "1400x1050@60 RB", 1400, 1050, 1560, 1080, 101.0 },
+        { "1440x900@60 RB", 1440, 900, 1600, 926, 88.75 },
+        { "1440x900@60", 1440, 900, 1904, 934, 106.5 },
+        { "1600x900@60 RB", 1600, 900, 1800, 1000, 108.0 },
+        { "1600x1200@60", 1600, 1200, 2160, 1250, 162.0 },
+        { "1680x1050@60 RB", 1680, 1050, 1840, 1080, 119.0 },
+        { "1920x1080@24 (1080p)", 1920, 1080, 2750, 1125, 74.25 },
+        { "1920x1080@30 (1080p)", 1920, 1080, 2200, 1125, 74.25 },
+        { "1920x1080@60 (1080p)", 1920, 1080, 2200, 1125, 148.5 },
+        { "1920x1200@60 RB", 1920, 1200, 2080, 1235, 154.0 },
+    };
+    return modes;
+}
+
+CaptureAnalysis analyzeCapture(const VideoMode &mode, const CaptureConfig &config)
+{
+    CaptureAnalysis result = CaptureAnalysis();
+    result.badRes = mode.resY % 8 != 0;
+    result.timed = mode.hTotal != 0 && mode.vTotal != 0 && mode.pxClockMhz > 0;
+    result.clockOk = !result.timed ||
+                     (mode.pxClockMhz >= config.pxClockMinMhz && mode.pxClockMhz <= config.pxClockMaxMhz);
+    result.margin = 0;
+
+    const double lineUs = result.timed ? mode.hTotal / mode.pxClockMhz : 0;
+    const double encPxPerUs = config.encClockMhz / config.encCyclesPerPx;
+    double encodeDoneUs = 0;
+
+    for (const StripeGeometry &g : stripeGeometry(mode.resX, config.numChan)) {
+        StripeTiming t = StripeTiming();
+        t.geometry = g;
+        t.fifoLines = g.width ? config.pxFifoDepth / g.width : 0;
+        result.tooWide = result.tooWide || g.width > config.maxLineWidth;
+
+        if (result.timed && g.width != 0) {
+            t.margin = lineUs * encPxPerUs / g.width;
+            // buffered_encoder starts mkjpeg once 8 lines are in the pixel
+            // FIFO; each MCU row then needs its 8 lines and the previous row
+            // done. Lines count as arrived at the end of their line period.
+            const double rowUs = 8.0 * g.width / encPxPerUs;
+            const uint32_t capacity = config.pxFifoDepth + config.bufFifoLines * g.width;
+            double end = 0;
+            for (uint32_t row = 0; row < mode.resY / 8u; row++) {
+                double start = std::max(end, (8.0 * row + 8) * lineUs);
+                end = start + rowUs;
+                uint32_t arrived = std::min<uint32_t>(mode.resY, static_cast<uint32_t>(end / lineUs));
+                uint32_t backlog = (arrived - 8 * row) * g.width;
+                t.peakBacklog = std::max(t.peakBacklog, backlog);
+            }
+            t.encodeDoneUs = end;
+            result.overflow = result.overflow || t.peakBacklog > capacity;
+            result.margin = result.stripes.empty() ? t.margin : std::min(result.margin, t.margin);
+            encodeDoneUs = std::max(encodeDoneUs, end);
+        }
+        result.stripes.push_back(t);
+    }
+
+    if (result.timed) {
+        // image_shim waits for downstream_ready, then for the next vsync,
+        // taken to be 3 lines after the last active one (DMT front porches
+        // are 1 to 3 lines)
+        const double activeUs = (mode.resY + 3) * lineUs;
+        const double frameUs = mode.vTotal * lineUs;
+        result.framesPerCapture = 1;
+        if (encodeDoneUs > activeUs) {
+            result.framesPerCapture += static_cast<uint32_t>(std::ceil((encodeDoneUs - activeUs) / frameUs));
+        }
+        result.captureFps = mode.refreshHz() / result.framesPerCapture;
+    }
+    return result;
+}
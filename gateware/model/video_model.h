@@ -0,0 +1,106 @@
+#ifndef VIDEO_MODEL_H
+#define VIDEO_MODEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * The part of striped_encoders in front of the mkjpeg instances:
+ * colorspace_conv and the split of each line into stripes (image_stripe),
+ * plus a timing model of image_shim, image_stripe and buffered_encoder that
+ * tells which video modes can be captured at all.
+ */
+
+// colorspace_conv.vhd: pixel bus in (R 7:0, G 15:8, B 23:16), out
+// (Y 7:0, Cb 15:8, Cr 23:16); coefficients scaled by 2^14, truncated
+inline uint32_t cscPixel(uint8_t r, uint8_t g, uint8_t b)
+{
+    int32_t y = 4899 * r + 9617 * g + 1868 * b;
+    int32_t cb = -2764 * r - 5428 * g + 8192 * b + 128 * 16384;
+    int32_t cr = 8192 * r - 6860 * g - 1332 * b + 128 * 16384;
+    return ((y >> 14) & 0xFF) | ((cb >> 14) & 0xFF) << 8 | ((cr >> 14) & 0xFF) << 16;
+}
+
+struct StripeGeometry
+{
+    uint16_t start;         // first pixel of the line
+    uint16_t width;         // padded to the MCU width, as seen by the encoder
+    uint16_t widthNopad;    // as written to SOF0
+};
+
+// image_stripe.vhd: res_x / num_chan each, the last stripe also gets the
+// remainder; padding pixels are taken from the next stripe
+std::vector<StripeGeometry> stripeGeometry(uint16_t resX, int numChan);
+
+// Cuts a stripe out of a converted frame. Padding past the end of the line
+// comes from the horizontal blanking in hardware, which the RTL leaves
+// undefined ('-' in image_shim); fill is used for it here.
+std::vector<uint32_t> extractStripe(const std::vector<uint32_t> &frame, uint16_t resX, uint16_t resY,
+                                    const StripeGeometry &stripe, uint32_t fill = 0);
+
+// The RTL constants the capture limits follow from
+struct CaptureConfig
+{
+    int numChan = 4;                    // striped_encoders num_chan
+    uint16_t maxLineWidth = 512;        // buffered_encoder RES_X_MAX, jpeg_pkg C_MAX_LINE_WIDTH
+    uint32_t pxFifoDepth = 16 * 512;    // buffered_encoder PX_FIFO_DEPTH, pixels
+    uint32_t bufFifoLines = 8;          // buf_fifo C_NUM_LINES
+    double encClockMhz = 1000.0 / 7.0;  // clk_enc (FCLK0)
+    double encCyclesPerPx = 2.0;        // FDCT reads 4 blocks of 64 samples per 16x8 MCU
+    double pxClockMinMhz = 60.0;        // clk_activity_detect thresholds in video_capture_hdmi
+    double pxClockMaxMhz = 90.0;
+};
+
+// Video timing; hTotal/vTotal include blanking
+struct VideoMode
+{
+    const char *name;
+    uint16_t resX;
+    uint16_t resY;
+    uint16_t hTotal;
+    uint16_t vTotal;
+    double pxClockMhz;
+
+    double refreshHz() const
+    {
+        return pxClockMhz * 1e6 / (static_cast<double>(hTotal) * vTotal);
+    }
+};
+
+// VESA DMT and CEA-861 modes a KVM is likely to be plugged into
+const std::vector<VideoMode> &standardModes();
+
+struct StripeTiming
+{
+    StripeGeometry geometry;
+    uint32_t fifoLines;         // lines of this stripe the pixel FIFO holds
+    double margin;              // encoder pixel rate / stripe pixel rate over a line
+    uint32_t peakBacklog;       // pixels in the pixel FIFO and buf_fifo, worst case
+    double encodeDoneUs;        // from the start of the first active line
+};
+
+struct CaptureAnalysis
+{
+    std::vector<StripeTiming> stripes;
+    bool badRes;                // image_stripe fault_bad_res: res_y not a multiple of 8
+    bool tooWide;               // a padded stripe exceeds RES_X_MAX
+    bool clockOk;               // pixel clock inside the clk_activity_detect window
+    bool overflow;              // the pixel FIFO would overflow (px_fifo_full is not handled)
+    bool timed;                 // the mode had timing, the fields below are valid
+    double margin;              // worst stripe
+    uint32_t framesPerCapture;  // source frames per captured frame
+    double captureFps;
+
+    bool ok() const
+    {
+        return !badRes && !tooWide && clockOk && !overflow;
+    }
+};
+
+// Geometry for any mode; timing only if hTotal, vTotal and pxClockMhz are set.
+// The encoder rate ignores Huffman and output stalls, so the margin and the
+// frame rate are upper bounds.
+CaptureAnalysis analyzeCapture(const VideoMode &mode, const CaptureConfig &config);
+
+#endif
@@ -4,11 +4,26 @@ cd /sys/kernel/
 mkdir config/usb_gadget/g1
 cd config/usb_gadget/g1
 mkdir configs/c.1
+# relative mouse: five buttons, dx and dy of +-32767, wheel; not a boot
+# mouse, the boot report has 8 bit moves
 mkdir functions/hid.usb0
-echo 2 > functions/hid.usb0/protocol
-echo 1 > functions/hid.usb0/subclass
-echo 8 > functions/hid.usb0/report_length
-echo -ne \\x05\\x01\\x09\\x02\\xa1\\x01\\x09\\x01\\xa1\\x00\\x05\\x09\\x19\\x01\\x29\\x03\\x15\\x00\\x25\\x01\\x95\\x03\\x75\\x01\\x81\\x02\\x95\\x01\\x75\\x05\\x81\\x03\\x05\\x01\\x09\\x30\\x09\\x31\\x15\\x81\\x25\\x7f\\x75\\x08\\x95\\x02\\x81\\x06\\xc0\\xc0 > functions/hid.usb0/report_desc
+echo 0 > functions/hid.usb0/protocol
+echo 0 > functions/hid.usb0/subclass
+echo 6 > functions/hid.usb0/report_length
+echo -ne \\x05\\x01\\x09\\x02\\xa1\\x01\\x09\\x01\\xa1\\x00\\x05\\x09\\x19\\x01\\x29\\x05\\x15\\x00\\x25\\x01\\x95\\x05\\x75\\x01\\x81\\x02\\x95\\x01\\x75\\x03\\x81\\x03\\x05\\x01\\x09\\x30\\x09\\x31\\x16\\x01\\x80\\x26\\xff\\x7f\\x75\\x10\\x95\\x02\\x81\\x06\\x09\\x38\\x15\\x81\\x25\\x7f\\x75\\x08\\x95\\x01\\x81\\x06\\xc0\\xc0 > functions/hid.usb0/report_desc
+# N-key rollover keyboard: modifiers, reserved byte and six boot keys (declared
+# constant, for a BIOS in boot protocol), LEDs, then a bitmap of usages 0-127
+mkdir functions/hid.usb1
+echo 1 > functions/hid.usb1/protocol
+echo 1 > functions/hid.usb1/subclass
+echo 24 > functions/hid.usb1/report_length
+echo -ne \\x05\\x01\\x09\\x06\\xa1\\x01\\x05\\x07\\x19\\xe0\\x29\\xe7\\x15\\x00\\x25\\x01\\x75\\x01\\x95\\x08\\x81\\x02\\x75\\x08\\x95\\x07\\x81\\x01\\x05\\x08\\x19\\x01\\x29\\x05\\x95\\x05\\x75\\x01\\x91\\x02\\x95\\x01\\x75\\x03\\x91\\x01\\x05\\x07\\x19\\x00\\x29\\x7f\\x15\\x00\\x25\\x01\\x75\\x01\\x96\\x80\\x00\\x81\\x02\\xc0 > functions/hid.usb1/report_desc
+# absolute pointer: buttons, X and Y of 0-32767 across the screen
+mkdir functions/hid.usb2
+echo 0 > functions/hid.usb2/protocol
+echo 0 > functions/hid.usb2/subclass
+echo 5 > functions/hid.usb2/report_length
+echo -ne \\x05\\x01\\x09\\x02\\xa1\\x01\\x09\\x01\\xa1\\x00\\x05\\x09\\x19\\x01\\x29\\x03\\x15\\x00\\x25\\x01\\x95\\x03\\x75\\x01\\x81\\x02\\x95\\x01\\x75\\x05\\x81\\x03\\x05\\x01\\x09\\x30\\x09\\x31\\x15\\x00\\x26\\xff\\x7f\\x75\\x10\\x95\\x02\\x81\\x02\\xc0\\xc0 > functions/hid.usb2/report_desc
 mkdir strings/0x409
 mkdir configs/c.1/strings/0x409
 echo 0x0100 > bcdDevice
@@ -21,14 +36,22 @@ echo 0x201c > idProduct
 echo 0x03eb > idVendor
 echo serial > strings/0x409/serialnumber
 echo manufacturer > strings/0x409/manufacturer
-echo HID Mouse > strings/0x409/product
+echo HID Mouse and Keyboard > strings/0x409/product
 echo "Conf 1" > configs/c.1/strings/0x409/configuration
 echo 120 > configs/c.1/MaxPower
 ln -s functions/hid.usb0 configs/c.1
+ln -s functions/hid.usb1 configs/c.1
+ln -s functions/hid.usb2 configs/c.1
 #ls -a /sys/class/udc/
 echo ci_hdrc.0 > UDC
 cd ~
 if [[ ! -e web_to_mouse ]]; then
     mkfifo web_to_mouse
 fi
-hidgadgettest /dev/hidg0 mouse &
+# kvm.js sends to inputd (port 8081), cgi-bin/mouse through the FIFO, which
+# inputd reads too (-f), so each HID function has one writer;
+# inputd writes the keyboard reports to /dev/hidg1, the absolute pointer
+# (index.html?pointer=abs) ones to /dev/hidg2; SCHED_FIFO 50 keeps input ahead of
+# the video (getimg, httpd); the shipped bitstream has no resolution register,
+# so the absolute pointer needs the host's mode, e.g. -r 1280x720
+inputd -P 50 &
@@ -12,15 +12,33 @@ canvas.requestPointerLock = canvas.requestPointerLock ||
 document.exitPointerLock = document.exitPointerLock ||
                            document.mozExitPointerLock;
 
-canvas.onclick = function() {
-  canvas.requestPointerLock();
+// index.html?pointer=abs: the absolute pointer (hid.usb2) follows the local
+// cursor over the video, no pointer lock
+var absolute = /[?&]pointer=abs/.test(location.search);
+
+canvas.onclick = function(e) {
+  if (!absolute) {
+    click_x = e.clientX;
+    click_y = e.clientY;
+    canvas.requestPointerLock();
+  }
 };
 
+var click_x = 0;          // where the pointer lock was asked for, for the local cursor
+var click_y = 0;
+
 var x_accum = 0;
 var y_accum = 0;
-var l_click = 0;
-var r_click = 0;
+var wheel_accum = 0;      // notches, fractions kept for the next one
+var buttons = 0;          // held, kButton* of input_event.h
+var clicked = 0;          // buttons released since the CGI chain was last told
 var pending_mouse = 0;
+var input_events = [];    // [type, buttons, x, y, z] of input_event.h, in order
+var held_keys = {};
+var abs_x = 0;
+var abs_y = 0;
+var abs_buttons = 0;
+var abs_moved = 0;
 
 // pointer lock event listeners
 
@@ -32,12 +50,24 @@ function lockChangeAlert() {
   if (document.pointerLockElement === canvas ||
       document.mozPointerLockElement === canvas) {
     document.addEventListener("mousemove", updatePosition, false);
-    document.addEventListener("click", doClick, false);
+    document.addEventListener("mousedown", updateButtons, false);
+    document.addEventListener("mouseup", updateButtons, false);
+    document.addEventListener("wheel", updateWheel, false);
     document.addEventListener("keydown", keyDown, false);
     document.addEventListener("keyup", keyUp, false);
+    startCursor();
   } else {
+    stopCursor();
+    releaseKeys();
+    if (buttons != 0) {
+      buttons = 0;
+      pushMouse();
+    }
+    scheduleUpdate(0);
     document.removeEventListener("mousemove", updatePosition, false);
-    document.removeEventListener("click", doClick, false);
+    document.removeEventListener("mousedown", updateButtons, false);
+    document.removeEventListener("mouseup", updateButtons, false);
+    document.removeEventListener("wheel", updateWheel, false);
     document.removeEventListener("keydown", keyDown, false);
     document.removeEventListener("keyup", keyUp, false);
   }
@@ -55,92 +85,673 @@ var HttpClient = function() {
   };
 };
 
+// inputd takes the events as binary POSTs on its own port, kept alive; the
+// CGI chain (cgi-bin/mouse) is the fallback while it does not answer
+var input_url = location.protocol + "//" + location.hostname + ":8081/input";
+var use_inputd = 1;
+
+// where it opens, the input goes to inputd as InputStates (input_event.h)
+// over a WebSocket instead: all input so far rather than what changed, so
+// a state goes out whenever there is something new without waiting for an
+// answer, and motion held back while the socket is backed up (the video
+// sharing the link) is in the next one
+var input_socket = null;
+var socket_ready = false;
+var state_seq = 0;
+var state_x = 0;            // motion and wheel notches, summed (wrapping)
+var state_y = 0;
+var state_wheel = 0;
+var state_buttons = 0;
+var state_abs_buttons = 0;
+var state_abs_x = 0xFFFF;   // kNoPosition
+var state_abs_y = 0xFFFF;
+var state_keys = new Uint8Array(32);
+
+function openInputSocket() {
+  if (!window.WebSocket) {
+    return;
+  }
+  input_socket = new WebSocket((location.protocol == "https:" ? "wss://" : "ws://") + location.hostname + ":8081/input");
+  // inputd takes the first state of a socket as where the sums start, so
+  // one goes out at once, before anything moves over this socket
+  input_socket.onopen = function() {
+    socket_ready = true;
+    sendState(0);
+  };
+  // a timestamp sent by sendRttProbe(), back through inputd
+  input_socket.onmessage = function(e) {
+    if (typeof e.data == "string") {
+      noteRtt(performance.now() - Number(e.data));
+    }
+  };
+  // inputd released what was held; the POSTs take over, a socket that was up is tried again
+  input_socket.onclose = function() {
+    if (socket_ready) {
+      setTimeout(openInputSocket, 1000);
+    }
+    socket_ready = false;
+  };
+}
+openInputSocket();
+
+function clampInt16(v) {
+  return Math.max(-32767, Math.min(32767, v));
+}
+
+// KeyboardEvent.code -> HID usage, from inputd's keymap.cpp
+var keymap = null;
+if (window.fetch) {
+  fetch(location.protocol + "//" + location.hostname + ":8081/keymap").then(function(response) {
+    return response.json();
+  }).then(function(map) {
+    keymap = map;
+  }, function(error) {});
+}
+
+// the oldest input not sent yet, on the clock of performance.now(); inputd
+// takes its age at sending as X-Input-Age (us), the browser's share of the
+// input latency
+var oldest_input = 0;
+
+function noteInput(e) {
+  if (oldest_input == 0) {
+    oldest_input = e.timeStamp || performance.now();
+  }
+  scheduleUpdate(0);
+}
+
+// serverUpdate() runs once the input handlers are through, for all the
+// events of that turn together, and again when a request is answered or
+// the socket drained; nothing polls while there is no input
+var update_scheduled = false;
+
+function scheduleUpdate(delay) {
+  if (!update_scheduled) {
+    update_scheduled = true;
+    setTimeout(function() {
+      update_scheduled = false;
+      serverUpdate();
+    }, delay);
+  }
+}
+
+// the motion so far with the buttons held now, as one kMouse event
+function pushMouse() {
+  var dx = clampInt16(x_accum);
+  var dy = clampInt16(y_accum);
+  var dz = Math.trunc(wheel_accum);
+  input_events.push([1, buttons, dx, dy, dz]);  // EventType::kMouse
+  x_accum -= dx;
+  y_accum -= dy;
+  wheel_accum -= dz;
+}
+
+// InputEvents of input_event.h (type, buttons, x, y, z): button changes
+// (with the motion before them) and key changes in the order they came,
+// then the motion since and where the absolute pointer is now
+function sendInputd() {
+  if ((x_accum != 0) || (y_accum != 0) || (Math.trunc(wheel_accum) != 0)) {
+    pushMouse();
+  }
+  if (abs_moved) {
+    input_events.push([3, abs_buttons, abs_x, abs_y, 0]);
+  }
+  var events = input_events;
+  var ev = new DataView(new ArrayBuffer(8 * events.length));
+  for (var i = 0; i < events.length; i++) {
+    ev.setUint8(8 * i, events[i][0]);
+    ev.setUint8(8 * i + 1, events[i][1]);
+    ev.setInt16(8 * i + 2, events[i][2], true);
+    ev.setInt16(8 * i + 4, events[i][3], true);
+    ev.setInt16(8 * i + 6, events[i][4], true);
+  }
+  var age = oldest_input > 0 ? Math.max(0, Math.round((performance.now() - oldest_input) * 1000)) : 0;
+  pending_mouse = 1;
+  clicked = 0;
+  input_events = [];
+  abs_moved = 0;
+  oldest_input = 0;
+  var sent = performance.now();
+  fetch(input_url, {method: "POST", body: ev.buffer, headers: {"X-Input-Age": String(age)}}).then(function(response) {
+    noteRtt(performance.now() - sent);
+    pending_mouse = 0;
+    scheduleUpdate(0);
+  }, function(error) {
+    // not sent: the motion goes to the CGI chain from now on
+    use_inputd = 0;
+    takeBackMotion(events);
+    pending_mouse = 0;
+    scheduleUpdate(0);
+  });
+}
+
+function sendState(age) {
+  var st = new DataView(new ArrayBuffer(60));
+  state_seq = (state_seq + 1) >>> 0;
+  st.setUint32(0, state_seq, true);
+  st.setUint32(4, age, true);
+  st.setInt32(8, state_x, true);
+  st.setInt32(12, state_y, true);
+  st.setInt32(16, state_wheel, true);
+  st.setUint8(20, state_buttons);
+  st.setUint8(21, state_abs_buttons);
+  st.setUint16(22, state_abs_x, true);
+  st.setUint16(24, state_abs_y, true);
+  for (var i = 0; i < 32; i++) {
+    st.setUint8(28 + i, state_keys[i]);
+  }
+  input_socket.send(st.buffer);
+}
+
+// the events since the last state folded into it, a state of its own after
+// each change of the buttons or keys so a click within a tick is not lost
+function sendStates() {
+  if ((x_accum != 0) || (y_accum != 0) || (Math.trunc(wheel_accum) != 0)) {
+    pushMouse();
+  }
+  if (abs_moved) {
+    input_events.push([3, abs_buttons, abs_x, abs_y, 0]);
+  }
+  var age = oldest_input > 0 ? Math.max(0, Math.round((performance.now() - oldest_input) * 1000)) : 0;
+  var moved = false;
+  for (var i = 0; i < input_events.length; i++) {
+    var ev = input_events[i];
+    var pressed = false;
+    if (ev[0] == 1) {
+      state_x = (state_x + ev[2]) | 0;
+      state_y = (state_y + ev[3]) | 0;
+      state_wheel = (state_wheel + ev[4]) | 0;
+      pressed = ev[1] != state_buttons;
+      state_buttons = ev[1];
+    } else if (ev[0] == 2) {
+      var bit = 1 << (ev[2] & 7);
+      state_keys[ev[2] >> 3] = ev[3] ? (state_keys[ev[2] >> 3] | bit) : (state_keys[ev[2] >> 3] & ~bit);
+      pressed = true;
+    } else if (ev[0] == 3) {
+      pressed = ev[1] != state_abs_buttons;
+      state_abs_buttons = ev[1];
+      state_abs_x = ev[2];
+      state_abs_y = ev[3];
+    }
+    if (pressed) {
+      sendState(age);
+    }
+    moved = !pressed;
+  }
+  if (moved) {
+    sendState(age);
+  }
+  input_events = [];
+  abs_moved = 0;
+  oldest_input = 0;
+  clicked = 0;
+}
+
+function takeBackMotion(events) {
+  for (var i = 0; i < events.length; i++) {
+    if (events[i][0] == 1) {
+      x_accum += events[i][2];
+      y_accum += events[i][3];
+    }
+  }
+}
+
 function serverUpdate() {
+  if (socket_ready) {
+    // motion alone waits while the socket is backed up, looked at again
+    // every millisecond as there is no event for the socket draining
+    var moved = (x_accum != 0) || (y_accum != 0) || (Math.trunc(wheel_accum) != 0) || abs_moved;
+    if ((input_events.length != 0) || (moved && input_socket.bufferedAmount == 0)) {
+      sendStates();
+    } else if (moved) {
+      scheduleUpdate(1);
+    }
+    return;
+  }
   if (pending_mouse == 0) {
-    if ((x_accum != 0) || (y_accum != 0) || (l_click != 0) || (r_click != 0)) {
+    if ((x_accum != 0) || (y_accum != 0) || (Math.trunc(wheel_accum) != 0) ||
+        (clicked != 0) || (input_events.length != 0) || abs_moved) {
+      if (use_inputd && window.fetch) {
+        sendInputd();
+        return;
+      }
+      // the CGI chain has no keyboard, wheel or absolute pointer; it gets the
+      // buttons held now and those clicked since the last request, so a
+      // press and release in between is not lost
+      takeBackMotion(input_events);
+      input_events = [];
+      abs_moved = 0;
+      wheel_accum = 0;
+      oldest_input = 0;
       var client = new HttpClient();
       pending_mouse = 1;
-      //console.log("Request cgi-bin/mouse?dx="+x_accum+"&dy="+y_accum+"&lc="+l_click+" ...");
-      client.get("cgi-bin/mouse?dx="+x_accum+"&dy="+y_accum+"&lc="+l_click+"&rc="+r_click, function(response) {
+      //console.log("Request cgi-bin/mouse?dx="+x_accum+"&dy="+y_accum+"&b="+buttons+" ...");
+      client.get("cgi-bin/mouse?dx="+x_accum+"&dy="+y_accum+"&b="+buttons+"&c="+clicked, function(response) {
         pending_mouse = 0;
+        scheduleUpdate(0);
         //console.log('Response: '+response);
       });
       x_accum = 0;
       y_accum = 0;
-      l_click = 0;
-      r_click = 0;
+      clicked = 0;
     }
   }
 }
 
 function updatePosition(e) {
+  noteInput(e);
   x_accum+=e.movementX;
   y_accum+=e.movementY;
+  moveCursor(e.movementX, e.movementY);
   //console.log('MouseMove: dx = ' + e.movementX + ', dy = ' + e.movementY + '.');  
 }
 
-function doClick(e) {
-  if (e.which) {
-    btn = e.which;
-  }
-  if (e.button) {
-    btn = e.button;
-  }
-  if (btn==1) {
-    l_click = 1;
+// e.button 0 .. 4: left, middle, right, back, forward
+var button_bits = [1, 4, 2, 8, 16];
+
+function updateButtons(e) {
+  noteInput(e);
+  var bit = button_bits[e.button] || 0;
+  if (e.type == "mousedown") {
+    buttons |= bit;
   } else {
-    r_click = 1;
+    buttons &= ~bit;
+    clicked |= bit;
+  }
+  pushMouse();
+  if (buttons == 0 && cursor_moved && cursor_timer == null) {
+    cursor_timer = setTimeout(syncCursor, cursor_settle_ms);
   }
-  //console.log('Click. Button ' + btn);  
 }
 
+// HID wheel up is positive; a notch is 100 pixels or 3 lines in most browsers
+function updateWheel(e) {
+  noteInput(e);
+  var notches = e.deltaMode == 0 ? e.deltaY / 100 : e.deltaMode == 1 ? e.deltaY / 3 : e.deltaY;
+  wheel_accum -= notches;
+}
+
+// Ctrl+Shift+V types the clipboard into the host (through inputd, at the
+// rate the host takes keys), as does a paste while the keys are not
+// captured; index.html?layout=de for a host with a German keyboard layout
+var paste_url = location.protocol + "//" + location.hostname + ":8081/paste?layout=" +
+                ((/[?&]layout=(\w+)/.exec(location.search) || [])[1] || "us");
+
+function isPasteKey(e) {
+  return e.code == "KeyV" && e.ctrlKey && e.shiftKey;
+}
+
+document.addEventListener("paste", function(e) {
+  var text = e.clipboardData ? e.clipboardData.getData("text/plain") : "";
+  if (text && window.fetch) {
+    e.preventDefault();
+    fetch(paste_url, { method: "POST", body: text }).catch(function(error) {});
+  }
+}, false);
+
+// the host repeats held keys itself, so only changes are sent
 function keyDown(e) {
+  if (isPasteKey(e)) {
+    return;     // left to the browser, for its paste event
+  }
+  if (isStatsKey(e)) {
+    return;     // toggles the telemetry overlay
+  }
   e.preventDefault();
-  //console.log('KeyDown: ' + e.which + ' (' + keyCodes[e.which]+ ').');
+  var usage = keymap ? keymap[e.code] : undefined;
+  if (usage && !held_keys[e.code]) {
+    noteInput(e);
+    held_keys[e.code] = usage;
+    input_events.push([2, 0, usage, 1, 0]);     // EventType::kKey
+  }
 }
 
 function keyUp(e) {
   e.preventDefault();
-  //console.log('KeyUp: ' + e.which + ' (' + keyCodes[e.which]+ ').');
-}
-
-var mouseupdate = setInterval("serverUpdate()",1);
-
-
-var img_ch0 = new Image();
-var img_ch1 = new Image();
-var img_ch2 = new Image();
-var img_ch3 = new Image();
-var img_cnt = 0;
-var go = 1;
-var lastGo = 0;
-img_ch0.onload = function(){
-    img_cnt--;
-    if (img_cnt==0) {
-        document.getElementById('ch0').src = img_ch0.src;
-        document.getElementById('ch1').src = img_ch1.src;
-        document.getElementById('ch2').src = img_ch2.src;
-        document.getElementById('ch3').src = img_ch3.src;
-        go = 1;
+  var usage = held_keys[e.code];
+  if (usage) {
+    noteInput(e);
+    delete held_keys[e.code];
+    input_events.push([2, 0, usage, 0, 0]);
+  }
+}
+
+// keys still held when the pointer lock or the focus goes would stay down on the host
+function releaseKeys() {
+  for (var code in held_keys) {
+    input_events.push([2, 0, held_keys[code], 0, 0]);
+  }
+  held_keys = {};
+  scheduleUpdate(0);
+}
+
+// pixel of the capture at a point of the page: the canvas holds the frame,
+// at 1/scale of its resolution when downscaled; null before the first frame
+function framePosition(client_x, client_y) {
+  var rect = video.getBoundingClientRect();
+  var res_x = video.width * scale;
+  var res_y = video.height * scale;
+  if (!stripes[0] || rect.width <= 0 || rect.height <= 0) {
+    return null;
+  }
+  return [Math.max(0, Math.min(res_x - 1, Math.floor((client_x - rect.left) * res_x / rect.width))),
+          Math.max(0, Math.min(res_y - 1, Math.floor((client_y - rect.top) * res_y / rect.height)))];
+}
+
+function setAbsPosition(e) {
+  var pos = framePosition(e.clientX, e.clientY);
+  if (pos) {
+    abs_x = pos[0];
+    abs_y = pos[1];
+  }
+}
+
+function absMove(e) {
+  noteInput(e);
+  setAbsPosition(e);
+  abs_moved = 1;
+}
+
+// e.button 0, 1, 2: left, middle, right -> kButtonLeft, kButtonMiddle, kButtonRight
+function absButton(e) {
+  e.preventDefault();
+  noteInput(e);
+  setAbsPosition(e);
+  var bit = button_bits[e.button] || 0;
+  abs_buttons = e.type == "mousedown" ? (abs_buttons | bit) : (abs_buttons & ~bit);
+  input_events.push([3, abs_buttons, abs_x, abs_y, 0]); // EventType::kPointer
+  abs_moved = 0;
+}
+
+if (absolute) {
+  canvas.addEventListener("mousemove", absMove, false);
+  canvas.addEventListener("mousedown", absButton, false);
+  document.addEventListener("mouseup", absButton, false);
+  canvas.addEventListener("contextmenu", function(e) { e.preventDefault(); }, false);
+  document.addEventListener("keydown", keyDown, false);
+  document.addEventListener("keyup", keyUp, false);
+  window.addEventListener("blur", releaseKeys, false);
+}
+
+// index.html?scale=2 or 4: stripes downscaled on the server, for small screens
+var scale_match = /[?&]scale=([24])/.exec(location.search);
+var scale = scale_match ? scale_match[1] : "1";
+
+// the stripes come decoded from kvm_decode.js, each on its own, and are
+// drawn on the next animation frame, the newest of each if several came
+// in meanwhile
+var video = document.getElementById("video");
+var video_ctx = video.getContext("2d");
+var stripes = [null, null, null, null];     // ImageBitmap of each stripe, kept to redraw
+var fresh = [false, false, false, false];   // not drawn yet
+var committed = [0, 0, 0, 0];               // on the server, for the frame age (timeOrigin + now)
+var draw_pending = false;
+
+// the stripes are a quarter of the frame wide, the last one also takes the
+// remainder (image_stripe.vhd)
+function drawStripes() {
+  draw_pending = false;
+  // the last stripe also holds what is left over of the width
+  // (image_stripe), so only the others tell where the stripes go; it waits
+  // for one of them, still fresh
+  var first = stripes[0] || stripes[1] || stripes[2];
+  if (!first) {
+    return;
+  }
+  var last = stripes[3];
+  var quarter = first.width;
+  var width = 3 * quarter + (last ? last.width : quarter);
+  var height = 0;
+  for (var i = 0; i < stripes.length; i++) {
+    height = stripes[i] ? Math.max(height, stripes[i].height) : height;
+  }
+  if (video.width != width || video.height != height) {
+    // resizing clears the canvas
+    video.width = width;
+    video.height = height;
+    fresh = [true, true, true, true];
+  }
+  for (var i = 0; i < stripes.length; i++) {
+    if (stripes[i] && fresh[i]) {
+      video_ctx.drawImage(stripes[i], i * quarter, 0);
+      if (committed[i] > 0) {
+        noteDrawn(i, performance.timeOrigin + performance.now() - committed[i]);
+        committed[i] = 0;
+      }
     }
+    fresh[i] = false;
+  }
+}
+
+var decoder = new Worker("kvm_decode.js");
+decoder.onmessage = function(e) {
+  var ch = e.data.ch;
+  if (stripes[ch]) {
+    stripes[ch].close();
+  }
+  stripes[ch] = e.data.bitmap;
+  fresh[ch] = true;
+  committed[ch] = e.data.committed;
+  noteDecoded(e.data.bytes, e.data.decode_ms);
+  if (!draw_pending) {
+    draw_pending = true;
+    requestAnimationFrame(drawStripes);
+  }
 };
-img_ch1.onload = img_ch0.onload;
-img_ch2.onload = img_ch0.onload;
-img_ch3.onload = img_ch0.onload;
-function ChangeMedia(){
-    var d = new Date();
-    var t = d.getTime();
-    if (go==1) {
-        lastGo = t;
-        go = 0;
-        img_cnt += 4;
-        img_ch0.src = "cgi-bin/getimg0?t="+t+"&ext=.jpeg";
-        img_ch1.src = "cgi-bin/getimg1?t="+t+"&ext=.jpeg";
-        img_ch2.src = "cgi-bin/getimg2?t="+t+"&ext=.jpeg";
-        img_ch3.src = "cgi-bin/getimg3?t="+t+"&ext=.jpeg";
-    } else if ((t-lastGo)>=1000) {
-        location.reload();
+decoder.postMessage({scale: scale});
+
+// Under pointer lock, a local cursor is drawn where the host's will be,
+// moved by the same motion as it is sent, rather than waiting for the
+// host's to come back in the frames. The absolute pointer (hid.usb2) puts
+// the host's cursor where the lock was taken, and again where the local one
+// is once the mouse rests for cursor_settle_ms, in case the host scaled or
+// accelerated the motion. index.html?cursor=host: just the host's cursor.
+var predict_cursor = !absolute && !/[?&]cursor=host/.test(location.search);
+var cursor_settle_ms = 300;
+var cursor_x = -1;        // frame pixels, -1: not shown
+var cursor_y = -1;
+var cursor_moved = false; // since the host was last told where it is
+var cursor_timer = null;
+var cursor_pending = false;
+
+// the usual arrow, 12x18, drawn once
+var cursor = document.createElement("canvas");
+cursor.id = "cursor";
+cursor.width = 12;
+cursor.height = 18;
+(function() {
+  var ctx = cursor.getContext("2d");
+  ctx.beginPath();
+  ctx.moveTo(0.5, 0.5);
+  ctx.lineTo(0.5, 15.5);
+  ctx.lineTo(4.5, 11.5);
+  ctx.lineTo(7.5, 17.5);
+  ctx.lineTo(9.5, 16.5);
+  ctx.lineTo(6.5, 10.5);
+  ctx.lineTo(11.5, 10.5);
+  ctx.closePath();
+  ctx.fillStyle = "white";
+  ctx.fill();
+  ctx.strokeStyle = "black";
+  ctx.stroke();
+})();
+canvas.appendChild(cursor);
+
+function placeCursor() {
+  cursor_pending = false;
+  if (cursor_x < 0) {
+    cursor.style.display = "none";
+    return;
+  }
+  var x = video.offsetLeft + cursor_x * video.clientWidth / (video.width * scale);
+  var y = video.offsetTop + cursor_y * video.clientHeight / (video.height * scale);
+  cursor.style.transform = "translate(" + Math.round(x) + "px," + Math.round(y) + "px)";
+  cursor.style.display = "block";
+}
+
+function drawCursor() {
+  if (!cursor_pending) {
+    cursor_pending = true;
+    requestAnimationFrame(placeCursor);
+  }
+}
+
+// the host's cursor to where the local one is, as an absolute pointer event;
+// not during a drag, whose buttons that event would release on the host:
+// updateButtons syncs once they are up
+function syncCursor() {
+  cursor_timer = null;
+  if (cursor_x >= 0 && cursor_moved && buttons == 0) {
+    cursor_moved = false;
+    input_events.push([3, 0, cursor_x, cursor_y, 0]);  // EventType::kPointer
+    scheduleUpdate(0);
+  }
+}
+
+function startCursor() {
+  var pos = predict_cursor ? framePosition(click_x, click_y) : null;
+  if (pos) {
+    cursor_x = pos[0];
+    cursor_y = pos[1];
+    cursor_moved = true;
+    syncCursor();
+    drawCursor();
+  }
+}
+
+function stopCursor() {
+  cursor_x = -1;
+  clearTimeout(cursor_timer);
+  cursor_timer = null;
+  drawCursor();
+}
+
+// kept on the frame as the host keeps its cursor on the screen
+function moveCursor(dx, dy) {
+  if (cursor_x < 0) {
+    return;
+  }
+  cursor_x = Math.max(0, Math.min(video.width * scale - 1, cursor_x + dx));
+  cursor_y = Math.max(0, Math.min(video.height * scale - 1, cursor_y + dy));
+  cursor_moved = true;
+  clearTimeout(cursor_timer);
+  cursor_timer = setTimeout(syncCursor, cursor_settle_ms);
+  drawCursor();
+}
+
+// Telemetry of what this browser gets, shown over the video with
+// Ctrl+Shift+S (index.html?stats=1: from the start) and POSTed to
+// cgi-bin/metrics every stats_upload_ms, where "getimg -m" lists it per
+// client next to the server's counters:
+//  - fps_chN: stripes of channel N drawn per second, unchanged ones are not
+//    fetched again and not counted;
+//  - decode_ms: mean time of createImageBitmap in kvm_decode.js;
+//  - bytes_per_s: of the stripes received;
+//  - frame_age_ms, frame_age_max_ms: from the server committing a stripe
+//    (X-Stripe-Age) to drawing it;
+//  - input_rtt_ms, input_rtt_max_ms: from a POST of events to its answer, or
+//    from a text message on the input WebSocket to inputd sending it back.
+var stats_id = 1 + Math.floor(Math.random() * 0x7FFFFFFE);
+var stats_upload_ms = 10000;
+var stats_shown = /[?&]stats=1/.test(location.search);
+
+function StatsWindow() {
+  this.start = performance.now();
+  this.drawn = [0, 0, 0, 0];
+  this.bytes = 0;
+  this.decodes = 0;
+  this.decode_ms = 0;
+  this.ages = 0;
+  this.age_ms = 0;
+  this.age_max_ms = 0;
+  this.rtts = 0;
+  this.rtt_ms = 0;
+  this.rtt_max_ms = 0;
+}
+
+// "name value" lines, empty if nothing happened
+StatsWindow.prototype.lines = function() {
+  var seconds = Math.max(0.001, (performance.now() - this.start) / 1000);
+  var lines = [];
+  if (this.decodes > 0 || this.rtts > 0) {
+    for (var i = 0; i < this.drawn.length; i++) {
+      lines.push("fps_ch" + i + " " + (this.drawn[i] / seconds).toFixed(1));
     }
+    lines.push("decode_ms " + (this.decodes > 0 ? this.decode_ms / this.decodes : 0).toFixed(2));
+    lines.push("bytes_per_s " + Math.round(this.bytes / seconds));
+    lines.push("frame_age_ms " + (this.ages > 0 ? this.age_ms / this.ages : 0).toFixed(1));
+    lines.push("frame_age_max_ms " + this.age_max_ms.toFixed(1));
+    lines.push("input_rtt_ms " + (this.rtts > 0 ? this.rtt_ms / this.rtts : 0).toFixed(2));
+    lines.push("input_rtt_max_ms " + this.rtt_max_ms.toFixed(2));
+  }
+  return lines;
+};
+
+var stats_overlay = new StatsWindow();
+var stats_upload = new StatsWindow();
+
+function noteDecoded(bytes, decode_ms) {
+  [stats_overlay, stats_upload].forEach(function(w) {
+    w.bytes += bytes;
+    w.decodes++;
+    w.decode_ms += decode_ms;
+  });
+}
+
+function noteDrawn(ch, age_ms) {
+  [stats_overlay, stats_upload].forEach(function(w) {
+    w.drawn[ch]++;
+    w.ages++;
+    w.age_ms += age_ms;
+    w.age_max_ms = Math.max(w.age_max_ms, age_ms);
+  });
+}
+
+function noteRtt(ms) {
+  [stats_overlay, stats_upload].forEach(function(w) {
+    w.rtts++;
+    w.rtt_ms += ms;
+    w.rtt_max_ms = Math.max(w.rtt_max_ms, ms);
+  });
+}
+
+var stats_text = document.createElement("pre");
+stats_text.id = "stats";
+canvas.appendChild(stats_text);
+
+function isStatsKey(e) {
+  return e.code == "KeyS" && e.ctrlKey && e.shiftKey;
 }
-var reloadcam = setInterval("ChangeMedia()",1);
 
+document.addEventListener("keydown", function(e) {
+  if (isStatsKey(e)) {
+    e.preventDefault();
+    stats_shown = !stats_shown;
+    stats_text.style.display = stats_shown ? "block" : "none";
+  }
+}, false);
+
+// the input WebSocket carries no answers, a timestamp goes through it
+// every second for the round trip; POSTs are timed as they are answered
+function sendRttProbe() {
+  if (socket_ready) {
+    input_socket.send(String(performance.now()));
+  }
+}
+
+setInterval(function() {
+  sendRttProbe();
+  if (stats_shown) {
+    stats_text.textContent = stats_overlay.lines().join("\n") || "no frames";
+    stats_text.style.display = "block";
+  }
+  stats_overlay = new StatsWindow();
+}, 1000);
+
+setInterval(function() {
+  var lines = stats_upload.lines();
+  stats_upload = new StatsWindow();
+  if (lines.length > 0 && window.fetch) {
+    fetch("cgi-bin/metrics?id=" + stats_id, {method: "POST", body: lines.join("\n") + "\n"}).catch(function(error) {});
+  }
+}, stats_upload_ms);
@@ -0,0 +1,122 @@
+// Worker of kvm.js: pulls each of the four stripes on its own and decodes
+// it off the page's thread, handing the ImageBitmap over (transferred, not
+// copied) as soon as it is in, so a slow stripe holds up no other. Each
+// request names the hash of the stripe the page has (known=), and the frame
+// server answers without the stripe if it is still the same. The next
+// request of a stripe goes out as soon as one is answered; the frame server
+// paces them (1 fps while the screen is idle, see cgi-bin/governor).
+
+// a stripe not in by then is asked for again
+var stall_ms = 5000;
+// after a failed request (httpd restarting, link down)
+var retry_ms = 1000;
+// a stripe still not answered after another one moved on by more commits
+// than this (X-Stripe-Sequence) is asked for again, rather than left on
+// screen that much older than the rest
+var max_skew = 8;
+
+var scale = "1";
+
+// per stripe: the hash and sequence of the one the page has, the request
+// in flight, and the sequences of all stripes when it was answered (null
+// before a stripe's first answer)
+var stripes = [];
+
+function stripeUrl(ch, t, hash) {
+  var known = hash ? "&known=" + hash : "";
+  if (scale != "1") {
+    return "cgi-bin/scaled?ch="+ch+"&s="+scale+"&t="+t+known+"&ext=.jpeg";
+  }
+  return "cgi-bin/getimg"+ch+"?t="+t+known+"&ext=.jpeg";
+}
+
+// the body as it comes in
+function readBody(response) {
+  var reader = response.body.getReader();
+  var chunks = [];
+  function next() {
+    return reader.read().then(function(result) {
+      if (result.done) {
+        return new Blob(chunks, {type: "image/jpeg"});
+      }
+      chunks.push(result.value);
+      return next();
+    });
+  }
+  return next();
+}
+
+// the stripes that fell behind ch's latest answer are asked for again
+function checkSkew(ch) {
+  for (var i = 0; i < stripes.length; i++) {
+    var seen = stripes[i].seen[ch];
+    if (i != ch && stripes[i].controller && seen !== null && stripes[ch].sequence - seen > max_skew) {
+      stripes[i].controller.abort();
+    }
+  }
+}
+
+function answered(ch, sequence) {
+  var stripe = stripes[ch];
+  stripe.sequence = sequence;
+  for (var i = 0; i < stripes.length; i++) {
+    stripe.seen[i] = stripes[i].sequence;
+  }
+  checkSkew(ch);
+}
+
+function pullStripe(ch) {
+  var stripe = stripes[ch];
+  var controller = new AbortController();
+  var stall = setTimeout(function() { controller.abort(); }, stall_ms);
+  stripe.controller = controller;
+  fetch(stripeUrl(ch, Date.now(), stripe.hash), {cache: "no-store", signal: controller.signal}).then(function(response) {
+    var hash = response.headers.get("X-Stripe-Hash");
+    var sequence = Number(response.headers.get("X-Stripe-Sequence")) || 0;
+    // when the server committed it, on the page's clock too (timeOrigin + now)
+    var committed = performance.timeOrigin + performance.now() - (Number(response.headers.get("X-Stripe-Age")) || 0) / 1000;
+    var bytes = 0;
+    var decode_start = 0;
+    // 304, or the stripe sent anyway by a server not taking known=
+    if (hash && hash == stripe.hash) {
+      if (response.body) {
+        response.body.cancel();
+      }
+      return sequence;
+    }
+    if (!response.ok) {
+      throw new Error("HTTP " + response.status);
+    }
+    return readBody(response).then(function(blob) {
+      bytes = blob.size;
+      decode_start = performance.now();
+      return createImageBitmap(blob);
+    }).then(function(bitmap) {
+      stripe.hash = hash;
+      postMessage({ch: ch, bitmap: bitmap, bytes: bytes, decode_ms: performance.now() - decode_start,
+                   committed: committed}, [bitmap]);
+      return sequence;
+    });
+  }).then(function(sequence) {
+    clearTimeout(stall);
+    stripe.controller = null;
+    answered(ch, sequence);
+    pullStripe(ch);
+  }, function(error) {
+    clearTimeout(stall);
+    stripe.controller = null;
+    // a stall or skew is asked for again at once, anything else after a pause
+    setTimeout(function() { pullStripe(ch); }, controller.signal.aborted ? 0 : retry_ms);
+  });
+}
+
+// {scale: "1" | "2" | "4"} from kvm.js starts it
+onmessage = function(e) {
+  scale = e.data.scale;
+  for (var ch = 0; ch < 4; ch++) {
+    stripes.push({hash: null, sequence: null, controller: null, seen: [null, null, null, null]});
+  }
+  for (var ch = 0; ch < 4; ch++) {
+    pullStripe(ch);
+  }
+};
@@ -0,0 +1,62 @@
+#ifndef BIT_WRITER_H
+#define BIT_WRITER_H
+
+#include <cstdint>
+
+// MSB first, 0xFF followed by a stuffed 0x00 (ByteStuffer)
+class BitWriter
+{
+public:
+    explicit BitWriter(uint8_t *out) :
+        m_out { out },
+        m_acc { 0 },
+        m_bits { 0 }
+    {
+    }
+
+    // value holds no bits above size; size <= 32
+    void put(uint32_t value, int size)
+    {
+        m_acc = m_acc << size | value;
+        m_bits += size;
+        if (m_bits >= 32) {
+            flush();
+        }
+    }
+
+    // output written so far; up to 7 bytes (14 stuffed) are still pending
+    const uint8_t *position() const
+    {
+        return m_out;
+    }
+
+    // fill up the last byte with ones, like huffman.vhd
+    uint8_t *finish()
+    {
+        if (m_bits & 7) {
+            int pad = 8 - (m_bits & 7);
+            put((1u << pad) - 1, pad);
+        }
+        flush();
+        return m_out;
+    }
+
+private:
+    void flush()
+    {
+        while (m_bits >= 8) {
+            m_bits -= 8;
+            uint8_t b = static_cast<uint8_t>(m_acc >> m_bits);
+            *m_out++ = b;
+            if (b == 0xFF) {
+                *m_out++ = 0x00;
+            }
+        }
+    }
+
+    uint8_t *m_out;
+    uint64_t m_acc;
+    int m_bits;
+};
+
+#endif
@@ -0,0 +1,124 @@
+#include "client_stats.h"
+
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+namespace {
+
+const char *kClientsPath = "/dev/shm/kvm_clients";
+const uint32_t kClientsMagic = 0x4b564d43;   // "KVMC"
+
+struct ClientTable
+{
+    uint32_t magic;
+    ClientReport clients[kMaxClients];
+};
+
+bool isName(const std::string & s)
+{
+    if (s.empty()) {
+        return false;
+    }
+    for (char c : s) {
+        if (!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool isNumber(const std::string & s)
+{
+    char *end = nullptr;
+    strtod(s.c_str(), &end);
+    return !s.empty() && end == s.c_str() + s.size();
+}
+
+// "name value" lines only, as "getimg -m" prints them on
+std::string sanitize(const std::string & text)
+{
+    std::string out;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        std::string line = text.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+        pos = end == std::string::npos ? text.size() : end + 1;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        size_t space = line.find(' ');
+        if (space != std::string::npos && isName(line.substr(0, space)) && isNumber(line.substr(space + 1)) &&
+            out.size() + line.size() + 1 <= kMaxClientReport) {
+            out += line + "\n";
+        }
+    }
+    return out;
+}
+
+}
+
+bool saveClientReport(uint32_t id, const std::string & text, uint64_t nowNs)
+{
+    std::string lines = sanitize(text);
+    if (id == 0 || lines.empty()) {
+        return false;
+    }
+    int fd = open(kClientsPath, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        std::cerr << "Could not open " << kClientsPath << ", errno " << errno << std::endl;
+        return false;
+    }
+    while (flock(fd, LOCK_EX) != 0 && errno == EINTR) {
+    }
+    static ClientTable table;
+    if (pread(fd, &table, sizeof(table), 0) != sizeof(table) || table.magic != kClientsMagic) {
+        memset(&table, 0, sizeof(table));
+        table.magic = kClientsMagic;
+    }
+    int slot = 0;
+    for (int i = 0; i < kMaxClients; i++) {
+        if (table.clients[i].id == id) {
+            slot = i;
+            break;
+        }
+        if (table.clients[i].receivedNs < table.clients[slot].receivedNs) {
+            slot = i;
+        }
+    }
+    ClientReport & report = table.clients[slot];
+    report.id = id;
+    report.length = lines.size();
+    report.receivedNs = nowNs;
+    memcpy(report.text, lines.data(), lines.size());
+    bool ok = pwrite(fd, &table, sizeof(table), 0) == sizeof(table);
+    flock(fd, LOCK_UN);
+    close(fd);
+    return ok;
+}
+
+std::vector<ClientReport> loadClientReports(uint64_t nowNs)
+{
+    std::vector<ClientReport> reports;
+    int fd = open(kClientsPath, O_RDONLY);
+    if (fd < 0) {
+        return reports;
+    }
+    while (flock(fd, LOCK_SH) != 0 && errno == EINTR) {
+    }
+    static ClientTable table;
+    bool ok = pread(fd, &table, sizeof(table), 0) == sizeof(table) && table.magic == kClientsMagic;
+    flock(fd, LOCK_UN);
+    close(fd);
+    for (int i = 0; ok && i < kMaxClients; i++) {
+        const ClientReport & report = table.clients[i];
+        if (report.id != 0 && report.length <= kMaxClientReport &&
+            nowNs - report.receivedNs < kClientTimeoutMs * 1000000ull) {
+            reports.push_back(report);
+        }
+    }
+    return reports;
+}
@@ -0,0 +1,36 @@
+#ifndef CLIENT_STATS_H
+#define CLIENT_STATS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * What the browsers see: kvm.js POSTs its aggregates of the last period to
+ * cgi-bin/metrics every few seconds (stripes drawn per second, decode time,
+ * bytes/s, frame age, input round trip) as "name value" lines. The last
+ * report of each of up to kMaxClients clients is kept in /dev/shm/kvm_clients
+ * for "getimg -m", which leaves out the ones not heard from for
+ * kClientTimeoutMs. A new client takes the slot of the one heard from
+ * longest ago.
+ */
+
+static const int kMaxClients = 8;
+static const uint32_t kMaxClientReport = 1024;
+static const uint32_t kClientTimeoutMs = 60000;
+
+struct ClientReport
+{
+    uint32_t id;            // picked by the page, 0: free slot
+    uint32_t length;
+    uint64_t receivedNs;    // CLOCK_MONOTONIC
+    char text[kMaxClientReport];
+};
+
+// text is cut down to the lines of a name of [a-z0-9_] and a number; false if none is left
+bool saveClientReport(uint32_t id, const std::string & text, uint64_t nowNs);
+
+// the clients heard from within kClientTimeoutMs
+std::vector<ClientReport> loadClientReports(uint64_t nowNs);
+
+#endif
@@ -0,0 +1,225 @@
+#include "csc.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CSC_NEON 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CSC_X86 1
+#endif
+
+namespace {
+
+const int kBlock = 16;      // pixels per kernel iteration
+
+#ifdef CSC_NEON
+
+// 4 pixels of one component: ((t + a*R + b*G + c*B) >> 14), 32 bit accumulator
+inline int16x4_t cscQuarter(int16x4_t r, int16x4_t g, int16x4_t b, int16_t a, int16_t bb, int16_t c, int32_t t)
+{
+    int32x4_t acc = vdupq_n_s32(t);
+    acc = vmlal_n_s16(acc, r, a);
+    acc = vmlal_n_s16(acc, g, bb);
+    acc = vmlal_n_s16(acc, b, c);
+    return vshrn_n_s32(acc, 14);
+}
+
+// 8 pixels, values 0..255, so the saturating narrow is a plain truncation
+inline uint8x8_t cscEighth(int16x8_t r, int16x8_t g, int16x8_t b, int16_t a, int16_t bb, int16_t c, int32_t t)
+{
+    int16x4_t lo = cscQuarter(vget_low_s16(r), vget_low_s16(g), vget_low_s16(b), a, bb, c, t);
+    int16x4_t hi = cscQuarter(vget_high_s16(r), vget_high_s16(g), vget_high_s16(b), a, bb, c, t);
+    return vqmovun_s16(vcombine_s16(lo, hi));
+}
+
+void cscRowNeon(const uint8_t *rgb, uint8_t *y, uint8_t *cb, uint8_t *cr, uint32_t n)
+{
+    const int32_t bias = 128 << 14;
+    uint32_t i = 0;
+    for (; i + kBlock <= n; i += kBlock) {
+        uint8x16x3_t px = vld3q_u8(rgb + i * 3);
+        int16x8_t r[2] = { vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(px.val[0]))),
+                           vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(px.val[0]))) };
+        int16x8_t g[2] = { vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(px.val[1]))),
+                           vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(px.val[1]))) };
+        int16x8_t b[2] = { vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(px.val[2]))),
+                           vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(px.val[2]))) };
+        uint8x8_t out[3][2];
+        for (int h = 0; h < 2; h++) {
+            out[0][h] = cscEighth(r[h], g[h], b[h], 4899, 9617, 1868, 0);
+            out[1][h] = cscEighth(r[h], g[h], b[h], -2764, -5428, 8192, bias);
+            out[2][h] = cscEighth(r[h], g[h], b[h], 8192, -6860, -1332, bias);
+        }
+        vst1q_u8(y + i, vcombine_u8(out[0][0], out[0][1]));
+        vst1q_u8(cb + i, vcombine_u8(out[1][0], out[1][1]));
+        vst1q_u8(cr + i, vcombine_u8(out[2][0], out[2][1]));
+    }
+    cscRowScalar(rgb + i * 3, y + i, cb + i, cr + i, n - i);
+}
+
+#endif
+
+#ifdef CSC_X86
+
+/*
+ * pshufb masks splitting 16 packed pixels (three 16 byte loads) into R, G
+ * and B: kSplit[channel][load][lane], 0x80 clears the lane.
+ */
+struct SplitMasks
+{
+    uint8_t m[3][3][16];
+
+    SplitMasks()
+    {
+        for (int ch = 0; ch < 3; ch++) {
+            for (int load = 0; load < 3; load++) {
+                for (int lane = 0; lane < 16; lane++) {
+                    int pos = 3 * lane + ch - 16 * load;
+                    m[ch][load][lane] = pos >= 0 && pos < 16 ? pos : 0x80;
+                }
+            }
+        }
+    }
+};
+
+const SplitMasks kSplit;
+
+// madd pairs: (R, G) x (a, b) and (B, 128) x (c, t / 128), with t = 128 * 2^14 or 0
+inline int32_t pair(int16_t lo, int16_t hi)
+{
+    return static_cast<int32_t>(static_cast<uint32_t>(static_cast<uint16_t>(hi)) << 16 | static_cast<uint16_t>(lo));
+}
+
+const int32_t kCoef[3][2] = {
+    { pair(4899, 9617), pair(1868, 0) },
+    { pair(-2764, -5428), pair(8192, 1 << 14) },
+    { pair(8192, -6860), pair(-1332, 1 << 14) },
+};
+
+__attribute__((target("ssse3")))
+inline void splitRgb(const uint8_t *rgb, __m128i & r, __m128i & g, __m128i & b)
+{
+    __m128i in[3];
+    for (int load = 0; load < 3; load++) {
+        in[load] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rgb + 16 * load));
+    }
+    __m128i *out[3] = { &r, &g, &b };
+    for (int ch = 0; ch < 3; ch++) {
+        __m128i v = _mm_setzero_si128();
+        for (int load = 0; load < 3; load++) {
+            __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i *>(kSplit.m[ch][load]));
+            v = _mm_or_si128(v, _mm_shuffle_epi8(in[load], mask));
+        }
+        *out[ch] = v;
+    }
+}
+
+__attribute__((target("ssse3")))
+void cscRowSsse3(const uint8_t *rgb, uint8_t *y, uint8_t *cb, uint8_t *cr, uint32_t n)
+{
+    uint8_t *out[3] = { y, cb, cr };
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i k128 = _mm_set1_epi16(128);
+    uint32_t i = 0;
+    for (; i + kBlock <= n; i += kBlock) {
+        __m128i r, g, b;
+        splitRgb(rgb + i * 3, r, g, b);
+        __m128i r16[2] = { _mm_unpacklo_epi8(r, zero), _mm_unpackhi_epi8(r, zero) };
+        __m128i g16[2] = { _mm_unpacklo_epi8(g, zero), _mm_unpackhi_epi8(g, zero) };
+        __m128i b16[2] = { _mm_unpacklo_epi8(b, zero), _mm_unpackhi_epi8(b, zero) };
+        for (int c = 0; c < 3; c++) {
+            __m128i rg = _mm_set1_epi32(kCoef[c][0]);
+            __m128i bt = _mm_set1_epi32(kCoef[c][1]);
+            __m128i half[2];
+            for (int h = 0; h < 2; h++) {
+                __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r16[h], g16[h]), rg),
+                                           _mm_madd_epi16(_mm_unpacklo_epi16(b16[h], k128), bt));
+                __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r16[h], g16[h]), rg),
+                                           _mm_madd_epi16(_mm_unpackhi_epi16(b16[h], k128), bt));
+                half[h] = _mm_packs_epi32(_mm_srai_epi32(lo, 14), _mm_srai_epi32(hi, 14));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out[c] + i), _mm_packus_epi16(half[0], half[1]));
+        }
+    }
+    cscRowScalar(rgb + i * 3, y + i, cb + i, cr + i, n - i);
+}
+
+// the same on 16 lanes of 16 bit; unpack and pack both work per 128 bit lane,
+// so the pixel order comes out right
+__attribute__((target("avx2")))
+void cscRowAvx2(const uint8_t *rgb, uint8_t *y, uint8_t *cb, uint8_t *cr, uint32_t n)
+{
+    uint8_t *out[3] = { y, cb, cr };
+    const __m256i k128 = _mm256_set1_epi16(128);
+    uint32_t i = 0;
+    for (; i + kBlock <= n; i += kBlock) {
+        __m128i r, g, b;
+        splitRgb(rgb + i * 3, r, g, b);
+        __m256i r16 = _mm256_cvtepu8_epi16(r);
+        __m256i g16 = _mm256_cvtepu8_epi16(g);
+        __m256i b16 = _mm256_cvtepu8_epi16(b);
+        __m256i rgLo = _mm256_unpacklo_epi16(r16, g16);
+        __m256i rgHi = _mm256_unpackhi_epi16(r16, g16);
+        __m256i btLo = _mm256_unpacklo_epi16(b16, k128);
+        __m256i btHi = _mm256_unpackhi_epi16(b16, k128);
+        for (int c = 0; c < 3; c++) {
+            __m256i rg = _mm256_set1_epi32(kCoef[c][0]);
+            __m256i bt = _mm256_set1_epi32(kCoef[c][1]);
+            __m256i lo = _mm256_add_epi32(_mm256_madd_epi16(rgLo, rg), _mm256_madd_epi16(btLo, bt));
+            __m256i hi = _mm256_add_epi32(_mm256_madd_epi16(rgHi, rg), _mm256_madd_epi16(btHi, bt));
+            __m256i v = _mm256_packs_epi32(_mm256_srai_epi32(lo, 14), _mm256_srai_epi32(hi, 14));
+            __m128i px = _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out[c] + i), px);
+        }
+    }
+    cscRowScalar(rgb + i * 3, y + i, cb + i, cr + i, n - i);
+}
+
+#endif
+
+typedef void (*CscRowFn)(const uint8_t *, uint8_t *, uint8_t *, uint8_t *, uint32_t);
+
+struct Kernel
+{
+    CscRowFn fn;
+    const char *name;
+};
+
+Kernel pickKernel()
+{
+#if defined(CSC_NEON)
+    return { cscRowNeon, "neon" };
+#elif defined(CSC_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return { cscRowAvx2, "avx2" };
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return { cscRowSsse3, "ssse3" };
+    }
+    return { cscRowScalar, "scalar" };
+#else
+    return { cscRowScalar, "scalar" };
+#endif
+}
+
+const Kernel kKernel = pickKernel();
+
+}
+
+void cscRowScalar(const uint8_t *rgb, uint8_t *y, uint8_t *cb, uint8_t *cr, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++, rgb += 3) {
+        cscPixel(rgb[0], rgb[1], rgb[2], y[i], cb[i], cr[i]);
+    }
+}
+
+void cscRow(const uint8_t *rgb, uint8_t *y, uint8_t *cb, uint8_t *cr, uint32_t n)
+{
+    kKernel.fn(rgb, y, cb, cr, n);
+}
+
+const char *cscKernelName()
+{
+    return kKernel.name;
+}
@@ -0,0 +1,29 @@
+#ifndef CSC_H
+#define CSC_H
+
+#include <cstdint>
+
+/*
+ * RGB to YCbCr exactly as colorspace_conv.vhd computes it: one csc_comp DSP
+ * cascade per component, p = a*x + b*y + c*z + t with the coefficients
+ * scaled by 2^14 and t = 128 * 2^14 for Cb/Cr, output p(21 downto 14).
+ * Every p lies in [0, 256 * 2^14), so that is a truncating shift and no
+ * bits are lost by keeping the sums in 32 bits.
+ */
+
+inline void cscPixel(uint8_t r, uint8_t g, uint8_t b, uint8_t & y, uint8_t & cb, uint8_t & cr)
+{
+    y = static_cast<uint8_t>((4899 * r + 9617 * g + 1868 * b) >> 14);
+    cb = static_cast<uint8_t>((-2764 * r - 5428 * g + 8192 * b + (128 << 14)) >> 14);
+    cr = static_cast<uint8_t>((8192 * r - 6860 * g - 1332 * b + (128 << 14)) >> 14);
+}
+
+// n packed RGB24 pixels to full resolution planar Y, Cb and Cr
+void cscRowScalar(const uint8_t *rgb, uint8_t *y, uint8_t *cb, uint8_t *cr, uint32_t n);
+
+// same, with the fastest kernel for this CPU: NEON, AVX2, SSSE3 or scalar
+void cscRow(const uint8_t *rgb, uint8_t *y, uint8_t *cb, uint8_t *cr, uint32_t n);
+
+const char *cscKernelName();
+
+#endif
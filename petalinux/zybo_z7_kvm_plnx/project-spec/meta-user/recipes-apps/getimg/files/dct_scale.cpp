@@ -0,0 +1,110 @@
+#include "dct_scale.h"
+
+#include <cmath>
+
+namespace {
+
+// orthonormal n point DCT-II basis, row k, sample i
+double dctBasis(int n, int k, int i)
+{
+    double c = k == 0 ? std::sqrt(1.0 / n) : std::sqrt(2.0 / n);
+    return c * std::cos((2 * i + 1) * k * std::acos(-1.0) / (2 * n));
+}
+
+}
+
+DctScaler::DctScaler(int factor) :
+    m_factor { factor == 4 ? 4 : 2 },
+    m_k { 8 / m_factor }
+{
+    // the K point IDCT of the corner gives the K x K block scaled by 8 / K
+    double gain = std::sqrt(static_cast<double>(m_k) / 8);
+    for (int a = 0; a < m_factor; a++) {
+        for (int r = 0; r < 8; r++) {
+            for (int j = 0; j < 4; j++) {
+                double s = 0;
+                for (int m = 0; j < m_k && m < m_k; m++) {
+                    s += dctBasis(8, r, a * m_k + m) * dctBasis(m_k, j, m);
+                }
+                m_a[a][r][j] = static_cast<float>(gain * s);
+            }
+        }
+    }
+}
+
+void DctScaler::scale(const CoefImage &in, CoefImage &out) const
+{
+    const int f = m_factor;
+    const int k = m_k;
+    out = in;
+    out.resize((in.width() + f - 1) / f, (in.height() + f - 1) / f);
+
+    for (size_t c = 0; c < in.components().size(); c++) {
+        const CoefComponent &src = in.components()[c];
+        CoefComponent &dst = out.components()[c];
+        const uint16_t *q = in.quant(src.tq);
+        for (uint32_t oby = 0; oby < dst.blocksY; oby++) {
+            for (uint32_t obx = 0; obx < dst.blocksX; obx++) {
+                float acc[8][8] = {};
+                for (int a = 0; a < f; a++) {
+                    // past the edge of the input the last block is repeated
+                    uint32_t iby = oby * f + a;
+                    iby = iby < src.blocksY ? iby : src.blocksY - 1;
+                    for (int b = 0; b < f; b++) {
+                        uint32_t ibx = obx * f + b;
+                        ibx = ibx < src.blocksX ? ibx : src.blocksX - 1;
+                        const int16_t *zz = src.block(ibx, iby);
+
+                        float s[4][4];
+                        bool dcOnly = true;
+                        for (int n = 0; n < 64; n++) {
+                            int v = kJpegZigzag[n] >> 3;
+                            int u = kJpegZigzag[n] & 7;
+                            if (v < k && u < k) {
+                                s[v][u] = static_cast<float>(zz[n] * q[n]);
+                                dcOnly = dcOnly && (n == 0 || zz[n] == 0);
+                            }
+                        }
+
+                        if (dcOnly) {
+                            for (int r = 0; r < 8; r++) {
+                                float col = s[0][0] * m_a[a][r][0];
+                                for (int x = 0; x < 8; x++) {
+                                    acc[r][x] += col * m_a[b][x][0];
+                                }
+                            }
+                            continue;
+                        }
+                        // t = S * A_b^T (K x 8), then acc += A_a * t
+                        float t[4][8];
+                        for (int j = 0; j < k; j++) {
+                            for (int x = 0; x < 8; x++) {
+                                float sum = 0;
+                                for (int i = 0; i < k; i++) {
+                                    sum += s[j][i] * m_a[b][x][i];
+                                }
+                                t[j][x] = sum;
+                            }
+                        }
+                        for (int r = 0; r < 8; r++) {
+                            for (int j = 0; j < k; j++) {
+                                float w = m_a[a][r][j];
+                                for (int x = 0; x < 8; x++) {
+                                    acc[r][x] += w * t[j][x];
+                                }
+                            }
+                        }
+                    }
+                }
+
+                int16_t *zz = dst.block(obx, oby);
+                for (int n = 0; n < 64; n++) {
+                    int idx = kJpegZigzag[n];
+                    long v = std::lround(acc[idx >> 3][idx & 7] / q[n]);
+                    // baseline coefficients have at most 11 magnitude bits
+                    zz[n] = static_cast<int16_t>(v < -2047 ? -2047 : v > 2047 ? 2047 : v);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef DCT_SCALE_H
+#define DCT_SCALE_H
+
+#include "jpeg_coef.h"
+
+/*
+ * Downscaling by 2 or 4 without going through pixels. Of each 8x8 block only
+ * the low frequency K x K corner is kept (K = 8 / factor), which is what a
+ * K point IDCT would turn into the K x K downscaled block; factor x factor
+ * of those are then combined straight into one 8x8 block of the output:
+ *
+ *   out = sum over (a, b) of  A_a * S_ab * A_b^T
+ *
+ * with S_ab the K x K corner of input block (a, b), dequantized, and
+ * A_a = sqrt(K / 8) * DCT8 * [K point IDCT at rows a*K .. a*K + K - 1],
+ * an 8 x K matrix worked out once. Blocks with nothing but a DC take a
+ * shortcut. The output is requantized with the input's tables and keeps its
+ * header, so a 4:2:2 stripe stays a 4:2:2 stripe of ceil(w / factor) x
+ * ceil(h / factor).
+ */
+
+class DctScaler
+{
+public:
+    explicit DctScaler(int factor);
+
+    int factor() const
+    {
+        return m_factor;
+    }
+
+    // in and out may not be the same object
+    void scale(const CoefImage &in, CoefImage &out) const;
+
+private:
+    int m_factor;
+    int m_k;
+    float m_a[4][8][4];     // A_a, [a][row][column], K columns used
+};
+
+#endif
@@ -0,0 +1,285 @@
+#include "frame_export.h"
+
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "idct.h"
+#include "jpeg_coef.h"
+
+namespace {
+
+const uint32_t kMagic = 0x4b564631;  // "KVF1"
+const size_t kMapSize = FrameExport::kHeaderSize + 2 * static_cast<size_t>(FrameExport::kMaxFrameSize);
+
+static_assert(sizeof(ExportHeader) <= FrameExport::kHeaderSize, "ExportHeader too large");
+
+inline uint8_t clampSample(int v)
+{
+    return static_cast<uint8_t>(v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+// JFIF YCbCr -> RGB, coefficients in Q16
+inline void yccToRgb(int y, int cb, int cr, uint8_t *rgb)
+{
+    cb -= 128;
+    cr -= 128;
+    rgb[0] = clampSample(y + ((91881 * cr + 32768) >> 16));
+    rgb[1] = clampSample(y - ((22554 * cb + 46802 * cr - 32768) >> 16));
+    rgb[2] = clampSample(y + ((116130 * cb + 32768) >> 16));
+}
+
+struct Target
+{
+    ExportFormat format;
+    uint8_t *out;
+    uint16_t width;
+    uint16_t height;
+};
+
+bool isStripeLayout(const CoefImage &img)
+{
+    const std::vector<CoefComponent> &comps = img.components();
+    return comps.size() == 3 && img.mcuWidth() == 16 && img.mcuHeight() == 8 &&
+           comps[1].h == 1 && comps[1].v == 1 && comps[2].h == 1 && comps[2].v == 1;
+}
+
+/*
+ * One MCU row at a time: IDCT into a row buffer per component, then the
+ * lines of the stripe (without the padding) go to their place in the frame.
+ * Chroma of the frame's column pair p is the stripe's sample for pixel 2p.
+ */
+bool decodeStripe(const uint8_t *jpeg, uint32_t length, uint16_t start, const Target &t)
+{
+    CoefImage img;
+    if (!img.decode(jpeg, length)) {
+        return false;
+    }
+    const std::vector<CoefComponent> &comps = img.components();
+    int16_t table[3][64];
+    uint32_t stride[3];
+    std::vector<uint8_t> rows[3];
+    for (int c = 0; c < 3; c++) {
+        idctTable(img.quant(comps[c].tq), table[c]);
+        stride[c] = comps[c].blocksX * 8;
+        rows[c].resize(stride[c] * 8);
+    }
+
+    const uint16_t w = img.width();
+    const uint32_t chromaWidth = (t.width + 1) / 2;
+    for (uint32_t my = 0; my < comps[0].blocksY; my++) {
+        for (int c = 0; c < 3; c++) {
+            for (uint32_t bx = 0; bx < comps[c].blocksX; bx++) {
+                idctBlock(comps[c].block(bx, my), table[c], &rows[c][bx * 8], stride[c]);
+            }
+        }
+        uint32_t lines = t.height - my * 8 < 8 ? t.height - my * 8 : 8;
+        for (uint32_t ly = 0; ly < lines; ly++) {
+            uint32_t y = my * 8 + ly;
+            const uint8_t *luma = &rows[0][ly * stride[0]];
+            const uint8_t *cb = &rows[1][ly * stride[1]];
+            const uint8_t *cr = &rows[2][ly * stride[2]];
+            if (t.format == ExportFormat::kYuv422p) {
+                memcpy(t.out + y * t.width + start, luma, w);
+                uint8_t *cbOut = t.out + static_cast<size_t>(t.width) * t.height + y * chromaWidth;
+                uint8_t *crOut = cbOut + chromaWidth * t.height;
+                for (uint32_t p = (start + 1) / 2; 2 * p < start + w; p++) {
+                    uint32_t lx = 2 * p - start;
+                    cbOut[p] = cb[lx / 2];
+                    crOut[p] = cr[lx / 2];
+                }
+            } else {
+                uint8_t *rgb = t.out + (static_cast<size_t>(y) * t.width + start) * 3;
+                for (uint32_t x = 0; x < w; x++, rgb += 3) {
+                    yccToRgb(luma[x], cb[x / 2], cr[x / 2], rgb);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+}
+
+uint32_t FrameExport::frameSize(ExportFormat format, uint16_t width, uint16_t height)
+{
+    if (format == ExportFormat::kRgb24) {
+        return static_cast<uint32_t>(width) * height * 3;
+    }
+    return (static_cast<uint32_t>(width) + (width + 1) / 2 * 2) * height;
+}
+
+FrameExport::FrameExport(bool create) :
+    m_fd { -1 },
+    m_header { nullptr }
+{
+    std::string name = path();
+    m_fd = open(name.c_str(), create ? (O_RDWR | O_CREAT) : O_RDWR, 0644);
+    if (m_fd < 0) {
+        std::cerr << "Could not open " << name << ", errno " << errno << std::endl;
+        return;
+    }
+
+    // sparse in tmpfs, only the pages actually written take up memory
+    if (create && ftruncate(m_fd, kMapSize) != 0) {
+        std::cerr << "Could not size " << name << ", errno " << errno << std::endl;
+        return;
+    }
+
+    void *mem = mmap(NULL, kMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (mem == MAP_FAILED) {
+        std::cerr << "Could not map " << name << ", errno " << errno << std::endl;
+        return;
+    }
+    m_header = static_cast<ExportHeader *>(mem);
+
+    // a single writer; readers of a stale layout see no frame until it restarts
+    if (create && m_header->magic != kMagic) {
+        memset(m_header, 0, sizeof(*m_header));
+        __atomic_store_n(&m_header->magic, kMagic, __ATOMIC_RELEASE);
+    }
+}
+
+FrameExport::~FrameExport()
+{
+    if (m_header != nullptr) {
+        munmap(m_header, kMapSize);
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool FrameExport::subscribed(uint64_t nowNs) const
+{
+    uint64_t seen = __atomic_load_n(&m_header->readerNs, __ATOMIC_RELAXED);
+    return seen != 0 && nowNs - seen < kSubscriberTimeoutNs;
+}
+
+uint8_t * FrameExport::backBuffer()
+{
+    // readers copying this buffer must see the sequence bump of the switch
+    // away from it before any of the writes that follow
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return buffer(m_header->active ^ 1);
+}
+
+void FrameExport::publish(ExportFormat format, uint16_t width, uint16_t height, uint64_t timestampNs,
+                          uint64_t decodeNs, uint32_t maxFps)
+{
+    uint32_t seq = m_header->sequence;
+    __atomic_store_n(&m_header->sequence, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    m_header->active ^= 1;
+    m_header->format = static_cast<uint32_t>(format);
+    m_header->width = width;
+    m_header->height = height;
+    m_header->size = frameSize(format, width, height);
+    m_header->maxFps = maxFps;
+    m_header->frame++;
+    m_header->timestampNs = timestampNs;
+    m_header->decodeNs = decodeNs;
+    __atomic_store_n(&m_header->sequence, seq + 2, __ATOMIC_RELEASE);
+}
+
+void FrameExport::attach(uint64_t nowNs)
+{
+    __atomic_store_n(&m_header->readerNs, nowNs, __ATOMIC_RELAXED);
+}
+
+bool FrameExport::read(ExportFrame &out, uint64_t nowNs)
+{
+    attach(nowNs);
+    if (__atomic_load_n(&m_header->magic, __ATOMIC_ACQUIRE) != kMagic) {
+        return false;
+    }
+    while (true) {
+        uint32_t seq = __atomic_load_n(&m_header->sequence, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;       // the switch is a handful of stores
+        }
+        if (seq == 0) {
+            return false;
+        }
+        uint32_t size = m_header->size;
+        out.format = static_cast<ExportFormat>(m_header->format);
+        out.width = m_header->width;
+        out.height = m_header->height;
+        out.frame = m_header->frame;
+        out.timestampNs = m_header->timestampNs;
+        const uint8_t *src = buffer(m_header->active & 1);
+        if (size <= kMaxFrameSize) {
+            out.pixels.assign(src, src + size);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&m_header->sequence, __ATOMIC_RELAXED) == seq && size <= kMaxFrameSize) {
+            return true;
+        }
+    }
+}
+
+std::string FrameExport::path()
+{
+    return "/dev/shm/kvm_frame";
+}
+
+bool decodeStripes(const uint8_t *const *jpeg, const uint32_t *lengths, int numStripes, ExportFormat format,
+                   int threads, uint8_t *out, uint32_t capacity, uint16_t &width, uint16_t &height)
+{
+    std::vector<uint16_t> start(numStripes);
+    uint32_t frameWidth = 0;
+    uint16_t frameHeight = 0;
+    for (int i = 0; i < numStripes; i++) {
+        CoefImage img;
+        if (!img.decode(jpeg[i], lengths[i], 0) || !isStripeLayout(img) ||
+            (i > 0 && img.height() != frameHeight)) {
+            return false;
+        }
+        start[i] = frameWidth;
+        frameWidth += img.width();
+        frameHeight = img.height();
+    }
+    if (numStripes == 0 || frameWidth > FrameExport::kMaxWidth ||
+        FrameExport::frameSize(format, frameWidth, frameHeight) > capacity) {
+        return false;
+    }
+    width = frameWidth;
+    height = frameHeight;
+
+    Target target { format, out, width, height };
+    std::vector<char> ok(numStripes, 0);
+    auto work = [&](int first) {
+        for (int i = first; i < numStripes; i += threads) {
+            ok[i] = decodeStripe(jpeg[i], lengths[i], start[i], target);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; t++) {
+        pool.emplace_back(work, t);
+    }
+    work(0);
+    for (std::thread & t : pool) {
+        t.join();
+    }
+    for (char stripeOk : ok) {
+        if (!stripeOk) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool writePixels(const std::string &path, const ExportFrame &frame)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (frame.format == ExportFormat::kRgb24) {
+        file << "P6\n" << frame.width << " " << frame.height << "\n255\n";
+    }
+    file.write(reinterpret_cast<const char *>(frame.pixels.data()), frame.pixels.size());
+    return static_cast<bool>(file);
+}
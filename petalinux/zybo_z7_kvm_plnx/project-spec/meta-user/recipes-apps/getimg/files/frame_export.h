@@ -0,0 +1,117 @@
+#ifndef FRAME_EXPORT_H
+#define FRAME_EXPORT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Decoded frames for local consumers that want pixels rather than JPEG
+ * (change detection, recording, test tools), in /dev/shm/kvm_frame:
+ *  - a header page, then two frame buffers. "getimg -d" decodes the four
+ *    stripes of each new frame into the buffer readers are not pointed at,
+ *    then switches "active" over to it;
+ *  - the header is guarded by a seqlock: sequence is odd while the writer
+ *    switches buffers. A reader copies the active buffer and takes the copy
+ *    only if sequence was even and unchanged across it, so readers never
+ *    block the writer and the writer never waits for readers;
+ *  - readers set readerNs whenever they attach or read; the writer only
+ *    decodes while that is less than kSubscriberTimeoutNs old.
+ */
+
+enum class ExportFormat : uint32_t {
+    kYuv422p,   // Y plane, then Cb and Cr planes of (width + 1) / 2 x height
+    kRgb24,     // R, G, B bytes
+};
+
+struct ExportHeader
+{
+    uint32_t magic;
+    uint32_t sequence;      // seqlock, odd while the writer switches buffers
+    uint32_t active;        // buffer holding the latest frame
+    uint32_t format;        // ExportFormat
+    uint16_t width;
+    uint16_t height;
+    uint32_t size;          // bytes of the frame
+    uint32_t maxFps;        // export rate cap of the writer
+    uint64_t frame;         // frames published so far
+    uint64_t timestampNs;   // CLOCK_MONOTONIC when its stripes were taken
+    uint64_t decodeNs;      // time the writer spent decoding it
+    uint64_t readerNs;      // last sign of life of a reader, written by readers
+};
+
+// what read() copied
+struct ExportFrame
+{
+    ExportFormat format;
+    uint16_t width;
+    uint16_t height;
+    uint64_t frame;
+    uint64_t timestampNs;
+    std::vector<uint8_t> pixels;
+};
+
+class FrameExport
+{
+public:
+    static const uint32_t kHeaderSize = 4096;
+    static const uint32_t kMaxWidth = 2048;                 // four 512 pixel stripes
+    static const uint32_t kMaxHeight = 1536;
+    static const uint32_t kMaxFrameSize = kMaxWidth * kMaxHeight * 3;
+    static const uint64_t kSubscriberTimeoutNs = 2000000000ull;
+
+    static uint32_t frameSize(ExportFormat format, uint16_t width, uint16_t height);
+
+    // the writer creates the file, readers open it
+    explicit FrameExport(bool create);
+
+    FrameExport(const FrameExport&) = delete;
+    FrameExport& operator=(const FrameExport&) = delete;
+
+    ~FrameExport();
+
+    bool isOpen() const
+    {
+        return m_header != nullptr;
+    }
+
+    // writer: a reader showed up within kSubscriberTimeoutNs of nowNs
+    bool subscribed(uint64_t nowNs) const;
+
+    // writer: the buffer for the next frame, which no reader takes a copy of
+    uint8_t * backBuffer();
+
+    // writer: the back buffer holds a new frame
+    void publish(ExportFormat format, uint16_t width, uint16_t height, uint64_t timestampNs,
+                 uint64_t decodeNs, uint32_t maxFps);
+
+    // reader: keeps the writer decoding; read() does it too
+    void attach(uint64_t nowNs);
+
+    // reader: copy of the latest frame, false if there is none yet
+    bool read(ExportFrame &out, uint64_t nowNs);
+
+    static std::string path();
+
+private:
+    uint8_t * buffer(uint32_t n)
+    {
+        return reinterpret_cast<uint8_t *>(m_header) + kHeaderSize + n * static_cast<size_t>(kMaxFrameSize);
+    }
+
+    int m_fd;
+    ExportHeader *m_header;
+};
+
+/*
+ * Decodes the stripes of one frame, left to right, into out (capacity
+ * bytes) with idctBlock; stripe i, i + threads, ... on thread i. Takes the
+ * 4:2:2 stripes of the encoders only. false if they do not make up a frame.
+ */
+bool decodeStripes(const uint8_t *const *jpeg, const uint32_t *lengths, int numStripes, ExportFormat format,
+                   int threads, uint8_t *out, uint32_t capacity, uint16_t &width, uint16_t &height);
+
+// frame to path, as PPM for RGB, raw planes for YUV
+bool writePixels(const std::string &path, const ExportFrame &frame);
+
+#endif
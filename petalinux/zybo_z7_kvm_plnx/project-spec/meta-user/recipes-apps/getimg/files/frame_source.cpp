@@ -0,0 +1,209 @@
+#include "frame_source.h"
+
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/videodev2.h>
+
+namespace {
+
+const unsigned kNumBuffers = 3;
+
+int xioctl(int fd, unsigned long request, void *arg)
+{
+    int ret;
+    do {
+        ret = ioctl(fd, request, arg);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+}
+
+FrameSource::FrameSource(const std::string & path, uint16_t width, uint16_t height) :
+    m_path { path },
+    m_fd { -1 },
+    m_device { false },
+    m_seekable { false },
+    m_format { nullptr, static_cast<uint32_t>(width) * 3, width, height, PixelFormat::kRgb24 },
+    m_queued { -1 }
+{
+    m_fd = open(path.c_str(), O_RDWR);
+    if (m_fd < 0) {
+        m_fd = open(path.c_str(), O_RDONLY);
+    }
+    if (m_fd < 0) {
+        std::cerr << "Could not open " << path << ", errno " << errno << std::endl;
+        return;
+    }
+
+    struct stat st;
+    if (fstat(m_fd, &st) == 0 && S_ISCHR(st.st_mode)) {
+        m_device = true;
+        if (!openDevice()) {
+            close(m_fd);
+            m_fd = -1;
+        }
+        return;
+    }
+    m_seekable = S_ISREG(st.st_mode);
+    if (width == 0 || height == 0) {
+        std::cerr << "Frame size of " << path << " must be given" << std::endl;
+        close(m_fd);
+        m_fd = -1;
+        return;
+    }
+    m_frame.resize(static_cast<size_t>(m_format.stride) * height);
+    m_format.data = m_frame.data();
+}
+
+FrameSource::~FrameSource()
+{
+    if (m_device && !m_buffers.empty()) {
+        int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        xioctl(m_fd, VIDIOC_STREAMOFF, &type);
+    }
+    for (const Buffer & b : m_buffers) {
+        munmap(b.start, b.length);
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool FrameSource::openDevice()
+{
+    struct v4l2_capability cap;
+    memset(&cap, 0, sizeof(cap));
+    if (xioctl(m_fd, VIDIOC_QUERYCAP, &cap) < 0 ||
+        !(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) || !(cap.capabilities & V4L2_CAP_STREAMING)) {
+        std::cerr << m_path << " is not a streaming capture device" << std::endl;
+        return false;
+    }
+
+    // YUYV needs no color conversion and is what UVC grabbers deliver uncompressed
+    static const uint32_t kFormats[] = { V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_RGB24 };
+    struct v4l2_format fmt;
+    bool found = false;
+    for (uint32_t pixfmt : kFormats) {
+        memset(&fmt, 0, sizeof(fmt));
+        fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        fmt.fmt.pix.width = m_format.width ? m_format.width : 1280;
+        fmt.fmt.pix.height = m_format.height ? m_format.height : 720;
+        fmt.fmt.pix.pixelformat = pixfmt;
+        fmt.fmt.pix.field = V4L2_FIELD_NONE;
+        if (xioctl(m_fd, VIDIOC_S_FMT, &fmt) == 0 && fmt.fmt.pix.pixelformat == pixfmt) {
+            found = true;
+            break;
+        }
+    }
+    if (!found) {
+        std::cerr << m_path << " supports neither YUYV nor RGB24" << std::endl;
+        return false;
+    }
+    m_format.width = fmt.fmt.pix.width;
+    m_format.height = fmt.fmt.pix.height;
+    m_format.stride = fmt.fmt.pix.bytesperline;
+    m_format.format = fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV ? PixelFormat::kYuyv : PixelFormat::kRgb24;
+
+    struct v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
+    req.count = kNumBuffers;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(m_fd, VIDIOC_REQBUFS, &req) < 0 || req.count == 0) {
+        std::cerr << "Could not get capture buffers, errno " << errno << std::endl;
+        return false;
+    }
+    for (unsigned i = 0; i < req.count; i++) {
+        struct v4l2_buffer buf;
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        if (xioctl(m_fd, VIDIOC_QUERYBUF, &buf) < 0) {
+            return false;
+        }
+        void *start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, buf.m.offset);
+        if (start == MAP_FAILED) {
+            std::cerr << "Could not map capture buffer, errno " << errno << std::endl;
+            return false;
+        }
+        m_buffers.push_back({ start, buf.length });
+        if (xioctl(m_fd, VIDIOC_QBUF, &buf) < 0) {
+            return false;
+        }
+    }
+
+    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(m_fd, VIDIOC_STREAMON, &type) < 0) {
+        std::cerr << "Could not start streaming, errno " << errno << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool FrameSource::next(RawFrame & frame)
+{
+    if (!isOpen()) {
+        return false;
+    }
+    return m_device ? nextFromDevice(frame) : nextFromFile(frame);
+}
+
+bool FrameSource::nextFromDevice(RawFrame & frame)
+{
+    struct v4l2_buffer buf;
+    if (m_queued >= 0) {
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = m_queued;
+        xioctl(m_fd, VIDIOC_QBUF, &buf);
+        m_queued = -1;
+    }
+
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(m_fd, VIDIOC_DQBUF, &buf) < 0) {
+        std::cerr << "Could not dequeue a frame, errno " << errno << std::endl;
+        return false;
+    }
+    m_queued = buf.index;
+    frame = m_format;
+    frame.data = static_cast<const uint8_t *>(m_buffers[buf.index].start);
+    return buf.bytesused >= static_cast<size_t>(frame.stride) * frame.height;
+}
+
+bool FrameSource::nextFromFile(RawFrame & frame)
+{
+    size_t done = 0;
+    bool rewound = false;
+    while (done < m_frame.size()) {
+        ssize_t ret = read(m_fd, m_frame.data() + done, m_frame.size() - done);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret < 0) {
+            std::cerr << "Could not read " << m_path << ", errno " << errno << std::endl;
+            return false;
+        }
+        if (ret == 0) {
+            // loop a file; a FIFO without writer is the end
+            if (!m_seekable || done != 0 || rewound || lseek(m_fd, 0, SEEK_SET) != 0) {
+                return false;
+            }
+            rewound = true;
+            continue;
+        }
+        done += ret;
+    }
+    frame = m_format;
+    return true;
+}
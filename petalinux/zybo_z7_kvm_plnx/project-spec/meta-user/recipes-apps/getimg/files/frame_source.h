@@ -0,0 +1,59 @@
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "sw_encoder.h"
+
+/*
+ * Raw frames for the software encoder. The PL only ever writes JPEG to DDR,
+ * so they come from a second capture path:
+ *  - a V4L2 capture device (e.g. a UVC grabber on the DVI source), streamed
+ *    with mmap buffers, YUYV preferred over RGB24;
+ *  - a FIFO or file of back to back RGB24 frames (video_capture_tb .data
+ *    format); a regular file is looped, which is what the benchmark uses.
+ */
+class FrameSource
+{
+public:
+    // width/height: requested from a device, required for a file
+    FrameSource(const std::string & path, uint16_t width, uint16_t height);
+
+    FrameSource(const FrameSource&) = delete;
+    FrameSource& operator=(const FrameSource&) = delete;
+
+    ~FrameSource();
+
+    bool isOpen() const
+    {
+        return m_fd >= 0;
+    }
+
+    // Blocks until the next frame is there. The frame stays valid until the
+    // next call.
+    bool next(RawFrame & frame);
+
+private:
+    struct Buffer
+    {
+        void *start;
+        size_t length;
+    };
+
+    bool openDevice();
+    bool nextFromDevice(RawFrame & frame);
+    bool nextFromFile(RawFrame & frame);
+
+    std::string m_path;
+    int m_fd;
+    bool m_device;
+    bool m_seekable;
+    RawFrame m_format;
+    std::vector<Buffer> m_buffers;
+    int m_queued;               // buffer index handed out by next(), -1: none
+    std::vector<uint8_t> m_frame;
+};
+
+#endif
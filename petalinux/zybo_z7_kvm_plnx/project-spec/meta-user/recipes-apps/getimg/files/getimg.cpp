@@ -1,22 +1,54 @@
 #include <iostream>
+#include <algorithm>
+#include <memory>
+#include <random>
 #include <string>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <fcntl.h>
+#include <time.h>
 #include <vector>
+#include <cerrno>
 #include <cstring>
 
+#include "client_stats.h"
+#include "dct_scale.h"
+#include "frame_export.h"
+#include "frame_source.h"
+#include "governor.h"
+#include "jpeg_check.h"
+#include "jpeg_coef.h"
+#include "latency_probe.h"
+#include "stripe_crop.h"
+#include "stripe_store.h"
+#include "sw_encoder.h"
+
 using namespace std;
 
 static const uint64_t kBaseAddr = 0x40000000;
 static const uint64_t kBaseImgAddr = kBaseAddr + 0xC;
 static const uint64_t kBaseUnfreezeAddr = kBaseAddr + 0x4;
+static const uint64_t kResolutionAddr = kBaseAddr + 0x8;   // res_y(31:16), res_x(15:0), 0: register not present
+static const uint64_t kFaultAddr = kBaseAddr + 0x18;       // bad_res(4), write_fault(3:0), sticky, 0: register not present
 static const uint64_t kImageOffset = 0x10;
 static const uint32_t kPageSize = sysconf(_SC_PAGESIZE);
 static const uint32_t kPageMask = ~(kPageSize - 1);
-static const uint64_t kMaxBuffSize = 4ull * 1024ull * 1024ull;
+static const uint32_t kNoImageAddr = 0xDEFEC8ED;          // no channel locked for reading
+static const uint64_t kDataOffset = 0x80;                 // JPEG follows the first burst, holding the size
+static const uint32_t kFaultWrite = 0x0F;                 // write_fault of buffered_encoder, per stripe
+static const uint32_t kFaultBadRes = 0x10;                // fault_bad_res of image_stripe: res_y % 8 != 0
+static const uint32_t kFaultTooWide = 0x20;               // not from the PL: stripe wider than C_MAX_LINE_WIDTH
+static const uint16_t kMaxStripeWidth = 512;              // jpeg_pkg.vhd C_MAX_LINE_WIDTH
+static const useconds_t kFaultPollUs = 200000;
+static const useconds_t kSubscriberPollUs = 100000;
+static const int kWaitFrameMs = 3000;                     // getimg -l: first frame after attaching
+static const char *kInputdSocket = "/var/run/inputd.sock";
+static const int16_t kProbeStepPx = 64;                     // getimg -j: cursor moves of the pattern
+static const uint64_t kProbeTimeoutNs = 1000000000ull;
 
 inline uint64_t getFreezeAddr(int imgNr)
 {
@@ -33,20 +65,37 @@ inline uint64_t getImageAddr(int imgNr)
     return kBaseImgAddr + imgNr * kImageOffset;
 }
 
+// see image_stripe.vhd: the last stripe also gets the remainder
+inline uint16_t getStripeWidth(uint16_t resX, int imgNr)
+{
+    uint16_t width = resX / kNumChan;
+    if (imgNr == kNumChan - 1) {
+        width += resX % kNumChan;
+    }
+    return width;
+}
+
+inline uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
 class Descriptor
 {
 public:
     Descriptor(const std::string & path, int flags)
     {
-        int m_fd = open(path.c_str(), flags);
-        if (m_fd < 1) {
-            std::cout << "File open failed: " << errno << std::endl;
+        m_fd = open(path.c_str(), flags);
+        if (m_fd < 0) {
+            std::cerr << "File open failed: " << errno << std::endl;
         }
     }
 
     bool isOpen ()
     {
-        return m_fd > 0;
+        return m_fd >= 0;
     }
 
     int getFd()
@@ -59,7 +108,9 @@ public:
 
     ~Descriptor()
     {
-        close(m_fd);
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
     }
 
 private:
@@ -67,34 +118,35 @@ private:
 };
 
 
-/*TODO: Should pass FD to MemoryAccess also it should  be singleton*/
+/*TODO: it should be singleton*/
 class MemoryAccess
 {
 public:
-    MemoryAccess(uint64_t size, int fd, uint64_t pageAddr, int flags) :
-        m_memSize { size },
+    MemoryAccess(uint64_t size, int fd, uint64_t addr, int flags) :
         m_flags { flags },
         m_fd { fd }
     {
-        m_pageAddr = pageAddr & kPageMask;
+        m_pageAddr = addr & kPageMask;
+        m_memSize = (size + (addr - m_pageAddr) + kPageSize - 1) & kPageMask;
         m_mappedMem = mmap(NULL, m_memSize, m_flags, MAP_SHARED, m_fd, m_pageAddr);
         if (m_mappedMem == MAP_FAILED) {
-            std::cout << "Could not map the memory, errno " << errno << std::endl;
+            std::cerr << "Could not map the memory, errno " << errno << std::endl;
         }
     }
 
+    MemoryAccess(const MemoryAccess&) = delete;
+    MemoryAccess& operator=(const MemoryAccess&) = delete;
+
     bool isMemoryMapped ()
     {
         return m_mappedMem != MAP_FAILED;
     }
 
-    uint64_t peek(uint64_t addr)
+    uint32_t peek(uint64_t addr)
     {
         if (isMemoryMapped())
         {
-            uint64_t pageAddr = (addr & kPageMask);
-            uint64_t pageOffset = addr - pageAddr;
-            return *((uint32_t *)(m_mappedMem) + pageOffset);
+            return *reg(addr);
         }
         return 0;
     }
@@ -103,209 +155,940 @@ public:
     {
         if (isMemoryMapped())
         {
-            /*TODO: Needs some clarifications*/
-            uint64_t pageAddr = (addr & kPageMask);
-            uint64_t pageOffset = addr - pageAddr;
-            *((uint32_t *)(m_mappedMem) + pageOffset) = val;
+            *reg(addr) = val;
         }
     }
 
-    uint32_t readData(uint64_t addr, uint64_t size, uint8_t * buffer)
+    const uint8_t * data(uint64_t addr)
     {
-        if (buffer == nullptr) {
-            std::cout << " null buffer \n";
-            return 0;
-        }
-
-        if (!isMemoryMapped()) {
-            std::cout << "Memory is not mapped, errno " << errno << "\n";
-            return 0;
-        }
-
-        uint32_t length = *(uint32_t*) m_mappedMem;
-        auto extraBytes = addr - m_pageAddr;
-        memcpy(buffer, (char *)m_mappedMem + extraBytes + m_dataOffset, length);
-        return length;
+        return static_cast<const uint8_t *>(m_mappedMem) + (addr - m_pageAddr);
     }
 
     ~MemoryAccess()
     {
-        munmap(m_mappedMem, m_memSize);
+        if (isMemoryMapped()) {
+            munmap(m_mappedMem, m_memSize);
+        }
     }
 
 private:
+    volatile uint32_t * reg(uint64_t addr)
+    {
+        return reinterpret_cast<volatile uint32_t *>(static_cast<uint8_t *>(m_mappedMem) + (addr - m_pageAddr));
+    }
+
     void *m_mappedMem;
     uint64_t m_memSize;
     uint64_t m_pageAddr;
-    static const uint64_t m_dataOffset { 0x80 };
     int m_flags;
     int m_fd;
 };
 
-int getImageNr()
+bool writeAll(int fd, const uint8_t *buf, size_t length)
 {
-    std::string queryString { "" };
+    while (length > 0) {
+        ssize_t ret = write(fd, buf, length);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Could not write data");
+            return false;
+        }
+        buf += ret;
+        length -= ret;
+    }
+    return true;
+}
+
+/*
+ * Reasons the hardware encoder cannot deliver: the fault bits of
+ * striped_encoders, which stay set until reset, or a line too wide for the
+ * stripes (the last one is the widest). 0 if the hardware path is fine.
+ * The shipped bitstream has neither the fault nor the resolution register,
+ * both read 0, so there this is always 0 and "getimg -s" stays idle.
+ */
+uint32_t encoderFault(MemoryAccess & controlMem)
+{
+    uint32_t fault = controlMem.peek(kFaultAddr) & (kFaultWrite | kFaultBadRes);
+    uint16_t resX = controlMem.peek(kResolutionAddr) & 0xFFFF;
+    uint16_t widest = (getStripeWidth(resX, kNumChan - 1) + 15) & ~15;
+    if (widest > kMaxStripeWidth) {
+        fault |= kFaultTooWide;
+    }
+    return fault;
+}
 
+/*
+ * Integer parameter from QUERY_STRING, e.g. "ch=1&t=155000000&ext=.jpeg",
+ * -1 if missing or not a number. Only a missing optional one is not logged.
+ */
+int getQueryInt(const std::string & name, bool optional = false)
+{
     auto str = getenv("QUERY_STRING");
-    if (str != nullptr) {
-        queryString = str;
-    } else {
-        std::cout << "Could not parse imageNr, NULL str" << std::endl;
+    if (str == nullptr) {
+        std::cerr << "Could not parse " << name << ", NULL str" << std::endl;
         return -1;
     }
 
-    //std::string queryString { "ch=1&t=155000000&ext=.jpeg" };
-    if (queryString != "") {
-        auto start = queryString.find("=") + 1;
-        auto end = queryString.find("&");
-
-        if (end <= start ) {
-            std::cout << " Invalid String " << queryString << std::endl;
+    std::string queryString = std::string { "&" } + str;
+    auto start = queryString.find("&" + name + "=");
+    if (start == std::string::npos) {
+        if (optional) {
             return -1;
         }
+        std::cerr << "Could not parse " << name << " from " << str << std::endl;
+        return -1;
+    }
+
+    try {
+        return stoi(queryString.substr(start + name.size() + 2));
+    } catch (std::exception & ex) {
+        std::cerr << "Could not get " << name << " from " << str << " ex " << ex.what() << std::endl;
+        return -1;
+    }
+}
 
-        auto size = end - start;
-        std::string imgNrStr = queryString.substr(start, size);
+int getImageNr()
+{
+    return getQueryInt("ch");
+}
 
-        int imgNr = -1;
-        try {
-            imgNr = stoi(imgNrStr);
-        } catch (std::exception & ex) {
-            std::cout << " Could not get Img nr From " << imgNrStr << " ex " << ex.what() << std::endl;
-            return -1;
-        }
-        return imgNr;
+// known= of QUERY_STRING, the stripeHash() in hex of the stripe the client has; 0 if none
+uint64_t getKnownHash()
+{
+    auto str = getenv("QUERY_STRING");
+    if (str == nullptr) {
+        return 0;
     }
+    std::string queryString = std::string { "&" } + str;
+    auto start = queryString.find("&known=");
+    return start == std::string::npos ? 0 : strtoull(queryString.c_str() + start + 7, nullptr, 16);
+}
 
+/*
+ * The good stripe's place in the sequence of commits of its channel and its
+ * hash, for the client to tell which stripes are behind the others and to
+ * name the one it has in its next request, and the us since it was
+ * committed, for the frame age the client reports.
+ */
+void printStripeHeaders(const StripeState & state)
+{
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(state.goodHash));
+    std::cout << "X-Stripe-Sequence: " << state.sequence << "\n"
+              << "X-Stripe-Hash: " << hash << "\n"
+              << "X-Stripe-Age: " << (nowNs() - state.committedNs) / 1000 << "\n";
+}
 
-    std::cout << "Could not parse imageNr " << std::endl;
-    return -1;
+int sendGoodStripe(StripeStore & store)
+{
+    StripeState & state = store.state();
+    if (state.goodLength == 0) {
+        std::cout << "Status: 503 Service Unavailable\n"
+                  << "Content-type: text/plain\n\n"
+                  << "No image\n";
+        return 0;
+    }
+
+    std::cout << "Content-type: image/jpeg\n"
+              << "Content-length: " << state.goodLength << "\n";
+    printStripeHeaders(state);
+    std::cout << "\n" << std::flush;
+    return writeAll(STDOUT_FILENO, store.goodSlot(), state.goodLength) ? 0 : 1;
 }
 
-int main(int argc, char** argv)
+/*
+ * The good stripe downscaled by 2 or 4 in the DCT domain, made once per
+ * committed stripe and cached in the StripeStore.
+ */
+int sendScaledStripe(StripeStore & store, int scale)
 {
-#if 0
-    int imgNr = getImageNr();
-    if (imgNr < 0) {
-        abort();
+    StripeState & state = store.state();
+    int index = StripeStore::scaleIndex(scale);
+    ScaledStripe & scaled = state.scaled[index];
+    if (state.goodLength != 0 && (scaled.sequence != state.sequence || scaled.length == 0)) {
+        uint64_t start = nowNs();
+        CoefImage in;
+        CoefImage out;
+        scaled.sequence = state.sequence;
+        scaled.length = 0;
+        if (in.decode(store.goodSlot(), state.goodLength)) {
+            DctScaler { scale }.scale(in, out);
+            scaled.length = out.encode(store.scaledSlot(index), kMaxScaledSize);
+        }
+        state.counters.scaledMiss++;
+        state.counters.scaleNs += nowNs() - start;
+    } else if (state.goodLength != 0) {
+        state.counters.scaledHit++;
     }
-    std::cout << " imgNr " << imgNr << std::endl;
-#else
-    int imgNr = 1;
-#endif
-    static const std::string filePath  { "/dev/mem" };
-    static const int fileFlags = O_RDWR;
 
-    Descriptor desc { filePath, fileFlags };
+    if (state.goodLength == 0 || scaled.length == 0) {
+        std::cout << "Status: 503 Service Unavailable\n"
+                  << "Content-type: text/plain\n\n"
+                  << "No image\n";
+        return 0;
+    }
 
-    MemoryAccess controlMem { kPageSize, desc.getFd(),  kBaseAddr, PROT_READ | PROT_WRITE };
-    controlMem.poke(getFreezeAddr(imgNr), 0);
-    auto imageAddr = controlMem.peek(getImageAddr(imgNr));
+    std::cout << "Content-type: image/jpeg\n"
+              << "Content-length: " << scaled.length << "\n";
+    printStripeHeaders(state);
+    std::cout << "\n" << std::flush;
+    return writeAll(STDOUT_FILENO, store.scaledSlot(index), scaled.length) ? 0 : 1;
+}
 
-    MemoryAccess dataMem { kMaxBuffSize, desc.getFd(),  imageAddr, PROT_READ };
+/*
+ * Bring the good slot of a locked StripeStore up to date. The stripe is
+ * copied out of the frame buffer into the spare slot and checked on the way;
+ * if it is truncated or corrupt (px_stable dropped mid-frame,
+ * write_fault...), it is quarantined and the last good stripe stays.
+ * While encoderFault() reports the hardware path down, the frame buffers are
+ * left alone and the good slot is kept up to date by "getimg -s".
+ */
+void refreshStripe(int imgNr, StripeStore & store, MemoryAccess & controlMem, int memFd)
+{
+    StripeState & state = store.state();
+    state.fault = encoderFault(controlMem);
+    if (state.fault != 0) {
+        state.counters.failover++;
+        return;
+    }
 
-    /*TODO: do I need more than 4MB?*/
-    std::vector<uint8_t> buffer(kPageSize + kMaxBuffSize, 0);
-    auto length = dataMem.readData(imageAddr, kMaxBuffSize, buffer.data());
+    controlMem.poke(getFreezeAddr(imgNr), 0);
+    uint32_t imageAddr = controlMem.peek(getImageAddr(imgNr));
+    // 0 where the bitstream has no resolution register: the SOF0 size is not checked
+    uint32_t resolution = controlMem.peek(kResolutionAddr);
 
-    std::cout << "Content-type: image/jpeg\n\n"
-              << std::string(buffer.begin(), buffer.begin() + length)
-              << std::endl;
+    JpegStatus st = JpegStatus::kBadLength;
+    uint32_t length = 0;
+    uint64_t hash = 0;
+    if (imageAddr != kNoImageAddr) {
+        MemoryAccess dataMem { kDataOffset + kMaxJpegSize, memFd,  imageAddr, PROT_READ };
+        if (dataMem.isMemoryMapped()) {
+            uint64_t start = nowNs();
+            length = *reinterpret_cast<const volatile uint32_t *>(dataMem.data(imageAddr));
+            JpegChecker checker { store.spareSlot(), length, kMaxJpegSize,
+                                  getStripeWidth(resolution & 0xFFFF, imgNr),
+                                  static_cast<uint16_t>(resolution >> 16) };
+            st = copyAndCheck(store.spareSlot(), dataMem.data(imageAddr + kDataOffset), checker, length, hash);
+            state.counters.copyNs += nowNs() - start;
+            state.counters.bytes += length;
+        }
+    }
     controlMem.poke(getUnfreezeAddr(imgNr), 0);
 
-    return 0;
+    if (imageAddr == kNoImageAddr) {
+        state.counters.noFrame++;
+    } else if (st == JpegStatus::kOk) {
+        store.commitSpare(length, hash);
+        state.counters.served++;
+    } else {
+        state.counters.rejected[static_cast<int>(st)]++;
+        if (state.goodLength != 0) {
+            state.counters.resent++;
+        } else {
+            state.counters.noFrame++;
+        }
+    }
 }
 
+// size word of the latest frame buffer of a stripe, read without freezing it
+uint32_t latestSize(int imgNr, MemoryAccess & controlMem, int memFd)
+{
+    uint32_t imageAddr = controlMem.peek(getImageAddr(imgNr));
+    if (imageAddr == kNoImageAddr) {
+        return 0;
+    }
+    MemoryAccess dataMem { sizeof(uint32_t), memFd, imageAddr, PROT_READ };
+    if (!dataMem.isMemoryMapped()) {
+        return 0;
+    }
+    return *reinterpret_cast<const volatile uint32_t *>(dataMem.data(imageAddr));
+}
 
-#if 0
+/*
+ * Hold a stripe request until FrameGovernor lets it go. Meanwhile the size
+ * word of the stripe's latest frame buffer is polled every probeMs, unless
+ * the hardware path is down; a new size is a change and ends the wait.
+ */
+void paceStripe(int imgNr, FrameGovernor & governor, MemoryAccess & controlMem, int memFd)
+{
+    uint64_t start = nowNs();
+    uint64_t now = start;
+    bool probe = encoderFault(controlMem) == 0;
+    uint32_t size = probe ? latestSize(imgNr, controlMem, memFd) : 0;
+    uint64_t due = governor.dueNs(imgNr, now);
+    while (now < due) {
+        uint64_t probeNs = governor.policy().probeMs * 1000000ull;
+        usleep((due - now < probeNs ? due - now : probeNs) / 1000);
+        now = nowNs();
+        if (probe && latestSize(imgNr, controlMem, memFd) != size) {
+            governor.changed(now);
+            break;
+        }
+        due = governor.dueNs(imgNr, now);
+    }
+    governor.released(imgNr, now, now - start);
+}
 
-static const std::string supportedOptions {""};
-struct options
+// The client has the good stripe already: just the headers, neither copied nor scaled.
+int sendUnchanged(StripeStore & store)
 {
-  int place_holder;
-};
+    StripeState & state = store.state();
+    state.counters.unchanged++;
+    std::cout << "Status: 304 Not Modified\n";
+    printStripeHeaders(state);
+    std::cout << "\n" << std::flush;
+    return 0;
+}
 
-options getOptions(int argc, char** argv)
+// A CGI request whose parameters are missing or out of range.
+int sendBadRequest(const std::string & reason)
 {
-    if (argc < 2) {
-        std::cout << " Not enough argumetnts \n";
-        exit(1);
+    std::cout << "Status: 400 Bad Request\n"
+              << "Content-type: text/plain\n\n"
+              << reason << "\n" << std::flush;
+    return 0;
+}
+
+/*
+ * Serve one stripe as CGI response, downscaled if scale is 2 or 4, or
+ * without the stripe if its hash is knownHash (0: none).
+ */
+int serveImage(int imgNr, int scale, uint64_t knownHash)
+{
+    static const std::string filePath  { "/dev/mem" };
+    static const int fileFlags = O_RDWR | O_SYNC;
+
+    StripeStore store { imgNr };
+    Descriptor desc { filePath, fileFlags };
+    FrameGovernor governor;
+    if (!store.isOpen() || !desc.isOpen() || !governor.isOpen()) {
+        return 1;
     }
 
-    int opt;
-    while ( (opt = getopt(argc, argv, supportedOptions.c_str())) != -1 ) {
-        switch ( opt ) {
-        case 'a':
-            break;
-        case '?':  // unknown option...
-            cerr << "Unknown option: '" << char(opt) << "'!" << endl;
-            break;
+    MemoryAccess controlMem { kPageSize, desc.getFd(),  kBaseAddr, PROT_READ | PROT_WRITE };
+    paceStripe(imgNr, governor, controlMem, desc.getFd());
+
+    StripeLock lock { store };
+    refreshStripe(imgNr, store, controlMem, desc.getFd());
+    StripeState & state = store.state();
+    if (state.goodLength != 0 && state.goodHash != state.servedHash) {
+        state.servedHash = state.goodHash;
+        governor.changed(nowNs());
+    }
+    if (state.goodLength != 0 && knownHash != 0 && state.goodHash == knownHash) {
+        return sendUnchanged(store);
+    }
+    return scale > 1 ? sendScaledStripe(store, scale) : sendGoodStripe(store);
+}
+
+/*
+ * Serve the rectangle x, y, w, h of the frame as one JPEG, cut out of the
+ * stripes by StripeCropper. Every stripe is refreshed as for serveImage and
+ * its good slot copied out, so the locks are not held while cropping.
+ * X-Crop gives the frame position of the first pixel and the JPEG size.
+ * Columns left out at seams off the MCU grid (see stripe_crop.h) are listed
+ * in X-Crop-Gaps as first column + count, so the JPEG is only as wide as
+ * the frame region it spans if that header is absent.
+ */
+int serveCrop(const CropRect & request)
+{
+    Descriptor desc { "/dev/mem", O_RDWR | O_SYNC };
+    if (!desc.isOpen()) {
+        return 1;
+    }
+    MemoryAccess controlMem { kPageSize, desc.getFd(),  kBaseAddr, PROT_READ | PROT_WRITE };
+
+    std::vector<std::vector<uint8_t>> stripes(kNumChan);
+    const uint8_t *jpeg[kNumChan];
+    uint32_t lengths[kNumChan];
+    for (int i = 0; i < kNumChan; i++) {
+        StripeStore store { i };
+        if (!store.isOpen()) {
+            return 1;
         }
+        StripeLock lock { store };
+        refreshStripe(i, store, controlMem, desc.getFd());
+        const uint8_t *good = store.goodSlot();
+        stripes[i].assign(good, good + store.state().goodLength);
+        store.state().counters.cropped++;
+        jpeg[i] = stripes[i].data();
+        lengths[i] = stripes[i].size();
+    }
+
+    StripeCropper cropper;
+    bool loaded = cropper.load(jpeg, lengths, kNumChan);
+    if (loaded && (request.x >= cropper.frameWidth() || request.y >= cropper.frameHeight())) {
+        return sendBadRequest("x= and y= must lie within the frame of " + std::to_string(cropper.frameWidth()) +
+                              "x" + std::to_string(cropper.frameHeight()));
+    }
+    CropRect rect = request;
+    std::vector<uint8_t> out(kMaxJpegSize);
+    uint32_t length = loaded ? cropper.crop(rect, out.data(), out.size()) : 0;
+    if (length == 0) {
+        std::cout << "Status: 503 Service Unavailable\n"
+                  << "Content-type: text/plain\n\n"
+                  << "No image\n";
+        return 0;
     }
 
-    return {};
+    std::cout << "Content-type: image/jpeg\n"
+              << "Content-length: " << length << "\n"
+              << "X-Crop: " << rect.x << "," << rect.y << "," << rect.width << "," << rect.height << "\n";
+    std::vector<CropGap> gaps = cropper.gaps();
+    if (!gaps.empty()) {
+        std::cout << "X-Crop-Gaps: ";
+        for (size_t i = 0; i < gaps.size(); i++) {
+            std::cout << (i > 0 ? "," : "") << gaps[i].x << "+" << gaps[i].width;
+        }
+        std::cout << "\n";
+    }
+    std::cout << "\n" << std::flush;
+    return writeAll(STDOUT_FILENO, out.data(), length) ? 0 : 1;
 }
 
-uint64_t peek(int fd, uint64_t addr)
+/*
+ * Software encoder failover. While encoderFault() reports the hardware path
+ * down, frames are taken from the capture source, encoded on both cores and
+ * committed to the StripeStores, which the CGI serves from meanwhile.
+ */
+int runFailover(const std::string & sourcePath, uint16_t width, uint16_t height)
 {
-    void *ptr;
-    unsigned pageAddr, pageOffset;
-    pageAddr = (addr & kPageMask);
-    pageOffset = addr-pageAddr;
+    Descriptor desc { "/dev/mem", O_RDWR | O_SYNC };
+    if (!desc.isOpen()) {
+        return 1;
+    }
+    MemoryAccess controlMem { kPageSize, desc.getFd(),  kBaseAddr, PROT_READ };
+    FrameSource source { sourcePath, width, height };
+    std::vector<std::unique_ptr<StripeStore>> stores;
+    for (int i = 0; i < kNumChan; i++) {
+        stores.emplace_back(new StripeStore { i });
+        if (!stores.back()->isOpen()) {
+            return 1;
+        }
+    }
+    if (!controlMem.isMemoryMapped() || !source.isOpen()) {
+        return 1;
+    }
 
-    ptr = mmap(NULL, kPageSize, PROT_READ, MAP_SHARED, fd, pageAddr);
-    if (ptr == MAP_FAILED) {
-        perror("mmap failed: ");
-        exit(1);
+    SwEncoder encoder;
+    std::vector<std::vector<uint8_t>> jpeg(kNumChan, std::vector<uint8_t>(kMaxJpegSize));
+    uint32_t lengths[kNumChan];
+    uint64_t ns[kNumChan];
+    while (true) {
+        if (encoderFault(controlMem) == 0) {
+            usleep(kFaultPollUs);
+            continue;
+        }
+        RawFrame frame;
+        if (!source.next(frame)) {
+            return 1;
+        }
+        encoder.encodeFrame(frame, kEncoderThreads, jpeg, lengths, ns);
+        for (int i = 0; i < kNumChan; i++) {
+            if (lengths[i] == 0) {
+                continue;
+            }
+            StripeLock lock { *stores[i] };
+            memcpy(stores[i]->spareSlot(), jpeg[i].data(), lengths[i]);
+            stores[i]->commitSpare(lengths[i], stripeHash(jpeg[i].data(), lengths[i]));
+            stores[i]->state().counters.swEncoded++;
+            stores[i]->state().counters.swEncodeNs += ns[i];
+        }
     }
-    munmap(ptr, kPageSize);
-    return *((uint32_t *)(ptr) + pageOffset);
 }
 
-uint64_t poke(int fd, uint64_t addr, uint32_t val)
+/*
+ * Raw frame export. While a reader of FrameExport is attached, the four
+ * stripes are refreshed as for serveImage, at most fps times per second and
+ * independent of the browser's requests, and every frame with a changed
+ * stripe is decoded on both cores into the back buffer and published.
+ */
+int runExport(ExportFormat format, int fps)
 {
-    void *ptr;
-    unsigned pageAddr, pageOffset;
+    Descriptor desc { "/dev/mem", O_RDWR | O_SYNC };
+    FrameExport out { true };
+    if (!desc.isOpen() || !out.isOpen()) {
+        return 1;
+    }
+    MemoryAccess controlMem { kPageSize, desc.getFd(),  kBaseAddr, PROT_READ | PROT_WRITE };
+    std::vector<std::unique_ptr<StripeStore>> stores;
+    for (int i = 0; i < kNumChan; i++) {
+        stores.emplace_back(new StripeStore { i });
+        if (!stores.back()->isOpen()) {
+            return 1;
+        }
+    }
+    if (!controlMem.isMemoryMapped()) {
+        return 1;
+    }
 
-    pageAddr=(addr & kPageMask);
-    pageOffset=addr-pageAddr;
+    const uint64_t interval = 1000000000ull / (fps > 0 ? fps : 1);
+    std::vector<std::vector<uint8_t>> stripes(kNumChan);
+    const uint8_t *jpeg[kNumChan];
+    uint32_t lengths[kNumChan];
+    uint64_t next = nowNs();
+    while (true) {
+        uint64_t now = nowNs();
+        if (now < next) {
+            usleep((next - now) / 1000);
+            continue;
+        }
+        next = now + interval;
+        if (!out.subscribed(now)) {
+            usleep(kSubscriberPollUs);
+            continue;
+        }
+
+        // a stripe committed again with the same bytes (idle screen) is no change
+        bool changed = false;
+        bool complete = true;
+        for (int i = 0; i < kNumChan; i++) {
+            StripeLock lock { *stores[i] };
+            refreshStripe(i, *stores[i], controlMem, desc.getFd());
+            uint32_t length = stores[i]->state().goodLength;
+            const uint8_t *good = stores[i]->goodSlot();
+            if (length != stripes[i].size() || memcmp(good, stripes[i].data(), length) != 0) {
+                stripes[i].assign(good, good + length);
+                changed = true;
+            }
+            complete = complete && length != 0;
+            jpeg[i] = stripes[i].data();
+            lengths[i] = length;
+        }
+        if (!changed || !complete) {
+            continue;
+        }
 
-    ptr = mmap(NULL, kPageSize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, pageAddr);
-    close(fd);
-    if (ptr == MAP_FAILED) {
-        perror("mmap failed: ");
-        exit(1);
+        uint64_t start = nowNs();
+        uint16_t width;
+        uint16_t height;
+        if (decodeStripes(jpeg, lengths, kNumChan, format, kEncoderThreads, out.backBuffer(),
+                          FrameExport::kMaxFrameSize, width, height)) {
+            out.publish(format, width, height, now, nowNs() - start, fps);
+        }
     }
-    munmap(ptr, kPageSize);
-    return *((uint32_t *)(ptr) + pageOffset) = val;
 }
 
+/*
+ * A minimal FrameExport reader: attaches, waits for the first frame decoded
+ * after that and writes it to path, as PPM for RGB, raw planes for YUV.
+ */
+int grabFrame(const std::string & path)
+{
+    FrameExport in { false };
+    if (!in.isOpen()) {
+        return 1;
+    }
+    ExportFrame frame;
+    uint64_t attached = nowNs();
+    for (int ms = 0; ms < kWaitFrameMs; ms += 10) {
+        if (in.read(frame, nowNs()) && frame.timestampNs >= attached) {
+            std::cout << path << ": frame " << frame.frame << ", " << frame.width << "x" << frame.height
+                      << (frame.format == ExportFormat::kRgb24 ? " RGB24" : " YUV 4:2:2 planar") << std::endl;
+            return writePixels(path, frame) ? 0 : 1;
+        }
+        usleep(10000);
+    }
+    std::cerr << "No frame from the exporter, is getimg -d running?" << std::endl;
+    return 2;
+}
 
+/*
+ * Latency probe, see latency_probe.h. Each round waits for the screen to
+ * settle (two passes over the stripes with the same hashes), sends a move
+ * of kProbeStepPx, right and left in turn so the cursor stays where it is
+ * on the whole, then refreshes the stripes until a hash differs from the
+ * settled ones. Rounds are spaced by a random 20-70 ms so they do not lock
+ * to the capture frame rate. Anything else moving on the host's screen
+ * shows up as a busy round or a change before the report: park the host on
+ * a static screen, the cursor away from the edges, and leave the browser
+ * alone meanwhile.
+ */
+void printLatencySummary(const char *name, const LatencySummary & s)
+{
+    printf("%-8s min %7.2f  p50 %7.2f  p90 %7.2f  p99 %7.2f  max %7.2f ms\n", name,
+           s.minNs / 1e6, s.p50Ns / 1e6, s.p90Ns / 1e6, s.p99Ns / 1e6, s.maxNs / 1e6);
+}
 
-uint32_t readData(int fd, uint64_t addr, uint64_t size, uint8_t * buffer)
+int probeLatency(int iterations)
 {
-    if (buffer == nullptr) {
-        std::cout << " null buffer \n";
-        return -1;
+    Descriptor desc { "/dev/mem", O_RDWR | O_SYNC };
+    InputTraceReader trace;
+    if (!desc.isOpen() || !trace.isOpen()) {
+        return 1;
     }
+    MemoryAccess controlMem { kPageSize, desc.getFd(),  kBaseAddr, PROT_READ | PROT_WRITE };
+    std::vector<std::unique_ptr<StripeStore>> stores;
+    for (int i = 0; i < kNumChan; i++) {
+        stores.emplace_back(new StripeStore { i });
+        if (!stores.back()->isOpen()) {
+            return 1;
+        }
+    }
+    if (!controlMem.isMemoryMapped()) {
+        return 1;
+    }
+    int sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, kInputdSocket, sizeof(addr.sun_path) - 1);
+    if (connect(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) {
+        std::cerr << "Could not connect to " << kInputdSocket << ", errno " << errno << std::endl;
+        close(sock);
+        return 1;
+    }
+
+    auto takeHashes = [&](uint64_t *hashes) {
+        for (int i = 0; i < kNumChan; i++) {
+            StripeLock lock { *stores[i] };
+            refreshStripe(i, *stores[i], controlMem, desc.getFd());
+            hashes[i] = stores[i]->state().goodHash;
+        }
+    };
 
-    off_t mapBase = addr & kPageMask;
-    off_t extraBytes = addr - mapBase;
+    std::mt19937 rng(nowNs());
+    LatencyReport report = {};
+    std::vector<uint64_t> inputNs;
+    std::vector<uint64_t> captureNs;
+    std::vector<uint64_t> totalNs;
+    uint64_t settled[kNumChan];
+    uint64_t hashes[kNumChan];
+    for (int i = 0; i < iterations; i++) {
+        usleep((20 + rng() % 50) * 1000);
+        takeHashes(settled);
+        bool quiet = false;
+        uint64_t deadline = nowNs() + kProbeTimeoutNs;
+        while (!quiet && nowNs() < deadline) {
+            takeHashes(hashes);
+            quiet = std::equal(hashes, hashes + kNumChan, settled);
+            std::copy(hashes, hashes + kNumChan, settled);
+        }
+        report.probes++;
+        if (!quiet) {
+            report.busy++;
+            continue;
+        }
 
-    auto mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, mapBase);
-    close(fd);
+        InputTraceState before = {};
+        trace.read(before);
+        ProbeEvent event = { kProbeEventMouse, 0, static_cast<int16_t>(i % 2 == 0 ? kProbeStepPx : -kProbeStepPx), 0, 0 };
+        uint64_t sent = nowNs();
+        if (send(sock, &event, sizeof(event), 0) != sizeof(event)) {
+            std::cerr << "Could not send to " << kInputdSocket << ", errno " << errno << std::endl;
+            break;
+        }
+        uint64_t changed = 0;
+        deadline = sent + kProbeTimeoutNs;
+        while (changed == 0 && nowNs() < deadline) {
+            takeHashes(hashes);
+            if (!std::equal(hashes, hashes + kNumChan, settled)) {
+                changed = nowNs();
+            }
+        }
 
-    if (mapping == MAP_FAILED) {
-        perror("Could not map memory");
-        exit(1);
+        // the report must hold the probe's move first, and come before the change
+        InputTraceState after = {};
+        if (changed == 0 || !trace.read(after) || after.reports == before.reports ||
+            after.receivedNs < sent || changed < after.writtenNs) {
+            report.missed++;
+            continue;
+        }
+        inputNs.push_back(after.writtenNs - sent);
+        captureNs.push_back(changed - after.writtenNs);
+        totalNs.push_back(changed - sent);
     }
+    close(sock);
 
-    uint32_t length = *(uint32_t*) mapping;
+    report.input = summarizeLatency(inputNs);
+    report.capture = summarizeLatency(captureNs);
+    report.total = summarizeLatency(totalNs);
+    saveLatencyReport(report);
+    printf("%u moves of %d px, %u missed, %u on a busy screen\n", report.probes, kProbeStepPx,
+           report.missed, report.busy);
+    printLatencySummary("input", report.input);
+    printLatencySummary("capture", report.capture);
+    printLatencySummary("total", report.total);
+    return report.total.samples > 0 ? 0 : 2;
+}
 
-    static const uint32_t dataOffset = 0x80;
-    memcpy(buffer, (char *)mapping + extraBytes + dataOffset, length);
-    munmap(mapping, size);
-    return length;
+void printGovernor(FrameGovernor & governor, const std::string & prefix)
+{
+    uint64_t now = nowNs();
+    GovernorPolicy p = governor.policy();
+    const GovernorState & st = governor.state();
+    uint64_t inputAge = FrameGovernor::inputAgeNs();
+    std::cout << prefix << "mode " << (governor.active(now) ? "full" : "idle") << "\n"
+              << prefix << "fps " << governor.currentFps(now) << "\n"
+              << prefix << "full_fps " << p.fullFps << "\n"
+              << prefix << "idle_fps " << p.idleFps << "\n"
+              << prefix << "idle_after_ms " << p.idleAfterMs << "\n"
+              << prefix << "probe_ms " << p.probeMs << "\n"
+              << prefix << "full_frames " << st.fullFrames << "\n"
+              << prefix << "idle_frames " << st.idleFrames << "\n"
+              << prefix << "wakeups " << st.wakeups << "\n"
+              << prefix << "held_ns " << st.heldNs << "\n"
+              << prefix << "input_age_ms " << (inputAge == ~0ull ? -1 : static_cast<int64_t>(inputAge / 1000000)) << "\n";
 }
 
-#endif
+/*
+ * The governor state as CGI response; full=, idle=, idle_after_ms= and
+ * probe_ms= in QUERY_STRING change the policy first.
+ */
+int serveGovernor()
+{
+    FrameGovernor governor;
+    if (!governor.isOpen()) {
+        return 1;
+    }
+    GovernorPolicy p = governor.policy();
+    const struct {
+        const char *name;
+        uint32_t *value;
+    } params[] = {
+        { "full", &p.fullFps },
+        { "idle", &p.idleFps },
+        { "idle_after_ms", &p.idleAfterMs },
+        { "probe_ms", &p.probeMs },
+    };
+    bool set = false;
+    for (const auto & param : params) {
+        int v = getenv("QUERY_STRING") ? getQueryInt(param.name, true) : -1;
+        if (v >= 0) {
+            *param.value = v;
+            set = true;
+        }
+    }
+    if (set) {
+        governor.setPolicy(p);
+    }
+    std::cout << "Content-type: text/plain\n\n";
+    printGovernor(governor, "");
+    return 0;
+}
+
+/*
+ * A POST to cgi-bin/metrics: the aggregates of a browser (client_stats.h),
+ * id= naming it.
+ */
+int takeClientReport()
+{
+    int id = getQueryInt("id");
+    const char *lengthStr = getenv("CONTENT_LENGTH");
+    long length = lengthStr != nullptr ? atol(lengthStr) : 0;
+    std::string text;
+    if (length > 0 && length <= static_cast<long>(4 * kMaxClientReport)) {
+        text.resize(length);
+        std::cin.read(&text[0], length);
+        text.resize(std::cin.gcount());
+    }
+    bool ok = id > 0 && saveClientReport(id, text, nowNs());
+    std::cout << (ok ? "OK\n" : "Bad report\n");
+    return 0;
+}
+
+int printMetrics()
+{
+    const char *method = getenv("REQUEST_METHOD");
+    if (method != nullptr && std::string { method } == "POST") {
+        return takeClientReport();
+    }
+    for (int i = 0; i < kNumChan; i++) {
+        StripeStore store { i, false };
+        if (!store.isOpen()) {
+            continue;
+        }
+        StripeCounters c;
+        uint32_t fault;
+        {
+            StripeLock lock { store };
+            c = store.state().counters;
+            fault = store.state().fault;
+        }
+        std::string ch = "ch" + std::to_string(i) + "_";
+        std::cout << ch << "served " << c.served << "\n"
+                  << ch << "resent " << c.resent << "\n"
+                  << ch << "no_frame " << c.noFrame << "\n"
+                  << ch << "bytes " << c.bytes << "\n"
+                  << ch << "copy_ns " << c.copyNs << "\n"
+                  << ch << "fault " << fault << "\n"
+                  << ch << "failover " << c.failover << "\n"
+                  << ch << "sw_encoded " << c.swEncoded << "\n"
+                  << ch << "sw_encode_ns " << c.swEncodeNs << "\n"
+                  << ch << "scaled_hit " << c.scaledHit << "\n"
+                  << ch << "scaled_miss " << c.scaledMiss << "\n"
+                  << ch << "scale_ns " << c.scaleNs << "\n"
+                  << ch << "cropped " << c.cropped << "\n"
+                  << ch << "unchanged " << c.unchanged << "\n";
+        for (int s = static_cast<int>(JpegStatus::kBadLength); s < static_cast<int>(JpegStatus::kNumStatus); s++) {
+            std::cout << ch << "rejected_" << jpegStatusName(static_cast<JpegStatus>(s)) << " " << c.rejected[s] << "\n";
+        }
+    }
+    FrameGovernor governor { false };
+    if (governor.isOpen()) {
+        printGovernor(governor, "governor_");
+    }
+    LatencyReport latency;
+    if (loadLatencyReport(latency)) {
+        std::cout << "latency_probes " << latency.probes << "\n"
+                  << "latency_missed " << latency.missed << "\n"
+                  << "latency_busy " << latency.busy << "\n";
+        const std::pair<const char *, const LatencySummary &> parts[] = {
+            { "input", latency.input }, { "capture", latency.capture }, { "total", latency.total } };
+        for (const auto & part : parts) {
+            std::string name = std::string("latency_") + part.first + "_";
+            const LatencySummary & s = part.second;
+            std::cout << name << "samples " << s.samples << "\n"
+                      << name << "min_us " << s.minNs / 1000 << "\n"
+                      << name << "p50_us " << s.p50Ns / 1000 << "\n"
+                      << name << "p90_us " << s.p90Ns / 1000 << "\n"
+                      << name << "p99_us " << s.p99Ns / 1000 << "\n"
+                      << name << "max_us " << s.maxNs / 1000 << "\n";
+        }
+    }
+    std::vector<ClientReport> clients = loadClientReports(nowNs());
+    std::cout << "clients " << clients.size() << "\n";
+    for (size_t i = 0; i < clients.size(); i++) {
+        std::string prefix = "client" + std::to_string(i) + "_";
+        const ClientReport & c = clients[i];
+        std::cout << prefix << "id " << c.id << "\n"
+                  << prefix << "report_age_ms " << (nowNs() - c.receivedNs) / 1000000 << "\n";
+        std::string text { c.text, c.length };
+        for (size_t pos = 0; pos < text.size();) {
+            size_t end = text.find('\n', pos);
+            std::cout << prefix << text.substr(pos, end + 1 - pos);
+            pos = end + 1;
+        }
+    }
+    return 0;
+}
+
+void usage(const char *prog)
+{
+    std::cerr << "usage: " << prog << " [CHANNEL]          serve stripe as CGI response (default: ch= in QUERY_STRING)\n"
+              << "       " << prog << " -m                 print counters; as a POST, keep the report of a browser (id=)\n"
+              << "       " << prog << " -s SOURCE [-x W -y H]  software encoder while the hardware one is down (needs the fault register)\n"
+              << "       " << prog << " -r                 serve stripe ch= downscaled by s= (2 or 4) as CGI response\n"
+              << "       " << prog << " -a                 serve the frame region x=, y=, w=, h= as CGI response\n"
+              << "       " << prog << " -d [-t yuv|rgb] [-f FPS]  export decoded frames to shared memory while read\n"
+              << "       " << prog << " -l FILE            write the next exported frame to FILE (PPM or raw YUV)\n"
+              << "       " << prog << " -g                 governor state as CGI response, full=, idle=, idle_after_ms=, probe_ms= set it\n"
+              << "       " << prog << " -w                 signal input to the governor\n"
+              << "       " << prog << " -j [-n ITER]        measure input to photon latency through inputd, kept for -m\n"
+              << "  SOURCE: V4L2 capture device, or FIFO/file of raw RGB24 frames (needs -x, -y)\n"
+              << "  checks and benchmarks: getimg_test\n";
+}
+
+int main(int argc, char** argv)
+{
+    std::string sourcePath;
+    std::string grabPath;
+    bool metrics = false;
+    bool scaled = false;
+    bool crop = false;
+    bool exportFrames = false;
+    bool governor = false;
+    bool probe = false;
+    ExportFormat exportFormat = ExportFormat::kYuv422p;
+    uint16_t width = 0;
+    uint16_t height = 0;
+    int iterations = 0;
+    int fps = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "mx:y:n:f:s:radt:l:gwj")) != -1) {
+        switch (opt) {
+        case 'm':
+            metrics = true;
+            break;
+        case 'x':
+            width = atoi(optarg);
+            break;
+        case 'y':
+            height = atoi(optarg);
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'f':
+            fps = atoi(optarg);
+            break;
+        case 's':
+            sourcePath = optarg;
+            break;
+        case 'r':
+            scaled = true;
+            break;
+        case 'a':
+            crop = true;
+            break;
+        case 'd':
+            exportFrames = true;
+            break;
+        case 't':
+            exportFormat = std::string { optarg } == "rgb" ? ExportFormat::kRgb24 : ExportFormat::kYuv422p;
+            break;
+        case 'l':
+            grabPath = optarg;
+            break;
+        case 'g':
+            governor = true;
+            break;
+        case 'w':
+            return FrameGovernor::touchInput() ? 0 : 1;
+        case 'j':
+            probe = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (metrics) {
+        return printMetrics();
+    }
+    if (governor) {
+        return serveGovernor();
+    }
+    if (probe) {
+        return probeLatency(iterations > 0 ? iterations : 100);
+    }
+    if (exportFrames) {
+        return runExport(exportFormat, fps > 0 ? fps : 10);
+    }
+    if (!grabPath.empty()) {
+        return grabFrame(grabPath);
+    }
+    if (!sourcePath.empty()) {
+        return runFailover(sourcePath, width, height);
+    }
+
+    if (crop) {
+        int x = getQueryInt("x");
+        int y = getQueryInt("y");
+        int w = getQueryInt("w");
+        int h = getQueryInt("h");
+        if (x < 0 || y < 0 || w <= 0 || h <= 0 || x > 0xFFFF || y > 0xFFFF) {
+            if (getenv("QUERY_STRING") != nullptr) {
+                return sendBadRequest("x=, y= must be at least 0 and w=, h= at least 1");
+            }
+            usage(argv[0]);
+            return 1;
+        }
+        return serveCrop({ static_cast<uint16_t>(x), static_cast<uint16_t>(y),
+                           static_cast<uint16_t>(std::min(w, 0xFFFF)), static_cast<uint16_t>(std::min(h, 0xFFFF)) });
+    }
+
+    int imgNr = optind < argc ? atoi(argv[optind]) : getImageNr();
+    int scale = scaled ? getQueryInt("s") : 1;
+    if (imgNr < 0 || imgNr >= kNumChan || (scale != 1 && scale != 2 && scale != 4)) {
+        if (getenv("QUERY_STRING") != nullptr) {
+            return sendBadRequest(scaled ? "ch= must be 0 to 3 and s= 2 or 4" : "ch= must be 0 to 3");
+        }
+        usage(argv[0]);
+        return 1;
+    }
+    return serveImage(imgNr, scale, getKnownHash());
+}
@@ -0,0 +1,662 @@
+#include <iostream>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <cmath>
+#include <cstring>
+
+#include "csc.h"
+#include "dct_scale.h"
+#include "frame_export.h"
+#include "frame_source.h"
+#include "idct.h"
+#include "jpeg_check.h"
+#include "jpeg_coef.h"
+#include "stripe_crop.h"
+#include "stripe_store.h"
+#include "sw_encoder.h"
+
+/*
+ * Checks and benchmarks of the frame server's building blocks, on files or
+ * generated frames, so they run on the host as well as on the board. The
+ * frame server itself is getimg.
+ */
+
+inline uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+bool readFile(const std::string & path, std::vector<uint8_t> & buffer)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "Could not open " << path << std::endl;
+        return false;
+    }
+    buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+int checkFile(const std::string & path, uint16_t width, uint16_t height)
+{
+    std::vector<uint8_t> jpeg;
+    if (!readFile(path, jpeg)) {
+        return 1;
+    }
+    JpegStatus st = checkJpeg(jpeg.data(), jpeg.size(), width, height);
+    std::cout << path << ": " << jpegStatusName(st) << std::endl;
+    return st == JpegStatus::kOk ? 0 : 2;
+}
+
+/*
+ * Cost of the check: plain chunked copy vs. copy + check, over the same
+ * stripe. Reported as extra CPU load at the given frame rate (all stripes).
+ * On the board the source is the uncached frame buffer, so the copy itself
+ * is slower and the relative overhead smaller than measured here.
+ */
+int benchmark(const std::string & path, uint16_t width, uint16_t height, int iterations, int fps)
+{
+    std::vector<uint8_t> src;
+    if (!readFile(path, src)) {
+        return 1;
+    }
+    uint32_t length = src.size();
+    std::vector<uint8_t> dst(length);
+
+    if (checkJpeg(src.data(), length, width, height) != JpegStatus::kOk) {
+        std::cerr << path << " does not pass the check" << std::endl;
+        return 2;
+    }
+
+    uint64_t copyNs = ~0ull;
+    uint64_t checkNs = ~0ull;
+    // best of a few runs, to filter out scheduling noise
+    for (int run = 0; run < 5; run++) {
+        uint64_t start = nowNs();
+        for (int i = 0; i < iterations; i++) {
+            for (uint32_t done = 0; done < length; done += kCopyChunk) {
+                uint32_t n = length - done < kCopyChunk ? length - done : kCopyChunk;
+                memcpy(dst.data() + done, src.data() + done, n);
+            }
+            asm volatile("" : : "r"(dst.data()) : "memory");
+        }
+        uint64_t mid = nowNs();
+        for (int i = 0; i < iterations; i++) {
+            JpegChecker checker { dst.data(), length, kMaxJpegSize, width, height };
+            uint64_t hash;
+            if (copyAndCheck(dst.data(), src.data(), checker, length, hash) != JpegStatus::kOk) {
+                return 3;
+            }
+        }
+        uint64_t end = nowNs();
+        copyNs = std::min(copyNs, mid - start);
+        checkNs = std::min(checkNs, end - mid);
+    }
+
+    double copyUs = copyNs / 1000.0 / iterations;
+    double checkUs = checkNs / 1000.0 / iterations;
+    double extraUs = checkUs > copyUs ? checkUs - copyUs : 0.0;
+    double load = extraUs * 1e-6 * fps * kNumChan * 100.0;
+    printf("stripe: %u bytes\n", length);
+    printf("copy: %.1f us, copy+check: %.1f us, check: %.1f us (%.0f MB/s)\n",
+           copyUs, checkUs, extraUs, extraUs > 0 ? length / extraUs : 0.0);
+    printf("added CPU at %d fps x %d stripes: %.3f%% %s\n",
+           fps, kNumChan, load, load < 1.0 ? "(< 1%)" : "(>= 1%!)");
+    return 0;
+}
+
+/*
+ * Desktop-like RGB24 test frame: gradient background, a window with lines
+ * of high contrast "text" in it, and a flat title bar.
+ */
+void makeTestFrame(uint16_t width, uint16_t height, std::vector<uint8_t> & rgb)
+{
+    rgb.resize(static_cast<size_t>(width) * height * 3);
+    uint32_t seed = 12345;
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            uint8_t *px = &rgb[(y * width + x) * 3];
+            px[0] = 40 + x * 80 / width;
+            px[1] = 60 + y * 100 / height;
+            px[2] = 160;
+            bool inWindow = x >= width / 8 && x < width * 7 / 8 && y >= height / 8 && y < height * 7 / 8;
+            if (!inWindow) {
+                continue;
+            }
+            if (y < height / 8 + 24u) {
+                px[0] = 50;
+                px[1] = 90;
+                px[2] = 200;
+                continue;
+            }
+            seed = seed * 1103515245 + 12345;
+            bool glyph = (y % 16) < 11 && (x % 7) < 6 && ((x / 42 + y / 16) % 5) != 0;
+            uint8_t v = glyph && (seed >> 16) % 3 == 0 ? 20 : 250;
+            px[0] = px[1] = px[2] = v;
+        }
+    }
+}
+
+/*
+ * Software encoder throughput, 1 thread and kEncoderThreads threads, on the
+ * test frame (or the first frame of SOURCE). Without a size, 800x600 and
+ * 1280x720 are measured.
+ */
+int benchSwEncoder(const std::string & sourcePath, uint16_t width, uint16_t height, int iterations,
+                   const std::string & prefix)
+{
+    std::vector<std::pair<uint16_t, uint16_t>> sizes;
+    if (width != 0 && height != 0) {
+        sizes.push_back({ width, height });
+    } else {
+        sizes = { { 800, 600 }, { 1280, 720 } };
+    }
+
+    SwEncoder encoder;
+    printf("NEON kernels: %s\n", SwEncoder::hasNeon() ? "yes" : "no");
+    for (const auto & size : sizes) {
+        std::vector<uint8_t> rgb;
+        RawFrame frame;
+        std::unique_ptr<FrameSource> source;
+        if (!sourcePath.empty()) {
+            source.reset(new FrameSource { sourcePath, size.first, size.second });
+            if (!source->next(frame)) {
+                return 1;
+            }
+        } else {
+            makeTestFrame(size.first, size.second, rgb);
+            frame = { rgb.data(), static_cast<uint32_t>(size.first) * 3, size.first, size.second, PixelFormat::kRgb24 };
+        }
+
+        std::vector<std::vector<uint8_t>> jpeg(kNumChan, std::vector<uint8_t>(kMaxJpegSize));
+        uint32_t lengths[kNumChan];
+        uint64_t ns[kNumChan];
+        double ms[2];
+        for (int t = 0; t < 2; t++) {
+            uint64_t best = ~0ull;
+            for (int i = 0; i < iterations; i++) {
+                uint64_t start = nowNs();
+                encoder.encodeFrame(frame, t == 0 ? 1 : kEncoderThreads, jpeg, lengths, ns);
+                best = std::min(best, nowNs() - start);
+            }
+            ms[t] = best / 1e6;
+        }
+
+        std::vector<Stripe> stripes = stripeLayout(frame.width, kNumChan);
+        uint32_t total = 0;
+        for (int i = 0; i < kNumChan; i++) {
+            JpegStatus st = checkJpeg(jpeg[i].data(), lengths[i], stripes[i].width, frame.height);
+            if (st != JpegStatus::kOk) {
+                std::cerr << "Stripe " << i << " does not pass the check: " << jpegStatusName(st) << std::endl;
+                return 2;
+            }
+            total += lengths[i];
+            if (!prefix.empty()) {
+                std::string path = prefix + "_" + std::to_string(frame.width) + "x" + std::to_string(frame.height)
+                                 + "_ch" + std::to_string(i) + ".jpg";
+                std::ofstream out(path, std::ios::binary);
+                out.write(reinterpret_cast<const char *>(jpeg[i].data()), lengths[i]);
+            }
+        }
+        printf("%ux%u: %u bytes, 1 thread: %.1f ms (%.1f fps), %d threads: %.1f ms (%.1f fps)\n",
+               frame.width, frame.height, total, ms[0], 1000.0 / ms[0],
+               kEncoderThreads, ms[1], 1000.0 / ms[1]);
+    }
+    return 0;
+}
+
+/*
+ * The CSC kernel against the scalar colorspace_conv reference on all 2^24
+ * colors, then both on a 1280x720 test frame, in megapixels/s.
+ */
+int checkCsc(int iterations)
+{
+    static const uint32_t kColors = 1u << 24;
+    static const uint32_t kChunk = 4096;
+    printf("CSC kernel: %s\n", cscKernelName());
+
+    std::vector<uint8_t> rgb(kChunk * 3);
+    std::vector<uint8_t> ref(kChunk * 3);
+    std::vector<uint8_t> out(kChunk * 3);
+    uint32_t mismatches = 0;
+    for (uint32_t base = 0; base < kColors; base += kChunk) {
+        for (uint32_t i = 0; i < kChunk; i++) {
+            uint32_t color = base + i;
+            rgb[3 * i] = color & 0xFF;
+            rgb[3 * i + 1] = (color >> 8) & 0xFF;
+            rgb[3 * i + 2] = color >> 16;
+        }
+        // odd length, so the scalar tail of the kernel is covered too
+        uint32_t n = kChunk - (base / kChunk) % 16;
+        cscRowScalar(rgb.data(), &ref[0], &ref[kChunk], &ref[2 * kChunk], n);
+        cscRow(rgb.data(), &out[0], &out[kChunk], &out[2 * kChunk], n);
+        for (int c = 0; c < 3; c++) {
+            for (uint32_t i = 0; i < n; i++) {
+                if (ref[c * kChunk + i] != out[c * kChunk + i] && mismatches++ < 10) {
+                    printf("mismatch at RGB 0x%06X, component %d: %u, expected %u\n",
+                           base + i, c, out[c * kChunk + i], ref[c * kChunk + i]);
+                }
+            }
+        }
+    }
+    printf("%u colors: %s\n", kColors, mismatches == 0 ? "bit exact" : "MISMATCH");
+    if (mismatches != 0) {
+        return 2;
+    }
+
+    const uint16_t width = 1280;
+    const uint16_t height = 720;
+    std::vector<uint8_t> frame;
+    makeTestFrame(width, height, frame);
+    std::vector<uint8_t> planes(static_cast<size_t>(width) * height * 3);
+    uint8_t *y = &planes[0];
+    uint8_t *cb = y + width * height;
+    uint8_t *cr = cb + width * height;
+    typedef void (*Kernel)(const uint8_t *, uint8_t *, uint8_t *, uint8_t *, uint32_t);
+    const Kernel kernels[2] = { cscRowScalar, cscRow };
+    const char *names[2] = { "scalar", cscKernelName() };
+    for (int k = 0; k < 2; k++) {
+        uint64_t best = ~0ull;
+        for (int i = 0; i < iterations; i++) {
+            uint64_t start = nowNs();
+            for (uint32_t line = 0; line < height; line++) {
+                uint32_t offset = line * width;
+                kernels[k](&frame[offset * 3], y + offset, cb + offset, cr + offset, width);
+            }
+            asm volatile("" : : "r"(planes.data()) : "memory");
+            best = std::min(best, nowNs() - start);
+        }
+        printf("%s: %.2f ms per %ux%u frame, %.1f MP/s\n", names[k], best / 1e6, width, height,
+               width * height * 1e3 / best);
+    }
+    return 0;
+}
+
+/*
+ * Box filter, factor x factor, of a plane of the given stride; out is
+ * width / factor wide.
+ */
+void boxDownscale(const uint8_t *in, uint32_t stride, uint32_t width, uint32_t height, int factor,
+                  std::vector<uint8_t> & out)
+{
+    uint32_t ow = width / factor;
+    uint32_t oh = height / factor;
+    out.resize(static_cast<size_t>(ow) * oh);
+    for (uint32_t y = 0; y < oh; y++) {
+        for (uint32_t x = 0; x < ow; x++) {
+            uint32_t sum = 0;
+            for (int i = 0; i < factor; i++) {
+                for (int j = 0; j < factor; j++) {
+                    sum += in[(y * factor + i) * stride + x * factor + j];
+                }
+            }
+            out[y * ow + x] = (sum + factor * factor / 2) / (factor * factor);
+        }
+    }
+}
+
+double psnr(const uint8_t *a, uint32_t strideA, const uint8_t *b, uint32_t strideB, uint32_t width, uint32_t height)
+{
+    double err = 0;
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            double d = static_cast<double>(a[y * strideA + x]) - b[y * strideB + x];
+            err += d * d;
+        }
+    }
+    err /= static_cast<double>(width) * height;
+    return err > 0 ? 10 * std::log10(255.0 * 255.0 / err) : 99.0;
+}
+
+/*
+ * Downscaling a 4:2:2 stripe by 2 and 4: in the DCT domain (DctScaler), and
+ * as decode, box filter, SwEncoder for comparison. The quality of both is
+ * given as Y PSNR against the box filtered decode.
+ */
+int benchScale(const std::string & path, int iterations, const std::string & prefix)
+{
+    std::vector<uint8_t> jpeg;
+    if (!readFile(path, jpeg)) {
+        return 1;
+    }
+    CoefImage in;
+    if (!in.decode(jpeg.data(), jpeg.size()) || in.components().size() != 3 ||
+        in.mcuWidth() != 16 || in.mcuHeight() != 8) {
+        std::cerr << path << " is not a 4:2:2 baseline JPEG" << std::endl;
+        return 2;
+    }
+    printf("%s: %ux%u, %zu bytes\n", path.c_str(), in.width(), in.height(), jpeg.size());
+
+    SwEncoder encoder;
+    std::vector<uint8_t> out(kMaxJpegSize);
+    for (int scale : { 2, 4 }) {
+        DctScaler scaler { scale };
+        uint64_t dctBest = ~0ull;
+        uint32_t dctLength = 0;
+        CoefImage scaled;
+        for (int i = 0; i < iterations; i++) {
+            uint64_t start = nowNs();
+            CoefImage src;
+            src.decode(jpeg.data(), jpeg.size());
+            scaler.scale(src, scaled);
+            dctLength = scaled.encode(out.data(), out.size());
+            dctBest = std::min(dctBest, nowNs() - start);
+        }
+        if (dctLength == 0) {
+            return 3;
+        }
+        if (!prefix.empty()) {
+            std::ofstream file(prefix + "_s" + std::to_string(scale) + ".jpg", std::ios::binary);
+            file.write(reinterpret_cast<const char *>(out.data()), dctLength);
+        }
+
+        uint16_t ow = in.width() / scale;
+        uint16_t oh = in.height() / scale;
+        std::vector<std::vector<uint8_t>> planes;
+        std::vector<uint8_t> small[3];
+        std::vector<uint8_t> yuyv(static_cast<size_t>(ow) * oh * 2);
+        uint64_t refBest = ~0ull;
+        uint32_t refLength = 0;
+        for (int i = 0; i < iterations; i++) {
+            uint64_t start = nowNs();
+            CoefImage src;
+            src.decode(jpeg.data(), jpeg.size());
+            src.toPlanes(planes);
+            for (int c = 0; c < 3; c++) {
+                uint32_t stride = src.components()[c].blocksX * 8;
+                boxDownscale(planes[c].data(), stride, c ? in.width() / 2 : in.width(), in.height(), scale, small[c]);
+            }
+            for (uint32_t y = 0; y < oh; y++) {
+                for (uint32_t x = 0; x < ow; x++) {
+                    uint32_t cx = std::min<uint32_t>(x / 2, in.width() / 2 / scale - 1);
+                    yuyv[(y * ow + x) * 2] = small[0][y * ow + x];
+                    yuyv[(y * ow + x) * 2 + 1] = small[x & 1 ? 2 : 1][y * (in.width() / 2 / scale) + cx];
+                }
+            }
+            RawFrame frame { yuyv.data(), static_cast<uint32_t>(ow) * 2, ow, oh, PixelFormat::kYuyv };
+            refLength = encoder.encodeStripe(frame, { 0, ow }, out.data(), out.size());
+            refBest = std::min(refBest, nowNs() - start);
+        }
+
+        std::vector<std::vector<uint8_t>> dctPlanes;
+        scaled.toPlanes(dctPlanes);
+        double quality = psnr(dctPlanes[0].data(), scaled.components()[0].blocksX * 8, small[0].data(), ow, ow, oh);
+        printf("1/%d: dct domain %.2f ms, %u bytes; decode-resize-encode %.2f ms, %u bytes; %.1fx; "
+               "Y PSNR vs box filter %.1f dB\n",
+               scale, dctBest / 1e6, dctLength, refBest / 1e6, refLength,
+               static_cast<double>(refBest) / dctBest, quality);
+    }
+    return 0;
+}
+
+/*
+ * Cropping the frame PREFIX_ch0.jpg .. PREFIX_ch3.jpg: time and size for a
+ * few rectangles, and a check that every block of the crop is the block of
+ * the stripe it was taken from.
+ */
+int benchCrop(const std::string & stripePrefix, int iterations, const std::string & prefix)
+{
+    std::vector<std::vector<uint8_t>> stripes(kNumChan);
+    const uint8_t *jpeg[kNumChan];
+    uint32_t lengths[kNumChan];
+    uint32_t total = 0;
+    for (int i = 0; i < kNumChan; i++) {
+        if (!readFile(stripePrefix + "_ch" + std::to_string(i) + ".jpg", stripes[i])) {
+            return 1;
+        }
+        jpeg[i] = stripes[i].data();
+        lengths[i] = stripes[i].size();
+        total += lengths[i];
+    }
+    StripeCropper full;
+    if (!full.load(jpeg, lengths, kNumChan)) {
+        std::cerr << stripePrefix << ": stripes do not make up a frame" << std::endl;
+        return 2;
+    }
+    uint16_t w = full.frameWidth();
+    uint16_t h = full.frameHeight();
+    CropRect whole { 0, 0, w, h };
+    std::vector<uint8_t> out(kMaxJpegSize);
+    full.crop(whole, out.data(), out.size());
+    printf("%s: %ux%u, %u bytes in %d stripes\n", stripePrefix.c_str(), w, h, total, kNumChan);
+
+    const struct {
+        const char *name;
+        CropRect rect;
+    } cases[] = {
+        { "window", { static_cast<uint16_t>(w / 8 + 5), static_cast<uint16_t>(h / 4 + 3),
+                      static_cast<uint16_t>(w / 4), static_cast<uint16_t>(h / 4) } },
+        { "line", { static_cast<uint16_t>(w / 3), static_cast<uint16_t>(h / 2),
+                    static_cast<uint16_t>(w / 3), 16 } },
+        { "corner", { static_cast<uint16_t>(w - 200), static_cast<uint16_t>(h - 120), 200, 120 } },
+        { "frame", { 0, 0, w, h } },
+    };
+    int failed = 0;
+    for (const auto & c : cases) {
+        uint64_t best = ~0ull;
+        uint32_t length = 0;
+        CropRect rect = c.rect;
+        StripeCropper cropper;
+        for (int i = 0; i < iterations; i++) {
+            uint64_t start = nowNs();
+            rect = c.rect;
+            cropper.load(jpeg, lengths, kNumChan);
+            length = cropper.crop(rect, out.data(), out.size());
+            best = std::min(best, nowNs() - start);
+        }
+
+        CoefImage cropped;
+        bool same = length != 0 && cropped.decode(out.data(), length) &&
+                    cropped.width() == rect.width && cropped.height() == rect.height;
+        uint32_t row0 = rect.y / cropped.mcuHeight();
+        for (size_t k = 0; same && k < cropper.columns().size(); k++) {
+            const CropColumn & col = cropper.columns()[k];
+            for (size_t ci = 0; ci < cropped.components().size(); ci++) {
+                const CoefComponent & dst = cropped.components()[ci];
+                const CoefComponent & src = full.stripe(col.stripe).components()[ci];
+                for (uint32_t by = 0; by < dst.blocksY; by++) {
+                    for (uint32_t bx = 0; bx < dst.h; bx++) {
+                        same = same && memcmp(dst.block(k * dst.h + bx, by),
+                                              src.block(col.col * src.h + bx, row0 * src.v + by), 128) == 0;
+                    }
+                }
+            }
+        }
+        failed += !same;
+        if (!prefix.empty() && length != 0) {
+            std::ofstream file(prefix + "_" + c.name + ".jpg", std::ios::binary);
+            file.write(reinterpret_cast<const char *>(out.data()), length);
+        }
+        uint32_t missing = 0;
+        std::vector<CropGap> gaps = cropper.gaps();
+        for (const CropGap & gap : gaps) {
+            missing += gap.width;
+        }
+        printf("%-6s %4u,%-4u %4ux%-4u -> %4u,%-4u %4ux%-4u: %.2f ms, %u bytes (%.1f%% of the frame), %s",
+               c.name, c.rect.x, c.rect.y, c.rect.width, c.rect.height, rect.x, rect.y, rect.width, rect.height,
+               best / 1e6, length, 100.0 * length / total, same ? "lossless" : "MISMATCH");
+        if (!gaps.empty()) {
+            printf(", %u columns left out at %zu seam%s", missing, gaps.size(), gaps.size() > 1 ? "s" : "");
+        }
+        printf("\n");
+    }
+    return failed ? 3 : 0;
+}
+
+/*
+ * Decoding the frame PREFIX_ch0.jpg .. PREFIX_ch3.jpg for the export, with
+ * 1 and 2 threads, and the fast IDCT against the exact one of
+ * CoefImage::toPlanes.
+ */
+int benchExport(const std::string & stripePrefix, int iterations, const std::string & prefix)
+{
+    std::vector<std::vector<uint8_t>> stripes(kNumChan);
+    const uint8_t *jpeg[kNumChan];
+    uint32_t lengths[kNumChan];
+    for (int i = 0; i < kNumChan; i++) {
+        if (!readFile(stripePrefix + "_ch" + std::to_string(i) + ".jpg", stripes[i])) {
+            return 1;
+        }
+        jpeg[i] = stripes[i].data();
+        lengths[i] = stripes[i].size();
+    }
+
+    std::vector<uint8_t> yuv(FrameExport::kMaxFrameSize);
+    uint16_t width;
+    uint16_t height;
+    if (!decodeStripes(jpeg, lengths, kNumChan, ExportFormat::kYuv422p, 1, yuv.data(), yuv.size(), width, height)) {
+        std::cerr << stripePrefix << ": stripes do not make up a frame" << std::endl;
+        return 2;
+    }
+    int maxError = 0;
+    uint16_t start = 0;
+    for (int i = 0; i < kNumChan; i++) {
+        CoefImage img;
+        img.decode(jpeg[i], lengths[i]);
+        std::vector<std::vector<uint8_t>> planes;
+        img.toPlanes(planes);
+        uint32_t stride = img.components()[0].blocksX * 8;
+        for (uint32_t y = 0; y < height; y++) {
+            for (uint32_t x = 0; x < img.width(); x++) {
+                int error = std::abs(yuv[y * width + start + x] - planes[0][y * stride + x]);
+                maxError = std::max(maxError, error);
+            }
+        }
+        start += img.width();
+    }
+    printf("%s: %ux%u, IDCT %s, max Y error vs exact IDCT %d\n", stripePrefix.c_str(), width, height,
+           idctHasNeon() ? "neon" : "scalar", maxError);
+
+    std::vector<uint8_t> out(FrameExport::kMaxFrameSize);
+    for (ExportFormat format : { ExportFormat::kYuv422p, ExportFormat::kRgb24 }) {
+        uint64_t best[kEncoderThreads + 1];
+        for (int threads = 1; threads <= kEncoderThreads; threads++) {
+            best[threads] = ~0ull;
+            for (int i = 0; i < iterations; i++) {
+                uint64_t t0 = nowNs();
+                decodeStripes(jpeg, lengths, kNumChan, format, threads, out.data(), out.size(), width, height);
+                best[threads] = std::min(best[threads], nowNs() - t0);
+            }
+        }
+        printf("%-4s: 1 thread %.2f ms (%.1f fps), %d threads %.2f ms (%.1f fps)\n",
+               format == ExportFormat::kRgb24 ? "rgb" : "yuv", best[1] / 1e6, 1e9 / best[1],
+               kEncoderThreads, best[kEncoderThreads] / 1e6, 1e9 / best[kEncoderThreads]);
+        if (!prefix.empty() && format == ExportFormat::kRgb24) {
+            ExportFrame frame { format, width, height, 0, 0,
+                                std::vector<uint8_t>(out.begin(), out.begin() + FrameExport::frameSize(format, width, height)) };
+            writePixels(prefix + ".ppm", frame);
+        }
+    }
+    return 0;
+}
+
+void usage(const char *prog)
+{
+    std::cerr << "usage: " << prog << " -c FILE [-x W -y H]  check a JPEG file\n"
+              << "       " << prog << " -b FILE [-x W -y H] [-n ITER] [-f FPS]  benchmark the check\n"
+              << "       " << prog << " -e [-s SOURCE] [-x W -y H] [-n ITER] [-o PREFIX]  benchmark the software encoder\n"
+              << "       " << prog << " -k [-n ITER]        check the CSC kernel on all colors and benchmark it\n"
+              << "       " << prog << " -z FILE [-n ITER] [-o PREFIX]  benchmark DCT domain downscaling of a stripe\n"
+              << "       " << prog << " -p STRIPES [-n ITER] [-o PREFIX]  check and benchmark cropping STRIPES_chN.jpg\n"
+              << "       " << prog << " -i STRIPES [-n ITER] [-o PREFIX]  benchmark decoding STRIPES_chN.jpg for the export\n"
+              << "  SOURCE: V4L2 capture device, or FIFO/file of raw RGB24 frames (needs -x, -y)\n";
+}
+
+int main(int argc, char** argv)
+{
+    std::string checkPath;
+    std::string benchPath;
+    std::string sourcePath;
+    std::string prefix;
+    std::string scaleBenchPath;
+    std::string cropBenchPrefix;
+    std::string exportBenchPrefix;
+    bool swBench = false;
+    bool csc = false;
+    uint16_t width = 0;
+    uint16_t height = 0;
+    int iterations = 0;
+    int fps = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:b:x:y:n:f:s:eo:kz:p:i:")) != -1) {
+        switch (opt) {
+        case 'c':
+            checkPath = optarg;
+            break;
+        case 'b':
+            benchPath = optarg;
+            break;
+        case 'x':
+            width = atoi(optarg);
+            break;
+        case 'y':
+            height = atoi(optarg);
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'f':
+            fps = atoi(optarg);
+            break;
+        case 's':
+            sourcePath = optarg;
+            break;
+        case 'e':
+            swBench = true;
+            break;
+        case 'o':
+            prefix = optarg;
+            break;
+        case 'k':
+            csc = true;
+            break;
+        case 'z':
+            scaleBenchPath = optarg;
+            break;
+        case 'p':
+            cropBenchPrefix = optarg;
+            break;
+        case 'i':
+            exportBenchPrefix = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!checkPath.empty()) {
+        return checkFile(checkPath, width, height);
+    }
+    if (!benchPath.empty()) {
+        return benchmark(benchPath, width, height, iterations > 0 ? iterations : 200, fps > 0 ? fps : 60);
+    }
+    if (csc) {
+        return checkCsc(iterations > 0 ? iterations : 20);
+    }
+    if (!scaleBenchPath.empty()) {
+        return benchScale(scaleBenchPath, iterations > 0 ? iterations : 20, prefix);
+    }
+    if (!cropBenchPrefix.empty()) {
+        return benchCrop(cropBenchPrefix, iterations > 0 ? iterations : 20, prefix);
+    }
+    if (!exportBenchPrefix.empty()) {
+        return benchExport(exportBenchPrefix, iterations > 0 ? iterations : 20, prefix);
+    }
+    if (swBench) {
+        return benchSwEncoder(sourcePath, width, height, iterations > 0 ? iterations : 20, prefix);
+    }
+    usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,155 @@
+#include "governor.h"
+
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+
+const uint32_t kMagic = 0x4b564731;  // "KVG1"
+const char *kInputPath = "/dev/shm/kvm_input";
+const uint32_t kMaxFps = 240;
+const uint32_t kMaxIdleAfterMs = 3600 * 1000;
+const uint32_t kMaxProbeMs = 1000;
+
+uint64_t intervalNs(uint32_t fps)
+{
+    return fps == 0 ? 0 : 1000000000ull / fps;
+}
+
+}
+
+const GovernorPolicy FrameGovernor::kDefaultPolicy = { 0, 1, 3000, 50 };
+
+FrameGovernor::FrameGovernor(bool create) :
+    m_fd { -1 },
+    m_state { nullptr }
+{
+    std::string name = path();
+    m_fd = open(name.c_str(), create ? (O_RDWR | O_CREAT) : O_RDWR, 0644);
+    if (m_fd < 0) {
+        if (create) {
+            std::cerr << "Could not open " << name << ", errno " << errno << std::endl;
+        }
+        return;
+    }
+    if (ftruncate(m_fd, sizeof(GovernorState)) != 0) {
+        std::cerr << "Could not size " << name << ", errno " << errno << std::endl;
+        return;
+    }
+    void *mem = mmap(NULL, sizeof(GovernorState), PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (mem == MAP_FAILED) {
+        std::cerr << "Could not map " << name << ", errno " << errno << std::endl;
+        return;
+    }
+    m_state = static_cast<GovernorState *>(mem);
+
+    // the rest is updated with atomics, only setting up takes the lock
+    while (flock(m_fd, LOCK_EX) != 0 && errno == EINTR) {
+    }
+    if (m_state->magic != kMagic) {
+        memset(m_state, 0, sizeof(*m_state));
+        m_state->policy = kDefaultPolicy;
+        m_state->magic = kMagic;
+    }
+    flock(m_fd, LOCK_UN);
+}
+
+FrameGovernor::~FrameGovernor()
+{
+    if (m_state != nullptr) {
+        munmap(m_state, sizeof(GovernorState));
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+GovernorPolicy FrameGovernor::policy() const
+{
+    GovernorPolicy p;
+    p.fullFps = __atomic_load_n(&m_state->policy.fullFps, __ATOMIC_RELAXED);
+    p.idleFps = __atomic_load_n(&m_state->policy.idleFps, __ATOMIC_RELAXED);
+    p.idleAfterMs = __atomic_load_n(&m_state->policy.idleAfterMs, __ATOMIC_RELAXED);
+    p.probeMs = __atomic_load_n(&m_state->policy.probeMs, __ATOMIC_RELAXED);
+    return p;
+}
+
+void FrameGovernor::setPolicy(GovernorPolicy policy)
+{
+    policy.fullFps = policy.fullFps > kMaxFps ? kMaxFps : policy.fullFps;
+    policy.idleFps = policy.idleFps == 0 ? 1 : policy.idleFps > kMaxFps ? kMaxFps : policy.idleFps;
+    policy.idleAfterMs = policy.idleAfterMs > kMaxIdleAfterMs ? kMaxIdleAfterMs : policy.idleAfterMs;
+    policy.probeMs = policy.probeMs == 0 ? 1 : policy.probeMs > kMaxProbeMs ? kMaxProbeMs : policy.probeMs;
+    __atomic_store_n(&m_state->policy.fullFps, policy.fullFps, __ATOMIC_RELAXED);
+    __atomic_store_n(&m_state->policy.idleFps, policy.idleFps, __ATOMIC_RELAXED);
+    __atomic_store_n(&m_state->policy.idleAfterMs, policy.idleAfterMs, __ATOMIC_RELAXED);
+    __atomic_store_n(&m_state->policy.probeMs, policy.probeMs, __ATOMIC_RELAXED);
+}
+
+bool FrameGovernor::active(uint64_t nowNs) const
+{
+    uint64_t idleAfterNs = policy().idleAfterMs * 1000000ull;
+    uint64_t change = __atomic_load_n(&m_state->lastChangeNs, __ATOMIC_RELAXED);
+    return (change != 0 && nowNs - change < idleAfterNs) || inputAgeNs() < idleAfterNs;
+}
+
+uint32_t FrameGovernor::currentFps(uint64_t nowNs) const
+{
+    GovernorPolicy p = policy();
+    return active(nowNs) ? p.fullFps : p.idleFps;
+}
+
+uint64_t FrameGovernor::dueNs(int chan, uint64_t nowNs) const
+{
+    return __atomic_load_n(&m_state->lastFrameNs[chan], __ATOMIC_RELAXED) + intervalNs(currentFps(nowNs));
+}
+
+void FrameGovernor::changed(uint64_t nowNs)
+{
+    if (!active(nowNs)) {
+        __atomic_fetch_add(&m_state->wakeups, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&m_state->lastChangeNs, nowNs, __ATOMIC_RELAXED);
+}
+
+void FrameGovernor::released(int chan, uint64_t nowNs, uint64_t heldNs)
+{
+    __atomic_fetch_add(active(nowNs) ? &m_state->fullFrames : &m_state->idleFrames, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&m_state->heldNs, heldNs, __ATOMIC_RELAXED);
+    __atomic_store_n(&m_state->lastFrameNs[chan], nowNs, __ATOMIC_RELAXED);
+}
+
+uint64_t FrameGovernor::inputAgeNs()
+{
+    struct stat st;
+    if (stat(kInputPath, &st) != 0) {
+        return ~0ull;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t age = (now.tv_sec - st.st_mtim.tv_sec) * 1000000000ll + (now.tv_nsec - st.st_mtim.tv_nsec);
+    return age < 0 ? 0 : age;
+}
+
+bool FrameGovernor::touchInput()
+{
+    int fd = open(kInputPath, O_WRONLY | O_CREAT, 0666);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = futimens(fd, NULL) == 0;
+    close(fd);
+    return ok;
+}
+
+std::string FrameGovernor::path()
+{
+    return "/dev/shm/kvm_governor";
+}
@@ -0,0 +1,97 @@
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#include <cstdint>
+#include <string>
+
+#include "stripe_store.h"
+
+/*
+ * Frame rate governor shared by all frame server processes, in
+ * /dev/shm/kvm_governor. The browser asks for the next frame as soon as it
+ * has the last one; the governor holds each stripe request until the
+ * stripe is due:
+ *  - at fullFps (0: no limit) while the screen changes or input arrives,
+ *  - at idleFps once neither happened for idleAfterMs.
+ * A held request polls the size word of the stripe's latest frame buffer
+ * every probeMs, which costs next to nothing; a different size means a
+ * change and releases it (and the other channels) at once. Changes that
+ * keep the size are caught by the stripe hash at the idle rate.
+ * Input handlers signal input by touching /dev/shm/kvm_input ("getimg -w",
+ * webmouse), the governor looks at its mtime.
+ */
+
+struct GovernorPolicy
+{
+    uint32_t fullFps;       // 0: as fast as the browser asks
+    uint32_t idleFps;
+    uint32_t idleAfterMs;   // without change or input
+    uint32_t probeMs;       // polling interval of a held request
+};
+
+struct GovernorState
+{
+    uint32_t magic;
+    GovernorPolicy policy;
+    uint64_t lastChangeNs;
+    uint64_t lastFrameNs[kNumChan];     // last stripe released, per channel
+    uint64_t fullFrames;                // stripes released at the full rate
+    uint64_t idleFrames;                // ... at the idle rate
+    uint64_t wakeups;                   // idle -> full on a change
+    uint64_t heldNs;                    // time requests were held
+};
+
+class FrameGovernor
+{
+public:
+    static const GovernorPolicy kDefaultPolicy;
+
+    explicit FrameGovernor(bool create = true);
+
+    FrameGovernor(const FrameGovernor&) = delete;
+    FrameGovernor& operator=(const FrameGovernor&) = delete;
+
+    ~FrameGovernor();
+
+    bool isOpen() const
+    {
+        return m_state != nullptr;
+    }
+
+    const GovernorState & state() const
+    {
+        return *m_state;
+    }
+
+    GovernorPolicy policy() const;
+
+    // out of range values are clamped
+    void setPolicy(GovernorPolicy policy);
+
+    // a change or input within idleAfterMs
+    bool active(uint64_t nowNs) const;
+
+    // the frame rate in force, 0: no limit
+    uint32_t currentFps(uint64_t nowNs) const;
+
+    // earliest release of the next stripe of a channel
+    uint64_t dueNs(int chan, uint64_t nowNs) const;
+
+    void changed(uint64_t nowNs);
+
+    void released(int chan, uint64_t nowNs, uint64_t heldNs);
+
+    // ns since the last input, ~0 if none yet
+    static uint64_t inputAgeNs();
+
+    // signal input
+    static bool touchInput();
+
+    static std::string path();
+
+private:
+    int m_fd;
+    GovernorState *m_state;
+};
+
+#endif
@@ -0,0 +1,228 @@
+#include "idct.h"
+
+#include <cmath>
+
+#include "jpeg_coef.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define IDCT_NEON 1
+#endif
+
+namespace {
+
+// jidctfst rotations, the fractional part in Q15 as taken by vqdmulh
+const int16_t kC1414 = 13573;   // 1.414213562 - 1
+const int16_t kC1847 = 27779;   // 1.847759065 - 1
+const int16_t kC1082 = 2700;    // 1.082392200 - 1
+const int16_t kC2613 = 20091;   // 2.613125930 - 2
+
+const int kScaleBits = 2;       // the table leaves the samples scaled by 8 << kScaleBits
+const int kDescale = kScaleBits + 3;
+
+#ifdef IDCT_NEON
+
+inline int16x8_t mul(int16x8_t x, int16_t c)
+{
+    return vqdmulhq_n_s16(x, c);
+}
+
+// one AAN pass down the 8 vectors, for all 8 lanes at once
+inline void idctPassNeon(int16x8_t d[8])
+{
+    int16x8_t tmp10 = vaddq_s16(d[0], d[4]);
+    int16x8_t tmp11 = vsubq_s16(d[0], d[4]);
+    int16x8_t tmp13 = vaddq_s16(d[2], d[6]);
+    int16x8_t t26 = vsubq_s16(d[2], d[6]);
+    int16x8_t tmp12 = vsubq_s16(vaddq_s16(t26, mul(t26, kC1414)), tmp13);
+    int16x8_t tmp0 = vaddq_s16(tmp10, tmp13);
+    int16x8_t tmp3 = vsubq_s16(tmp10, tmp13);
+    int16x8_t tmp1 = vaddq_s16(tmp11, tmp12);
+    int16x8_t tmp2 = vsubq_s16(tmp11, tmp12);
+
+    int16x8_t z13 = vaddq_s16(d[5], d[3]);
+    int16x8_t z10 = vsubq_s16(d[5], d[3]);
+    int16x8_t z11 = vaddq_s16(d[1], d[7]);
+    int16x8_t z12 = vsubq_s16(d[1], d[7]);
+    int16x8_t tmp7 = vaddq_s16(z11, z13);
+    int16x8_t t1113 = vsubq_s16(z11, z13);
+    tmp11 = vaddq_s16(t1113, mul(t1113, kC1414));
+    int16x8_t t1012 = vaddq_s16(z10, z12);
+    int16x8_t z5 = vaddq_s16(t1012, mul(t1012, kC1847));
+    tmp10 = vsubq_s16(vaddq_s16(z12, mul(z12, kC1082)), z5);
+    tmp12 = vsubq_s16(z5, vaddq_s16(vaddq_s16(z10, z10), mul(z10, kC2613)));
+    int16x8_t tmp6 = vsubq_s16(tmp12, tmp7);
+    int16x8_t tmp5 = vsubq_s16(tmp11, tmp6);
+    int16x8_t tmp4 = vaddq_s16(tmp10, tmp5);
+
+    d[0] = vaddq_s16(tmp0, tmp7);
+    d[7] = vsubq_s16(tmp0, tmp7);
+    d[1] = vaddq_s16(tmp1, tmp6);
+    d[6] = vsubq_s16(tmp1, tmp6);
+    d[2] = vaddq_s16(tmp2, tmp5);
+    d[5] = vsubq_s16(tmp2, tmp5);
+    d[4] = vaddq_s16(tmp3, tmp4);
+    d[3] = vsubq_s16(tmp3, tmp4);
+}
+
+inline int16x8_t combineLow(int32x4_t a, int32x4_t b)
+{
+    return vreinterpretq_s16_s32(vcombine_s32(vget_low_s32(a), vget_low_s32(b)));
+}
+
+inline int16x8_t combineHigh(int32x4_t a, int32x4_t b)
+{
+    return vreinterpretq_s16_s32(vcombine_s32(vget_high_s32(a), vget_high_s32(b)));
+}
+
+// rows in, columns out
+inline void transposeNeon(int16x8_t r[8])
+{
+    int16x8x2_t t01 = vtrnq_s16(r[0], r[1]);
+    int16x8x2_t t23 = vtrnq_s16(r[2], r[3]);
+    int16x8x2_t t45 = vtrnq_s16(r[4], r[5]);
+    int16x8x2_t t67 = vtrnq_s16(r[6], r[7]);
+    int32x4x2_t u02 = vtrnq_s32(vreinterpretq_s32_s16(t01.val[0]), vreinterpretq_s32_s16(t23.val[0]));
+    int32x4x2_t u13 = vtrnq_s32(vreinterpretq_s32_s16(t01.val[1]), vreinterpretq_s32_s16(t23.val[1]));
+    int32x4x2_t u46 = vtrnq_s32(vreinterpretq_s32_s16(t45.val[0]), vreinterpretq_s32_s16(t67.val[0]));
+    int32x4x2_t u57 = vtrnq_s32(vreinterpretq_s32_s16(t45.val[1]), vreinterpretq_s32_s16(t67.val[1]));
+    r[0] = combineLow(u02.val[0], u46.val[0]);
+    r[1] = combineLow(u13.val[0], u57.val[0]);
+    r[2] = combineLow(u02.val[1], u46.val[1]);
+    r[3] = combineLow(u13.val[1], u57.val[1]);
+    r[4] = combineHigh(u02.val[0], u46.val[0]);
+    r[5] = combineHigh(u13.val[0], u57.val[0]);
+    r[6] = combineHigh(u02.val[1], u46.val[1]);
+    r[7] = combineHigh(u13.val[1], u57.val[1]);
+}
+
+#else
+
+inline int16_t mul(int16_t x, int16_t c)
+{
+    return static_cast<int16_t>((x * c) >> 15);
+}
+
+/*
+ * Scalar IDCT pass, in place on 16 bit values like the NEON lanes (the
+ * sums wrap the same way): the 8 inputs of transform n are
+ * d[n * next + k * step].
+ */
+void idctPass(int16_t *d, int step, int next)
+{
+    for (int n = 0; n < 8; n++, d += next) {
+        int16_t tmp10 = d[0] + d[4 * step];
+        int16_t tmp11 = d[0] - d[4 * step];
+        int16_t tmp13 = d[2 * step] + d[6 * step];
+        int16_t t26 = d[2 * step] - d[6 * step];
+        int16_t tmp12 = static_cast<int16_t>(t26 + mul(t26, kC1414)) - tmp13;
+        int16_t tmp0 = tmp10 + tmp13;
+        int16_t tmp3 = tmp10 - tmp13;
+        int16_t tmp1 = tmp11 + tmp12;
+        int16_t tmp2 = tmp11 - tmp12;
+
+        int16_t z13 = d[5 * step] + d[3 * step];
+        int16_t z10 = d[5 * step] - d[3 * step];
+        int16_t z11 = d[step] + d[7 * step];
+        int16_t z12 = d[step] - d[7 * step];
+        int16_t tmp7 = z11 + z13;
+        int16_t t1113 = z11 - z13;
+        tmp11 = t1113 + mul(t1113, kC1414);
+        int16_t t1012 = z10 + z12;
+        int16_t z5 = t1012 + mul(t1012, kC1847);
+        tmp10 = static_cast<int16_t>(z12 + mul(z12, kC1082)) - z5;
+        int16_t z10x2 = z10 + z10;
+        tmp12 = z5 - static_cast<int16_t>(z10x2 + mul(z10, kC2613));
+        int16_t tmp6 = tmp12 - tmp7;
+        int16_t tmp5 = tmp11 - tmp6;
+        int16_t tmp4 = tmp10 + tmp5;
+
+        d[0] = tmp0 + tmp7;
+        d[7 * step] = tmp0 - tmp7;
+        d[step] = tmp1 + tmp6;
+        d[6 * step] = tmp1 - tmp6;
+        d[2 * step] = tmp2 + tmp5;
+        d[5 * step] = tmp2 - tmp5;
+        d[4 * step] = tmp3 + tmp4;
+        d[3 * step] = tmp3 - tmp4;
+    }
+}
+
+#endif
+
+inline uint8_t descale(int16_t x)
+{
+    int v = static_cast<int16_t>(x + (1 << (kDescale - 1))) >> kDescale;
+    v += 128;
+    return static_cast<uint8_t>(v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+}
+
+void idctTable(const uint16_t *quant, int16_t *table)
+{
+    double aan[8];
+    for (int k = 0; k < 8; k++) {
+        aan[k] = k == 0 ? 1.0 : std::sqrt(2.0) * std::cos(k * std::acos(-1.0) / 16);
+    }
+    for (int k = 0; k < 64; k++) {
+        int n = kJpegZigzag[k];
+        table[k] = static_cast<int16_t>(std::lround(quant[k] * aan[n / 8] * aan[n % 8] * (1 << kScaleBits)));
+    }
+}
+
+void idctBlock(const int16_t *coef, const int16_t *table, uint8_t *out, uint32_t stride)
+{
+    int16_t blk[64] = {};
+    int16_t ac = 0;
+    for (int k = 1; k < 64; k++) {
+        blk[kJpegZigzag[k]] = static_cast<int16_t>(coef[k] * table[k]);
+        ac |= coef[k];
+    }
+    blk[0] = static_cast<int16_t>(coef[0] * table[0]);
+
+    // flat blocks are common on a desktop; both passes would give blk[0] everywhere
+    if (ac == 0) {
+        uint8_t v = descale(blk[0]);
+        for (int y = 0; y < 8; y++) {
+            for (int x = 0; x < 8; x++) {
+                out[y * stride + x] = v;
+            }
+        }
+        return;
+    }
+
+#ifdef IDCT_NEON
+    int16x8_t r[8];
+    for (int i = 0; i < 8; i++) {
+        r[i] = vld1q_s16(blk + i * 8);
+    }
+    idctPassNeon(r);        // columns
+    transposeNeon(r);
+    idctPassNeon(r);        // rows
+    transposeNeon(r);
+    const int16x8_t bias = vdupq_n_s16(1 << (kDescale - 1));
+    const int16x8_t level = vdupq_n_s16(128);
+    for (int i = 0; i < 8; i++) {
+        int16x8_t v = vaddq_s16(vshrq_n_s16(vaddq_s16(r[i], bias), kDescale), level);
+        vst1_u8(out + i * stride, vqmovun_s16(v));
+    }
+#else
+    idctPass(blk, 8, 1);    // columns
+    idctPass(blk, 1, 8);    // rows
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            out[y * stride + x] = descale(blk[y * 8 + x]);
+        }
+    }
+#endif
+}
+
+bool idctHasNeon()
+{
+#ifdef IDCT_NEON
+    return true;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,23 @@
+#ifndef IDCT_H
+#define IDCT_H
+
+#include <cstdint>
+
+/*
+ * Fast inverse DCT for turning stripes back into pixels, the counterpart of
+ * the FDCT in sw_encoder.cpp: AAN (jidctfst) in 16 bit, the AAN scale
+ * folded into the dequantization table, rotations in Q15 as taken by
+ * vqdmulh. The NEON kernel and the scalar one compute exactly the same;
+ * against the exact IDCT of CoefImage::toPlanes samples are off by a few
+ * levels at most.
+ */
+
+// quant in zigzag order (CoefImage::quant) -> dequantization table for idctBlock
+void idctTable(const uint16_t *quant, int16_t *table);
+
+// one block of coefficients in zigzag order to 8x8 samples
+void idctBlock(const int16_t *coef, const int16_t *table, uint8_t *out, uint32_t stride);
+
+bool idctHasNeon();
+
+#endif
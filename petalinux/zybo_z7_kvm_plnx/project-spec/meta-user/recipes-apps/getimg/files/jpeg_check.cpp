@@ -0,0 +1,266 @@
+#include "jpeg_check.h"
+
+#include <cstring>
+
+namespace {
+
+const uint8_t kMarkerSof0 = 0xC0;
+const uint8_t kMarkerDht = 0xC4;
+const uint8_t kMarkerSoi = 0xD8;
+const uint8_t kMarkerEoi = 0xD9;
+const uint8_t kMarkerSos = 0xDA;
+const uint8_t kMarkerDqt = 0xDB;
+const uint8_t kMarkerApp0 = 0xE0;
+const uint8_t kMarkerApp15 = 0xEF;
+const uint8_t kMarkerCom = 0xFE;
+
+inline uint32_t be16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+const char *const kStatusNames[] = {
+    "incomplete",
+    "ok",
+    "bad_length",
+    "no_soi",
+    "bad_marker",
+    "bad_segment",
+    "bad_tables",
+    "bad_frame",
+    "bad_size",
+    "bad_scan",
+    "bad_stuffing",
+    "no_eoi",
+};
+
+static_assert(sizeof(kStatusNames) / sizeof(kStatusNames[0]) == static_cast<size_t>(JpegStatus::kNumStatus),
+              "kStatusNames out of sync with JpegStatus");
+
+}
+
+const char *jpegStatusName(JpegStatus status)
+{
+    return kStatusNames[static_cast<int>(status)];
+}
+
+JpegChecker::JpegChecker(const uint8_t *buf, uint32_t length, uint32_t maxLength,
+                         uint16_t width, uint16_t height) :
+    m_buf { buf },
+    m_length { length },
+    m_width { width },
+    m_height { height },
+    m_pos { 0 },
+    m_inScan { false },
+    m_status { JpegStatus::kIncomplete },
+    m_frameWidth { 0 },
+    m_frameHeight { 0 },
+    m_numComp { 0 },
+    m_dqtMask { 0 },
+    m_dhtMask { 0 }
+{
+    if (length < kMinLength || length > maxLength) {
+        m_status = JpegStatus::kBadLength;
+    }
+}
+
+JpegStatus JpegChecker::advance(uint32_t available)
+{
+    if (m_status != JpegStatus::kIncomplete) {
+        return m_status;
+    }
+    if (available > m_length) {
+        available = m_length;
+    }
+    if (!m_inScan) {
+        m_status = parseHeader(available);
+    }
+    if (m_inScan && m_status == JpegStatus::kIncomplete) {
+        m_status = scanEntropy(available);
+    }
+    return m_status;
+}
+
+JpegStatus JpegChecker::parseHeader(uint32_t available)
+{
+    if (m_pos == 0) {
+        if (available < 2) {
+            return JpegStatus::kIncomplete;
+        }
+        if (m_buf[0] != 0xFF || m_buf[1] != kMarkerSoi) {
+            return JpegStatus::kNoSoi;
+        }
+        m_pos = 2;
+    }
+
+    // the header segments are parsed only once they are complete
+    while (m_pos + 4 <= available) {
+        const uint8_t *p = m_buf + m_pos;
+        if (p[0] != 0xFF) {
+            return JpegStatus::kBadMarker;
+        }
+        uint8_t marker = p[1];
+        uint32_t segLength = be16(p + 2);
+        uint32_t end = m_pos + 2 + segLength;
+        // leave room for EOI
+        if (segLength < 2 || end + 2 > m_length) {
+            return JpegStatus::kBadSegment;
+        }
+        if (end > available) {
+            return JpegStatus::kIncomplete;
+        }
+
+        JpegStatus st = JpegStatus::kIncomplete;
+        if (marker == kMarkerDqt || marker == kMarkerDht) {
+            st = parseTables(marker, m_pos + 4, end);
+        } else if (marker == kMarkerSof0) {
+            st = parseFrame(m_pos + 4, end);
+        } else if (marker == kMarkerSos) {
+            st = parseScan(m_pos + 4, end);
+        } else if ((marker < kMarkerApp0 || marker > kMarkerApp15) && marker != kMarkerCom) {
+            // anything else (progressive/lossless SOFn, DRI, DNL...) is never
+            // produced by the encoder, so treat it as garbage
+            return JpegStatus::kBadMarker;
+        }
+        if (st != JpegStatus::kIncomplete) {
+            return st;
+        }
+
+        m_pos = end;
+        if (marker == kMarkerSos) {
+            m_inScan = true;
+            return JpegStatus::kIncomplete;
+        }
+    }
+    // all data seen, but no SOS
+    return available == m_length ? JpegStatus::kBadSegment : JpegStatus::kIncomplete;
+}
+
+JpegStatus JpegChecker::parseTables(uint8_t marker, uint32_t pos, uint32_t end)
+{
+    while (pos < end) {
+        uint8_t tc = m_buf[pos] >> 4;
+        uint8_t th = m_buf[pos] & 0x0F;
+        if (marker == kMarkerDqt) {
+            // 8 bit precision only
+            if (tc != 0 || th > 3) {
+                return JpegStatus::kBadTables;
+            }
+            m_dqtMask |= 1 << th;
+            pos += 1 + 64;
+        } else {
+            if (tc > 1 || th > 3 || pos + 17 > end) {
+                return JpegStatus::kBadTables;
+            }
+            uint32_t count = 0;
+            for (int i = 1; i <= 16; i++) {
+                count += m_buf[pos + i];
+            }
+            if (count == 0 || count > (tc ? 162u : 12u)) {
+                return JpegStatus::kBadTables;
+            }
+            m_dhtMask |= 1 << (4 * tc + th);
+            pos += 17 + count;
+        }
+    }
+    return pos == end ? JpegStatus::kIncomplete : JpegStatus::kBadTables;
+}
+
+JpegStatus JpegChecker::parseFrame(uint32_t pos, uint32_t end)
+{
+    if (m_numComp != 0 || end - pos < 6) {
+        return JpegStatus::kBadFrame;
+    }
+    const uint8_t *p = m_buf + pos;
+    uint8_t numComp = p[5];
+    if (p[0] != 8 || (numComp != 1 && numComp != 3) || end - pos != 6u + 3u * numComp) {
+        return JpegStatus::kBadFrame;
+    }
+    m_frameHeight = be16(p + 1);
+    m_frameWidth = be16(p + 3);
+    if (m_frameWidth == 0 || m_frameHeight == 0) {
+        return JpegStatus::kBadFrame;
+    }
+    if ((m_width && m_frameWidth != m_width) || (m_height && m_frameHeight != m_height)) {
+        return JpegStatus::kBadSize;
+    }
+    for (int i = 0; i < numComp; i++) {
+        const uint8_t *c = p + 6 + 3 * i;
+        uint8_t h = c[1] >> 4;
+        uint8_t v = c[1] & 0x0F;
+        if (h < 1 || h > 4 || v < 1 || v > 4 || c[2] > 3) {
+            return JpegStatus::kBadFrame;
+        }
+        m_compId[i] = c[0];
+        m_compTq[i] = c[2];
+    }
+    m_numComp = numComp;
+    return JpegStatus::kIncomplete;
+}
+
+JpegStatus JpegChecker::parseScan(uint32_t pos, uint32_t end)
+{
+    if (m_numComp == 0) {
+        return JpegStatus::kBadFrame;
+    }
+    const uint8_t *p = m_buf + pos;
+    uint8_t numComp = p[0];
+    // single, interleaved scan over all components
+    if (numComp != m_numComp || end - pos != 4u + 2u * numComp) {
+        return JpegStatus::kBadScan;
+    }
+    for (int i = 0; i < numComp; i++) {
+        uint8_t td = p[2 + 2 * i] >> 4;
+        uint8_t ta = p[2 + 2 * i] & 0x0F;
+        if (p[1 + 2 * i] != m_compId[i] || td > 3 || ta > 3) {
+            return JpegStatus::kBadScan;
+        }
+        if (!(m_dhtMask & (1 << td)) || !(m_dhtMask & (1 << (4 + ta))) || !(m_dqtMask & (1 << m_compTq[i]))) {
+            return JpegStatus::kBadTables;
+        }
+    }
+    const uint8_t *s = p + 1 + 2 * numComp;
+    if (s[0] != 0 || s[1] != 63 || s[2] != 0) {
+        return JpegStatus::kBadScan;
+    }
+    return JpegStatus::kIncomplete;
+}
+
+JpegStatus JpegChecker::scanEntropy(uint32_t available)
+{
+    const uint8_t *p = m_buf + m_pos;
+    const uint8_t *end = m_buf + available;
+
+    while (p < end) {
+        const uint8_t *ff = static_cast<const uint8_t *>(memchr(p, 0xFF, end - p));
+        if (ff == nullptr) {
+            p = end;
+            break;
+        }
+        if (ff + 1 == end) {
+            // look at the byte after 0xFF with the next chunk
+            p = ff;
+            break;
+        }
+        if (ff[1] == 0x00) {
+            p = ff + 2;
+            continue;
+        }
+        if (ff[1] == kMarkerEoi && ff + 2 == m_buf + m_length) {
+            m_pos = m_length;
+            return JpegStatus::kOk;
+        }
+        // no restart intervals are used, so any other marker (including an
+        // early EOI) means the stripe is truncated or corrupt
+        return ff[1] == kMarkerEoi ? JpegStatus::kNoEoi : JpegStatus::kBadStuffing;
+    }
+
+    m_pos = p - m_buf;
+    return available == m_length ? JpegStatus::kNoEoi : JpegStatus::kIncomplete;
+}
+
+JpegStatus checkJpeg(const uint8_t *buf, uint32_t length, uint16_t width, uint16_t height)
+{
+    JpegChecker checker { buf, length, length, width, height };
+    return checker.advance(length);
+}
@@ -0,0 +1,86 @@
+#ifndef JPEG_CHECK_H
+#define JPEG_CHECK_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Structural check of the baseline JPEG stripes written by the mkjpeg
+ * encoders. Meant to run inside the copy loop: call advance() whenever
+ * another chunk has landed in the destination buffer, and only the bytes
+ * not seen yet are looked at (while they are still in cache).
+ */
+
+enum class JpegStatus {
+    kIncomplete,    // need more data
+    kOk,
+    kBadLength,     // length word out of range (e.g. override_enc_size)
+    kNoSoi,
+    kBadMarker,     // not a marker where one was due, or unexpected marker
+    kBadSegment,    // segment length runs past the end of the image
+    kBadTables,     // DQT/DHT malformed, or referenced table missing
+    kBadFrame,      // SOF0 malformed, or not a baseline frame
+    kBadSize,       // SOF0 size does not match the detected resolution
+    kBadScan,       // SOS malformed
+    kBadStuffing,   // 0xFF in entropy coded data not followed by 0x00
+    kNoEoi,         // data ends without EOI, or EOI before the end
+    kNumStatus
+};
+
+const char *jpegStatusName(JpegStatus status);
+
+class JpegChecker
+{
+public:
+    static const uint32_t kMinLength = 2 + 4 + 4 + 2;  // SOI, SOF0, SOS and EOI, at least
+
+    // width/height of 0 skip the SOF0 size check
+    JpegChecker(const uint8_t *buf, uint32_t length, uint32_t maxLength,
+                uint16_t width = 0, uint16_t height = 0);
+
+    // buf[0, available) is valid; returns kIncomplete until a verdict is reached
+    JpegStatus advance(uint32_t available);
+
+    JpegStatus status() const
+    {
+        return m_status;
+    }
+
+    uint16_t width() const
+    {
+        return m_frameWidth;
+    }
+
+    uint16_t height() const
+    {
+        return m_frameHeight;
+    }
+
+private:
+    JpegStatus parseHeader(uint32_t available);
+    JpegStatus parseTables(uint8_t marker, uint32_t pos, uint32_t end);
+    JpegStatus parseFrame(uint32_t pos, uint32_t end);
+    JpegStatus parseScan(uint32_t pos, uint32_t end);
+    JpegStatus scanEntropy(uint32_t available);
+
+    const uint8_t *m_buf;
+    uint32_t m_length;
+    uint16_t m_width;
+    uint16_t m_height;
+    uint32_t m_pos;
+    bool m_inScan;
+    JpegStatus m_status;
+
+    uint16_t m_frameWidth;
+    uint16_t m_frameHeight;
+    uint8_t m_numComp;
+    uint8_t m_compId[4];
+    uint8_t m_compTq[4];
+    uint8_t m_dqtMask;      // bit n: quantization table n defined
+    uint8_t m_dhtMask;      // bit n: DC table n, bit 4+n: AC table n
+};
+
+// one-shot check of a complete buffer
+JpegStatus checkJpeg(const uint8_t *buf, uint32_t length, uint16_t width = 0, uint16_t height = 0);
+
+#endif
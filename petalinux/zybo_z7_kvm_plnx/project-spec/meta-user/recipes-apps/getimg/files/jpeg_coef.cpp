@@ -0,0 +1,498 @@
+#include "jpeg_coef.h"
+
+#include <cmath>
+#include <cstring>
+
+#include "bit_writer.h"
+
+const uint8_t kJpegZigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63
+};
+
+namespace {
+
+const int kFastBits = 9;
+const uint32_t kMaxBlockBytes = 64 * 27 / 8 * 2;   // 27 bit per coefficient, all stuffed
+
+inline uint16_t readBe16(const uint8_t *p)
+{
+    return static_cast<uint16_t>(p[0] << 8 | p[1]);
+}
+
+// F.2.2.1 EXTEND: the additional bits of a magnitude category to the value
+inline int32_t extend(uint32_t bits, int size)
+{
+    return bits < (1u << (size - 1)) ? static_cast<int32_t>(bits) - (1 << size) + 1 : static_cast<int32_t>(bits);
+}
+
+}
+
+/*
+ * MSB first, stuffed 0x00 after 0xFF dropped. At a marker (the EOI) the
+ * reader keeps returning zero bits; a valid scan never consumes them, since
+ * the encoder pads its last byte with ones.
+ */
+class CoefImage::BitReader
+{
+public:
+    BitReader(const uint8_t *data, const uint8_t *end) :
+        m_p { data },
+        m_end { end },
+        m_acc { 0 },
+        m_bits { 0 },
+        m_pad { 0 }
+    {
+        fill();
+    }
+
+    // at least 32 bits available afterwards
+    void fill()
+    {
+        while (m_bits <= 56) {
+            uint32_t b = 0;
+            if (m_p < m_end && !(m_p[0] == 0xFF && (m_p + 1 >= m_end || m_p[1] != 0x00))) {
+                b = *m_p;
+                m_p += b == 0xFF ? 2 : 1;
+            } else {
+                m_pad += 8;
+            }
+            m_acc |= static_cast<uint64_t>(b) << (56 - m_bits);
+            m_bits += 8;
+        }
+    }
+
+    uint32_t peek(int n) const
+    {
+        return static_cast<uint32_t>(m_acc >> (64 - n));
+    }
+
+    void skip(int n)
+    {
+        m_acc <<= n;
+        m_bits -= n;
+    }
+
+    uint32_t get(int n)
+    {
+        if (n == 0) {
+            return 0;
+        }
+        uint32_t v = peek(n);
+        skip(n);
+        return v;
+    }
+
+    bool overrun() const
+    {
+        return m_pad > m_bits;
+    }
+
+private:
+    const uint8_t *m_p;
+    const uint8_t *m_end;
+    uint64_t m_acc;
+    int m_bits;
+    int m_pad;
+};
+
+CoefImage::CoefImage() :
+    m_width { 0 },
+    m_height { 0 },
+    m_hMax { 1 },
+    m_vMax { 1 },
+    m_sizeOffset { 0 }
+{
+    memset(m_quant, 0, sizeof(m_quant));
+    memset(m_dec, 0, sizeof(m_dec));
+    memset(m_enc, 0, sizeof(m_enc));
+}
+
+bool CoefImage::buildTable(int index, const uint8_t *bits, const uint8_t *vals, int numVals)
+{
+    HuffDecode &dec = m_dec[index];
+    HuffEncode &enc = m_enc[index];
+    memset(&dec, 0, sizeof(dec));
+    memset(&enc, 0, sizeof(enc));
+    memcpy(dec.vals, vals, numVals);
+
+    int32_t code = 0;
+    int k = 0;
+    for (int len = 1; len <= 16; len++) {
+        int count = bits[len - 1];
+        dec.valOffset[len] = k - code;
+        dec.maxCode[len] = count ? code + count - 1 : -1;
+        for (int i = 0; i < count; i++, k++, code++) {
+            if (code >= (1 << len)) {
+                return false;
+            }
+            enc.code[vals[k]] = code;
+            enc.size[vals[k]] = len;
+            if (len <= kFastBits) {
+                int shift = kFastBits - len;
+                for (int j = 0; j < (1 << shift); j++) {
+                    dec.fast[(code << shift) + j] = static_cast<uint16_t>(len << 8 | vals[k]);
+                }
+            }
+        }
+        code <<= 1;
+    }
+    dec.maxCode[17] = 0x7FFFFFFF;
+    return true;
+}
+
+int CoefImage::decodeSymbol(BitReader &br, const HuffDecode &table) const
+{
+    uint16_t fast = table.fast[br.peek(kFastBits)];
+    if (fast != 0) {
+        br.skip(fast >> 8);
+        return fast & 0xFF;
+    }
+    for (int len = kFastBits + 1; len <= 16; len++) {
+        int32_t code = br.peek(len);
+        if (code <= table.maxCode[len]) {
+            br.skip(len);
+            return table.vals[table.valOffset[len] + code];
+        }
+    }
+    return -1;
+}
+
+bool CoefImage::parseSegments(const uint8_t *jpeg, uint32_t length, uint32_t &scanStart)
+{
+    if (length < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8) {
+        return false;
+    }
+    uint8_t dqtMask = 0;
+    uint8_t dhtMask = 0;
+    bool haveFrame = false;
+    uint32_t pos = 2;
+    while (true) {
+        if (pos + 4 > length || jpeg[pos] != 0xFF) {
+            return false;
+        }
+        uint8_t marker = jpeg[pos + 1];
+        if (marker == 0xFF) {
+            pos++;          // fill byte
+            continue;
+        }
+        uint32_t segLen = readBe16(jpeg + pos + 2);
+        if (segLen < 2 || pos + 2 + segLen > length) {
+            return false;
+        }
+        const uint8_t *seg = jpeg + pos + 4;
+        uint32_t n = segLen - 2;
+
+        if (marker == 0xDB) {
+            for (uint32_t i = 0; i < n;) {
+                int pq = seg[i] >> 4;
+                int tq = seg[i] & 0x0F;
+                uint32_t size = pq ? 128 : 64;
+                if (pq > 1 || tq > 3 || i + 1 + size > n) {
+                    return false;
+                }
+                for (int k = 0; k < 64; k++) {
+                    m_quant[tq][k] = pq ? readBe16(seg + i + 1 + 2 * k) : seg[i + 1 + k];
+                }
+                dqtMask |= 1 << tq;
+                i += 1 + size;
+            }
+        } else if (marker == 0xC4) {
+            for (uint32_t i = 0; i < n;) {
+                int tc = seg[i] >> 4;
+                int th = seg[i] & 0x0F;
+                if (tc > 1 || th > 3 || i + 17 > n) {
+                    return false;
+                }
+                int numVals = 0;
+                for (int len = 0; len < 16; len++) {
+                    numVals += seg[i + 1 + len];
+                }
+                if (numVals > 256 || i + 17 + numVals > n ||
+                    !buildTable(tc * 4 + th, seg + i + 1, seg + i + 17, numVals)) {
+                    return false;
+                }
+                dhtMask |= 1 << (tc * 4 + th);
+                i += 17 + numVals;
+            }
+        } else if (marker == 0xC0 || marker == 0xC1) {
+            if (n < 6 || seg[0] != 8) {
+                return false;
+            }
+            m_height = readBe16(seg + 1);
+            m_width = readBe16(seg + 3);
+            int nf = seg[5];
+            if (m_height == 0 || m_width == 0 || nf < 1 || nf > 4 || n != 6u + 3 * nf) {
+                return false;
+            }
+            m_sizeOffset = pos + 5;
+            m_comps.assign(nf, CoefComponent());
+            m_hMax = m_vMax = 1;
+            for (int c = 0; c < nf; c++) {
+                CoefComponent &comp = m_comps[c];
+                comp.id = seg[6 + 3 * c];
+                comp.h = seg[7 + 3 * c] >> 4;
+                comp.v = seg[7 + 3 * c] & 0x0F;
+                comp.tq = seg[8 + 3 * c];
+                if (comp.h < 1 || comp.h > 4 || comp.v < 1 || comp.v > 4 || comp.tq > 3) {
+                    return false;
+                }
+                m_hMax = comp.h > m_hMax ? comp.h : m_hMax;
+                m_vMax = comp.v > m_vMax ? comp.v : m_vMax;
+            }
+            haveFrame = true;
+        } else if (marker == 0xDA) {
+            // one scan with all components, in frame order
+            if (!haveFrame || n < 1 || seg[0] != m_comps.size() || n != 4 + 2 * m_comps.size()) {
+                return false;
+            }
+            for (size_t c = 0; c < m_comps.size(); c++) {
+                CoefComponent &comp = m_comps[c];
+                if (seg[1 + 2 * c] != comp.id) {
+                    return false;
+                }
+                comp.td = seg[2 + 2 * c] >> 4;
+                comp.ta = seg[2 + 2 * c] & 0x0F;
+                if (comp.td > 3 || comp.ta > 3 || !(dqtMask & (1 << comp.tq)) ||
+                    !(dhtMask & (1 << comp.td)) || !(dhtMask & (1 << (4 + comp.ta)))) {
+                    return false;
+                }
+            }
+            const uint8_t *sel = seg + 1 + 2 * m_comps.size();
+            if (sel[0] != 0 || sel[1] != 63 || sel[2] != 0) {
+                return false;
+            }
+            scanStart = pos + 2 + segLen;
+            return true;
+        } else if (marker == 0xDD) {
+            if (n < 2 || readBe16(seg) != 0) {
+                return false;   // restart intervals
+            }
+        } else if ((marker >= 0xC2 && marker <= 0xCF) || marker == 0xD8 || marker == 0xD9) {
+            return false;       // progressive, lossless, arithmetic, or out of place
+        }
+        pos += 2 + segLen;
+    }
+}
+
+void CoefImage::resize(uint16_t width, uint16_t height)
+{
+    m_width = width;
+    m_height = height;
+    uint32_t mcusX = (width + mcuWidth() - 1) / mcuWidth();
+    uint32_t mcusY = (height + mcuHeight() - 1) / mcuHeight();
+    for (CoefComponent &comp : m_comps) {
+        comp.blocksX = mcusX * comp.h;
+        comp.blocksY = mcusY * comp.v;
+        comp.coef.assign(static_cast<size_t>(comp.blocksX) * comp.blocksY * 64, 0);
+    }
+}
+
+bool CoefImage::decode(const uint8_t *jpeg, uint32_t length, uint32_t lines)
+{
+    uint32_t scanStart = 0;
+    if (!parseSegments(jpeg, length, scanStart)) {
+        return false;
+    }
+    m_header.assign(jpeg, jpeg + scanStart);
+    resize(m_width, m_height);
+
+    BitReader br { jpeg + scanStart, jpeg + length };
+    int32_t pred[4] = { 0, 0, 0, 0 };
+    uint32_t mcusX = m_comps[0].blocksX / m_comps[0].h;
+    uint32_t mcusY = m_comps[0].blocksY / m_comps[0].v;
+    if (lines < m_height) {
+        mcusY = (lines + mcuHeight() - 1) / mcuHeight();
+    }
+    for (uint32_t my = 0; my < mcusY; my++) {
+        for (uint32_t mx = 0; mx < mcusX; mx++) {
+            for (size_t c = 0; c < m_comps.size(); c++) {
+                CoefComponent &comp = m_comps[c];
+                const HuffDecode &dc = m_dec[comp.td];
+                const HuffDecode &ac = m_dec[4 + comp.ta];
+                for (uint32_t by = 0; by < comp.v; by++) {
+                    for (uint32_t bx = 0; bx < comp.h; bx++) {
+                        int16_t *zz = comp.block(mx * comp.h + bx, my * comp.v + by);
+                        br.fill();
+                        int s = decodeSymbol(br, dc);
+                        if (s < 0 || s > 11) {
+                            return false;
+                        }
+                        pred[c] += s ? extend(br.get(s), s) : 0;
+                        zz[0] = static_cast<int16_t>(pred[c]);
+                        for (int k = 1; k < 64; k++) {
+                            br.fill();
+                            int rs = decodeSymbol(br, ac);
+                            if (rs < 0) {
+                                return false;
+                            }
+                            int run = rs >> 4;
+                            int size = rs & 0x0F;
+                            if (size == 0) {
+                                if (run != 15) {
+                                    break;      // EOB
+                                }
+                                k += 15;        // ZRL
+                                continue;
+                            }
+                            k += run;
+                            if (k > 63) {
+                                return false;
+                            }
+                            zz[k] = static_cast<int16_t>(extend(br.get(size), size));
+                        }
+                    }
+                }
+            }
+            if (br.overrun()) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool CoefImage::sameTables(const CoefImage &other) const
+{
+    if (m_header.size() != other.m_header.size() || m_sizeOffset != other.m_sizeOffset) {
+        return false;
+    }
+    return memcmp(m_header.data(), other.m_header.data(), m_sizeOffset) == 0 &&
+           memcmp(&m_header[m_sizeOffset + 4], &other.m_header[m_sizeOffset + 4],
+                  m_header.size() - m_sizeOffset - 4) == 0;
+}
+
+uint32_t CoefImage::encode(uint8_t *out, uint32_t capacity) const
+{
+    if (m_header.empty()) {
+        return 0;
+    }
+    uint32_t blocksPerMcu = 0;
+    for (const CoefComponent &comp : m_comps) {
+        blocksPerMcu += comp.h * comp.v;
+    }
+    const uint32_t reserve = blocksPerMcu * kMaxBlockBytes + 14 + 2;
+    if (capacity < m_header.size() + reserve) {
+        return 0;
+    }
+
+    memcpy(out, m_header.data(), m_header.size());
+    out[m_sizeOffset] = m_height >> 8;
+    out[m_sizeOffset + 1] = m_height & 0xFF;
+    out[m_sizeOffset + 2] = m_width >> 8;
+    out[m_sizeOffset + 3] = m_width & 0xFF;
+
+    BitWriter bw { out + m_header.size() };
+    const uint8_t *limit = out + capacity - reserve;
+    int32_t pred[4] = { 0, 0, 0, 0 };
+    uint32_t mcusX = m_comps[0].blocksX / m_comps[0].h;
+    uint32_t mcusY = m_comps[0].blocksY / m_comps[0].v;
+    for (uint32_t my = 0; my < mcusY; my++) {
+        for (uint32_t mx = 0; mx < mcusX; mx++) {
+            if (bw.position() > limit) {
+                return 0;
+            }
+            for (size_t c = 0; c < m_comps.size(); c++) {
+                const CoefComponent &comp = m_comps[c];
+                const HuffEncode &dc = m_enc[comp.td];
+                const HuffEncode &ac = m_enc[4 + comp.ta];
+                for (uint32_t by = 0; by < comp.v; by++) {
+                    for (uint32_t bx = 0; bx < comp.h; bx++) {
+                        const int16_t *zz = comp.block(mx * comp.h + bx, my * comp.v + by);
+                        int32_t diff = zz[0] - pred[c];
+                        pred[c] = zz[0];
+                        uint32_t mag = diff < 0 ? -diff : diff;
+                        int size = mag ? 32 - __builtin_clz(mag) : 0;
+                        uint32_t bits = static_cast<uint32_t>(diff < 0 ? diff - 1 : diff) & ((1u << size) - 1);
+                        bw.put(static_cast<uint32_t>(dc.code[size]) << size | bits, dc.size[size] + size);
+
+                        int run = 0;
+                        for (int k = 1; k < 64; k++) {
+                            int32_t x = zz[k];
+                            if (x == 0) {
+                                run++;
+                                continue;
+                            }
+                            while (run > 15) {
+                                bw.put(ac.code[0xF0], ac.size[0xF0]);     // ZRL
+                                run -= 16;
+                            }
+                            uint32_t a = x < 0 ? -x : x;
+                            int n = 32 - __builtin_clz(a);
+                            int sym = run << 4 | n;
+                            uint32_t v = static_cast<uint32_t>(x < 0 ? x - 1 : x) & ((1u << n) - 1);
+                            bw.put(static_cast<uint32_t>(ac.code[sym]) << n | v, ac.size[sym] + n);
+                            run = 0;
+                        }
+                        if (run != 0) {
+                            bw.put(ac.code[0x00], ac.size[0x00]);         // EOB
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    uint8_t *end = bw.finish();
+    *end++ = 0xFF;
+    *end++ = 0xD9;
+    return static_cast<uint32_t>(end - out);
+}
+
+/*
+ * Reference IDCT, in double precision; for the decode-resize-encode
+ * baseline, where speed does not matter.
+ */
+void CoefImage::toPlanes(std::vector<std::vector<uint8_t>> &planes) const
+{
+    double basis[8][8];     // [x][u]
+    for (int x = 0; x < 8; x++) {
+        for (int u = 0; u < 8; u++) {
+            basis[x][u] = (u == 0 ? std::sqrt(0.5) : 1.0) / 2 * std::cos((2 * x + 1) * u * std::acos(-1.0) / 16);
+        }
+    }
+
+    planes.resize(m_comps.size());
+    for (size_t c = 0; c < m_comps.size(); c++) {
+        const CoefComponent &comp = m_comps[c];
+        const uint16_t *q = m_quant[comp.tq];
+        uint32_t stride = comp.blocksX * 8;
+        planes[c].resize(static_cast<size_t>(stride) * comp.blocksY * 8);
+        for (uint32_t by = 0; by < comp.blocksY; by++) {
+            for (uint32_t bx = 0; bx < comp.blocksX; bx++) {
+                const int16_t *zz = comp.block(bx, by);
+                double f[64] = {};
+                for (int k = 0; k < 64; k++) {
+                    f[kJpegZigzag[k]] = zz[k] * q[k];
+                }
+                double tmp[64];     // rows: vertical frequency, columns: x
+                for (int v = 0; v < 8; v++) {
+                    for (int x = 0; x < 8; x++) {
+                        double s = 0;
+                        for (int u = 0; u < 8; u++) {
+                            s += basis[x][u] * f[v * 8 + u];
+                        }
+                        tmp[v * 8 + x] = s;
+                    }
+                }
+                uint8_t *dst = &planes[c][by * 8 * stride + bx * 8];
+                for (int y = 0; y < 8; y++) {
+                    for (int x = 0; x < 8; x++) {
+                        double s = 128;
+                        for (int v = 0; v < 8; v++) {
+                            s += basis[y][v] * tmp[v * 8 + x];
+                        }
+                        long p = std::lround(s);
+                        dst[y * stride + x] = static_cast<uint8_t>(p < 0 ? 0 : p > 255 ? 255 : p);
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,137 @@
+#ifndef JPEG_COEF_H
+#define JPEG_COEF_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * A baseline JPEG as quantized DCT coefficients: the entropy coded data of a
+ * stripe decoded into one plane of 8x8 blocks per component, and written
+ * back with the stripe's own header and Huffman tables. Transcoding in this
+ * domain (scaling, cropping) never goes through pixels.
+ *
+ * Handles what the mkjpeg encoders and SwEncoder write, and any other
+ * baseline, Huffman coded, interleaved JPEG without restart intervals.
+ */
+
+// zigzag position -> row-major index
+extern const uint8_t kJpegZigzag[64];
+
+struct CoefComponent
+{
+    uint8_t id;
+    uint8_t h;                      // sampling factors from SOF0
+    uint8_t v;
+    uint8_t tq;                     // quantization table
+    uint8_t td;                     // DC and AC Huffman tables, from SOS
+    uint8_t ta;
+    uint16_t blocksX;               // plane size, whole MCUs
+    uint16_t blocksY;
+    std::vector<int16_t> coef;      // 64 per block in zigzag order, blocks in raster order
+
+    int16_t *block(uint32_t bx, uint32_t by)
+    {
+        return &coef[(static_cast<size_t>(by) * blocksX + bx) * 64];
+    }
+
+    const int16_t *block(uint32_t bx, uint32_t by) const
+    {
+        return &coef[(static_cast<size_t>(by) * blocksX + bx) * 64];
+    }
+};
+
+class CoefImage
+{
+public:
+    CoefImage();
+
+    // false if not a JPEG this class handles, or the data is corrupt; with
+    // lines given, only the MCU rows covering that many lines are decoded
+    // (the rest of the blocks stays 0), 0 reads just the header
+    bool decode(const uint8_t *jpeg, uint32_t length, uint32_t lines = 0xFFFF);
+
+    // same header apart from the SOF0 size, i.e. same tables and layout
+    bool sameTables(const CoefImage &other) const;
+
+    // Sets the SOF0 size and sizes the planes for it, all coefficients 0.
+    // Tables and components are kept.
+    void resize(uint16_t width, uint16_t height);
+
+    // JPEG length, or 0 if it does not fit into capacity
+    uint32_t encode(uint8_t *out, uint32_t capacity) const;
+
+    // planar 8 bit samples, one plane per component, blocksX * 8 wide
+    void toPlanes(std::vector<std::vector<uint8_t>> &planes) const;
+
+    uint16_t width() const
+    {
+        return m_width;
+    }
+
+    uint16_t height() const
+    {
+        return m_height;
+    }
+
+    // pixels per MCU
+    uint16_t mcuWidth() const
+    {
+        return 8 * m_hMax;
+    }
+
+    uint16_t mcuHeight() const
+    {
+        return 8 * m_vMax;
+    }
+
+    // zigzag order
+    const uint16_t *quant(int table) const
+    {
+        return m_quant[table];
+    }
+
+    std::vector<CoefComponent> & components()
+    {
+        return m_comps;
+    }
+
+    const std::vector<CoefComponent> & components() const
+    {
+        return m_comps;
+    }
+
+private:
+    struct HuffDecode
+    {
+        uint16_t fast[512];         // next 9 bits: size << 8 | symbol, 0 if longer
+        int32_t maxCode[18];        // per length, -1 if none
+        int32_t valOffset[17];
+        uint8_t vals[256];
+    };
+
+    struct HuffEncode
+    {
+        uint16_t code[256];
+        uint8_t size[256];
+    };
+
+    class BitReader;
+
+    bool parseSegments(const uint8_t *jpeg, uint32_t length, uint32_t &scanStart);
+    bool buildTable(int index, const uint8_t *bits, const uint8_t *vals, int numVals);
+    int decodeSymbol(BitReader &br, const HuffDecode &table) const;
+
+    uint16_t m_width;
+    uint16_t m_height;
+    uint8_t m_hMax;
+    uint8_t m_vMax;
+    std::vector<CoefComponent> m_comps;
+    uint16_t m_quant[4][64];
+    HuffDecode m_dec[8];            // DC tables 0-3, then AC tables 0-3
+    HuffEncode m_enc[8];
+    std::vector<uint8_t> m_header;  // SOI up to and including SOS
+    uint32_t m_sizeOffset;          // SOF0 height, then width, in m_header
+};
+
+#endif
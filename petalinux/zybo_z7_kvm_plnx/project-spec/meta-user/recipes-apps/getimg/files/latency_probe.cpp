@@ -0,0 +1,109 @@
+#include "latency_probe.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace {
+
+const char *kTracePath = "/dev/shm/kvm_input_trace";
+const char *kReportPath = "/dev/shm/kvm_latency";
+const uint32_t kTraceMagic = 0x4b564d54;    // "KVMT", as inputd writes it
+const uint32_t kReportMagic = 0x4b564d4c;   // "KVML"
+
+}
+
+InputTraceReader::InputTraceReader() :
+    m_fd { -1 },
+    m_state { nullptr }
+{
+    m_fd = open(kTracePath, O_RDONLY);
+    if (m_fd < 0) {
+        std::cerr << "Could not open " << kTracePath << " (is inputd running?), errno " << errno << std::endl;
+        return;
+    }
+    void *mem = mmap(NULL, sizeof(InputTraceState), PROT_READ, MAP_SHARED, m_fd, 0);
+    if (mem == MAP_FAILED) {
+        std::cerr << "Could not map " << kTracePath << ", errno " << errno << std::endl;
+        return;
+    }
+    m_state = static_cast<const InputTraceState *>(mem);
+}
+
+InputTraceReader::~InputTraceReader()
+{
+    if (m_state != nullptr) {
+        munmap(const_cast<InputTraceState *>(m_state), sizeof(InputTraceState));
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool InputTraceReader::read(InputTraceState & out) const
+{
+    if (__atomic_load_n(&m_state->magic, __ATOMIC_ACQUIRE) != kTraceMagic) {
+        return false;
+    }
+    while (true) {
+        uint32_t seq = __atomic_load_n(&m_state->sequence, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;       // a handful of stores
+        }
+        out.reports = m_state->reports;
+        out.receivedNs = m_state->receivedNs;
+        out.writtenNs = m_state->writtenNs;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&m_state->sequence, __ATOMIC_RELAXED) == seq) {
+            out.magic = kTraceMagic;
+            out.sequence = seq;
+            return out.reports != 0;
+        }
+    }
+}
+
+LatencySummary summarizeLatency(std::vector<uint64_t> & ns)
+{
+    LatencySummary s = {};
+    if (ns.empty()) {
+        return s;
+    }
+    std::sort(ns.begin(), ns.end());
+    auto at = [&](double q) {
+        return ns[static_cast<size_t>(q * (ns.size() - 1))];
+    };
+    s.samples = ns.size();
+    s.minNs = ns.front();
+    s.p50Ns = at(0.5);
+    s.p90Ns = at(0.9);
+    s.p99Ns = at(0.99);
+    s.maxNs = ns.back();
+    return s;
+}
+
+bool saveLatencyReport(LatencyReport report)
+{
+    report.magic = kReportMagic;
+    int fd = open(kReportPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Could not open " << kReportPath << ", errno " << errno << std::endl;
+        return false;
+    }
+    bool ok = write(fd, &report, sizeof(report)) == sizeof(report);
+    close(fd);
+    return ok;
+}
+
+bool loadLatencyReport(LatencyReport & report)
+{
+    int fd = open(kReportPath, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = ::read(fd, &report, sizeof(report)) == sizeof(report) && report.magic == kReportMagic;
+    close(fd);
+    return ok;
+}
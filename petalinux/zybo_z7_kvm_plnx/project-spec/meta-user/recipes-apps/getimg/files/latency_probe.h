@@ -0,0 +1,96 @@
+#ifndef LATENCY_PROBE_H
+#define LATENCY_PROBE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Input to photon latency as "getimg -j" measures it on the board: it moves
+ * the host's cursor by a known pattern, sending relative mouse events to
+ * inputd's datagram socket, and takes the stripes until the hash of one
+ * changes. inputd publishes when each mouse report went to /dev/hidg0 in
+ * /dev/shm/kvm_input_trace, which splits the latency into
+ *  - input: event sent -> report written (inputd's queue and scheduler);
+ *  - capture: report written -> first changed stripe (USB poll, the host
+ *    drawing the cursor, scan-out, capture and encoder, plus the time the
+ *    probe takes to see it);
+ * and the result is kept in /dev/shm/kvm_latency for "getimg -m". The
+ * browser's share is in inputd's metrics (client_age_*, from X-Input-Age).
+ */
+
+// InputEvent of inputd's input_event.h
+struct __attribute__((packed)) ProbeEvent
+{
+    uint8_t type;
+    uint8_t buttons;
+    int16_t x;
+    int16_t y;
+    int16_t z;
+};
+
+static const uint8_t kProbeEventMouse = 1;     // EventType::kMouse
+
+// InputTraceState of inputd's input_trace.h
+struct InputTraceState
+{
+    uint32_t magic;
+    uint32_t sequence;      // seqlock, odd while inputd writes
+    uint64_t reports;
+    uint64_t receivedNs;
+    uint64_t writtenNs;
+};
+
+class InputTraceReader
+{
+public:
+    InputTraceReader();
+
+    InputTraceReader(const InputTraceReader&) = delete;
+    InputTraceReader& operator=(const InputTraceReader&) = delete;
+
+    ~InputTraceReader();
+
+    bool isOpen() const
+    {
+        return m_state != nullptr;
+    }
+
+    // a consistent copy, false before inputd wrote the first report
+    bool read(InputTraceState & out) const;
+
+private:
+    int m_fd;
+    const InputTraceState *m_state;
+};
+
+struct LatencySummary
+{
+    uint32_t samples;
+    uint64_t minNs;
+    uint64_t p50Ns;
+    uint64_t p90Ns;
+    uint64_t p99Ns;
+    uint64_t maxNs;
+};
+
+struct LatencyReport
+{
+    uint32_t magic;
+    uint32_t probes;        // moves sent
+    uint32_t missed;        // no stripe changed in time, or inputd wrote no report
+    uint32_t busy;          // the screen did not settle before the move
+    LatencySummary input;
+    LatencySummary capture;
+    LatencySummary total;
+};
+
+// sorts ns
+LatencySummary summarizeLatency(std::vector<uint64_t> & ns);
+
+bool saveLatencyReport(LatencyReport report);
+
+// false if "getimg -j" never ran
+bool loadLatencyReport(LatencyReport & report);
+
+#endif
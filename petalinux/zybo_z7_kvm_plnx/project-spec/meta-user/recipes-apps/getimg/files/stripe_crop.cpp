@@ -0,0 +1,133 @@
+#include "stripe_crop.h"
+
+#include <algorithm>
+#include <cstring>
+
+StripeCropper::StripeCropper() :
+    m_frameWidth { 0 },
+    m_frameHeight { 0 }
+{
+}
+
+bool StripeCropper::load(const uint8_t *const *jpeg, const uint32_t *lengths, int numStripes)
+{
+    m_jpeg.assign(jpeg, jpeg + numStripes);
+    m_lengths.assign(lengths, lengths + numStripes);
+    m_start.assign(numStripes, 0);
+    m_stripes.assign(numStripes, CoefImage {});
+    m_lines.assign(numStripes, 0);
+    m_columns.clear();
+    m_frameWidth = 0;
+    m_frameHeight = 0;
+
+    uint32_t width = 0;
+    for (int i = 0; i < numStripes; i++) {
+        CoefImage &img = m_stripes[i];
+        if (!img.decode(m_jpeg[i], m_lengths[i], 0)) {
+            return false;
+        }
+        if (i > 0 && (img.height() != m_stripes[0].height() || !img.sameTables(m_stripes[0]))) {
+            return false;
+        }
+        m_start[i] = width;
+        width += img.width();
+    }
+    if (numStripes == 0 || width > 0xFFFF) {
+        return false;
+    }
+    m_frameWidth = width;
+    m_frameHeight = m_stripes[0].height();
+    return true;
+}
+
+std::vector<CropGap> StripeCropper::gaps() const
+{
+    std::vector<CropGap> gaps;
+    for (size_t k = 1; k < m_columns.size(); k++) {
+        uint32_t end = m_columns[k - 1].x + m_stripes[0].mcuWidth();
+        if (m_columns[k].x > end) {
+            gaps.push_back({ static_cast<uint16_t>(end), static_cast<uint16_t>(m_columns[k].x - end) });
+        }
+    }
+    return gaps;
+}
+
+uint32_t StripeCropper::crop(CropRect &rect, uint8_t *out, uint32_t capacity)
+{
+    m_columns.clear();
+    if (rect.x >= m_frameWidth || rect.y >= m_frameHeight || rect.width == 0 || rect.height == 0) {
+        return 0;
+    }
+    const uint32_t mcuW = m_stripes[0].mcuWidth();
+    const uint32_t mcuH = m_stripes[0].mcuHeight();
+    uint32_t xEnd = std::min<uint32_t>(rect.x + rect.width, m_frameWidth);
+    uint32_t y0 = rect.y / mcuH * mcuH;
+    uint32_t yEnd = std::min<uint32_t>((rect.y + rect.height + mcuH - 1) / mcuH * mcuH, m_frameHeight);
+
+    // MCU columns covering [rect.x, xEnd), skipping those of a stripe that
+    // the padding of the previous one already delivered
+    uint32_t covered = 0;
+    for (size_t i = 0; i < m_stripes.size(); i++) {
+        uint32_t start = m_start[i];
+        uint32_t lo = std::max<uint32_t>(rect.x, start);
+        uint32_t hi = std::min<uint32_t>(xEnd, start + m_stripes[i].width());
+        if (lo >= hi) {
+            continue;
+        }
+        uint32_t c0 = (lo - start) / mcuW;
+        uint32_t c1 = (hi - start + mcuW - 1) / mcuW;
+        if (!m_columns.empty() && covered > start) {
+            c0 = std::max(c0, (covered - start + mcuW - 1) / mcuW);
+        }
+        for (uint32_t c = c0; c < c1; c++) {
+            m_columns.push_back({ static_cast<uint8_t>(i), static_cast<uint16_t>(c),
+                                  static_cast<uint16_t>(start + c * mcuW) });
+        }
+        if (c0 < c1) {
+            covered = start + c1 * mcuW;
+        }
+    }
+
+    if (m_columns.empty()) {
+        return 0;
+    }
+
+    // the padding of the last stripe lies past the frame and is cut off
+    uint32_t width = m_columns.size() * mcuW;
+    if (covered > m_frameWidth) {
+        width -= covered - m_frameWidth;
+    }
+
+    for (const CropColumn &col : m_columns) {
+        int i = col.stripe;
+        if (m_lines[i] < yEnd) {
+            if (!m_stripes[i].decode(m_jpeg[i], m_lengths[i], yEnd)) {
+                m_lines[i] = 0;
+                return 0;
+            }
+            m_lines[i] = yEnd;
+        }
+    }
+
+    CoefImage cropped = m_stripes[m_columns[0].stripe];
+    cropped.resize(width, yEnd - y0);
+    uint32_t rows = (yEnd - y0 + mcuH - 1) / mcuH;
+    uint32_t row0 = y0 / mcuH;
+    for (size_t c = 0; c < cropped.components().size(); c++) {
+        CoefComponent &dst = cropped.components()[c];
+        for (uint32_t r = 0; r < rows; r++) {
+            for (size_t k = 0; k < m_columns.size(); k++) {
+                const CoefComponent &src = m_stripes[m_columns[k].stripe].components()[c];
+                for (uint32_t by = 0; by < dst.v; by++) {
+                    memcpy(dst.block(k * dst.h, r * dst.v + by),
+                           src.block(m_columns[k].col * src.h, (row0 + r) * src.v + by),
+                           dst.h * 64 * sizeof(int16_t));
+                }
+            }
+        }
+    }
+
+    rect = { m_columns[0].x, static_cast<uint16_t>(y0), static_cast<uint16_t>(width),
+             static_cast<uint16_t>(yEnd - y0) };
+    return cropped.encode(out, capacity);
+}
@@ -0,0 +1,94 @@
+#ifndef STRIPE_CROP_H
+#define STRIPE_CROP_H
+
+#include <cstdint>
+#include <vector>
+
+#include "jpeg_coef.h"
+
+/*
+ * A rectangle of the frame cut straight out of its stripe JPEGs: the MCUs
+ * covering it are taken from each stripe as quantized coefficients and
+ * written out as one JPEG with the stripes' tables. Nothing is re-encoded;
+ * the DC predictors start over at the first MCU of the output, which
+ * CoefImage::encode takes care of as the DCs are kept absolute.
+ *
+ * The rectangle grows to whole MCUs. Stripes start at multiples of
+ * res_x / 4, so if that is not a multiple of the MCU width the MCU grids
+ * of neighbouring stripes do not line up: the last MCU of a stripe then
+ * holds pixels of the next one (image_stripe pads with them), and the next
+ * stripe continues at its first MCU past them. Up to MCU width - 1 columns
+ * at such a seam are left out; columns() tells where each MCU column of the
+ * output comes from, gaps() which frame columns are missing from it.
+ */
+
+struct CropRect
+{
+    uint16_t x;
+    uint16_t y;
+    uint16_t width;
+    uint16_t height;
+};
+
+struct CropGap
+{
+    uint16_t x;             // first frame column left out
+    uint16_t width;
+};
+
+struct CropColumn
+{
+    uint8_t stripe;
+    uint16_t col;           // MCU column in the stripe
+    uint16_t x;             // frame position of its first pixel
+};
+
+class StripeCropper
+{
+public:
+    StripeCropper();
+
+    // The stripes of one frame, left to right; only their headers are read
+    // here. false if they do not belong together (size, tables).
+    bool load(const uint8_t *const *jpeg, const uint32_t *lengths, int numStripes);
+
+    // rect is clipped to the frame and set to the region delivered; JPEG
+    // length, or 0 if rect is empty, a stripe is corrupt or out is too small
+    uint32_t crop(CropRect &rect, uint8_t *out, uint32_t capacity);
+
+    uint16_t frameWidth() const
+    {
+        return m_frameWidth;
+    }
+
+    uint16_t frameHeight() const
+    {
+        return m_frameHeight;
+    }
+
+    // of the last crop()
+    const std::vector<CropColumn> & columns() const
+    {
+        return m_columns;
+    }
+
+    // of the last crop(), left to right; empty if it covers its region whole
+    std::vector<CropGap> gaps() const;
+
+    const CoefImage & stripe(int index) const
+    {
+        return m_stripes[index];
+    }
+
+private:
+    std::vector<const uint8_t *> m_jpeg;
+    std::vector<uint32_t> m_lengths;
+    std::vector<uint16_t> m_start;
+    std::vector<CoefImage> m_stripes;
+    std::vector<uint32_t> m_lines;      // decoded so far, per stripe
+    std::vector<CropColumn> m_columns;
+    uint16_t m_frameWidth;
+    uint16_t m_frameHeight;
+};
+
+#endif
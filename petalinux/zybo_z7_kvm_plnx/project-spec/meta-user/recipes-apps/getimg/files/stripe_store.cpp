@@ -0,0 +1,120 @@
+#include "stripe_store.h"
+
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+namespace {
+
+const size_t kMapSize = StripeStore::kStateSize + 2 * static_cast<size_t>(kMaxJpegSize)
+                      + kNumScales * static_cast<size_t>(kMaxScaledSize);
+
+static_assert(sizeof(StripeState) <= StripeStore::kStateSize, "StripeState too large");
+
+}
+
+StripeStore::StripeStore(int chan, bool create) :
+    m_fd { -1 },
+    m_state { nullptr }
+{
+    std::string name = path(chan);
+    m_fd = open(name.c_str(), create ? (O_RDWR | O_CREAT) : O_RDWR, 0644);
+    if (m_fd < 0) {
+        if (create) {
+            std::cerr << "Could not open " << name << ", errno " << errno << std::endl;
+        }
+        return;
+    }
+
+    // sparse in tmpfs, only the pages actually written take up memory
+    if (ftruncate(m_fd, kMapSize) != 0) {
+        std::cerr << "Could not size " << name << ", errno " << errno << std::endl;
+        return;
+    }
+
+    void *mem = mmap(NULL, kMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (mem == MAP_FAILED) {
+        std::cerr << "Could not map " << name << ", errno " << errno << std::endl;
+        return;
+    }
+    m_state = static_cast<StripeState *>(mem);
+
+    lock();
+    if (m_state->magic != kStripeMagic) {
+        memset(m_state, 0, sizeof(*m_state));
+        m_state->magic = kStripeMagic;
+    }
+    unlock();
+}
+
+StripeStore::~StripeStore()
+{
+    if (m_state != nullptr) {
+        munmap(m_state, kMapSize);
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+void StripeStore::lock()
+{
+    while (flock(m_fd, LOCK_EX) != 0 && errno == EINTR) {
+    }
+}
+
+void StripeStore::unlock()
+{
+    flock(m_fd, LOCK_UN);
+}
+
+void StripeStore::commitSpare(uint32_t length, uint64_t hash)
+{
+    m_state->goodSlot ^= 1;
+    m_state->goodLength = length;
+    m_state->goodHash = hash;
+    m_state->sequence++;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    m_state->committedNs = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+std::string StripeStore::path(int chan)
+{
+    return "/dev/shm/kvm_stripe" + std::to_string(chan);
+}
+
+uint64_t stripeHash(const uint8_t *data, uint32_t length, uint64_t hash)
+{
+    const uint64_t prime = 0x100000001b3ull;
+    uint32_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * prime;
+    }
+    for (; i < length; i++) {
+        hash = (hash ^ data[i]) * prime;
+    }
+    return hash;
+}
+
+JpegStatus copyAndCheck(uint8_t *dst, const uint8_t *src, JpegChecker & checker, uint32_t length, uint64_t & hash)
+{
+    JpegStatus st = checker.status();
+    uint32_t done = 0;
+    hash = kStripeHashSeed;
+    while (st == JpegStatus::kIncomplete && done < length) {
+        uint32_t n = length - done < kCopyChunk ? length - done : kCopyChunk;
+        memcpy(dst + done, src + done, n);
+        hash = stripeHash(dst + done, n, hash);
+        done += n;
+        st = checker.advance(done);
+    }
+    return st;
+}
@@ -0,0 +1,165 @@
+#ifndef STRIPE_STORE_H
+#define STRIPE_STORE_H
+
+#include <cstdint>
+#include <string>
+
+#include "jpeg_check.h"
+
+static const int kNumChan = 4;
+static const uint32_t kMaxJpegSize = 4u * 1024u * 1024u;  // size field is capped to 22 bits
+static const int kNumScales = 2;                            // 1/2 and 1/4, see DctScaler
+static const uint32_t kMaxScaledSize = kMaxJpegSize / 4;
+static const uint64_t kStripeHashSeed = 0xcbf29ce484222325ull;
+static const uint32_t kCopyChunk = 8 * 1024;                // copyAndCheck: checked while still in L1
+static const uint32_t kStripeMagic = 0x4b564d37;            // "KVM7", changes with the layout of StripeState
+
+/*
+ * Per channel state shared by all frame server processes (httpd starts one
+ * per request), kept in /dev/shm so it outlives them:
+ *  - two slots: one holds the last stripe that passed JpegChecker, the other
+ *    one is where the next stripe is copied to. A stripe that fails the check
+ *    never overwrites the last good one, which is re-sent instead;
+ *  - the good stripe downscaled by 2 and 4, made on the first request for it
+ *    after each commit and tagged with the sequence number of the commit;
+ *  - counters, printed by "getimg -m".
+ * While the hardware encoder is down, "getimg -s" commits the stripes of the
+ * software encoder to the same slots.
+ * Access is serialized with flock(). inputd's ScreenWatch reads goodHash
+ * under a shared lock; its recipe builds against this header.
+ */
+
+struct StripeCounters
+{
+    uint64_t served;        // stripes that passed the check
+    uint64_t resent;        // last good stripe sent in place of a bad one
+    uint64_t noFrame;       // nothing to send (no read lock, no good stripe yet)
+    uint64_t bytes;         // bytes copied out of the frame buffer
+    uint64_t copyNs;        // time spent copying + checking
+    uint64_t failover;      // requests while the hardware encoder was down
+    uint64_t swEncoded;     // stripes written by the software encoder
+    uint64_t swEncodeNs;    // time spent encoding them (both threads)
+    uint64_t scaledHit;     // downscaled stripes served from the cache
+    uint64_t scaledMiss;    // downscaled stripes made
+    uint64_t scaleNs;       // time spent making them
+    uint64_t cropped;       // crop requests that refreshed this stripe
+    uint64_t unchanged;     // answered without the stripe, the client had it (known=)
+    uint64_t rejected[static_cast<int>(JpegStatus::kNumStatus)];
+};
+
+struct ScaledStripe
+{
+    uint32_t sequence;      // of the good stripe it was made from
+    uint32_t length;        // 0: none
+};
+
+struct StripeState
+{
+    uint32_t magic;
+    uint32_t goodSlot;
+    uint32_t goodLength;    // 0: no good stripe yet
+    uint32_t fault;         // last encoderFault() seen, 0: hardware path ok
+    uint32_t sequence;      // bumped by every commit
+    uint64_t goodHash;      // stripeHash() of the good stripe
+    uint64_t servedHash;    // of the good stripe when it was last served, for FrameGovernor
+    uint64_t committedNs;   // CLOCK_MONOTONIC of the last commit, for the frame age in the browser
+    ScaledStripe scaled[kNumScales];
+    StripeCounters counters;
+};
+
+class StripeStore
+{
+public:
+    static const uint32_t kStateSize = 4096;
+
+    explicit StripeStore(int chan, bool create = true);
+
+    StripeStore(const StripeStore&) = delete;
+    StripeStore& operator=(const StripeStore&) = delete;
+
+    ~StripeStore();
+
+    bool isOpen() const
+    {
+        return m_state != nullptr;
+    }
+
+    void lock();
+    void unlock();
+
+    StripeState & state()
+    {
+        return *m_state;
+    }
+
+    uint8_t * spareSlot()
+    {
+        return slot(m_state->goodSlot ^ 1);
+    }
+
+    const uint8_t * goodSlot()
+    {
+        return slot(m_state->goodSlot);
+    }
+
+    // the spare slot now holds a good stripe of the given length and hash
+    void commitSpare(uint32_t length, uint64_t hash);
+
+    // scale 2 or 4
+    static int scaleIndex(int scale)
+    {
+        return scale == 4 ? 1 : 0;
+    }
+
+    uint8_t * scaledSlot(int index)
+    {
+        return slot(2) + index * kMaxScaledSize;
+    }
+
+    static std::string path(int chan);
+
+private:
+    uint8_t * slot(uint32_t n)
+    {
+        return reinterpret_cast<uint8_t *>(m_state) + kStateSize + n * kMaxJpegSize;
+    }
+
+    int m_fd;
+    StripeState *m_state;
+};
+
+/*
+ * FNV-1a over 64 bit words, for telling whether a stripe changed. Can be
+ * continued over consecutive chunks if all but the last are a multiple of 8
+ * bytes long.
+ */
+uint64_t stripeHash(const uint8_t *data, uint32_t length, uint64_t hash = kStripeHashSeed);
+
+/*
+ * Copy the stripe in chunks, checking and hashing each chunk right after it
+ * lands in dst, so both read from cache rather than from the frame buffer.
+ */
+JpegStatus copyAndCheck(uint8_t *dst, const uint8_t *src, JpegChecker & checker, uint32_t length, uint64_t & hash);
+
+class StripeLock
+{
+public:
+    explicit StripeLock(StripeStore & store) :
+        m_store { store }
+    {
+        m_store.lock();
+    }
+
+    StripeLock(const StripeLock&) = delete;
+    StripeLock& operator=(const StripeLock&) = delete;
+
+    ~StripeLock()
+    {
+        m_store.unlock();
+    }
+
+private:
+    StripeStore & m_store;
+};
+
+#endif
@@ -0,0 +1,594 @@
+#include "sw_encoder.h"
+
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <time.h>
+
+#include "bit_writer.h"
+#include "csc.h"
+#include "quant_tables.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SW_ENCODER_NEON 1
+#endif
+
+namespace {
+
+uint64_t monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// hostif_emu.vhd qrom_lum_chr, in zigzag order, from the model's one
+// implementation of the tables (jpeg_model -t checks the ROM against it)
+struct QuantTables
+{
+    uint8_t table[128];
+
+    QuantTables()
+    {
+        builtinQuantTables(table);
+    }
+};
+
+const QuantTables kQuant;
+
+// zigzag position -> row-major index
+const uint8_t kZigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// ITU T.81 Annex K.3, as in header.data
+const uint8_t kDcBits[2][16] = {
+    { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 },
+};
+
+const uint8_t kDcVals[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+const uint8_t kAcBits[2][16] = {
+    { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d },
+    { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 },
+};
+
+const uint8_t kAcVals[2][162] = {
+    {
+        0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06,
+        0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+        0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72,
+        0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+        0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45,
+        0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+        0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75,
+        0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+        0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3,
+        0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+        0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9,
+        0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+        0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4,
+        0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa,
+    },
+    {
+        0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41,
+        0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+        0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1,
+        0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+        0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44,
+        0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+        0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74,
+        0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+        0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a,
+        0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+        0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+        0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+        0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4,
+        0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa,
+    },
+};
+
+// jfdctfst (AAN) rotations in Q15, as taken by vqdmulh: (a * c) >> 15
+const int16_t kC0382 = 12540;   // 0.382683433
+const int16_t kC0541 = 17734;   // 0.541196100
+const int16_t kC0707 = 23170;   // 0.707106781
+const int16_t kC0306 = 10045;   // 1.306562965 - 1
+
+const uint32_t kHeaderSize = 623;       // same as jfifgen/header.data
+const uint32_t kSizeOffset = 25;        // SOF0 height, then width
+const uint32_t kMaxMcuBytes = 4 * 64 * 27 / 8 * 2;  // 4 blocks, 27 bit per coefficient, all stuffed
+const int kMcuWidth = 16;
+const int kMcuHeight = 8;
+
+#ifdef SW_ENCODER_NEON
+
+// one AAN pass down the 8 vectors, for all 8 lanes at once
+inline void fdctPassNeon(int16x8_t d[8])
+{
+    int16x8_t t0 = vaddq_s16(d[0], d[7]);
+    int16x8_t t7 = vsubq_s16(d[0], d[7]);
+    int16x8_t t1 = vaddq_s16(d[1], d[6]);
+    int16x8_t t6 = vsubq_s16(d[1], d[6]);
+    int16x8_t t2 = vaddq_s16(d[2], d[5]);
+    int16x8_t t5 = vsubq_s16(d[2], d[5]);
+    int16x8_t t3 = vaddq_s16(d[3], d[4]);
+    int16x8_t t4 = vsubq_s16(d[3], d[4]);
+
+    int16x8_t t10 = vaddq_s16(t0, t3);
+    int16x8_t t13 = vsubq_s16(t0, t3);
+    int16x8_t t11 = vaddq_s16(t1, t2);
+    int16x8_t t12 = vsubq_s16(t1, t2);
+    d[0] = vaddq_s16(t10, t11);
+    d[4] = vsubq_s16(t10, t11);
+    int16x8_t z1 = vqdmulhq_n_s16(vaddq_s16(t12, t13), kC0707);
+    d[2] = vaddq_s16(t13, z1);
+    d[6] = vsubq_s16(t13, z1);
+
+    t10 = vaddq_s16(t4, t5);
+    t11 = vaddq_s16(t5, t6);
+    t12 = vaddq_s16(t6, t7);
+    int16x8_t z5 = vqdmulhq_n_s16(vsubq_s16(t10, t12), kC0382);
+    int16x8_t z2 = vaddq_s16(vqdmulhq_n_s16(t10, kC0541), z5);
+    int16x8_t z4 = vaddq_s16(vaddq_s16(vqdmulhq_n_s16(t12, kC0306), t12), z5);
+    int16x8_t z3 = vqdmulhq_n_s16(t11, kC0707);
+    int16x8_t z11 = vaddq_s16(t7, z3);
+    int16x8_t z13 = vsubq_s16(t7, z3);
+    d[5] = vaddq_s16(z13, z2);
+    d[3] = vsubq_s16(z13, z2);
+    d[1] = vaddq_s16(z11, z4);
+    d[7] = vsubq_s16(z11, z4);
+}
+
+inline int16x8_t combineLow(int32x4_t a, int32x4_t b)
+{
+    return vreinterpretq_s16_s32(vcombine_s32(vget_low_s32(a), vget_low_s32(b)));
+}
+
+inline int16x8_t combineHigh(int32x4_t a, int32x4_t b)
+{
+    return vreinterpretq_s16_s32(vcombine_s32(vget_high_s32(a), vget_high_s32(b)));
+}
+
+// rows in, columns out
+inline void transposeNeon(int16x8_t r[8])
+{
+    int16x8x2_t t01 = vtrnq_s16(r[0], r[1]);
+    int16x8x2_t t23 = vtrnq_s16(r[2], r[3]);
+    int16x8x2_t t45 = vtrnq_s16(r[4], r[5]);
+    int16x8x2_t t67 = vtrnq_s16(r[6], r[7]);
+    int32x4x2_t u02 = vtrnq_s32(vreinterpretq_s32_s16(t01.val[0]), vreinterpretq_s32_s16(t23.val[0]));
+    int32x4x2_t u13 = vtrnq_s32(vreinterpretq_s32_s16(t01.val[1]), vreinterpretq_s32_s16(t23.val[1]));
+    int32x4x2_t u46 = vtrnq_s32(vreinterpretq_s32_s16(t45.val[0]), vreinterpretq_s32_s16(t67.val[0]));
+    int32x4x2_t u57 = vtrnq_s32(vreinterpretq_s32_s16(t45.val[1]), vreinterpretq_s32_s16(t67.val[1]));
+    r[0] = combineLow(u02.val[0], u46.val[0]);
+    r[1] = combineLow(u13.val[0], u57.val[0]);
+    r[2] = combineLow(u02.val[1], u46.val[1]);
+    r[3] = combineLow(u13.val[1], u57.val[1]);
+    r[4] = combineHigh(u02.val[0], u46.val[0]);
+    r[5] = combineHigh(u13.val[0], u57.val[0]);
+    r[6] = combineHigh(u02.val[1], u46.val[1]);
+    r[7] = combineHigh(u13.val[1], u57.val[1]);
+}
+
+#else
+
+inline int16_t mulq15(int32_t a, int16_t c)
+{
+    return static_cast<int16_t>((a * c) >> 15);
+}
+
+/*
+ * Scalar FDCT. The NEON one computes exactly the same: 16 bit lanes never
+ * overflow (|x| < 13000 for 8 bit input), and vqdmulh rounds down like
+ * mulq15. Vertical pass first, then horizontal, and the result is left
+ * transposed: out[u * 8 + v].
+ */
+void fdctPass(const int16_t *in, int inStep, int inNext, int16_t *out, int outStep, int outNext)
+{
+    for (int n = 0; n < 8; n++, in += inNext, out += outNext) {
+        int32_t t0 = in[0] + in[7 * inStep];
+        int32_t t7 = in[0] - in[7 * inStep];
+        int32_t t1 = in[inStep] + in[6 * inStep];
+        int32_t t6 = in[inStep] - in[6 * inStep];
+        int32_t t2 = in[2 * inStep] + in[5 * inStep];
+        int32_t t5 = in[2 * inStep] - in[5 * inStep];
+        int32_t t3 = in[3 * inStep] + in[4 * inStep];
+        int32_t t4 = in[3 * inStep] - in[4 * inStep];
+
+        int32_t t10 = t0 + t3;
+        int32_t t13 = t0 - t3;
+        int32_t t11 = t1 + t2;
+        int32_t t12 = t1 - t2;
+        out[0] = t10 + t11;
+        out[4 * outStep] = t10 - t11;
+        int32_t z1 = mulq15(t12 + t13, kC0707);
+        out[2 * outStep] = t13 + z1;
+        out[6 * outStep] = t13 - z1;
+
+        t10 = t4 + t5;
+        t11 = t5 + t6;
+        t12 = t6 + t7;
+        int32_t z5 = mulq15(t10 - t12, kC0382);
+        int32_t z2 = mulq15(t10, kC0541) + z5;
+        int32_t z4 = mulq15(t12, kC0306) + t12 + z5;
+        int32_t z3 = mulq15(t11, kC0707);
+        int32_t z11 = t7 + z3;
+        int32_t z13 = t7 - z3;
+        out[5 * outStep] = z13 + z2;
+        out[3 * outStep] = z13 - z2;
+        out[outStep] = z11 + z4;
+        out[7 * outStep] = z11 - z4;
+    }
+}
+
+#endif
+
+// level shifted 8x8 block -> AAN scaled coefficients, out[u * 8 + v]
+void fdct(const uint8_t *src, uint32_t stride, int16_t *out)
+{
+#ifdef SW_ENCODER_NEON
+    int16x8_t r[8];
+    for (int i = 0; i < 8; i++) {
+        r[i] = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(src + i * stride), vdup_n_u8(128)));
+    }
+    fdctPassNeon(r);
+    transposeNeon(r);
+    fdctPassNeon(r);
+    for (int i = 0; i < 8; i++) {
+        vst1q_s16(out + i * 8, r[i]);
+    }
+#else
+    int16_t blk[64];
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 8; j++) {
+            blk[i * 8 + j] = src[i * stride + j] - 128;
+        }
+    }
+    int16_t tmp[64];
+    fdctPass(blk, 8, 1, tmp, 8, 1);     // columns
+    fdctPass(tmp, 1, 8, out, 8, 1);     // rows, stored transposed
+#endif
+}
+
+/*
+ * Rounded division by the AAN scaled quantizer: n = |x| + d / 2, then
+ * n * r >> 16 with r = 65536 / d + 1, which is n / d or one more, fixed up
+ * by comparing against n.
+ */
+void quantize(int16_t *coef, const uint16_t *divisor, const uint16_t *reciprocal)
+{
+#ifdef SW_ENCODER_NEON
+    for (int i = 0; i < 64; i += 8) {
+        int16x8_t x = vld1q_s16(coef + i);
+        uint16x8_t d = vld1q_u16(divisor + i);
+        uint16x8_t r = vld1q_u16(reciprocal + i);
+        int16x8_t sign = vshrq_n_s16(x, 15);
+        uint16x8_t n = vaddq_u16(vreinterpretq_u16_s16(vabsq_s16(x)), vshrq_n_u16(d, 1));
+        uint32x4_t lo = vmull_u16(vget_low_u16(n), vget_low_u16(r));
+        uint32x4_t hi = vmull_u16(vget_high_u16(n), vget_high_u16(r));
+        uint16x8_t q = vcombine_u16(vshrn_n_u32(lo, 16), vshrn_n_u32(hi, 16));
+        q = vaddq_u16(q, vcgtq_u16(vmulq_u16(q, d), n));     // mask is all ones: -1
+        int16x8_t s = vreinterpretq_s16_u16(q);
+        vst1q_s16(coef + i, vsubq_s16(veorq_s16(s, sign), sign));
+    }
+#else
+    for (int i = 0; i < 64; i++) {
+        int32_t x = coef[i];
+        uint32_t n = static_cast<uint32_t>(x < 0 ? -x : x) + (divisor[i] >> 1);
+        uint32_t q = (n * reciprocal[i]) >> 16;
+        if (q * divisor[i] > n) {
+            q--;
+        }
+        coef[i] = static_cast<int16_t>(x < 0 ? -static_cast<int32_t>(q) : static_cast<int32_t>(q));
+    }
+#endif
+}
+
+/*
+ * Huffman preparation over the zigzag ordered block: magnitude category,
+ * VLI (x, or x - 1 for negative x; masked to nbits when emitted) and a mask
+ * of the non-zero coefficients, so the coder can jump from one to the next.
+ */
+uint64_t huffPrepare(const int16_t *zz, uint8_t *nbits, int16_t *vli)
+{
+#ifdef SW_ENCODER_NEON
+    static const uint8_t kLaneBits[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+    uint8x8_t laneBits = vld1_u8(kLaneBits);
+    uint64_t zeros = 0;
+    for (int i = 0; i < 64; i += 8) {
+        int16x8_t x = vld1q_s16(zz + i);
+        uint16x8_t clz = vclzq_u16(vreinterpretq_u16_s16(vabsq_s16(x)));
+        vst1_u8(nbits + i, vmovn_u16(vsubq_u16(vdupq_n_u16(16), clz)));
+        vst1q_s16(vli + i, vaddq_s16(x, vshrq_n_s16(x, 15)));
+        uint8x8_t z = vand_u8(vmovn_u16(vceqq_s16(x, vdupq_n_s16(0))), laneBits);
+        z = vpadd_u8(z, z);
+        z = vpadd_u8(z, z);
+        z = vpadd_u8(z, z);
+        zeros |= static_cast<uint64_t>(vget_lane_u8(z, 0)) << i;
+    }
+    return ~zeros;
+#else
+    uint64_t nonzero = 0;
+    for (int i = 0; i < 64; i++) {
+        int32_t x = zz[i];
+        uint32_t a = x < 0 ? -x : x;
+        nbits[i] = a ? 32 - __builtin_clz(a) : 0;
+        vli[i] = static_cast<int16_t>(x < 0 ? x - 1 : x);
+        if (x != 0) {
+            nonzero |= 1ull << i;
+        }
+    }
+    return nonzero;
+#endif
+}
+
+}
+
+struct SwEncoder::Scratch
+{
+    uint32_t width;                 // padded to the MCU width
+    std::vector<uint8_t> y;         // 8 lines of width
+    std::vector<uint8_t> cb;        // 8 lines of width / 2
+    std::vector<uint8_t> cr;
+    std::vector<uint8_t> cbLine;    // one line of width, before decimation
+    std::vector<uint8_t> crLine;
+};
+
+std::vector<Stripe> stripeLayout(uint16_t resX, int numChan)
+{
+    std::vector<Stripe> stripes(numChan);
+    uint16_t start = 0;
+    for (int i = 0; i < numChan; i++) {
+        stripes[i].start = start;
+        stripes[i].width = resX / numChan + (i == numChan - 1 ? resX % numChan : 0);
+        start += stripes[i].width;
+    }
+    return stripes;
+}
+
+SwEncoder::SwEncoder()
+{
+    // AAN output (u, v) is 8 * a(u) * a(v) times the JPEG coefficient
+    double aan[8];
+    for (int k = 0; k < 8; k++) {
+        aan[k] = k == 0 ? 1.0 : std::cos(k * std::acos(-1.0) / 16) * std::sqrt(2.0);
+    }
+    for (int c = 0; c < 2; c++) {
+        for (int k = 0; k < 64; k++) {
+            int v = kZigzag[k] / 8;
+            int u = kZigzag[k] % 8;
+            long d = std::lround(kQuant.table[c * 64 + k] * 8 * aan[u] * aan[v]);
+            // r must fit 16 bits; only reachable with a quantizer of 1
+            d = d < 2 ? 2 : d;
+            m_divisor[c][u * 8 + v] = static_cast<uint16_t>(d);
+            m_reciprocal[c][u * 8 + v] = static_cast<uint16_t>(65536 / d + 1);
+        }
+    }
+
+    for (int c = 0; c < 2; c++) {
+        HuffTable *tables[2] = { &m_dc[c], &m_ac[c] };
+        const uint8_t *bits[2] = { kDcBits[c], kAcBits[c] };
+        const uint8_t *vals[2] = { kDcVals, kAcVals[c] };
+        for (int t = 0; t < 2; t++) {
+            memset(tables[t], 0, sizeof(HuffTable));
+            uint16_t code = 0;
+            int k = 0;
+            for (int len = 1; len <= 16; len++) {
+                for (int i = 0; i < bits[t][len - 1]; i++, k++) {
+                    tables[t]->code[vals[t][k]] = code++;
+                    tables[t]->size[vals[t][k]] = len;
+                }
+                code <<= 1;
+            }
+        }
+    }
+
+    buildHeader();
+}
+
+// same segments, in the same order, as jfifgen/header.data
+void SwEncoder::buildHeader()
+{
+    std::vector<uint8_t> &h = m_header;
+    auto segment = [&h](uint8_t marker, uint16_t length) {
+        h.push_back(0xFF);
+        h.push_back(marker);
+        h.push_back(length >> 8);
+        h.push_back(length & 0xFF);
+    };
+
+    h = { 0xFF, 0xD8 };
+    segment(0xE0, 16);
+    h.insert(h.end(), { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 });
+    segment(0xC0, 17);
+    h.insert(h.end(), { 8, 0, 0, 0, 0, 3, 1, 0x21, 0, 2, 0x11, 1, 3, 0x11, 1 });
+    for (int c = 0; c < 2; c++) {
+        segment(0xDB, 67);
+        h.push_back(c);
+        h.insert(h.end(), kQuant.table + c * 64, kQuant.table + c * 64 + 64);
+    }
+    for (int c = 0; c < 2; c++) {
+        segment(0xC4, 2 + 1 + 16 + sizeof(kDcVals));
+        h.push_back(c);
+        h.insert(h.end(), kDcBits[c], kDcBits[c] + 16);
+        h.insert(h.end(), kDcVals, kDcVals + sizeof(kDcVals));
+    }
+    for (int c = 0; c < 2; c++) {
+        segment(0xC4, 2 + 1 + 16 + sizeof(kAcVals[c]));
+        h.push_back(0x10 | c);
+        h.insert(h.end(), kAcBits[c], kAcBits[c] + 16);
+        h.insert(h.end(), kAcVals[c], kAcVals[c] + sizeof(kAcVals[c]));
+    }
+    segment(0xDA, 12);
+    h.insert(h.end(), { 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 });
+}
+
+/*
+ * One MCU row of the stripe into planar Y, Cb, Cr, chroma from the even
+ * columns. Like image_stripe, the padding up to the MCU width is taken from
+ * the pixels right of the stripe; past the frame edge (and below it) the
+ * last pixel is repeated.
+ */
+void SwEncoder::loadMcuRow(const RawFrame &frame, const Stripe &stripe, uint32_t y, Scratch &s) const
+{
+    uint32_t chromaWidth = s.width / 2;
+    for (int r = 0; r < kMcuHeight; r++) {
+        uint32_t line = y + r < frame.height ? y + r : frame.height - 1;
+        const uint8_t *src = frame.data + line * frame.stride;
+        uint8_t *yl = &s.y[r * s.width];
+        uint8_t *cbl = &s.cb[r * chromaWidth];
+        uint8_t *crl = &s.cr[r * chromaWidth];
+        if (frame.format == PixelFormat::kYuyv) {
+            for (uint32_t x = 0; x < s.width; x++) {
+                uint32_t px = stripe.start + x < frame.width ? stripe.start + x : frame.width - 1;
+                const uint8_t *pair = src + (px & ~1u) * 2;
+                yl[x] = src[px * 2];
+                if ((x & 1) == 0) {
+                    cbl[x / 2] = pair[1];
+                    crl[x / 2] = pair[3];
+                }
+            }
+            continue;
+        }
+
+        // colorspace_conv, then the pixels past the frame edge and decimation
+        uint32_t inFrame = frame.width - stripe.start;
+        inFrame = inFrame < s.width ? inFrame : s.width;
+        cscRow(src + stripe.start * 3, yl, &s.cbLine[0], &s.crLine[0], inFrame);
+        for (uint32_t x = inFrame; x < s.width; x++) {
+            yl[x] = yl[inFrame - 1];
+            s.cbLine[x] = s.cbLine[inFrame - 1];
+            s.crLine[x] = s.crLine[inFrame - 1];
+        }
+        for (uint32_t x = 0; x < chromaWidth; x++) {
+            cbl[x] = s.cbLine[2 * x];
+            crl[x] = s.crLine[2 * x];
+        }
+    }
+}
+
+uint32_t SwEncoder::encodeStripe(const RawFrame &frame, const Stripe &stripe, uint8_t *out, uint32_t capacity) const
+{
+    if (stripe.width == 0 || frame.height == 0 || capacity < kHeaderSize + kMaxMcuBytes + 14 + 2) {
+        return 0;
+    }
+
+    Scratch s;
+    s.width = (stripe.width + kMcuWidth - 1) & ~(kMcuWidth - 1);
+    s.y.resize(s.width * kMcuHeight);
+    s.cb.resize(s.width / 2 * kMcuHeight);
+    s.cr.resize(s.width / 2 * kMcuHeight);
+    s.cbLine.resize(s.width);
+    s.crLine.resize(s.width);
+
+    memcpy(out, m_header.data(), kHeaderSize);
+    out[kSizeOffset] = frame.height >> 8;
+    out[kSizeOffset + 1] = frame.height & 0xFF;
+    out[kSizeOffset + 2] = stripe.width >> 8;
+    out[kSizeOffset + 3] = stripe.width & 0xFF;
+
+    BitWriter bw { out + kHeaderSize };
+    const uint8_t *limit = out + capacity - kMaxMcuBytes - 14 - 2;
+    int16_t pred[3] = { 0, 0, 0 };
+
+    for (uint32_t y = 0; y < frame.height; y += kMcuHeight) {
+        loadMcuRow(frame, stripe, y, s);
+        for (uint32_t x = 0; x < s.width; x += kMcuWidth) {
+            if (bw.position() > limit) {
+                return 0;
+            }
+            // Y1, Y2, Cb, Cr
+            const uint8_t *src[4] = { &s.y[x], &s.y[x + 8], &s.cb[x / 2], &s.cr[x / 2] };
+            const uint32_t stride[4] = { s.width, s.width, s.width / 2, s.width / 2 };
+            for (int b = 0; b < 4; b++) {
+                int chroma = b >= 2;
+                int16_t coef[64];
+                fdct(src[b], stride[b], coef);
+                quantize(coef, m_divisor[chroma], m_reciprocal[chroma]);
+
+                int16_t zz[64];
+                for (int k = 0; k < 64; k++) {
+                    zz[k] = coef[(kZigzag[k] & 7) * 8 + (kZigzag[k] >> 3)];
+                }
+                uint8_t nbits[64];
+                int16_t vli[64];
+                uint64_t nonzero = huffPrepare(zz, nbits, vli);
+
+                const HuffTable &dc = m_dc[chroma];
+                const HuffTable &ac = m_ac[chroma];
+                int16_t &p = pred[b < 2 ? 0 : b - 1];
+                int32_t diff = zz[0] - p;
+                p = zz[0];
+                uint32_t mag = diff < 0 ? -diff : diff;
+                int size = mag ? 32 - __builtin_clz(mag) : 0;
+                uint32_t bits = static_cast<uint32_t>(diff < 0 ? diff - 1 : diff) & ((1u << size) - 1);
+                bw.put(static_cast<uint32_t>(dc.code[size]) << size | bits, dc.size[size] + size);
+
+                uint64_t mask = nonzero & ~1ull;
+                int last = 0;
+                while (mask) {
+                    int k = __builtin_ctzll(mask);
+                    int run = k - last - 1;
+                    while (run > 15) {
+                        bw.put(ac.code[0xF0], ac.size[0xF0]);     // ZRL
+                        run -= 16;
+                    }
+                    int n = nbits[k];
+                    int sym = run << 4 | n;
+                    uint32_t v = static_cast<uint16_t>(vli[k]) & ((1u << n) - 1);
+                    bw.put(static_cast<uint32_t>(ac.code[sym]) << n | v, ac.size[sym] + n);
+                    last = k;
+                    mask &= mask - 1;
+                }
+                if (last != 63) {
+                    bw.put(ac.code[0x00], ac.size[0x00]);         // EOB
+                }
+            }
+        }
+    }
+
+    uint8_t *end = bw.finish();
+    *end++ = 0xFF;
+    *end++ = 0xD9;
+    return static_cast<uint32_t>(end - out);
+}
+
+void SwEncoder::encodeFrame(const RawFrame &frame, int threads, std::vector<std::vector<uint8_t>> &jpeg,
+                            uint32_t *lengths, uint64_t *ns) const
+{
+    int numStripes = jpeg.size();
+    std::vector<Stripe> stripes = stripeLayout(frame.width, numStripes);
+    auto work = [&](int first) {
+        for (int i = first; i < numStripes; i += threads) {
+            uint64_t start = monotonicNs();
+            lengths[i] = encodeStripe(frame, stripes[i], jpeg[i].data(), jpeg[i].size());
+            ns[i] = monotonicNs() - start;
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; t++) {
+        pool.emplace_back(work, t);
+    }
+    work(0);
+    for (std::thread &t : pool) {
+        t.join();
+    }
+}
+
+bool SwEncoder::hasNeon()
+{
+#ifdef SW_ENCODER_NEON
+    return true;
+#else
+    return false;
+#endif
+}
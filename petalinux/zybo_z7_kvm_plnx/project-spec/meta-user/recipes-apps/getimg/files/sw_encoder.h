@@ -0,0 +1,80 @@
+#ifndef SW_ENCODER_H
+#define SW_ENCODER_H
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * Software replacement for the striped mkjpeg encoders, used by the frame
+ * server when the hardware path is down (write_fault, fault_bad_res, or a
+ * resolution the four stripes cannot take). It writes the same stripes the
+ * hardware does: 4:2:2 baseline JPEG, 16x8 MCUs, chroma taken from the even
+ * columns, the hostif_emu.vhd quantization tables and the header.data layout,
+ * so the client cannot tell the difference.
+ *
+ * FDCT, quantization and the Huffman preparation (nbits, VLI, zero mask)
+ * have NEON kernels; the scalar versions compute exactly the same thing.
+ */
+
+enum class PixelFormat {
+    kRgb24,     // R, G, B bytes, as read by video_capture_tb
+    kYuyv,      // Y0, Cb, Y1, Cr (V4L2_PIX_FMT_YUYV)
+};
+
+struct RawFrame
+{
+    const uint8_t *data;
+    uint32_t stride;        // bytes per line
+    uint16_t width;
+    uint16_t height;
+    PixelFormat format;
+};
+
+struct Stripe
+{
+    uint16_t start;         // first pixel of the line
+    uint16_t width;         // as written to SOF0
+};
+
+// image_stripe.vhd: res_x / num_chan each, the last stripe also gets the remainder
+std::vector<Stripe> stripeLayout(uint16_t resX, int numChan);
+
+static const int kEncoderThreads = 2;   // one per A9 core
+
+class SwEncoder
+{
+public:
+    SwEncoder();
+
+    // Encodes a stripe of frame to out; returns the JPEG length, or 0 if it
+    // does not fit into capacity. Reentrant, one call per stripe and thread.
+    uint32_t encodeStripe(const RawFrame &frame, const Stripe &stripe, uint8_t *out, uint32_t capacity) const;
+
+    // All stripes of frame, jpeg.size() of them, split by stripe over
+    // threads threads (stripes i, i + threads, ...); ns gets the time of
+    // each stripe.
+    void encodeFrame(const RawFrame &frame, int threads, std::vector<std::vector<uint8_t>> &jpeg,
+                     uint32_t *lengths, uint64_t *ns) const;
+
+    static bool hasNeon();
+
+private:
+    struct HuffTable
+    {
+        uint16_t code[256];
+        uint8_t size[256];
+    };
+
+    struct Scratch;
+
+    void buildHeader();
+    void loadMcuRow(const RawFrame &frame, const Stripe &stripe, uint32_t y, Scratch &s) const;
+
+    std::vector<uint8_t> m_header;
+    uint16_t m_divisor[2][64];      // DCT output order, AAN scale folded in
+    uint16_t m_reciprocal[2][64];
+    HuffTable m_dc[2];
+    HuffTable m_ac[2];
+};
+
+#endif
@@ -792,14 +792,18 @@ static struct options mmod[] = {
 	{.opt = "--b1", .val = 0x01},
 	{.opt = "--b2", .val = 0x02},
 	{.opt = "--b3", .val = 0x04},
+	{.opt = "--b4", .val = 0x08},
+	{.opt = "--b5", .val = 0x10},
 	{.opt = NULL}
 };
 
+/* buttons, dx and dy as 16 bit little endian, wheel */
 int mouse_fill_report(char report[8], char buf[BUF_LEN], int *hold)
 {
 	char *tok = strtok(buf, " ");
 	int mvt = 0;
 	int i = 0;
+	long val;
 	for (; tok != NULL; tok = strtok(NULL, " ")) {
 
 		if (strcmp(tok, "--quit") == 0)
@@ -818,19 +822,26 @@ int mouse_fill_report(char report[8], char buf[BUF_LEN], int *hold)
 		if (mmod[i].opt != NULL)
 			continue;
 
-		if (!(tok[0] == '-' && tok[1] == '-') && mvt < 2) {
+		if (!(tok[0] == '-' && tok[1] == '-') && mvt < 3) {
 			errno = 0;
-			report[1 + mvt++] = (char)strtol(tok, NULL, 0);
+			val = strtol(tok, NULL, 0);
 			if (errno != 0) {
 				fprintf(stderr, "Bad value:'%s'\n", tok);
-				report[1 + mvt--] = 0;
+				continue;
+			}
+			if (mvt < 2) {
+				report[1 + 2 * mvt] = (char)(val & 0xff);
+				report[2 + 2 * mvt] = (char)((val >> 8) & 0xff);
+			} else {
+				report[5] = (char)val;
 			}
+			mvt++;
 			continue;
 		}
 
 		fprintf(stderr, "unknown option: %s\n", tok);
 	}
-	return 3;
+	return 6;
 }
 
 static struct options jmod[] = {
@@ -905,7 +916,7 @@ void print_options(char c)
 		for (i = 0; mmod[i].opt != NULL; i++)
 			printf("\t\t%s\n", mmod[i].opt);
 		printf("\n	mouse values:\n"
-		       "		Two signed numbers\n"
+		       "		dx and dy, optionally a wheel step\n"
 		       "--quit to close\n");
 	} else {
 		printf("	joystick options:\n");
@@ -920,11 +931,14 @@ void print_options(char c)
 int main(int argc, const char *argv[])
 {
 	const char *filename = NULL;
+	const char *pipename = "/home/root/web_to_mouse";
 	int fd = 0;
 	FILE * wp;
 	int wd = 0;
 	int maxfd = 0;
 	char buf[BUF_LEN];
+	char line[BUF_LEN];
+	int line_len = 0;
 	int cmd_len;
 	char report[8];
 	int to_send = 8;
@@ -934,7 +948,7 @@ int main(int argc, const char *argv[])
 	char *p;
 
 	if (argc < 3) {
-		fprintf(stderr, "Usage: %s devname mouse|keyboard|joystick\n",
+		fprintf(stderr, "Usage: %s devname mouse|keyboard|joystick [pipename]\n",
 			argv[0]);
 		return 1;
 	}
@@ -943,6 +957,8 @@ int main(int argc, const char *argv[])
 	  return 2;
 
 	filename = argv[1];
+	if (argc > 3)
+		pipename = argv[3];
 
 	if ((fd = open(filename, O_RDWR, 0666)) == -1) {
 		perror(filename);
@@ -950,7 +966,7 @@ int main(int argc, const char *argv[])
 	}
 
     // R/W to keep pipe open even after "echo" closes it
-	if ((wp = fopen("/home/root/web_to_mouse", "r+")) == NULL) {
+	if ((wp = fopen(pipename, "r+")) == NULL) {
 		perror("pipe?");
 		return 7;
 	}
@@ -984,43 +1000,56 @@ int main(int argc, const char *argv[])
 		}
 
 		if (FD_ISSET(wd, &rfds)) {
-			memset(report, 0x0, sizeof(report));
-
-			if (fgets(buf, BUF_LEN, wp) == NULL)
+			cmd_len = read(wd, line + line_len, BUF_LEN - 1 - line_len);
+			if (cmd_len <= 0)
 				break;
+			line_len += cmd_len;
 
-			p = strchr(buf, '\n');
-			if (p) {
+			/* a burst brings several lines per read, do them all
+			   before select() again (fgets() would keep them in
+			   its buffer, unseen by select()) */
+			while ((p = memchr(line, '\n', line_len)) != NULL) {
 				*p = '\0';
-			}
+				strcpy(buf, line);
+				line_len -= p + 1 - line;
+				memmove(line, p + 1, line_len);
 
-			hold = 0;
+				hold = 0;
 
-			memset(report, 0x0, sizeof(report));
-			if (argv[2][0] == 'k')
-				to_send = keyboard_fill_report(report, buf, &hold);
-			else if (argv[2][0] == 'm')
-				to_send = mouse_fill_report(report, buf, &hold);
-			else
-				to_send = joystick_fill_report(report, buf, &hold);
+				memset(report, 0x0, sizeof(report));
+				if (argv[2][0] == 'k')
+					to_send = keyboard_fill_report(report, buf, &hold);
+				else if (argv[2][0] == 'm')
+					to_send = mouse_fill_report(report, buf, &hold);
+				else
+					to_send = joystick_fill_report(report, buf, &hold);
 
-			if (to_send == -1)
-				break;
+				if (to_send == -1)
+					goto quit;
 
-			if (write(fd, report, to_send) != to_send) {
-				perror(filename);
-				return 5;
-			}
-			if (!hold) {
-				memset(report, 0x0, sizeof(report));
 				if (write(fd, report, to_send) != to_send) {
 					perror(filename);
-					return 6;
+					return 5;
+				}
+				/* without --hold each line is a click, its report
+				   followed by an all-zero one; webmouse sends --hold
+				   with the buttons held, so they stay down until a
+				   line without them */
+				if (!hold) {
+					memset(report, 0x0, sizeof(report));
+					if (write(fd, report, to_send) != to_send) {
+						perror(filename);
+						return 6;
+					}
 				}
 			}
+			/* no newline in a full buffer: drop the overlong line */
+			if (line_len == BUF_LEN - 1)
+				line_len = 0;
 		}
 	}
 
+quit:
 	close(fd);
 	close(wd);
 	return 0;
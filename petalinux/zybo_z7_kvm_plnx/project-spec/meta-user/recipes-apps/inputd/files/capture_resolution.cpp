@@ -0,0 +1,62 @@
+#include "capture_resolution.h"
+
+#include <iostream>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace {
+
+const off_t kBaseAddr = 0x40000000;
+const uint32_t kResolutionReg = 2;     // res_y(31:16), res_x(15:0)
+
+}
+
+CaptureResolution::CaptureResolution(uint16_t fixedX, uint16_t fixedY) :
+    m_fixedX { fixedX },
+    m_fixedY { fixedY },
+    m_fd { -1 },
+    m_regs { nullptr }
+{
+    if (fixedX != 0) {
+        return;
+    }
+    m_fd = open("/dev/mem", O_RDONLY | O_SYNC);
+    if (m_fd < 0) {
+        std::cerr << "Could not open /dev/mem, errno " << errno << std::endl;
+        return;
+    }
+    void *mem = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, m_fd, kBaseAddr);
+    if (mem == MAP_FAILED) {
+        std::cerr << "Could not map the registers, errno " << errno << std::endl;
+        return;
+    }
+    m_regs = static_cast<volatile uint32_t *>(mem);
+}
+
+CaptureResolution::~CaptureResolution()
+{
+    if (m_regs != nullptr) {
+        munmap(const_cast<uint32_t *>(m_regs), sysconf(_SC_PAGESIZE));
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool CaptureResolution::read(uint16_t & resX, uint16_t & resY) const
+{
+    if (m_fixedX != 0) {
+        resX = m_fixedX;
+        resY = m_fixedY;
+        return true;
+    }
+    if (m_regs == nullptr) {
+        return false;
+    }
+    uint32_t resolution = m_regs[kResolutionReg];
+    resX = resolution & 0xFFFF;
+    resY = resolution >> 16;
+    return resX != 0 && resY != 0;
+}
@@ -0,0 +1,39 @@
+#ifndef CAPTURE_RESOLUTION_H
+#define CAPTURE_RESOLUTION_H
+
+#include <cstdint>
+
+/*
+ * The resolution resolution_detect measured, from the register file of
+ * the capture path (res_y(31:16), res_x(15:0) at 0x40000008), read on
+ * every call as the source may switch modes. A fixed resolution stands in
+ * for it where there is no PL, e.g. when testing on a PC, or where the
+ * bitstream has no such register (the shipped kvm_top.bit): it reads 0.
+ */
+class CaptureResolution
+{
+public:
+    // 0 x 0: read the register
+    CaptureResolution(uint16_t fixedX, uint16_t fixedY);
+
+    CaptureResolution(const CaptureResolution&) = delete;
+    CaptureResolution& operator=(const CaptureResolution&) = delete;
+
+    ~CaptureResolution();
+
+    bool isOpen() const
+    {
+        return m_fixedX != 0 || m_regs != nullptr;
+    }
+
+    // false while there is no valid mode
+    bool read(uint16_t & resX, uint16_t & resY) const;
+
+private:
+    uint16_t m_fixedX;
+    uint16_t m_fixedY;
+    int m_fd;
+    volatile uint32_t *m_regs;
+};
+
+#endif
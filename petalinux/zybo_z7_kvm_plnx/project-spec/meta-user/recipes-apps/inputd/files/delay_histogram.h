@@ -0,0 +1,36 @@
+#ifndef DELAY_HISTOGRAM_H
+#define DELAY_HISTOGRAM_H
+
+#include <cstdint>
+
+static const int kDelayBuckets = 8;                 // < 125 us, < 250 us, ... < 8 ms, the rest
+static const uint64_t kFirstDelayBoundNs = 125000;
+
+// delays by powers of two, cheap enough to add one per event
+struct DelayHistogram
+{
+    uint64_t count;
+    uint64_t sumNs;
+    uint64_t maxNs;
+    uint64_t buckets[kDelayBuckets];
+
+    void add(uint64_t ns)
+    {
+        count++;
+        sumNs += ns;
+        maxNs = ns > maxNs ? ns : maxNs;
+        int bucket = 0;
+        while (bucket < kDelayBuckets - 1 && ns >= bound(bucket)) {
+            bucket++;
+        }
+        buckets[bucket]++;
+    }
+
+    // upper bound of bucket i in ns, 0 for the last one
+    static uint64_t bound(int bucket)
+    {
+        return bucket < kDelayBuckets - 1 ? kFirstDelayBoundNs << bucket : 0;
+    }
+};
+
+#endif
@@ -0,0 +1,256 @@
+#include "hid_report.h"
+
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "keymap.h"
+
+namespace {
+
+const int kMaxDelta = 32767;
+const int kMaxWheel = 127;
+
+inline int clamp(int v, int max)
+{
+    return v < -max ? -max : v > max ? max : v;
+}
+
+inline bool isModifier(uint8_t usage)
+{
+    return usage >= kUsageFirstModifier && usage < kUsageFirstModifier + 8;
+}
+
+}
+
+HidDevice::HidDevice(const std::string & path) :
+    m_fd { -1 },
+    m_path { path },
+    m_reports { 0 }
+{
+    // read/write like hidgadgettest, which also keeps a FIFO stand-in open;
+    // non-blocking so a report the host has not fetched yet cannot stall the daemon
+    m_fd = open(path.c_str(), O_RDWR | O_NONBLOCK);
+    if (m_fd < 0) {
+        std::cerr << "Could not open " << path << ", errno " << errno << std::endl;
+    }
+}
+
+HidDevice::~HidDevice()
+{
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool HidDevice::send(const uint8_t *report, uint32_t length)
+{
+    ssize_t n;
+    do {
+        n = write(m_fd, report, length);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0 && errno == EAGAIN) {
+        return false;
+    }
+    if (n != static_cast<ssize_t>(length)) {
+        std::cerr << "Could not write " << m_path << ", errno " << errno << std::endl;
+        return false;
+    }
+    m_reports++;
+    return true;
+}
+
+HidMouse::HidMouse(HidDevice & device, uint32_t intervalUs) :
+    m_buttons { 0 },
+    m_scheduler { device, kReportLength, intervalUs, [this](uint8_t *report, uint32_t & covered) {
+        return build(report, covered);
+    } }
+{
+}
+
+bool HidMouse::handle(const InputEvent & event, uint64_t receivedNs)
+{
+    Motion motion { static_cast<uint8_t>(event.buttons & kButtons), event.x, event.y, event.z };
+    uint8_t buttons = m_queue.empty() ? m_buttons : m_queue.back().buttons;
+    if (motion.dx == 0 && motion.dy == 0 && motion.wheel == 0 && motion.buttons == buttons) {
+        return true;
+    }
+    m_queue.push_back(motion);
+    return m_scheduler.queued(receivedNs);
+}
+
+bool HidMouse::build(uint8_t *report, uint32_t & covered)
+{
+    if (m_queue.empty()) {
+        return false;
+    }
+    // -32768 is outside the logical range of the descriptor
+    int dx = 0;
+    int dy = 0;
+    int wheel = 0;
+    m_buttons = m_queue.front().buttons;
+    while (!m_queue.empty() && m_queue.front().buttons == m_buttons) {
+        Motion & motion = m_queue.front();
+        int take = clamp(dx + motion.dx, kMaxDelta) - dx;
+        dx += take;
+        motion.dx -= take;
+        take = clamp(dy + motion.dy, kMaxDelta) - dy;
+        dy += take;
+        motion.dy -= take;
+        take = clamp(wheel + motion.wheel, kMaxWheel) - wheel;
+        wheel += take;
+        motion.wheel -= take;
+        if (motion.dx != 0 || motion.dy != 0 || motion.wheel != 0) {
+            break;
+        }
+        m_queue.pop_front();
+        covered++;
+    }
+    report[0] = m_buttons;
+    report[1] = dx & 0xFF;
+    report[2] = (dx >> 8) & 0xFF;
+    report[3] = dy & 0xFF;
+    report[4] = (dy >> 8) & 0xFF;
+    report[5] = static_cast<uint8_t>(static_cast<int8_t>(wheel));
+    return true;
+}
+
+HidPointer::HidPointer(HidDevice & device, uint32_t intervalUs) :
+    // no position sent yet, the first event always goes out
+    m_last { 0, 0xFFFF, 0xFFFF },
+    m_scheduler { device, kReportLength, intervalUs, [this](uint8_t *report, uint32_t & covered) {
+        return build(report, covered);
+    } }
+{
+}
+
+uint16_t HidPointer::scale(int pixel, uint16_t size)
+{
+    if (size < 2 || pixel <= 0) {
+        return 0;
+    }
+    if (pixel >= size - 1) {
+        return kMaxLogical;
+    }
+    return (static_cast<uint32_t>(pixel) * kMaxLogical + (size - 1) / 2) / (size - 1);
+}
+
+bool HidPointer::handle(const InputEvent & event, uint16_t resX, uint16_t resY, uint64_t receivedNs)
+{
+    Position position { static_cast<uint8_t>(event.buttons & (kButtonLeft | kButtonRight | kButtonMiddle)),
+                        scale(event.x, resX), scale(event.y, resY) };
+    const Position & last = m_queue.empty() ? m_last : m_queue.back();
+    if (position.buttons == last.buttons && position.x == last.x && position.y == last.y) {
+        return true;
+    }
+    m_queue.push_back(position);
+    return m_scheduler.queued(receivedNs);
+}
+
+bool HidPointer::build(uint8_t *report, uint32_t & covered)
+{
+    if (m_queue.empty()) {
+        return false;
+    }
+    uint8_t buttons = m_queue.front().buttons;
+    while (!m_queue.empty() && m_queue.front().buttons == buttons) {
+        m_last = m_queue.front();
+        m_queue.pop_front();
+        covered++;
+    }
+    report[0] = m_last.buttons;
+    report[1] = m_last.x & 0xFF;
+    report[2] = m_last.x >> 8;
+    report[3] = m_last.y & 0xFF;
+    report[4] = m_last.y >> 8;
+    return true;
+}
+
+HidKeyboard::HidKeyboard(HidDevice & device, uint32_t intervalUs) :
+    m_applied { 0 },
+    m_counters {},
+    m_scheduler { device, kReportLength, intervalUs, [this](uint8_t *report, uint32_t & covered) {
+        return build(report, covered);
+    } }
+{
+}
+
+void HidKeyboard::buildReport(const std::bitset<256> & keys, uint8_t *report)
+{
+    memset(report, 0, kReportLength);
+    uint32_t boot = 0;
+    for (uint32_t usage = 0; usage < keys.size(); usage++) {
+        if (!keys[usage]) {
+            continue;
+        }
+        if (isModifier(usage)) {
+            report[0] |= 1 << (usage - kUsageFirstModifier);
+            continue;
+        }
+        report[8 + usage / 8] |= 1 << (usage % 8);
+        if (boot < kBootKeys) {
+            report[2 + boot] = usage;
+        }
+        boot++;
+    }
+    if (boot > kBootKeys) {
+        memset(report + 2, kUsageErrorRollOver, kBootKeys);
+    }
+}
+
+bool HidKeyboard::key(uint8_t usage, bool down, uint64_t receivedNs)
+{
+    // the bitmap holds 0x04 .. 0x7F, 0x00 .. 0x03 are not keys
+    if ((usage < 0x04 || usage > kMaxBitmapUsage) && !isModifier(usage)) {
+        return true;
+    }
+    m_counters.changes++;
+    Change change { usage, down };
+    if (!m_deferred.empty() || !apply(change)) {
+        m_deferred.push_back(change);
+        m_counters.deferred++;
+    }
+    return m_scheduler.queued(receivedNs);
+}
+
+bool HidKeyboard::releaseAll(uint64_t receivedNs)
+{
+    std::bitset<256> keys = m_next;
+    for (size_t i = 0; i < m_deferred.size(); i++) {
+        keys[m_deferred[i].usage] = m_deferred[i].down;
+    }
+    for (uint32_t usage = 0; usage < keys.size(); usage++) {
+        if (keys[usage] && !key(usage, false, receivedNs)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool HidKeyboard::apply(Change change)
+{
+    if (m_next[change.usage] != m_sent[change.usage] && m_next[change.usage] != change.down) {
+        return false;
+    }
+    m_next[change.usage] = change.down;
+    m_applied++;
+    return true;
+}
+
+bool HidKeyboard::build(uint8_t *report, uint32_t & covered)
+{
+    covered = m_applied;
+    m_applied = 0;
+    if (m_next == m_sent) {
+        return false;
+    }
+    buildReport(m_next, report);
+    m_sent = m_next;
+    // what no longer conflicts goes into the next report
+    while (!m_deferred.empty() && apply(m_deferred.front())) {
+        m_deferred.pop_front();
+    }
+    return true;
+}
@@ -0,0 +1,197 @@
+#ifndef HID_REPORT_H
+#define HID_REPORT_H
+
+#include <bitset>
+#include <cstdint>
+#include <string>
+
+#include "input_event.h"
+#include "report_scheduler.h"
+#include "ring_buffer.h"
+
+// the gadget's HID function, /dev/hidg0 (or a FIFO standing in for it)
+class HidDevice
+{
+public:
+    explicit HidDevice(const std::string & path);
+
+    HidDevice(const HidDevice&) = delete;
+    HidDevice& operator=(const HidDevice&) = delete;
+
+    ~HidDevice();
+
+    bool isOpen() const
+    {
+        return m_fd >= 0;
+    }
+
+    // one report per write(), as f_hid takes them; false with errno EAGAIN
+    // while the host has not fetched the last one
+    bool send(const uint8_t *report, uint32_t length);
+
+    uint64_t reports() const
+    {
+        return m_reports;
+    }
+
+private:
+    int m_fd;
+    std::string m_path;
+    uint64_t m_reports;
+};
+
+/*
+ * Relative mouse of initmouse.sh (hid.usb0): five buttons, then dx and dy
+ * as 16 bit values and the wheel as a byte. The buttons stay as the event
+ * says until the next one, rather than being released after each move; an
+ * event that neither moves nor changes the buttons is dropped. Events are
+ * merged into one report per poll interval: the motion of consecutive
+ * events with the same buttons is summed, and each change of the buttons
+ * starts a new report, so no press or release is lost. Motion beyond what
+ * one report holds goes in the next.
+ */
+class HidMouse
+{
+public:
+    static const uint32_t kReportLength = 6;
+    static const uint8_t kButtons = kButtonLeft | kButtonRight | kButtonMiddle | kButtonBack | kButtonForward;
+
+    HidMouse(HidDevice & device, uint32_t intervalUs);
+
+    HidMouse(const HidMouse&) = delete;
+    HidMouse& operator=(const HidMouse&) = delete;
+
+    bool handle(const InputEvent & event, uint64_t receivedNs);
+
+    ReportScheduler & scheduler()
+    {
+        return m_scheduler;
+    }
+
+private:
+    struct Motion
+    {
+        uint8_t buttons;
+        int dx;
+        int dy;
+        int wheel;
+    };
+
+    bool build(uint8_t *report, uint32_t & covered);
+
+    uint8_t m_buttons;              // in the last report built
+    RingBuffer<Motion> m_queue;
+    ReportScheduler m_scheduler;
+};
+
+/*
+ * Absolute pointer of initmouse.sh (hid.usb2): buttons, then X and Y as
+ * 16 bit values of 0 .. kMaxLogical spanning the screen. A pixel of the
+ * capture maps to the same spot on the host at any resolution, so the
+ * cursor cannot drift. Events within a poll interval merge into one report
+ * at the last position, up to the next change of the buttons.
+ */
+class HidPointer
+{
+public:
+    static const uint32_t kReportLength = 5;
+    static const uint16_t kMaxLogical = 0x7FFF;
+
+    HidPointer(HidDevice & device, uint32_t intervalUs);
+
+    HidPointer(const HidPointer&) = delete;
+    HidPointer& operator=(const HidPointer&) = delete;
+
+    // resX x resY: the capture resolution the event's pixel is in
+    bool handle(const InputEvent & event, uint16_t resX, uint16_t resY, uint64_t receivedNs);
+
+    ReportScheduler & scheduler()
+    {
+        return m_scheduler;
+    }
+
+    // pixel -> logical coordinate, the pixel centers of the first and last column at 0 and kMaxLogical
+    static uint16_t scale(int pixel, uint16_t size);
+
+private:
+    struct Position
+    {
+        uint8_t buttons;
+        uint16_t x;
+        uint16_t y;
+    };
+
+    bool build(uint8_t *report, uint32_t & covered);
+
+    Position m_last;                // in the last report built
+    RingBuffer<Position> m_queue;
+    ReportScheduler m_scheduler;
+};
+
+struct KeyboardCounters
+{
+    uint64_t changes;       // key presses and releases taken
+    uint64_t deferred;      // changes held for a later report (release of a key pressed in the same one)
+};
+
+/*
+ * N-key rollover keyboard of initmouse.sh (hid.usb1): modifier bits, a
+ * reserved byte and the six key array of the boot protocol, then a bitmap
+ * of usages 0x00 .. 0x7F. The report descriptor declares the array
+ * constant, so a host in report protocol only looks at the bitmap while a
+ * BIOS in boot protocol reads the first 8 bytes as a boot report.
+ *
+ * Key changes within a poll interval are merged into one report. A change
+ * that would undo one not yet sent (a key pressed and released within the
+ * interval) is deferred to the next report, and so is everything after
+ * it, so no key is lost and the order of changes is kept.
+ */
+class HidKeyboard
+{
+public:
+    static const uint32_t kReportLength = 24;
+    static const uint32_t kBootKeys = 6;
+    static const uint8_t kMaxBitmapUsage = 0x7F;
+
+    HidKeyboard(HidDevice & device, uint32_t intervalUs);
+
+    HidKeyboard(const HidKeyboard&) = delete;
+    HidKeyboard& operator=(const HidKeyboard&) = delete;
+
+    bool key(uint8_t usage, bool down, uint64_t receivedNs);
+
+    // releases every key, for a browser that lost focus
+    bool releaseAll(uint64_t receivedNs);
+
+    ReportScheduler & scheduler()
+    {
+        return m_scheduler;
+    }
+
+    const KeyboardCounters & counters() const
+    {
+        return m_counters;
+    }
+
+    // the report for a key state, as sent
+    static void buildReport(const std::bitset<256> & keys, uint8_t *report);
+
+private:
+    struct Change
+    {
+        uint8_t usage;
+        bool down;
+    };
+
+    bool apply(Change change);
+    bool build(uint8_t *report, uint32_t & covered);
+
+    std::bitset<256> m_sent;        // in the last report built
+    std::bitset<256> m_next;
+    RingBuffer<Change> m_deferred;
+    uint32_t m_applied;             // changes in m_next since
+    KeyboardCounters m_counters;
+    ReportScheduler m_scheduler;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include "input_channel.h"
+
+#include <cstring>
+
+#include "keymap.h"
+
+namespace {
+
+inline bool held(const uint8_t *keys, uint32_t usage)
+{
+    return (keys[usage / 8] >> (usage % 8)) & 1;
+}
+
+inline int16_t clampInt16(int64_t v)
+{
+    return v < -32767 ? -32767 : v > 32767 ? 32767 : v;
+}
+
+}
+
+InputChannel::InputChannel() :
+    m_started { false },
+    m_last {}
+{
+    m_last.pointerX = kNoPosition;
+    m_last.pointerY = kNoPosition;
+}
+
+bool InputChannel::apply(const InputState & state, const Handler & handler, uint32_t & lost)
+{
+    int32_t ahead = static_cast<int32_t>(state.sequence - m_last.sequence);
+    if (m_started && ahead <= 0) {
+        return false;
+    }
+    lost = m_started ? ahead - 1 : 0;
+    if (!m_started) {
+        // the motion and wheel are running totals the client may have kept
+        // from an earlier channel: the first state is where they start
+        m_last.x = state.x;
+        m_last.y = state.y;
+        m_last.wheel = state.wheel;
+    }
+    m_started = true;
+
+    // motion beyond an event goes in the next
+    int64_t dx = static_cast<int32_t>(static_cast<uint32_t>(state.x) - static_cast<uint32_t>(m_last.x));
+    int64_t dy = static_cast<int32_t>(static_cast<uint32_t>(state.y) - static_cast<uint32_t>(m_last.y));
+    int64_t dz = static_cast<int32_t>(static_cast<uint32_t>(state.wheel) - static_cast<uint32_t>(m_last.wheel));
+    while (dx != 0 || dy != 0 || dz != 0) {
+        InputEvent event = { static_cast<uint8_t>(EventType::kMouse), m_last.buttons, clampInt16(dx), clampInt16(dy), clampInt16(dz) };
+        handler(event);
+        dx -= event.x;
+        dy -= event.y;
+        dz -= event.z;
+    }
+    if (state.buttons != m_last.buttons) {
+        handler({ static_cast<uint8_t>(EventType::kMouse), state.buttons, 0, 0, 0 });
+    }
+
+    auto keys = [&](bool down, uint32_t first, uint32_t end) {
+        for (uint32_t usage = first; usage < end; usage++) {
+            if (held(state.keys, usage) == down && held(m_last.keys, usage) != down) {
+                handler({ static_cast<uint8_t>(EventType::kKey), 0, static_cast<int16_t>(usage), static_cast<int16_t>(down), 0 });
+            }
+        }
+    };
+    const uint32_t modifiersEnd = kUsageFirstModifier + 8;
+    keys(false, 0, kUsageFirstModifier);
+    keys(false, kUsageFirstModifier, modifiersEnd);
+    keys(true, kUsageFirstModifier, modifiersEnd);
+    keys(true, 0, kUsageFirstModifier);
+
+    if (state.pointerX != kNoPosition && (state.pointerX != m_last.pointerX || state.pointerY != m_last.pointerY ||
+                                          state.pointerButtons != m_last.pointerButtons)) {
+        handler({ static_cast<uint8_t>(EventType::kPointer), state.pointerButtons,
+                  static_cast<int16_t>(state.pointerX), static_cast<int16_t>(state.pointerY), 0 });
+    }
+    m_last = state;
+    return true;
+}
+
+void InputChannel::release(const Handler & handler)
+{
+    if (!m_started) {
+        return;
+    }
+    InputState state = m_last;
+    state.sequence++;
+    state.buttons = 0;
+    state.pointerButtons = 0;
+    memset(state.keys, 0, sizeof(state.keys));
+    uint32_t lost;
+    apply(state, handler, lost);
+}
@@ -0,0 +1,37 @@
+#ifndef INPUT_CHANNEL_H
+#define INPUT_CHANNEL_H
+
+#include <cstdint>
+#include <functional>
+
+#include "input_event.h"
+
+/*
+ * One client sending InputStates: each state newer than the last one taken
+ * becomes the InputEvents that take the host from there to it, motion
+ * first with the buttons held before, then the buttons, then the keys
+ * (releases before presses, modifiers pressed before and released after
+ * the other keys). A state not newer, a late or repeated one, changes
+ * nothing; states skipped in the sequence were lost, what they held is in
+ * this one. The first state only sets where the motion and wheel start,
+ * its buttons and keys are taken as any others.
+ */
+class InputChannel
+{
+public:
+    typedef std::function<void(const InputEvent &)> Handler;
+
+    InputChannel();
+
+    // false if the state is not newer than the last one taken; lost: states skipped
+    bool apply(const InputState & state, const Handler & handler, uint32_t & lost);
+
+    // the client is gone: releases whatever it held
+    void release(const Handler & handler);
+
+private:
+    bool m_started;
+    InputState m_last;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef INPUT_EVENT_H
+#define INPUT_EVENT_H
+
+#include <cstdint>
+
+/*
+ * Wire formats of the input inputd takes, fixed size and little endian like
+ * both ends, so neither side formats or parses text:
+ *  - InputEvents, on its HTTP port (the body of a POST is any number of
+ *    them) and on its datagram socket;
+ *  - InputStates, one per WebSocket message or UDP datagram on its port.
+ */
+
+enum class EventType : uint8_t {
+    kNone,
+    kMouse,         // relative move and wheel, with the buttons held
+    kKey,           // press or release of a keyboard usage
+    kPointer,       // absolute position and buttons held
+};
+
+// buttons held, in the bit order of the HID button page
+static const uint8_t kButtonLeft = 0x01;
+static const uint8_t kButtonRight = 0x02;
+static const uint8_t kButtonMiddle = 0x04;
+static const uint8_t kButtonBack = 0x08;
+static const uint8_t kButtonForward = 0x10;
+
+struct __attribute__((packed)) InputEvent
+{
+    uint8_t type;       // EventType
+    uint8_t buttons;    // kMouse, kPointer: kButton* bits
+    int16_t x;          // kMouse: dx, kKey: HID usage (keymap.h), kPointer: pixel column of the capture
+    int16_t y;          // kMouse: dy, kKey: 1 pressed, 0 released, kPointer: pixel row
+    int16_t z;          // kMouse: wheel notches, up is positive
+};
+
+static_assert(sizeof(InputEvent) == 8, "InputEvent is 8 bytes on the wire");
+
+static const uint16_t kNoPosition = 0xFFFF;
+
+/*
+ * All input of a client so far rather than what changed: motion as totals
+ * since the channel opened (wrapping), what is held as it is now. A state
+ * that is lost is made up by the next one, so neither motion nor a release
+ * goes missing, and one that comes late is ignored by its sequence number.
+ */
+struct __attribute__((packed)) InputState
+{
+    uint32_t sequence;          // one more for each state, repeats keep it
+    uint32_t ageUs;             // how long the client held the oldest input in it
+    int32_t x;                  // relative motion and wheel notches, summed
+    int32_t y;
+    int32_t wheel;
+    uint8_t buttons;            // kButton* held, relative mouse
+    uint8_t pointerButtons;     // kButton* held, absolute pointer
+    uint16_t pointerX;          // pixel of the capture, kNoPosition before the first
+    uint16_t pointerY;
+    uint16_t reserved;
+    uint8_t keys[32];           // bitmap of the HID usages held (keymap.h)
+};
+
+static_assert(sizeof(InputState) == 60, "InputState is 60 bytes on the wire");
+
+#endif
@@ -0,0 +1,564 @@
+#include "input_server.h"
+
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <poll.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+
+namespace {
+
+const char kResponse[] =
+    "HTTP/1.1 204 No Content\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "Access-Control-Allow-Methods: GET, POST\r\n"
+    "Access-Control-Allow-Headers: Content-Type, X-Input-Age\r\n"
+    "Access-Control-Max-Age: 86400\r\n"
+    "\r\n";
+
+const char kNotFound[] =
+    "HTTP/1.1 404 Not Found\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n";
+
+const char kBadRequest[] =
+    "HTTP/1.1 400 Bad Request\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n";
+
+const uint32_t kMaxHeader = 4096;
+const char kWebSocketGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+// WebSocket opcodes
+const uint8_t kOpText = 0x1;
+const uint8_t kOpBinary = 0x2;
+const uint8_t kOpClose = 0x8;
+const uint8_t kOpPing = 0x9;
+const uint8_t kOpPong = 0xA;
+const size_t kMaxControlLength = 125;
+
+inline uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// where the value of a header starts in the head of the request at the
+// start of in, npos if it is not there; in place, as for every POST of events
+size_t findHeader(const std::string & in, size_t headLength, const char *name)
+{
+    size_t nameLength = strlen(name);
+    for (size_t pos = in.find("\r\n"); pos + 2 + nameLength < headLength; pos = in.find("\r\n", pos + 2)) {
+        const char *line = in.data() + pos + 2;
+        if (strncasecmp(line, name, nameLength) == 0 && line[nameLength] == ':') {
+            size_t value = pos + 3 + nameLength;
+            while (value < headLength && in[value] == ' ') {
+                value++;
+            }
+            return value;
+        }
+    }
+    return std::string::npos;
+}
+
+// value of a header, -1 if it is not there
+long headerValue(const std::string & in, size_t headLength, const char *name)
+{
+    size_t value = findHeader(in, headLength, name);
+    return value == std::string::npos ? -1 : strtol(in.c_str() + value, nullptr, 10);
+}
+
+// value of a header as sent, "" if it is not there
+std::string headerText(const std::string & in, size_t headLength, const char *name)
+{
+    size_t value = findHeader(in, headLength, name);
+    return value == std::string::npos ? std::string() : in.substr(value, in.find('\r', value) - value);
+}
+
+inline uint32_t rotl(uint32_t v, int n)
+{
+    return v << n | v >> (32 - n);
+}
+
+// for Sec-WebSocket-Accept (RFC 6455), nothing secret
+std::string sha1(const std::string & data)
+{
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    std::string msg = data + '\x80';
+    while (msg.size() % 64 != 56) {
+        msg += '\0';
+    }
+    uint64_t bits = data.size() * 8ull;
+    for (int i = 7; i >= 0; i--) {
+        msg += static_cast<char>(bits >> (i * 8));
+    }
+    for (size_t chunk = 0; chunk < msg.size(); chunk += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++) {
+            const uint8_t *b = reinterpret_cast<const uint8_t *>(msg.data() + chunk + 4 * i);
+            w[i] = b[0] << 24 | b[1] << 16 | b[2] << 8 | b[3];
+        }
+        for (int i = 16; i < 80; i++) {
+            w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f = i < 20 ? (b & c) | (~b & d) : i < 40 || i >= 60 ? b ^ c ^ d : (b & c) | (b & d) | (c & d);
+            uint32_t k = i < 20 ? 0x5A827999 : i < 40 ? 0x6ED9EBA1 : i < 60 ? 0x8F1BBCDC : 0xCA62C1D6;
+            uint32_t t = rotl(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rotl(b, 30);
+            b = a;
+            a = t;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+    std::string out;
+    for (uint32_t v : h) {
+        for (int i = 3; i >= 0; i--) {
+            out += static_cast<char>(v >> (i * 8));
+        }
+    }
+    return out;
+}
+
+std::string base64(const std::string & data)
+{
+    static const char kDigits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for (size_t i = 0; i < data.size(); i += 3) {
+        uint32_t v = static_cast<uint8_t>(data[i]) << 16;
+        v |= i + 1 < data.size() ? static_cast<uint8_t>(data[i + 1]) << 8 : 0;
+        v |= i + 2 < data.size() ? static_cast<uint8_t>(data[i + 2]) : 0;
+        out += kDigits[v >> 18];
+        out += kDigits[(v >> 12) & 0x3F];
+        out += i + 1 < data.size() ? kDigits[(v >> 6) & 0x3F] : '=';
+        out += i + 2 < data.size() ? kDigits[v & 0x3F] : '=';
+    }
+    return out;
+}
+
+bool sendAll(int fd, const char *data, size_t length)
+{
+    while (length > 0) {
+        ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+}
+
+InputServer::InputServer(uint16_t port, const std::string & socketPath, Handler handler) :
+    m_tcpFd { -1 },
+    m_udpFd { -1 },
+    m_unixFd { -1 },
+    m_socketPath { socketPath },
+    m_open { false },
+    m_handler { handler },
+    m_counters {}
+{
+    m_eventHandler = [this](const InputEvent & event) {
+        m_counters.events++;
+        m_handler(event);
+    };
+    if (port != 0) {
+        m_tcpFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int one = 1;
+        setsockopt(m_tcpFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        if (bind(m_tcpFd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 ||
+            listen(m_tcpFd, kMaxClients) != 0) {
+            std::cerr << "Could not listen on port " << port << ", errno " << errno << std::endl;
+            return;
+        }
+        m_udpFd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (bind(m_udpFd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) {
+            std::cerr << "Could not bind UDP port " << port << ", errno " << errno << std::endl;
+            return;
+        }
+    }
+    if (!socketPath.empty()) {
+        m_unixFd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+        unlink(socketPath.c_str());
+        if (bind(m_unixFd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) {
+            std::cerr << "Could not bind " << socketPath << ", errno " << errno << std::endl;
+            return;
+        }
+        // the CGI programs do not run as root
+        chmod(socketPath.c_str(), 0666);
+    }
+    m_open = true;
+}
+
+InputServer::~InputServer()
+{
+    for (Client & client : m_clients) {
+        close(client.fd);
+    }
+    if (m_tcpFd >= 0) {
+        close(m_tcpFd);
+    }
+    if (m_udpFd >= 0) {
+        close(m_udpFd);
+    }
+    if (m_unixFd >= 0) {
+        close(m_unixFd);
+        unlink(m_socketPath.c_str());
+    }
+}
+
+void InputServer::addResource(const std::string & path, const std::string & contentType, const std::string & body)
+{
+    m_resources[path] = { contentType, [body]() {
+        return body;
+    } };
+}
+
+void InputServer::addHandler(const std::string & path, const std::string & contentType, Generator generator)
+{
+    m_resources[path] = { contentType, generator };
+}
+
+void InputServer::addAction(const std::string & path, Action action)
+{
+    m_actions[path] = action;
+}
+
+void InputServer::watch(int fd, std::function<void()> ready)
+{
+    m_watches.push_back({ fd, ready });
+}
+
+int InputServer::run()
+{
+    std::vector<struct pollfd> fds;
+    while (true) {
+        fds.clear();
+        fds.push_back({ m_tcpFd, POLLIN, 0 });
+        fds.push_back({ m_unixFd, POLLIN, 0 });
+        fds.push_back({ m_udpFd, POLLIN, 0 });
+        for (Watch & watch : m_watches) {
+            fds.push_back({ watch.fd, POLLIN, 0 });
+        }
+        for (Client & client : m_clients) {
+            fds.push_back({ client.fd, POLLIN, 0 });
+        }
+        // while UDP clients are around, to notice the ones that went quiet
+        if (poll(fds.data(), fds.size(), m_peers.empty() ? -1 : kPeerTimeoutMs / 4) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "poll failed, errno " << errno << std::endl;
+            return 1;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            readDatagrams();
+        }
+        if (fds[2].revents & POLLIN) {
+            readStates();
+        }
+        expirePeers(nowNs());
+        for (size_t i = 0; i < m_watches.size(); i++) {
+            if (fds[3 + i].revents & POLLIN) {
+                m_watches[i].ready();
+            }
+        }
+        // clients first: accepting changes m_clients
+        size_t first = 3 + m_watches.size();
+        for (size_t i = m_clients.size(); i-- > 0;) {
+            if (fds[first + i].revents == 0) {
+                continue;
+            }
+            if (!readClient(m_clients[i])) {
+                if (m_clients[i].websocket) {
+                    m_clients[i].channel.release(m_eventHandler);
+                    m_counters.released++;
+                }
+                close(m_clients[i].fd);
+                m_clients.erase(m_clients.begin() + i);
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            acceptClient();
+        }
+    }
+}
+
+void InputServer::acceptClient()
+{
+    int fd = accept4(m_tcpFd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    if (m_clients.size() >= static_cast<size_t>(kMaxClients)) {
+        m_counters.dropped++;
+        close(fd);
+        return;
+    }
+    // the answer is what lets kvm.js send the next batch
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    m_clients.push_back({ fd, std::string(), false, InputChannel() });
+    // appended to and erased from without allocating, up to a batch of events
+    m_clients.back().in.reserve(kMaxHeader + kMaxBatch);
+}
+
+bool InputServer::readClient(Client & client)
+{
+    char buf[4096];
+    ssize_t n = recv(client.fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return true;
+    }
+    if (n <= 0) {
+        return false;
+    }
+    client.in.append(buf, n);
+    return client.websocket ? readFrames(client) : answerRequests(client);
+}
+
+bool InputServer::answerRequests(Client & client)
+{
+    while (true) {
+        size_t end = client.in.find("\r\n\r\n");
+        if (end == std::string::npos) {
+            if (client.in.size() > kMaxHeader) {
+                m_counters.dropped++;
+                return false;
+            }
+            return true;
+        }
+        size_t head = end + 2;
+        long length = headerValue(client.in, head, "content-length");
+        length = length < 0 ? 0 : length;
+        if (length > static_cast<long>(kMaxRequest)) {
+            m_counters.dropped++;
+            return false;
+        }
+        size_t body = end + 4;
+        if (client.in.size() < body + length) {
+            return true;
+        }
+        m_counters.requests++;
+        bool post = client.in.compare(0, 5, "POST ") == 0;
+        auto action = post ? findAction(client.in) : m_actions.end();
+        if (post && action == m_actions.end()) {
+            // events: answered without building anything
+            long age = headerValue(client.in, head, "x-input-age");
+            if (age >= 0) {
+                m_counters.clientAge.add(age * 1000ull);
+            }
+            dispatch(client.in.data() + body, length);
+            client.in.erase(0, body + length);
+            if (!sendAll(client.fd, kResponse, sizeof(kResponse) - 1)) {
+                return false;
+            }
+            continue;
+        }
+        std::string reply;
+        std::string key = headerText(client.in, head, "sec-websocket-key");
+        if (post) {
+            size_t pathEnd = client.in.find_first_of(" ?\r", 5);
+            size_t queryEnd = client.in.find_first_of(" \r", pathEnd);
+            std::string query = client.in[pathEnd] == '?' ? client.in.substr(pathEnd + 1, queryEnd - pathEnd - 1) : "";
+            reply = action->second(query, client.in.substr(body, length)) ? kResponse : kBadRequest;
+        } else if (client.in.compare(0, 11, "GET /input ") == 0 && !key.empty()) {
+            reply = "HTTP/1.1 101 Switching Protocols\r\n"
+                    "Upgrade: websocket\r\n"
+                    "Connection: Upgrade\r\n"
+                    "Sec-WebSocket-Accept: " + base64(sha1(key + kWebSocketGuid)) + "\r\n"
+                    "\r\n";
+            client.websocket = true;
+        } else {
+            reply = answer(client.in.substr(0, head));
+        }
+        client.in.erase(0, body + length);
+        if (!sendAll(client.fd, reply.data(), reply.size())) {
+            return false;
+        }
+        if (client.websocket) {
+            return readFrames(client);
+        }
+    }
+}
+
+std::map<std::string, InputServer::Action>::iterator InputServer::findAction(const std::string & in)
+{
+    for (auto it = m_actions.begin(); it != m_actions.end(); ++it) {
+        size_t end = 5 + it->first.size();
+        if (in.compare(5, it->first.size(), it->first) == 0 && end < in.size() && (in[end] == ' ' || in[end] == '?')) {
+            return it;
+        }
+    }
+    return m_actions.end();
+}
+
+std::string InputServer::answer(const std::string & head)
+{
+    if (head.compare(0, 4, "GET ") != 0) {
+        return kResponse;
+    }
+    std::string path = head.substr(4, head.find_first_of(" ?\r", 4) - 4);
+    auto it = m_resources.find(path);
+    if (it == m_resources.end()) {
+        return kNotFound;
+    }
+    std::string body = it->second.body();
+    return "HTTP/1.1 200 OK\r\n"
+           "Access-Control-Allow-Origin: *\r\n"
+           "Content-Type: " + it->second.contentType + "\r\n"
+           "Content-Length: " + std::to_string(body.size()) + "\r\n"
+           "\r\n" + body;
+}
+
+bool InputServer::readFrames(Client & client)
+{
+    while (client.in.size() >= 2) {
+        const uint8_t *in = reinterpret_cast<const uint8_t *>(client.in.data());
+        // masked as clients send them; states and control frames fit in
+        // the 7 bit length and browsers do not fragment messages this small
+        uint8_t opcode = in[0] & 0x0F;
+        size_t length = in[1] & 0x7F;
+        if (!(in[0] & 0x80) || !(in[1] & 0x80) || length > kMaxControlLength) {
+            m_counters.dropped++;
+            return false;
+        }
+        if (client.in.size() < 6 + length) {
+            return true;
+        }
+        char payload[kMaxControlLength];
+        for (size_t i = 0; i < length; i++) {
+            payload[i] = in[6 + i] ^ in[2 + i % 4];
+        }
+        client.in.erase(0, 6 + length);
+        if (opcode == kOpBinary && length == sizeof(InputState)) {
+            InputState state;
+            memcpy(&state, payload, sizeof(state));
+            takeState(client.channel, state);
+        } else if (opcode == kOpPing || opcode == kOpText) {
+            // a pong, or the text message echoed
+            char pong[2 + kMaxControlLength] = { static_cast<char>(0x80 | (opcode == kOpPing ? kOpPong : kOpText)),
+                                                 static_cast<char>(length) };
+            memcpy(pong + 2, payload, length);
+            if (!sendAll(client.fd, pong, 2 + length)) {
+                return false;
+            }
+        } else if (opcode == kOpClose) {
+            const char close[] = { static_cast<char>(0x80 | kOpClose), 0 };
+            sendAll(client.fd, close, sizeof(close));
+            return false;
+        } else if (opcode != kOpPong) {
+            m_counters.dropped++;
+            return false;
+        }
+    }
+    return true;
+}
+
+void InputServer::readStates()
+{
+    InputState state;
+    struct sockaddr_in addr;
+    while (true) {
+        socklen_t addrLength = sizeof(addr);
+        ssize_t n = recvfrom(m_udpFd, &state, sizeof(state), MSG_DONTWAIT | MSG_TRUNC,
+                             reinterpret_cast<struct sockaddr *>(&addr), &addrLength);
+        if (n < 0) {
+            return;
+        }
+        m_counters.datagrams++;
+        uint64_t id = static_cast<uint64_t>(addr.sin_addr.s_addr) << 16 | addr.sin_port;
+        auto peer = m_peers.find(id);
+        if (n != sizeof(state) || (peer == m_peers.end() && m_peers.size() >= static_cast<size_t>(kMaxClients))) {
+            m_counters.dropped++;
+            continue;
+        }
+        if (peer == m_peers.end()) {
+            peer = m_peers.insert({ id, Peer { InputChannel(), 0 } }).first;
+        }
+        peer->second.lastNs = nowNs();
+        takeState(peer->second.channel, state);
+    }
+}
+
+void InputServer::expirePeers(uint64_t now)
+{
+    for (auto it = m_peers.begin(); it != m_peers.end();) {
+        if (now - it->second.lastNs < kPeerTimeoutMs * 1000000ull) {
+            ++it;
+            continue;
+        }
+        it->second.channel.release(m_eventHandler);
+        m_counters.released++;
+        it = m_peers.erase(it);
+    }
+}
+
+void InputServer::takeState(InputChannel & channel, const InputState & state)
+{
+    m_counters.states++;
+    uint32_t lost;
+    if (!channel.apply(state, m_eventHandler, lost)) {
+        m_counters.stale++;
+        return;
+    }
+    m_counters.lost += lost;
+    if (state.ageUs != 0) {
+        m_counters.clientAge.add(state.ageUs * 1000ull);
+    }
+}
+
+void InputServer::readDatagrams()
+{
+    char buf[kMaxRequest];
+    while (true) {
+        ssize_t n = recv(m_unixFd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n < 0) {
+            return;
+        }
+        m_counters.datagrams++;
+        dispatch(buf, n);
+    }
+}
+
+void InputServer::dispatch(const char *data, size_t length)
+{
+    // a partial event at the end is dropped
+    for (size_t pos = 0; pos + sizeof(InputEvent) <= length; pos += sizeof(InputEvent)) {
+        InputEvent event;
+        memcpy(&event, data + pos, sizeof(event));
+        m_counters.events++;
+        m_handler(event);
+    }
+}
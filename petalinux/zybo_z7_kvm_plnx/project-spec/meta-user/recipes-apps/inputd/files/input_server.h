@@ -0,0 +1,148 @@
+#ifndef INPUT_SERVER_H
+#define INPUT_SERVER_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "delay_histogram.h"
+#include "input_channel.h"
+#include "input_event.h"
+
+struct InputCounters
+{
+    uint64_t events;        // InputEvents handed on
+    uint64_t requests;      // HTTP requests answered
+    uint64_t datagrams;     // datagrams read from the sockets
+    uint64_t dropped;       // clients refused or closed on a bad request
+    uint64_t states;        // InputStates taken, over WebSocket and UDP
+    uint64_t stale;         // of them late or repeated, ignored
+    uint64_t lost;          // skipped in the sequence, made up by the next
+    uint64_t released;      // channels that went away holding input, released
+    DelayHistogram clientAge;   // X-Input-Age of the POSTs, ageUs of the states: oldest input to sent
+};
+
+/*
+ * Takes InputEvents from the browser and from local tools, in one process
+ * that stays up, and hands them on in the order they came:
+ *  - an HTTP/1.1 port: kvm.js POSTs the events it gathered since the last
+ *    answer over a kept-alive connection, answered with a bodiless 204 that
+ *    allows any origin (the page is served by httpd on port 80);
+ *  - a datagram socket, one or more events per datagram;
+ *  - InputStates (InputChannel) in the binary messages of a WebSocket,
+ *    GET /input upgraded, and in UDP datagrams to the same port. A slow
+ *    answer holds up nothing, and a client that is behind can skip states.
+ *    A WebSocket that closes releases what its client held; a UDP client
+ *    repeats its state while idle and is released after kPeerTimeoutMs
+ *    without one. A text message on the WebSocket is sent back as it is,
+ *    once the states before it are taken, for kvm.js to time the round trip.
+ * Port 0 or an empty path leaves the listener out. GET serves the resources
+ * added with addResource(), e.g. the keymap kvm.js translates keys with,
+ * and the ones made per request with addHandler(), e.g. /metrics. A POST
+ * to a path added with addAction() calls it instead of taking events.
+ */
+class InputServer
+{
+public:
+    typedef std::function<void(const InputEvent &)> Handler;
+
+    static const int kMaxClients = 8;
+    static const uint32_t kMaxRequest = 64 * 1024;
+    static const uint32_t kMaxBatch = 4096;             // events kvm.js POSTs at once, as a rule
+    static const int kPeerTimeoutMs = 1000;
+
+    InputServer(uint16_t port, const std::string & socketPath, Handler handler);
+
+    InputServer(const InputServer&) = delete;
+    InputServer& operator=(const InputServer&) = delete;
+
+    ~InputServer();
+
+    // the listeners asked for are up
+    bool isOpen() const
+    {
+        return m_open;
+    }
+
+    typedef std::function<std::string()> Generator;
+
+    // GET path answers with body
+    void addResource(const std::string & path, const std::string & contentType, const std::string & body);
+
+    // GET path answers with what generator returns then, e.g. counters
+    void addHandler(const std::string & path, const std::string & contentType, Generator generator);
+
+    // takes the query string and the body of the request, false answers 400
+    typedef std::function<bool(const std::string & query, const std::string & body)> Action;
+
+    // POST path runs action, e.g. /macro/play?name=grub or /paste with the text
+    void addAction(const std::string & path, Action action);
+
+    // calls ready whenever fd is readable, e.g. a timerfd
+    void watch(int fd, std::function<void()> ready);
+
+    // serves until poll() fails
+    int run();
+
+    const InputCounters & counters() const
+    {
+        return m_counters;
+    }
+
+private:
+    struct Client
+    {
+        int fd;
+        std::string in;
+        bool websocket;         // upgraded, in holds frames
+        InputChannel channel;
+    };
+
+    struct Peer
+    {
+        InputChannel channel;
+        uint64_t lastNs;
+    };
+
+    struct Watch
+    {
+        int fd;
+        std::function<void()> ready;
+    };
+
+    struct Resource
+    {
+        std::string contentType;
+        Generator body;
+    };
+
+    void acceptClient();
+    bool readClient(Client & client);
+    bool answerRequests(Client & client);
+    std::map<std::string, Action>::iterator findAction(const std::string & in);
+    std::string answer(const std::string & head);
+    bool readFrames(Client & client);
+    void readDatagrams();
+    void readStates();
+    void expirePeers(uint64_t now);
+    void dispatch(const char *data, size_t length);
+    void takeState(InputChannel & channel, const InputState & state);
+
+    int m_tcpFd;
+    int m_udpFd;
+    int m_unixFd;
+    std::string m_socketPath;
+    bool m_open;
+    Handler m_handler;
+    std::vector<Client> m_clients;
+    std::map<uint64_t, Peer> m_peers;   // UDP clients by address and port
+    InputChannel::Handler m_eventHandler;
+    std::vector<Watch> m_watches;
+    std::map<std::string, Resource> m_resources;
+    std::map<std::string, Action> m_actions;
+    InputCounters m_counters;
+};
+
+#endif
@@ -0,0 +1,56 @@
+#include "input_trace.h"
+
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace {
+
+const char *kTracePath = "/dev/shm/kvm_input_trace";
+const uint32_t kMagic = 0x4b564d54;  // "KVMT"
+
+}
+
+InputTrace::InputTrace() :
+    m_fd { -1 },
+    m_state { nullptr }
+{
+    m_fd = open(kTracePath, O_RDWR | O_CREAT, 0644);
+    if (m_fd < 0 || ftruncate(m_fd, sizeof(InputTraceState)) != 0) {
+        std::cerr << "Could not open " << kTracePath << ", errno " << errno << std::endl;
+        return;
+    }
+    void *mem = mmap(NULL, sizeof(InputTraceState), PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (mem == MAP_FAILED) {
+        std::cerr << "Could not map " << kTracePath << ", errno " << errno << std::endl;
+        return;
+    }
+    m_state = static_cast<InputTraceState *>(mem);
+    // one inputd at a time, a restart starts over
+    memset(m_state, 0, sizeof(*m_state));
+    m_state->magic = kMagic;
+}
+
+InputTrace::~InputTrace()
+{
+    if (m_state != nullptr) {
+        munmap(m_state, sizeof(InputTraceState));
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+void InputTrace::written(uint64_t receivedNs, uint64_t writtenNs)
+{
+    uint32_t seq = m_state->sequence;
+    __atomic_store_n(&m_state->sequence, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    m_state->reports++;
+    m_state->receivedNs = receivedNs;
+    m_state->writtenNs = writtenNs;
+    __atomic_store_n(&m_state->sequence, seq + 2, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,45 @@
+#ifndef INPUT_TRACE_H
+#define INPUT_TRACE_H
+
+#include <cstdint>
+
+/*
+ * When the last relative mouse report went out, in /dev/shm/kvm_input_trace,
+ * for "getimg -j" to tell the input path from the capture path of the
+ * latency it measures. Guarded by a seqlock like getimg's FrameExport:
+ * sequence is odd while inputd writes, a reader takes a copy only if it was
+ * even and unchanged across it. Times are CLOCK_MONOTONIC.
+ */
+
+struct InputTraceState
+{
+    uint32_t magic;
+    uint32_t sequence;
+    uint64_t reports;       // written so far
+    uint64_t receivedNs;    // first event the last one holds arrived
+    uint64_t writtenNs;     // the last one was written
+};
+
+class InputTrace
+{
+public:
+    InputTrace();
+
+    InputTrace(const InputTrace&) = delete;
+    InputTrace& operator=(const InputTrace&) = delete;
+
+    ~InputTrace();
+
+    bool isOpen() const
+    {
+        return m_state != nullptr;
+    }
+
+    void written(uint64_t receivedNs, uint64_t writtenNs);
+
+private:
+    int m_fd;
+    InputTraceState *m_state;
+};
+
+#endif
@@ -0,0 +1,487 @@
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <cerrno>
+#include <cctype>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "capture_resolution.h"
+#include "hid_report.h"
+#include "input_event.h"
+#include "input_server.h"
+#include "input_trace.h"
+#include "keymap.h"
+#include "macro.h"
+#include "mouse_fifo.h"
+#include "paste.h"
+
+using namespace std;
+
+static const char *kDefaultDevice = "/dev/hidg0";
+static const char *kDefaultKeyboard = "/dev/hidg1";
+static const char *kDefaultPointer = "/dev/hidg2";
+static const uint32_t kDefaultIntervalUs = 1000;            // bInterval 4 of f_hid at high speed
+static const uint16_t kDefaultPort = 8081;
+static const char *kDefaultSocket = "/var/run/inputd.sock";
+static const char *kDefaultFifo = "/home/root/web_to_mouse";   // cgi-bin/mouse writes there
+static const char *kInputPath = "/dev/shm/kvm_input";      // FrameGovernor looks at its mtime
+static const uint64_t kInputSignalNs = 100000000ull;        // touch it at most every 100 ms
+static const char *kDefaultMacroDir = "/home/root/macros";
+static const char *kMacroSuffix = ".macro";
+static const long kDefaultMacroWaitMs = 10000;
+static const char *kDefaultPasteLayout = "us";
+static const size_t kPrefaultStack = 256 * 1024;
+
+// heap allocations so far, in /metrics: the input path makes none once running
+static uint64_t heapAllocations = 0;
+
+// neither inlined, or the compiler takes the malloc() and free() inside for a mismatch
+__attribute__((noinline)) void *operator new(size_t size)
+{
+    heapAllocations++;
+    void *p = malloc(size > 0 ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+inline uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// the frame rate governor of getimg goes back to full rate on input
+void signalInput(uint64_t now)
+{
+    static uint64_t last = 0;
+    if (last != 0 && now - last < kInputSignalNs) {
+        return;
+    }
+    last = now;
+    int fd = open(kInputPath, O_WRONLY | O_CREAT, 0666);
+    if (fd >= 0) {
+        futimens(fd, NULL);
+        close(fd);
+    }
+}
+
+// "name value" lines like getimg -m
+std::string histogramMetrics(const std::string & prefix, const DelayHistogram & h)
+{
+    std::string out = prefix + "count " + std::to_string(h.count) + "\n" +
+                      prefix + "ns " + std::to_string(h.sumNs) + "\n" +
+                      prefix + "max_ns " + std::to_string(h.maxNs) + "\n";
+    for (int i = 0; i < kDelayBuckets; i++) {
+        uint64_t bound = DelayHistogram::bound(i);
+        out += prefix + (bound != 0 ? "lt_" + std::to_string(bound / 1000)
+                                    : "ge_" + std::to_string(DelayHistogram::bound(i - 1) / 1000)) +
+               "us " + std::to_string(h.buckets[i]) + "\n";
+    }
+    return out;
+}
+
+std::string schedulerMetrics(const std::string & prefix, const ReportScheduler & scheduler)
+{
+    const SchedulerCounters & c = scheduler.counters();
+    return prefix + "events " + std::to_string(c.events) + "\n" +
+           prefix + "reports " + std::to_string(c.reports) + "\n" +
+           prefix + "refused " + std::to_string(c.refused) + "\n" +
+           prefix + "backlog " + std::to_string(scheduler.backlog()) + "\n" +
+           prefix + "max_backlog " + std::to_string(c.maxBacklog) + "\n" +
+           histogramMetrics(prefix + "delay_", c.delay);
+}
+
+// value of name in a query string, "" if it is not there
+std::string queryValue(const std::string & query, const std::string & name)
+{
+    size_t pos = 0;
+    while (pos < query.size()) {
+        size_t end = query.find('&', pos);
+        end = end == std::string::npos ? query.size() : end;
+        if (query.compare(pos, name.size() + 1, name + "=") == 0) {
+            return query.substr(pos + name.size() + 1, end - pos - name.size() - 1);
+        }
+        pos = end + 1;
+    }
+    return std::string();
+}
+
+// a file name in the macro directory, nothing that leaves it
+bool validMacroName(const std::string & name)
+{
+    if (name.empty() || name.size() > 64) {
+        return false;
+    }
+    for (char c : name) {
+        if (!isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// one name per line
+std::string macroList(const std::string & dir)
+{
+    std::string out;
+    size_t suffix = strlen(kMacroSuffix);
+    DIR *d = opendir(dir.c_str());
+    if (d == nullptr) {
+        return out;
+    }
+    while (struct dirent *entry = readdir(d)) {
+        std::string name = entry->d_name;
+        if (name.size() > suffix && name.compare(name.size() - suffix, suffix, kMacroSuffix) == 0) {
+            out += name.substr(0, name.size() - suffix) + "\n";
+        }
+    }
+    closedir(d);
+    return out;
+}
+
+/*
+ * The receive and write loop ahead of getimg and httpd on the same two
+ * cores, so a busy screen does not delay the input: SCHED_FIFO, all of its
+ * memory locked and the stack it will use touched, so that neither other
+ * work nor a page fault comes between an event and its report.
+ */
+bool makeRealtime(int priority)
+{
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        std::cerr << "Could not lock memory, errno " << errno << std::endl;
+        return false;
+    }
+    volatile char stack[kPrefaultStack];
+    for (size_t i = 0; i < sizeof(stack); i += 4096) {
+        stack[i] = 0;
+    }
+    struct sched_param param = {};
+    param.sched_priority = priority;
+    if (sched_setscheduler(0, SCHED_FIFO, &param) != 0) {
+        std::cerr << "Could not run at SCHED_FIFO priority " << priority << ", errno " << errno << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int runDaemon(const std::string & device, const std::string & keyboardDevice, const std::string & pointerDevice,
+              uint16_t resX, uint16_t resY, uint32_t intervalUs, uint16_t port, const std::string & socketPath,
+              const std::string & fifoPath, const std::string & macroDir, int priority)
+{
+    HidDevice hid { device };
+    if (!hid.isOpen()) {
+        return 1;
+    }
+    HidMouse mouse { hid, intervalUs };
+    // for the latency probe of getimg -j
+    InputTrace trace;
+    if (trace.isOpen()) {
+        mouse.scheduler().setWritten([&](uint64_t receivedNs, uint64_t writtenNs) {
+            trace.written(receivedNs, writtenNs);
+        });
+    }
+    // without hid.usb1 (an older initmouse.sh) there is just the mouse
+    std::unique_ptr<HidDevice> keyboardHid;
+    std::unique_ptr<HidKeyboard> keyboard;
+    if (!keyboardDevice.empty()) {
+        keyboardHid.reset(new HidDevice { keyboardDevice });
+        if (keyboardHid->isOpen()) {
+            keyboard.reset(new HidKeyboard { *keyboardHid, intervalUs });
+        }
+    }
+    std::unique_ptr<PasteTyper> typer;
+    if (keyboard) {
+        typer.reset(new PasteTyper { *keyboard, intervalUs });
+    }
+    uint64_t keysDropped = 0;
+    bool noResolution = false;
+    std::unique_ptr<HidDevice> pointerHid;
+    std::unique_ptr<HidPointer> pointer;
+    CaptureResolution resolution { resX, resY };
+    if (!pointerDevice.empty()) {
+        pointerHid.reset(new HidDevice { pointerDevice });
+        if (pointerHid->isOpen() && resolution.isOpen()) {
+            pointer.reset(new HidPointer { *pointerHid, intervalUs });
+        }
+    }
+    auto deliver = [&](const InputEvent & event, uint64_t now) {
+        switch (static_cast<EventType>(event.type)) {
+        case EventType::kMouse:
+            mouse.handle(event, now);
+            break;
+        case EventType::kKey:
+            // the paste has the keyboard until it is typed
+            if (typer && typer->typing()) {
+                keysDropped++;
+            } else if (keyboard) {
+                keyboard->key(event.x, event.y != 0, now);
+            }
+            break;
+        case EventType::kPointer: {
+            uint16_t x, y;
+            if (!pointer) {
+                break;
+            }
+            if (resolution.read(x, y)) {
+                pointer->handle(event, x, y, now);
+                noResolution = false;
+            } else if (!noResolution) {
+                // no mode, or a bitstream without the register (reads 0)
+                std::cerr << "Could not read the capture resolution, pointer events dropped (-r WxH sets it)" << std::endl;
+                noResolution = true;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+        signalInput(now);
+    };
+    MacroRecorder recorder;
+    std::string recordName;
+    ScreenWatch screen;
+    MacroPlayer player { [&](const InputEvent & event, uint64_t, uint64_t now) {
+        deliver(event, now);
+    }, [&](uint64_t & hash) {
+        return screen.hash(hash);
+    } };
+    auto receive = [&](const InputEvent & event) {
+        uint64_t now = nowNs();
+        if (recorder.recording()) {
+            recorder.add(event, now);
+        }
+        deliver(event, now);
+    };
+    InputServer server { port, socketPath, receive };
+    // the CGI chain, kvm.js's fallback; without the FIFO there is none
+    std::unique_ptr<MouseFifo> fifo;
+    if (!fifoPath.empty()) {
+        fifo.reset(new MouseFifo { fifoPath, receive });
+    }
+    if (!server.isOpen() || !player.isOpen() || (typer && !typer->isOpen())) {
+        return 2;
+    }
+    server.addResource("/keymap", "application/json", keymapJson());
+    server.addHandler("/metrics", "text/plain", [&]() {
+        uint64_t allocations = heapAllocations;
+        const InputCounters & c = server.counters();
+        std::string out = "heap_allocations " + std::to_string(allocations) + "\n"
+                          "events " + std::to_string(c.events) + "\n"
+                          "requests " + std::to_string(c.requests) + "\n"
+                          "datagrams " + std::to_string(c.datagrams) + "\n"
+                          "dropped " + std::to_string(c.dropped) + "\n"
+                          "states " + std::to_string(c.states) + "\n"
+                          "states_stale " + std::to_string(c.stale) + "\n"
+                          "states_lost " + std::to_string(c.lost) + "\n"
+                          "channels_released " + std::to_string(c.released) + "\n";
+        if (fifo && fifo->isOpen()) {
+            out += "fifo_lines " + std::to_string(fifo->lines()) + "\n"
+                   "fifo_bad " + std::to_string(fifo->bad()) + "\n";
+        }
+        out += histogramMetrics("client_age_", c.clientAge);
+        out += schedulerMetrics("mouse_", mouse.scheduler());
+        if (keyboard) {
+            out += schedulerMetrics("keyboard_", keyboard->scheduler());
+        }
+        if (pointer) {
+            out += schedulerMetrics("pointer_", pointer->scheduler());
+        }
+        const MacroCounters & m = player.counters();
+        out += "macro_recording " + std::to_string(recorder.recording() ? 1 : 0) + "\n"
+               "macro_playing " + std::to_string(player.playing() ? 1 : 0) + "\n"
+               "macro_plays " + std::to_string(m.plays) + "\n"
+               "macro_completed " + std::to_string(m.completed) + "\n"
+               "macro_steps " + std::to_string(m.steps) + "\n"
+               "macro_waits " + std::to_string(m.waits) + "\n"
+               "macro_wait_timeouts " + std::to_string(m.waitTimeouts) + "\n";
+        out += histogramMetrics("macro_jitter_", m.jitter);
+        if (typer) {
+            const PasteCounters & p = typer->counters();
+            out += "paste_typing " + std::to_string(typer->typing() ? 1 : 0) + "\n"
+                   "paste_pastes " + std::to_string(p.pastes) + "\n"
+                   "paste_chars " + std::to_string(p.chars) + "\n"
+                   "paste_skipped " + std::to_string(p.skipped) + "\n"
+                   "paste_backoffs " + std::to_string(p.backoffs) + "\n"
+                   "paste_gap_us " + std::to_string(typer->gapNs() / 1000) + "\n"
+                   "paste_chars_per_s " + std::to_string(static_cast<uint64_t>(typer->charsPerSecond())) + "\n"
+                   "paste_keys_dropped " + std::to_string(keysDropped) + "\n";
+        }
+        return out;
+    });
+    // POST /macro/record?name=N, then the input to record, /macro/wait?timeout_ms=T
+    // before a step that must wait for the screen, /macro/stop; /macro/play?name=N
+    server.addAction("/macro/record", [&](const std::string & query, const std::string &) {
+        std::string name = queryValue(query, "name");
+        if (!validMacroName(name)) {
+            return false;
+        }
+        recordName = name;
+        recorder.start(nowNs());
+        return true;
+    });
+    server.addAction("/macro/wait", [&](const std::string & query, const std::string &) {
+        std::string timeout = queryValue(query, "timeout_ms");
+        long timeoutMs = timeout.empty() ? kDefaultMacroWaitMs : atol(timeout.c_str());
+        if (!recorder.recording() || timeoutMs <= 0) {
+            return false;
+        }
+        recorder.wait(timeoutMs, nowNs());
+        return true;
+    });
+    server.addAction("/macro/stop", [&](const std::string &, const std::string &) {
+        player.stop();
+        if (!recorder.recording()) {
+            return true;
+        }
+        mkdir(macroDir.c_str(), 0755);
+        return saveMacro(macroDir + "/" + recordName + kMacroSuffix, recorder.stop());
+    });
+    server.addAction("/macro/play", [&](const std::string & query, const std::string &) {
+        std::string name = queryValue(query, "name");
+        std::vector<MacroStep> steps;
+        if (!validMacroName(name) || !loadMacro(macroDir + "/" + name + kMacroSuffix, steps)) {
+            return false;
+        }
+        player.play(steps, nowNs());
+        return true;
+    });
+    server.addHandler("/macros", "text/plain", [&]() {
+        return macroList(macroDir);
+    });
+    // POST /paste?layout=L with the UTF-8 text as the body, /paste/stop
+    server.addAction("/paste", [&](const std::string & query, const std::string & body) {
+        std::string layout = queryValue(query, "layout");
+        return typer && typer->type(body, layout.empty() ? kDefaultPasteLayout : layout, nowNs());
+    });
+    server.addAction("/paste/stop", [&](const std::string &, const std::string &) {
+        if (typer) {
+            typer->stop(nowNs());
+        }
+        return true;
+    });
+    server.watch(player.timerFd(), [&]() {
+        player.flush();
+    });
+    server.watch(mouse.scheduler().timerFd(), [&]() {
+        mouse.scheduler().flush();
+    });
+    if (keyboard) {
+        server.watch(keyboard->scheduler().timerFd(), [&]() {
+            keyboard->scheduler().flush();
+        });
+        server.watch(typer->timerFd(), [&]() {
+            typer->flush();
+        });
+    }
+    if (pointer) {
+        server.watch(pointer->scheduler().timerFd(), [&]() {
+            pointer->scheduler().flush();
+        });
+    }
+    if (fifo && fifo->isOpen()) {
+        server.watch(fifo->fd(), [&]() {
+            fifo->read();
+        });
+    }
+    signal(SIGPIPE, SIG_IGN);
+    // without the rights it runs on at normal priority
+    if (priority > 0) {
+        makeRealtime(priority);
+    }
+    return server.run();
+}
+
+void usage(const char *prog)
+{
+    std::cerr << "usage: " << prog << " [-o MOUSE] [-K KEYBOARD] [-A POINTER] [-r WxH] [-i US] [-p PORT] [-u SOCKET] [-f FIFO] [-d DIR] [-P PRIO]"
+              << "  take input events and write HID reports\n"
+              << "  defaults: -o " << kDefaultDevice << " -K " << kDefaultKeyboard << " -A " << kDefaultPointer
+              << " -i " << kDefaultIntervalUs << " (USB poll interval) -p " << kDefaultPort << " -u " << kDefaultSocket
+              << " -f " << kDefaultFifo << " -d " << kDefaultMacroDir
+              << ", -K '' / -A '' / -p 0 / -u '' / -f '' leave it out\n"
+              << "  -f: the FIFO of cgi-bin/mouse, lines as hidgadgettest's mouse mode takes them\n"
+              << "  -r: capture resolution for the absolute pointer, instead of the register of resolution_detect\n"
+              << "      (not in the shipped bitstream, where it reads 0 and the pointer needs -r)\n"
+              << "  -P: run at this SCHED_FIFO priority with the memory locked, 0 (default) at normal priority\n"
+              << "  checks and benchmarks: inputd_test\n";
+}
+
+int main(int argc, char** argv)
+{
+    std::string device = kDefaultDevice;
+    std::string keyboardDevice = kDefaultKeyboard;
+    std::string pointerDevice = kDefaultPointer;
+    unsigned resX = 0;
+    unsigned resY = 0;
+    std::string socketPath = kDefaultSocket;
+    std::string fifoPath = kDefaultFifo;
+    int port = kDefaultPort;
+    int intervalUs = kDefaultIntervalUs;
+    int priority = 0;
+    std::string macroDir = kDefaultMacroDir;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "o:K:A:r:i:p:u:f:d:P:")) != -1) {
+        switch (opt) {
+        case 'o':
+            device = optarg;
+            break;
+        case 'K':
+            keyboardDevice = optarg;
+            break;
+        case 'A':
+            pointerDevice = optarg;
+            break;
+        case 'r':
+            if (sscanf(optarg, "%ux%u", &resX, &resY) != 2 || resX == 0 || resY == 0 || resX > 0xFFFF || resY > 0xFFFF) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'i':
+            intervalUs = atoi(optarg);
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'u':
+            socketPath = optarg;
+            break;
+        case 'f':
+            fifoPath = optarg;
+            break;
+        case 'd':
+            macroDir = optarg;
+            break;
+        case 'P':
+            priority = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    return runDaemon(device, keyboardDevice, pointerDevice, resX, resY,
+                     intervalUs > 0 ? intervalUs : kDefaultIntervalUs, port, socketPath, fifoPath, macroDir, priority);
+}
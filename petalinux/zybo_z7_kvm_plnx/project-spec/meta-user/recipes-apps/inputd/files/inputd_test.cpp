@@ -0,0 +1,1435 @@
+#include <iostream>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "hid_report.h"
+#include "input_event.h"
+#include "input_server.h"
+#include "keymap.h"
+#include "loopback.h"
+#include "macro.h"
+#include "paste.h"
+
+/*
+ * Checks and benchmarks of the input path, on pseudo terminals standing in
+ * for /dev/hidgN or on the gadget over dummy_hcd, so they run on the host
+ * as well as on the board. The daemon they start is the inputd next to
+ * this binary.
+ */
+
+static const uint32_t kDefaultIntervalUs = 1000;            // inputd's, bInterval 4 of f_hid at high speed
+static const int kBenchTimeoutMs = 2000;
+static const int kBenchWarmup = 10;
+static const int kStressPriority = 50;
+
+inline uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Latency benchmark: the time from an event leaving its sender to the
+ * report written for it arriving at a pseudo terminal that stands in for
+ * /dev/hidg0. One move of (5, -3) per iteration, one at a time, over
+ *  - the CGI chain: a shell running "webmouse > FIFO" as httpd runs
+ *    cgi-bin/mouse, and inputd parsing the text line (-f);
+ *  - inputd over HTTP, as kvm.js falls back to, over the datagram socket,
+ *    and as InputStates over a WebSocket, as kvm.js sends them, and UDP;
+ *  - HTTP and the WebSocket again while a stream of 64 KiB writes over
+ *    loopback TCP stands in for the video.
+ * httpd's own request handling is left out of the CGI chain.
+ */
+
+pid_t spawn(const std::vector<std::string> & args)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        std::vector<char *> argv;
+        for (const std::string & arg : args) {
+            argv.push_back(const_cast<char *>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    return pid;
+}
+
+void stop(pid_t pid)
+{
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+    }
+}
+
+// the inputd installed next to this binary, not one further up the PATH
+std::string inputdPath()
+{
+    char self[4096];
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len <= 0) {
+        return std::string();
+    }
+    self[len] = '\0';
+    std::string path = self;
+    return path.substr(0, path.rfind('/') + 1) + "inputd";
+}
+
+void printLatency(const char *name, std::vector<uint64_t> & ns)
+{
+    if (ns.empty()) {
+        printf("%-16s no samples\n", name);
+        return;
+    }
+    std::sort(ns.begin(), ns.end());
+    auto at = [&](double q) {
+        return ns[static_cast<size_t>(q * (ns.size() - 1))] / 1000.0;
+    };
+    printf("%-16s min %8.1f  p50 %8.1f  p90 %8.1f  p99 %8.1f  max %8.1f us\n",
+           name, at(0.0), at(0.5), at(0.9), at(0.99), at(1.0));
+}
+
+bool checkMove(const uint8_t *report)
+{
+    return report[0] == 0 && static_cast<int16_t>(report[1] | report[2] << 8) == 5 &&
+           static_cast<int16_t>(report[3] | report[4] << 8) == -3 && report[5] == 0;
+}
+
+bool benchCgiChain(LoopbackDevice & device, const std::string & dir, int iterations, std::vector<uint64_t> & ns)
+{
+    std::string fifo = dir + "/web_to_mouse";
+    if (mkfifo(fifo.c_str(), 0600) != 0) {
+        std::cerr << "Could not make " << fifo << ", errno " << errno << std::endl;
+        return false;
+    }
+    std::string inputd = inputdPath();
+    if (inputd.empty()) {
+        return false;
+    }
+    pid_t daemon = spawn({ inputd, "-o", device.path(), "-K", "", "-A", "", "-p", "0", "-u", "", "-f", fifo });
+    bool ok = true;
+    for (int i = 0; i < iterations + kBenchWarmup && ok; i++) {
+        uint64_t start = nowNs();
+        pid_t cgi = fork();
+        if (cgi == 0) {
+            setenv("QUERY_STRING", "dx=5&dy=-3&b=0&c=0", 1);
+            execl("/bin/sh", "sh", "-c", "webmouse > \"$1\"", "sh", fifo.c_str(), (char *)nullptr);
+            _exit(127);
+        }
+        uint8_t report[HidMouse::kReportLength];
+        ok = device.read(report, HidMouse::kReportLength);
+        uint64_t end = nowNs();
+        ok = ok && checkMove(report);
+        waitpid(cgi, nullptr, 0);
+        if (i >= kBenchWarmup) {
+            ns.push_back(end - start);
+        }
+    }
+    stop(daemon);
+    unlink(fifo.c_str());
+    if (!ok) {
+        std::cerr << "CGI chain: no report, is webmouse in PATH?" << std::endl;
+    }
+    return ok;
+}
+
+uint16_t freePort()
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+    getsockname(fd, reinterpret_cast<struct sockaddr *>(&addr), &len);
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+int connectTcp(uint16_t port)
+{
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    // until inputd is up
+    for (int wait = 0; wait < kBenchTimeoutMs; wait += 10) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            return fd;
+        }
+        close(fd);
+        usleep(10000);
+    }
+    return -1;
+}
+
+int connectUnix(const std::string & path)
+{
+    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int connectUdp(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// reads one bodiless answer of inputd
+bool readAnswer(int fd)
+{
+    std::string in;
+    char buf[512];
+    while (in.find("\r\n\r\n") == std::string::npos) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            return false;
+        }
+        in.append(buf, n);
+    }
+    return true;
+}
+
+// GET /input upgraded, as kvm.js opens it
+int connectWebSocket(uint16_t port)
+{
+    int fd = connectTcp(port);
+    std::string request = "GET /input HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                          "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+    if (fd >= 0 && (send(fd, request.data(), request.size(), 0) != static_cast<ssize_t>(request.size()) || !readAnswer(fd))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// a datagram, or a binary message masked as a browser sends it
+bool sendState(int fd, const InputState & state, bool websocket)
+{
+    if (!websocket) {
+        return send(fd, &state, sizeof(state), 0) == sizeof(state);
+    }
+    uint8_t frame[6 + sizeof(InputState)] = { 0x82, 0x80 | sizeof(InputState), 0x12, 0x34, 0x56, 0x78 };
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(&state);
+    for (size_t i = 0; i < sizeof(state); i++) {
+        frame[6 + i] = data[i] ^ frame[2 + i % 4];
+    }
+    return send(fd, frame, sizeof(frame), 0) == sizeof(frame);
+}
+
+// each state moves (5, -3) further than the one before, an interval apart
+bool timeStates(LoopbackDevice & device, int fd, InputState & state, bool websocket, int iterations,
+                std::vector<uint64_t> & ns)
+{
+    uint8_t report[HidMouse::kReportLength];
+    // the first state of a channel only sets where the sums start, kvm.js sends it on open
+    if (state.sequence == 0) {
+        state.sequence++;
+        if (!sendState(fd, state, websocket)) {
+            return false;
+        }
+    }
+    for (int i = 0; i < iterations + kBenchWarmup; i++) {
+        usleep(kDefaultIntervalUs);
+        state.sequence++;
+        state.x += 5;
+        state.y -= 3;
+        uint64_t start = nowNs();
+        if (!sendState(fd, state, websocket) || !device.read(report, sizeof(report))) {
+            return false;
+        }
+        uint64_t end = nowNs();
+        if (!checkMove(report)) {
+            return false;
+        }
+        if (i >= kBenchWarmup) {
+            ns.push_back(end - start);
+        }
+    }
+    return true;
+}
+
+// a writer streaming to a reader over loopback TCP until stopped, like the stripes to the browser
+std::vector<pid_t> startVideoLoad()
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    bind(listener, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+    listen(listener, 1);
+    getsockname(listener, reinterpret_cast<struct sockaddr *>(&addr), &len);
+    std::vector<pid_t> pids;
+    pid_t reader = fork();
+    if (reader == 0) {
+        int fd = accept(listener, nullptr, nullptr);
+        static char buf[64 * 1024];
+        while (read(fd, buf, sizeof(buf)) > 0) {
+        }
+        _exit(0);
+    }
+    pids.push_back(reader);
+    pid_t writer = fork();
+    if (writer == 0) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        static char buf[64 * 1024];
+        if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0) {
+            while (write(fd, buf, sizeof(buf)) > 0) {
+            }
+        }
+        _exit(0);
+    }
+    pids.push_back(writer);
+    close(listener);
+    return pids;
+}
+
+bool benchInputd(LoopbackDevice & device, const std::string & dir, int iterations,
+                 std::vector<uint64_t> & httpNs, std::vector<uint64_t> & socketNs,
+                 std::vector<uint64_t> & webSocketNs, std::vector<uint64_t> & udpNs,
+                 std::vector<uint64_t> & loadedHttpNs, std::vector<uint64_t> & loadedWebSocketNs)
+{
+    std::string inputd = inputdPath();
+    if (inputd.empty()) {
+        return false;
+    }
+    std::string socketPath = dir + "/inputd.sock";
+    uint16_t port = freePort();
+    pid_t daemon = spawn({ inputd, "-o", device.path(), "-K", "", "-A", "", "-p", std::to_string(port), "-u", socketPath, "-f", "" });
+
+    int tcp = connectTcp(port);
+    int dgram = tcp >= 0 ? connectUnix(socketPath) : -1;
+    int webSocket = tcp >= 0 ? connectWebSocket(port) : -1;
+    int udp = tcp >= 0 ? connectUdp(port) : -1;
+    InputEvent event = { static_cast<uint8_t>(EventType::kMouse), 0, 5, -3, 0 };
+    std::string request = "POST /input HTTP/1.1\r\nHost: localhost\r\nContent-Length: 8\r\n\r\n";
+    request.append(reinterpret_cast<const char *>(&event), sizeof(event));
+    uint8_t report[HidMouse::kReportLength];
+    bool ok = tcp >= 0 && dgram >= 0 && webSocket >= 0 && udp >= 0;
+    // events an interval apart, as ReportScheduler holds back a report that would come sooner
+    auto benchHttp = [&](std::vector<uint64_t> & ns) {
+        for (int i = 0; i < iterations + kBenchWarmup && ok; i++) {
+            usleep(kDefaultIntervalUs);
+            uint64_t start = nowNs();
+            ok = send(tcp, request.data(), request.size(), 0) == static_cast<ssize_t>(request.size()) &&
+                 device.read(report, sizeof(report));
+            uint64_t end = nowNs();
+            ok = ok && checkMove(report) && readAnswer(tcp);
+            if (i >= kBenchWarmup) {
+                ns.push_back(end - start);
+            }
+        }
+    };
+    InputState webSocketState = {};
+    InputState udpState = {};
+    webSocketState.pointerX = webSocketState.pointerY = udpState.pointerX = udpState.pointerY = kNoPosition;
+    auto benchStates = [&](int fd, InputState & state, bool websocket, std::vector<uint64_t> & ns) {
+        ok = ok && timeStates(device, fd, state, websocket, iterations, ns);
+    };
+    benchHttp(httpNs);
+    for (int i = 0; i < iterations + kBenchWarmup && ok; i++) {
+        usleep(kDefaultIntervalUs);
+        uint64_t start = nowNs();
+        ok = send(dgram, &event, sizeof(event), 0) == sizeof(event) && device.read(report, sizeof(report));
+        uint64_t end = nowNs();
+        ok = ok && checkMove(report);
+        if (i >= kBenchWarmup) {
+            socketNs.push_back(end - start);
+        }
+    }
+    benchStates(webSocket, webSocketState, true, webSocketNs);
+    benchStates(udp, udpState, false, udpNs);
+    if (ok) {
+        std::vector<pid_t> load = startVideoLoad();
+        benchHttp(loadedHttpNs);
+        benchStates(webSocket, webSocketState, true, loadedWebSocketNs);
+        for (pid_t pid : load) {
+            stop(pid);
+        }
+    }
+    for (int fd : { tcp, dgram, webSocket, udp }) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    stop(daemon);
+    // inputd leaves its socket behind on SIGTERM
+    unlink(socketPath.c_str());
+    if (!ok) {
+        std::cerr << "inputd: no report" << std::endl;
+    }
+    return ok;
+}
+
+int benchLatency(int iterations)
+{
+    LoopbackDevice device;
+    if (!device.isOpen()) {
+        return 1;
+    }
+    TempDir dir;
+    if (!dir.isOpen()) {
+        return 1;
+    }
+
+    std::vector<uint64_t> cgiNs;
+    std::vector<uint64_t> httpNs;
+    std::vector<uint64_t> socketNs;
+    std::vector<uint64_t> webSocketNs;
+    std::vector<uint64_t> udpNs;
+    std::vector<uint64_t> loadedHttpNs;
+    std::vector<uint64_t> loadedWebSocketNs;
+    bool cgiOk = benchCgiChain(device, dir.path(), iterations, cgiNs);
+    bool inputdOk = benchInputd(device, dir.path(), iterations, httpNs, socketNs, webSocketNs, udpNs, loadedHttpNs,
+                                loadedWebSocketNs);
+
+    printf("event to report written, %d events each:\n", iterations);
+    printLatency("cgi chain", cgiNs);
+    printLatency("inputd http", httpNs);
+    printLatency("inputd socket", socketNs);
+    printLatency("inputd websocket", webSocketNs);
+    printLatency("inputd udp", udpNs);
+    printf("with a TCP stream over loopback:\n");
+    printLatency("inputd http", loadedHttpNs);
+    printLatency("inputd websocket", loadedWebSocketNs);
+    return cgiOk && inputdOk ? 0 : 2;
+}
+
+/*
+ * Stress test: state sent to report written onto a pseudo terminal, over
+ * the WebSocket kvm.js uses, with inputd at normal priority and with -P,
+ * each idle and while the video keeps the cores busy: a TCP stream over
+ * loopback like the stripes to the browser, and a process per core copying
+ * 4 MiB buffers like getimg copying the JPEGs out. With the heap
+ * allocations inputd made meanwhile, from its /metrics: none are expected.
+ */
+std::vector<pid_t> startCopyLoad()
+{
+    std::vector<pid_t> pids;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    for (long i = 0; i < cores; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            std::vector<char> from(4 << 20, 1);
+            std::vector<char> to(4 << 20);
+            while (true) {
+                memcpy(to.data(), from.data(), from.size());
+                from[to[i] & 0xFF]++;
+            }
+        }
+        pids.push_back(pid);
+    }
+    return pids;
+}
+
+// heap_allocations of inputd's /metrics, -1 without an answer
+long long heapAllocationsOf(uint16_t port)
+{
+    int fd = connectTcp(port);
+    if (fd < 0) {
+        return -1;
+    }
+    std::string request = "GET /metrics HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    std::string in;
+    char buf[4096];
+    ssize_t n;
+    if (send(fd, request.data(), request.size(), 0) == static_cast<ssize_t>(request.size())) {
+        while (in.find("\nevents ") == std::string::npos && (n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+            in.append(buf, n);
+        }
+    }
+    close(fd);
+    size_t pos = in.find("heap_allocations ");
+    return pos == std::string::npos ? -1 : atoll(in.c_str() + pos + 17);
+}
+
+int stressTest(int iterations)
+{
+    LoopbackDevice device;
+    if (!device.isOpen()) {
+        return 1;
+    }
+    std::string inputd = inputdPath();
+    if (inputd.empty()) {
+        return 1;
+    }
+
+    printf("state to report written over the WebSocket, %d states each:\n", iterations);
+    bool ok = true;
+    for (int priority : { 0, kStressPriority }) {
+        uint16_t port = freePort();
+        pid_t daemon = spawn({ inputd, "-o", device.path(), "-K", "", "-A", "", "-p", std::to_string(port), "-u", "", "-f", "",
+                               "-P", std::to_string(priority) });
+        int webSocket = connectWebSocket(port);
+        InputState state = {};
+        state.pointerX = state.pointerY = kNoPosition;
+        // the first states set up what is kept for the connection
+        std::vector<uint64_t> warmup;
+        bool warm = webSocket >= 0 && timeStates(device, webSocket, state, true, 0, warmup);
+        for (bool loaded : { false, true }) {
+            std::vector<pid_t> load;
+            if (loaded) {
+                load = startVideoLoad();
+                std::vector<pid_t> copies = startCopyLoad();
+                load.insert(load.end(), copies.begin(), copies.end());
+            }
+            // one /metrics answer allocates too, taken off
+            long long first = heapAllocationsOf(port);
+            long long before = heapAllocationsOf(port);
+            std::vector<uint64_t> ns;
+            bool passed = warm && timeStates(device, webSocket, state, true, iterations, ns);
+            long long after = heapAllocationsOf(port);
+            for (pid_t pid : load) {
+                stop(pid);
+            }
+            std::string name = std::string(priority > 0 ? "fifo" : "normal") + (loaded ? " + video" : " idle");
+            printLatency(name.c_str(), ns);
+            long long allocations = after - before - (before - first);
+            printf("%-16s %lld heap allocations for %d states: %s\n", "", allocations, iterations + kBenchWarmup,
+                   passed && first >= 0 && allocations == 0 ? "ok" : "FAILED");
+            ok = ok && passed && first >= 0 && allocations == 0;
+        }
+        if (webSocket >= 0) {
+            close(webSocket);
+        }
+        stop(daemon);
+    }
+    return ok ? 0 : 2;
+}
+
+/*
+ * Loss check: random moves, wheel steps, buttons and keys as InputStates
+ * over UDP to an inputd writing onto pseudo terminals, a fifth of them
+ * dropped, a tenth sent twice and a tenth swapped with the next, as a bad
+ * network would. The first state is far from zero, as from a client
+ * coming back with its running totals, and must move nothing. The reports
+ * read back must add up to all the motion after it and end holding what
+ * the last state holds; once the client has gone quiet
+ * for InputServer::kPeerTimeoutMs, inputd must release all of it.
+ */
+int checkStates(int iterations)
+{
+    LoopbackDevice mouse;
+    LoopbackDevice keyboard;
+    if (!mouse.isOpen() || !keyboard.isOpen()) {
+        return 1;
+    }
+    std::string inputd = inputdPath();
+    if (inputd.empty()) {
+        return 1;
+    }
+    uint16_t port = freePort();
+    pid_t daemon = spawn({ inputd, "-o", mouse.path(), "-K", keyboard.path(), "-A", "", "-p", std::to_string(port), "-u", "",
+                           "-f", "" });
+    int tcp = connectTcp(port);
+    int udp = tcp >= 0 ? connectUdp(port) : -1;
+    if (udp < 0) {
+        stop(daemon);
+        return 1;
+    }
+    close(tcp);
+
+    std::vector<uint8_t> mouseReports;
+    std::vector<uint8_t> keyboardReports;
+    auto drain = [&](int ms) {
+        usleep(ms * 1000);
+        mouse.drain(mouseReports);
+        keyboard.drain(keyboardReports);
+    };
+
+    // a client coming back keeps its running totals: the first state must
+    // move nothing and only press its button
+    InputState first = {};
+    first.pointerX = first.pointerY = kNoPosition;
+    first.sequence = 1000;
+    first.x = 123456;
+    first.y = -654321;
+    first.wheel = 7;
+    first.buttons = 2;
+    bool baseline = sendState(udp, first, false);
+    drain(20);
+    baseline = baseline && mouseReports.size() == HidMouse::kReportLength && mouseReports[0] == first.buttons;
+    for (size_t i = 1; i < mouseReports.size(); i++) {
+        baseline = baseline && mouseReports[i] == 0;
+    }
+
+    std::mt19937 rng(12345);
+    std::vector<InputState> states;
+    InputState state = first;
+    for (int i = 0; i < iterations; i++) {
+        state.sequence++;
+        state.x += static_cast<int>(rng() % 81) - 40;
+        state.y += static_cast<int>(rng() % 81) - 40;
+        state.wheel += rng() % 10 == 0 ? static_cast<int>(rng() % 3) - 1 : 0;
+        if (rng() % 8 == 0) {
+            state.buttons ^= 1 << rng() % 3;
+        }
+        if (rng() % 4 == 0) {
+            uint32_t usage = rng() % 8 == 0 ? kUsageFirstModifier + 1 : 0x04 + rng() % 26;
+            state.keys[usage / 8] ^= 1 << usage % 8;
+        }
+        states.push_back(state);
+    }
+
+    int dropped = 0;
+    int twice = 0;
+    int swapped = 0;
+    bool ok = true;
+    for (size_t i = 0; i < states.size() && ok; i++) {
+        uint32_t fate = rng() % 10;
+        if (fate < 2) {
+            dropped++;
+            continue;
+        }
+        if (fate == 2) {
+            twice++;
+            ok = sendState(udp, states[i], false);
+        } else if (fate == 3 && i + 1 < states.size()) {
+            swapped++;
+            ok = sendState(udp, states[i + 1], false);
+        }
+        ok = ok && sendState(udp, states[i], false);
+        if (i % 16 == 0) {
+            drain(1);
+        }
+    }
+    // repeated while idle, which makes up for the last one if it was lost
+    for (int i = 0; i < 3 && ok; i++) {
+        ok = sendState(udp, state, false);
+        drain(20);
+    }
+    drain(100);
+
+    auto held = [&](bool released) {
+        if (mouseReports.empty() || keyboardReports.empty()) {
+            return false;
+        }
+        int64_t x = 0, y = 0, wheel = 0;
+        for (size_t pos = 0; pos + HidMouse::kReportLength <= mouseReports.size(); pos += HidMouse::kReportLength) {
+            x += static_cast<int16_t>(mouseReports[pos + 1] | mouseReports[pos + 2] << 8);
+            y += static_cast<int16_t>(mouseReports[pos + 3] | mouseReports[pos + 4] << 8);
+            wheel += static_cast<int8_t>(mouseReports[pos + 5]);
+        }
+        bool same = x == static_cast<int64_t>(state.x) - first.x && y == static_cast<int64_t>(state.y) - first.y &&
+                    wheel == static_cast<int64_t>(state.wheel) - first.wheel &&
+                    mouseReports[mouseReports.size() - HidMouse::kReportLength] == (released ? 0 : state.buttons);
+        const uint8_t *report = &keyboardReports[keyboardReports.size() - HidKeyboard::kReportLength];
+        for (uint32_t usage = 0x04; usage <= HidKeyboard::kMaxBitmapUsage; usage++) {
+            bool down = (report[8 + usage / 8] >> (usage % 8)) & 1;
+            same = same && down == (!released && ((state.keys[usage / 8] >> (usage % 8)) & 1));
+        }
+        return same && report[0] == (released ? 0 : state.keys[kUsageFirstModifier / 8]);
+    };
+    bool holding = ok && held(false);
+    drain(InputServer::kPeerTimeoutMs + InputServer::kPeerTimeoutMs / 2);
+    bool released = ok && held(true);
+    close(udp);
+    stop(daemon);
+
+    printf("first state at (%d, %d): %s\n", first.x, first.y, baseline ? "ok" : "FAILED");
+    printf("%6zu states, %d dropped, %d sent twice, %d swapped -> %zu mouse and %zu keyboard reports, holding %s, released %s\n",
+           states.size(), dropped, twice, swapped, mouseReports.size() / HidMouse::kReportLength,
+           keyboardReports.size() / HidKeyboard::kReportLength, holding ? "ok" : "FAILED", released ? "ok" : "FAILED");
+    return baseline && holding && released ? 0 : 2;
+}
+
+/*
+ * Keyboard check: a typist holding up to 4 keys (letters and left shift)
+ * at once, first as a burst with no gaps (a paste), then with 0-400 us
+ * between changes (a fast typist), through HidKeyboard onto a pseudo
+ * terminal. The reports read back must hold every press and release of
+ * each key in order, and the boot array must match the bitmap.
+ */
+bool checkKeyboardReports(const std::vector<uint8_t> & reports, const std::vector<std::vector<bool>> & expected)
+{
+    std::vector<std::vector<bool>> seen(256);
+    std::bitset<256> state;
+    for (size_t pos = 0; pos + HidKeyboard::kReportLength <= reports.size(); pos += HidKeyboard::kReportLength) {
+        const uint8_t *report = &reports[pos];
+        std::bitset<256> keys;
+        for (uint32_t usage = 0; usage <= HidKeyboard::kMaxBitmapUsage; usage++) {
+            keys[usage] = (report[8 + usage / 8] >> (usage % 8)) & 1;
+        }
+        for (uint32_t bit = 0; bit < 8; bit++) {
+            keys[kUsageFirstModifier + bit] = (report[0] >> bit) & 1;
+        }
+        uint8_t boot[HidKeyboard::kReportLength];
+        HidKeyboard::buildReport(keys, boot);
+        if (memcmp(boot, report, HidKeyboard::kReportLength) != 0) {
+            std::cerr << "report " << pos / HidKeyboard::kReportLength << ": boot keys do not match" << std::endl;
+            return false;
+        }
+        for (uint32_t usage = 0; usage < keys.size(); usage++) {
+            if (keys[usage] != state[usage]) {
+                seen[usage].push_back(keys[usage]);
+            }
+        }
+        state = keys;
+    }
+    for (uint32_t usage = 0; usage < seen.size(); usage++) {
+        if (seen[usage] != expected[usage]) {
+            std::cerr << "usage 0x" << std::hex << usage << std::dec << ": " << expected[usage].size()
+                      << " changes typed, " << seen[usage].size() << " seen" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int checkKeyboard(LoopbackDevice & device, int iterations)
+{
+    HidDevice hid { device.path() };
+    if (!hid.isOpen()) {
+        return 1;
+    }
+    std::mt19937 rng(12345);
+    const uint8_t shift = keyUsage("--left-shift");
+    bool ok = true;
+    for (int gapUs : { 0, 400 }) {
+        HidKeyboard keyboard { hid, kDefaultIntervalUs };
+        std::vector<std::vector<bool>> expected(256);
+        std::vector<uint8_t> held;
+        std::vector<uint8_t> reports;
+        auto serve = [&](uint64_t untilNs) {
+            do {
+                uint64_t now = nowNs();
+                uint64_t waitNs = untilNs > now ? untilNs - now : 0;
+                struct timespec timeout = { static_cast<time_t>(waitNs / 1000000000ull),
+                                            static_cast<long>(waitNs % 1000000000ull) };
+                struct pollfd pfd = { keyboard.scheduler().timerFd(), POLLIN, 0 };
+                if (ppoll(&pfd, 1, &timeout, nullptr) > 0) {
+                    keyboard.scheduler().flush();
+                }
+                device.drain(reports);
+            } while (nowNs() < untilNs);
+        };
+
+        uint64_t start = nowNs();
+        for (int i = 0; i < iterations || !held.empty(); i++) {
+            bool press = i < iterations && (held.empty() || (held.size() < 4 && rng() % 2 == 0));
+            uint8_t usage;
+            if (press) {
+                do {
+                    usage = rng() % 8 == 0 ? shift : static_cast<uint8_t>(0x04 + rng() % 26);
+                } while (std::find(held.begin(), held.end(), usage) != held.end());
+                held.push_back(usage);
+            } else {
+                size_t n = rng() % held.size();
+                usage = held[n];
+                held.erase(held.begin() + n);
+            }
+            expected[usage].push_back(press);
+            keyboard.key(usage, press, nowNs());
+            serve(gapUs > 0 ? nowNs() + rng() % (gapUs * 1000) : 0);
+        }
+        while (keyboard.scheduler().busy()) {
+            serve(nowNs() + kDefaultIntervalUs * 1000ull);
+        }
+        uint64_t end = nowNs();
+        device.drain(reports);
+
+        const KeyboardCounters & c = keyboard.counters();
+        uint64_t sent = keyboard.scheduler().counters().reports;
+        bool passed = checkKeyboardReports(reports, expected) &&
+                      reports.size() == sent * HidKeyboard::kReportLength;
+        printf("%-8s %6llu changes in %7.1f ms -> %6llu reports (%.2f changes/report), %llu deferred: %s\n",
+               gapUs > 0 ? "typist" : "burst", static_cast<unsigned long long>(c.changes), (end - start) / 1e6,
+               static_cast<unsigned long long>(sent), sent > 0 ? double(c.changes) / sent : 0.0,
+               static_cast<unsigned long long>(c.deferred), passed ? "ok" : "FAILED");
+        ok = ok && passed;
+    }
+    return ok ? 0 : 2;
+}
+
+/*
+ * Mouse check: random moves (now and then far beyond what one report
+ * holds), wheel steps and button changes, as a burst and with 0-300 us
+ * between events, through HidMouse onto a pseudo terminal. The reports
+ * read back must add up to the same motion, show every change of the
+ * buttons in order, and come at most one per poll interval.
+ */
+int checkMouse(LoopbackDevice & device, int iterations)
+{
+    HidDevice hid { device.path() };
+    if (!hid.isOpen()) {
+        return 1;
+    }
+    std::mt19937 rng(12345);
+    bool ok = true;
+    for (int gapUs : { 0, 300 }) {
+        HidMouse mouse { hid, kDefaultIntervalUs };
+        std::vector<uint8_t> reports;
+        std::vector<uint8_t> pressed;           // button states in order
+        int64_t dx = 0;
+        int64_t dy = 0;
+        int64_t wheel = 0;
+        uint8_t buttons = 0;
+        auto serve = [&](uint64_t untilNs) {
+            do {
+                uint64_t now = nowNs();
+                uint64_t waitNs = untilNs > now ? untilNs - now : 0;
+                struct timespec timeout = { static_cast<time_t>(waitNs / 1000000000ull),
+                                            static_cast<long>(waitNs % 1000000000ull) };
+                struct pollfd pfd = { mouse.scheduler().timerFd(), POLLIN, 0 };
+                if (ppoll(&pfd, 1, &timeout, nullptr) > 0) {
+                    mouse.scheduler().flush();
+                }
+                device.drain(reports);
+            } while (nowNs() < untilNs);
+        };
+
+        uint64_t start = nowNs();
+        for (int i = 0; i < iterations; i++) {
+            InputEvent event = { static_cast<uint8_t>(EventType::kMouse), buttons, 0, 0, 0 };
+            if (rng() % 8 == 0) {
+                buttons ^= 1 << (rng() % 5);
+                event.buttons = buttons;
+                pressed.push_back(buttons);
+            } else if (rng() % 16 == 0) {
+                event.x = static_cast<int16_t>(rng() % 65535 - 32767);
+                event.y = static_cast<int16_t>(rng() % 65535 - 32767);
+            } else {
+                event.x = static_cast<int16_t>(rng() % 101 - 50);
+                event.y = static_cast<int16_t>(rng() % 101 - 50);
+                event.z = rng() % 4 == 0 ? static_cast<int16_t>(rng() % 5 - 2) : 0;
+            }
+            dx += event.x;
+            dy += event.y;
+            wheel += event.z;
+            mouse.handle(event, nowNs());
+            serve(gapUs > 0 ? nowNs() + rng() % (gapUs * 1000) : 0);
+        }
+        while (mouse.scheduler().busy()) {
+            serve(nowNs() + kDefaultIntervalUs * 1000ull);
+        }
+        uint64_t end = nowNs();
+        device.drain(reports);
+
+        uint8_t state = 0;
+        std::vector<uint8_t> seen;
+        for (size_t pos = 0; pos + HidMouse::kReportLength <= reports.size(); pos += HidMouse::kReportLength) {
+            const uint8_t *report = &reports[pos];
+            if (report[0] != state) {
+                state = report[0];
+                seen.push_back(state);
+            }
+            dx -= static_cast<int16_t>(report[1] | report[2] << 8);
+            dy -= static_cast<int16_t>(report[3] | report[4] << 8);
+            wheel -= static_cast<int8_t>(report[5]);
+        }
+        const SchedulerCounters & c = mouse.scheduler().counters();
+        uint64_t maxReports = (end - start) / (kDefaultIntervalUs * 1000ull) + 1;
+        bool passed = dx == 0 && dy == 0 && wheel == 0 && seen == pressed &&
+                      reports.size() == c.reports * HidMouse::kReportLength && c.reports <= maxReports;
+        printf("%-8s %6llu events in %7.1f ms -> %6llu reports (at most %llu), delay avg %6.1f max %7.1f us: %s\n",
+               gapUs > 0 ? "spaced" : "burst", static_cast<unsigned long long>(c.events), (end - start) / 1e6,
+               static_cast<unsigned long long>(c.reports), static_cast<unsigned long long>(maxReports),
+               c.delay.count > 0 ? c.delay.sumNs / 1e3 / c.delay.count : 0.0, c.delay.maxNs / 1e3,
+               passed ? "ok" : "FAILED");
+        ok = ok && passed;
+    }
+    return ok ? 0 : 2;
+}
+
+/*
+ * Macro check: a macro of small moves one poll interval apart, with a
+ * burst of ten due at once now and then and, halfway, a step that waits
+ * for a screen which changes 50 ms after the wait began, played through
+ * HidMouse onto a pseudo terminal. Every step must be sent, not before it
+ * is due, the reports must add up to the same motion at most one per poll
+ * interval, and the wait must hold. Then the same macro with a screen that
+ * never changes must stop at the wait. Prints how late the steps went out.
+ */
+int checkMacro(LoopbackDevice & device, int iterations)
+{
+    HidDevice hid { device.path() };
+    if (!hid.isOpen()) {
+        return 1;
+    }
+    const uint64_t changeAfterNs = 50000000ull;
+    std::mt19937 rng(12345);
+    std::vector<MacroStep> steps;
+    uint64_t plannedNs = 0;
+    uint64_t beforeWaitNs = 0;
+    int64_t dx = 0;
+    int64_t dy = 0;
+    for (int i = 0; i < iterations; i++) {
+        InputEvent event = { static_cast<uint8_t>(EventType::kMouse), 0,
+                             static_cast<int16_t>(rng() % 101 - 50), static_cast<int16_t>(rng() % 101 - 50), 0 };
+        uint32_t delayUs = i % 50 >= 40 ? 0 : kDefaultIntervalUs;
+        uint32_t waitMs = i == iterations / 2 ? 1000 : 0;
+        steps.push_back({ delayUs, waitMs, event });
+        beforeWaitNs = waitMs != 0 ? plannedNs : beforeWaitNs;
+        plannedNs += delayUs * 1000ull;
+        dx += event.x;
+        dy += event.y;
+    }
+
+    bool ok = true;
+    for (bool changes : { true, false }) {
+        HidMouse mouse { hid, kDefaultIntervalUs };
+        std::vector<uint64_t> lateNs;
+        uint64_t changeAtNs = 0;
+        MacroPlayer player { [&](const InputEvent & event, uint64_t dueNs, uint64_t now) {
+            lateNs.push_back(now - dueNs);
+            mouse.handle(event, now);
+        }, [&](uint64_t & hash) {
+            uint64_t now = nowNs();
+            if (changeAtNs == 0) {
+                changeAtNs = now + changeAfterNs;
+            }
+            hash = changes && now >= changeAtNs ? 2 : 1;
+            return true;
+        } };
+        if (!player.isOpen()) {
+            return 1;
+        }
+        std::vector<uint8_t> reports;
+        uint64_t start = nowNs();
+        player.play(steps, start);
+        while (player.playing() || mouse.scheduler().busy()) {
+            struct pollfd pfd[2] = { { player.timerFd(), POLLIN, 0 }, { mouse.scheduler().timerFd(), POLLIN, 0 } };
+            if (poll(pfd, 2, kBenchTimeoutMs) <= 0) {
+                break;
+            }
+            if (pfd[0].revents & POLLIN) {
+                player.flush();
+            }
+            if (pfd[1].revents & POLLIN) {
+                mouse.scheduler().flush();
+            }
+            device.drain(reports);
+        }
+        uint64_t end = nowNs();
+        device.drain(reports);
+
+        const MacroCounters & m = player.counters();
+        const SchedulerCounters & c = mouse.scheduler().counters();
+        bool passed;
+        if (changes) {
+            int64_t restX = dx;
+            int64_t restY = dy;
+            for (size_t pos = 0; pos + HidMouse::kReportLength <= reports.size(); pos += HidMouse::kReportLength) {
+                restX -= static_cast<int16_t>(reports[pos + 1] | reports[pos + 2] << 8);
+                restY -= static_cast<int16_t>(reports[pos + 3] | reports[pos + 4] << 8);
+            }
+            uint64_t maxReports = (end - start) / (kDefaultIntervalUs * 1000ull) + 1;
+            passed = m.completed == 1 && m.steps == steps.size() && m.waits == 1 && restX == 0 && restY == 0 &&
+                     end - start >= plannedNs + changeAfterNs && c.reports <= maxReports;
+        } else {
+            passed = m.completed == 0 && m.waitTimeouts == 1 && m.steps == static_cast<uint64_t>(iterations / 2);
+        }
+        std::sort(lateNs.begin(), lateNs.end());
+        auto at = [&](double q) {
+            return lateNs.empty() ? 0.0 : lateNs[static_cast<size_t>(q * (lateNs.size() - 1))] / 1000.0;
+        };
+        printf("%-8s %6llu steps in %7.1f ms (due in %7.1f) -> %6llu reports, late p50 %6.1f p99 %6.1f max %7.1f us: %s\n",
+               changes ? "wait" : "timeout", static_cast<unsigned long long>(m.steps), (end - start) / 1e6,
+               (changes ? plannedNs + changeAfterNs : beforeWaitNs + 1000000000ull) / 1e6, static_cast<unsigned long long>(c.reports),
+               at(0.5), at(0.99), at(1.0), passed ? "ok" : "FAILED");
+        ok = ok && passed;
+    }
+    return ok ? 0 : 2;
+}
+
+/*
+ * Paste check: random text of the characters a layout has keys for (and
+ * now and then one it has not, to be skipped) typed by PasteTyper through
+ * HidKeyboard. The reports read back are turned into characters again
+ * through the same table: the text must come out as it went in. Typed onto
+ * a pseudo terminal with the US and the German layout, then onto a FIFO
+ * that holds 4 KiB and is read one report per kSlowHostNs, a host slower
+ * than its poll interval: the typer must back off and still lose nothing.
+ */
+static const uint64_t kSlowHostNs = 4000000ull;
+
+void appendUtf8(std::string & out, uint32_t codepoint)
+{
+    if (codepoint < 0x80) {
+        out += static_cast<char>(codepoint);
+    } else if (codepoint < 0x800) {
+        out += static_cast<char>(0xC0 | codepoint >> 6);
+        out += static_cast<char>(0x80 | (codepoint & 0x3F));
+    } else {
+        out += static_cast<char>(0xE0 | codepoint >> 12);
+        out += static_cast<char>(0x80 | (codepoint >> 6 & 0x3F));
+        out += static_cast<char>(0x80 | (codepoint & 0x3F));
+    }
+}
+
+// the characters the presses in the reports type, "" on one the layout does not type
+std::string typedText(const std::vector<uint8_t> & reports, const KeyLayout & layout)
+{
+    std::string text;
+    std::bitset<256> state;
+    bool dead = false;
+    for (size_t pos = 0; pos + HidKeyboard::kReportLength <= reports.size(); pos += HidKeyboard::kReportLength) {
+        const uint8_t *report = &reports[pos];
+        for (uint32_t usage = 0x04; usage <= HidKeyboard::kMaxBitmapUsage; usage++) {
+            bool down = (report[8 + usage / 8] >> (usage % 8)) & 1;
+            bool pressed = down && !state[usage];
+            state[usage] = down;
+            if (!pressed) {
+                continue;
+            }
+            const CharKey *key = nullptr;
+            for (int i = 0; i < layout.count && key == nullptr; i++) {
+                if (layout.keys[i].usage == usage && layout.keys[i].modifiers == report[0]) {
+                    key = &layout.keys[i];
+                }
+            }
+            if (key == nullptr) {
+                return std::string();
+            }
+            // the space after a dead key types its accent, not a space
+            if (dead && key->codepoint == ' ') {
+                dead = false;
+                continue;
+            }
+            dead = key->dead;
+            appendUtf8(text, key->codepoint);
+        }
+    }
+    return text;
+}
+
+int checkPaste(LoopbackDevice & device, int iterations)
+{
+    TempDir dir;
+    if (!dir.isOpen()) {
+        return 1;
+    }
+    std::string fifo = dir.path() + "/hidg1";
+    int slowHost = -1;
+    if (mkfifo(fifo.c_str(), 0600) == 0) {
+        slowHost = open(fifo.c_str(), O_RDONLY | O_NONBLOCK);
+    }
+    if (slowHost < 0 || fcntl(slowHost, F_SETPIPE_SZ, 4096) < 0) {
+        std::cerr << "Could not make " << fifo << ", errno " << errno << std::endl;
+        return 1;
+    }
+
+    std::mt19937 rng(12345);
+    bool ok = true;
+    for (const char *mode : { "us", "de", "slow" }) {
+        bool slow = std::string(mode) == "slow";
+        const KeyLayout & layout = *keyLayout(slow ? "us" : mode);
+        int chars = slow ? std::min(iterations, 500) : iterations;
+        std::string text;
+        std::string expected;
+        uint64_t untypeable = 0;
+        for (int i = 0; i < chars; i++) {
+            if (i % 100 == 99) {
+                appendUtf8(text, 0x2603);      // a snowman, on no keyboard
+                untypeable++;
+                continue;
+            }
+            uint32_t codepoint = layout.keys[rng() % layout.count].codepoint;
+            appendUtf8(text, codepoint);
+            appendUtf8(expected, codepoint);
+        }
+
+        HidDevice hid { slow ? fifo : device.path() };
+        if (!hid.isOpen()) {
+            return 1;
+        }
+        HidKeyboard keyboard { hid, kDefaultIntervalUs };
+        PasteTyper typer { keyboard, kDefaultIntervalUs };
+        if (!typer.isOpen()) {
+            return 1;
+        }
+        std::vector<uint8_t> reports;
+        uint64_t nextReadNs = 0;
+        auto drain = [&](uint64_t now) {
+            if (!slow) {
+                device.drain(reports);
+                return;
+            }
+            uint8_t report[HidKeyboard::kReportLength];
+            while (now >= nextReadNs && read(slowHost, report, sizeof(report)) == sizeof(report)) {
+                reports.insert(reports.end(), report, report + sizeof(report));
+                nextReadNs = (nextReadNs == 0 ? now : nextReadNs) + kSlowHostNs;
+            }
+        };
+        uint64_t start = nowNs();
+        typer.type(text, layout.name, start);
+        while (typer.typing()) {
+            struct pollfd pfd[2] = { { typer.timerFd(), POLLIN, 0 }, { keyboard.scheduler().timerFd(), POLLIN, 0 } };
+            if (poll(pfd, 2, slow ? 1 : kBenchTimeoutMs) < 0) {
+                break;
+            }
+            if (pfd[0].revents & POLLIN) {
+                typer.flush();
+            }
+            if (pfd[1].revents & POLLIN) {
+                keyboard.scheduler().flush();
+            }
+            drain(nowNs());
+        }
+        uint64_t end = nowNs();
+        // the FIFO still holds what the slow host did not read yet
+        while (slow && reports.size() < hid.reports() * HidKeyboard::kReportLength) {
+            nextReadNs = 0;
+            drain(nowNs());
+        }
+        device.drain(reports);
+
+        const PasteCounters & p = typer.counters();
+        const SchedulerCounters & c = keyboard.scheduler().counters();
+        bool passed = typedText(reports, layout) == expected && p.skipped == untypeable &&
+                      p.chars == static_cast<uint64_t>(chars) - untypeable && (!slow || p.backoffs > 0);
+        printf("%-8s %6llu chars in %7.1f ms -> %6llu reports, %7.0f chars/s, %5llu refused, %4llu backoffs, %3llu skipped: %s\n",
+               mode, static_cast<unsigned long long>(p.chars), (end - start) / 1e6, static_cast<unsigned long long>(c.reports),
+               typer.charsPerSecond(), static_cast<unsigned long long>(c.refused), static_cast<unsigned long long>(p.backoffs),
+               static_cast<unsigned long long>(p.skipped), passed ? "ok" : "FAILED");
+        ok = ok && passed;
+    }
+    close(slowHost);
+    unlink(fifo.c_str());
+    return ok ? 0 : 2;
+}
+
+/*
+ * Loopback test: the gadget of initmouse.sh on dummy_hcd, read back through
+ * the host's hidraw nodes, or pseudo terminals where there is no dummy_hcd.
+ * hidgadgettest gets random mouse and keyboard lines through its FIFO,
+ * first as a burst (as fast as the FIFO takes them, like a paste) and then
+ * one at a time. Every report must be what mouse_fill_report or
+ * keyboard_fill_report make of its line, byte for byte, and each is timed
+ * from its line being written to the report read on the host side. Then
+ * inputd's own mouse and keyboard go through the checks of -m and -k on
+ * the same functions.
+ */
+static const uint32_t kBootReportLength = 8;   // hidgadgettest writes the boot keyboard report only
+
+struct TestLine
+{
+    std::string text;
+    std::vector<uint8_t> reports;   // one, or two when hidgadgettest follows it with an all-zero one
+};
+
+struct LoopbackRun
+{
+    uint64_t reports;
+    uint64_t ns;                    // first line written to last report read
+    uint64_t wrong;
+    std::vector<uint64_t> latencyNs;
+};
+
+TestLine mouseLine(std::mt19937 & rng)
+{
+    TestLine line;
+    uint8_t buttons = rng() % 4 == 0 ? rng() % 32 : 0;
+    for (int bit = 0; bit < 5; bit++) {
+        if (buttons & (1 << bit)) {
+            line.text += "--b" + std::to_string(bit + 1) + " ";
+        }
+    }
+    int dx = rng() % 8 == 0 ? static_cast<int>(rng() % 65535) - 32767 : static_cast<int>(rng() % 201) - 100;
+    int dy = rng() % 8 == 0 ? static_cast<int>(rng() % 65535) - 32767 : static_cast<int>(rng() % 201) - 100;
+    line.text += std::to_string(dx) + " " + std::to_string(dy);
+    int wheel = 0;
+    if (rng() % 3 == 0) {
+        wheel = static_cast<int>(rng() % 255) - 127;
+        line.text += " " + std::to_string(wheel);
+    }
+    bool hold = rng() % 2 == 0;
+    line.text += hold ? " --hold\n" : "\n";
+    line.reports = { buttons, static_cast<uint8_t>(dx), static_cast<uint8_t>(dx >> 8),
+                     static_cast<uint8_t>(dy), static_cast<uint8_t>(dy >> 8), static_cast<uint8_t>(wheel) };
+    if (!hold) {
+        line.reports.resize(2 * HidMouse::kReportLength, 0);
+    }
+    return line;
+}
+
+// modifiers, then up to 7 keys of which the boot report holds the first 6
+TestLine keyboardLine(std::mt19937 & rng, const std::vector<const KeyName *> & keys)
+{
+    TestLine line;
+    line.reports.resize(kBootReportLength, 0);
+    for (uint8_t bit = 0; bit < 8; bit++) {
+        if (rng() % 8 == 0) {
+            for (int i = 0; i < kNumKeyNames; i++) {
+                if (kKeyNames[i].option != nullptr && kKeyNames[i].usage == kUsageFirstModifier + bit) {
+                    line.text += std::string(kKeyNames[i].option) + " ";
+                    line.reports[0] |= 1 << bit;
+                }
+            }
+        }
+    }
+    int count = rng() % 8;
+    for (int k = 0; k < count; k++) {
+        const KeyName *key = keys[rng() % keys.size()];
+        line.text += std::string(key->option) + " ";
+        if (k < static_cast<int>(HidKeyboard::kBootKeys)) {
+            line.reports[2 + k] = key->usage;
+        }
+    }
+    bool hold = rng() % 2 == 0;
+    line.text += hold ? "--hold\n" : "\n";
+    if (!hold) {
+        line.reports.resize(2 * kBootReportLength, 0);
+    }
+    return line;
+}
+
+std::string hexReport(const uint8_t *report, uint32_t length)
+{
+    std::string out;
+    char buf[4];
+    for (uint32_t i = 0; i < length; i++) {
+        snprintf(buf, sizeof(buf), " %02x", report[i]);
+        out += buf;
+    }
+    return out;
+}
+
+bool runGadgetTest(LoopbackDevice & device, const std::string & dir, const char *mode, const std::vector<TestLine> & lines,
+                   uint32_t length, bool burst, LoopbackRun & run)
+{
+    std::string fifo = dir + "/loopback_fifo";
+    if (mkfifo(fifo.c_str(), 0600) != 0) {
+        std::cerr << "Could not make " << fifo << ", errno " << errno << std::endl;
+        return false;
+    }
+    pid_t daemon = spawn({ "hidgadgettest", device.path(), mode, fifo });
+    // read/write, so the open does not wait for hidgadgettest
+    int in = open(fifo.c_str(), O_RDWR | O_NONBLOCK);
+
+    struct Pending
+    {
+        uint64_t writtenNs;
+        size_t line;
+    };
+    std::deque<Pending> pending;        // a report still to come each
+    std::vector<uint8_t> expected;
+    for (const TestLine & line : lines) {
+        expected.insert(expected.end(), line.reports.begin(), line.reports.end());
+    }
+    size_t next = 0;
+    size_t offset = 0;
+    uint64_t start = nowNs();
+    uint64_t last = start;
+    while (in >= 0 && offset < expected.size()) {
+        struct pollfd pfd[2] = { { device.fd(), POLLIN, 0 }, { in, POLLOUT, 0 } };
+        bool writing = next < lines.size() && (burst || pending.empty());
+        if (poll(pfd, writing ? 2 : 1, kBenchTimeoutMs) <= 0) {
+            break;
+        }
+        if (writing && (pfd[1].revents & POLLOUT)) {
+            const std::string & text = lines[next].text;
+            if (write(in, text.data(), text.size()) == static_cast<ssize_t>(text.size())) {
+                uint64_t now = nowNs();
+                for (size_t i = 0; i < lines[next].reports.size() / length; i++) {
+                    pending.push_back({ now, next });
+                }
+                next++;
+            }
+        }
+        if (pfd[0].revents & POLLIN) {
+            uint8_t report[HidKeyboard::kReportLength];
+            if (!device.read(report, length) || pending.empty()) {
+                break;
+            }
+            last = nowNs();
+            run.latencyNs.push_back(last - pending.front().writtenNs);
+            if (memcmp(report, &expected[offset], length) != 0 && run.wrong++ == 0) {
+                std::cerr << mode << " report " << run.reports << " of \"" << lines[pending.front().line].text.substr(0,
+                             lines[pending.front().line].text.size() - 1) << "\":" << hexReport(report, length)
+                          << ", expected" << hexReport(&expected[offset], length) << std::endl;
+            }
+            pending.pop_front();
+            offset += length;
+            run.reports++;
+        }
+    }
+    run.ns = last - start;
+    stop(daemon);
+    if (in >= 0) {
+        close(in);
+    }
+    unlink(fifo.c_str());
+    if (run.reports == 0) {
+        std::cerr << "hidgadgettest: no report, is it in PATH?" << std::endl;
+    }
+    return offset == expected.size() && run.wrong == 0;
+}
+
+void printLoopback(const char *mode, bool burst, LoopbackRun & run, bool passed)
+{
+    std::vector<uint64_t> & ns = run.latencyNs;
+    std::sort(ns.begin(), ns.end());
+    auto at = [&](double q) {
+        return ns.empty() ? 0.0 : ns[static_cast<size_t>(q * (ns.size() - 1))] / 1000.0;
+    };
+    printf("%-8s %-6s %6llu reports in %7.1f ms, %8.0f reports/s, latency p50 %7.1f p99 %7.1f max %8.1f us: %s\n",
+           mode, burst ? "burst" : "paced", static_cast<unsigned long long>(run.reports), run.ns / 1e6,
+           run.ns > 0 ? run.reports * 1e9 / run.ns : 0.0, at(0.5), at(0.99), at(1.0), passed ? "ok" : "FAILED");
+}
+
+int loopbackTest(int iterations)
+{
+    LoopbackGadget gadget;
+    std::unique_ptr<LoopbackDevice> mouse;
+    std::unique_ptr<LoopbackDevice> keyboard;
+    if (gadget.isOpen()) {
+        printf("gadget on dummy_hcd: mouse %s -> %s, keyboard %s -> %s\n",
+               gadget.devicePath(LoopbackGadget::kMouse).c_str(), gadget.hostPath(LoopbackGadget::kMouse).c_str(),
+               gadget.devicePath(LoopbackGadget::kKeyboard).c_str(), gadget.hostPath(LoopbackGadget::kKeyboard).c_str());
+        mouse.reset(new LoopbackDevice { gadget.devicePath(LoopbackGadget::kMouse), gadget.hostPath(LoopbackGadget::kMouse) });
+        keyboard.reset(new LoopbackDevice { gadget.devicePath(LoopbackGadget::kKeyboard),
+                                            gadget.hostPath(LoopbackGadget::kKeyboard) });
+    } else {
+        printf("no gadget on dummy_hcd, pseudo terminals stand in for /dev/hidg0 and /dev/hidg1\n");
+        mouse.reset(new LoopbackDevice);
+        keyboard.reset(new LoopbackDevice);
+    }
+    if (!mouse->isOpen() || !keyboard->isOpen()) {
+        return 1;
+    }
+    TempDir dir;
+    if (!dir.isOpen()) {
+        return 1;
+    }
+
+    // the kval names and [a-z] of hidgadgettest
+    std::vector<const KeyName *> keys;
+    for (int i = 0; i < kNumKeyNames; i++) {
+        if (kKeyNames[i].option != nullptr && kKeyNames[i].usage < kUsageFirstModifier) {
+            keys.push_back(&kKeyNames[i]);
+        }
+    }
+    std::mt19937 rng(12345);
+    bool ok = true;
+    for (const char *mode : { "mouse", "keyboard" }) {
+        bool isKeyboard = mode[0] == 'k';
+        std::vector<TestLine> lines;
+        for (int i = 0; i < iterations; i++) {
+            lines.push_back(isKeyboard ? keyboardLine(rng, keys) : mouseLine(rng));
+        }
+        for (bool burst : { true, false }) {
+            LoopbackRun run = {};
+            bool passed = runGadgetTest(isKeyboard ? *keyboard : *mouse, dir.path(), mode, lines,
+                                        isKeyboard ? kBootReportLength : HidMouse::kReportLength, burst, run);
+            printLoopback(mode, burst, run, passed);
+            ok = ok && passed;
+        }
+    }
+
+    printf("inputd mouse:\n");
+    ok = checkMouse(*mouse, iterations) == 0 && ok;
+    printf("inputd keyboard:\n");
+    ok = checkKeyboard(*keyboard, iterations) == 0 && ok;
+    return ok ? 0 : 2;
+}
+
+void usage(const char *prog)
+{
+    std::cerr << "usage: " << prog << " -l [-n ITER]  benchmark event to report latency against the CGI chain\n"
+              << "       " << prog << " -k [-n ITER]  check merging of key changes into keyboard reports\n"
+              << "       " << prog << " -m [-n ITER]  check merging of mouse events into one report per poll interval\n"
+              << "       " << prog << " -R [-n ITER]  check the timing of macro replay\n"
+              << "       " << prog << " -T [-n ITER]  check typing of pasted text, also to a host slower than its poll interval\n"
+              << "       " << prog << " -W [-n ITER]  compare event to report latency with and without video load, at normal and real-time priority\n"
+              << "       " << prog << " -S [-n ITER]  check input states over UDP with loss, duplicates and reordering\n"
+              << "       " << prog << " -L [-n ITER]  check and time hidgadgettest and inputd through the gadget on dummy_hcd\n"
+              << "  -l runs webmouse, -L hidgadgettest from the PATH\n";
+}
+
+int main(int argc, char** argv)
+{
+    int test = 0;
+    int iterations = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "lkmRTSWLn:")) != -1) {
+        switch (opt) {
+        case 'l':
+        case 'k':
+        case 'm':
+        case 'R':
+        case 'T':
+        case 'S':
+        case 'W':
+        case 'L':
+            test = opt;
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    switch (test) {
+    case 'l':
+        return benchLatency(iterations > 0 ? iterations : 200);
+    case 'L':
+        return loopbackTest(iterations > 0 ? iterations : 1000);
+    case 'W':
+        return stressTest(iterations > 0 ? iterations : 2000);
+    case 'S':
+        return checkStates(iterations > 0 ? iterations : 2000);
+    case 'k':
+    case 'm':
+    case 'R':
+    case 'T': {
+        LoopbackDevice device;
+        if (!device.isOpen()) {
+            return 1;
+        }
+        int n = iterations > 0 ? iterations : 2000;
+        return test == 'k' ? checkKeyboard(device, n) : test == 'm' ? checkMouse(device, n) :
+               test == 'R' ? checkMacro(device, n) : checkPaste(device, n);
+    }
+    default:
+        usage(argv[0]);
+        return 1;
+    }
+}
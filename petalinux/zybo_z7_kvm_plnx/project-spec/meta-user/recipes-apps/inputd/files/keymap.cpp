@@ -0,0 +1,377 @@
+#include "keymap.h"
+
+const KeyName kKeyNames[] = {
+    // kmod
+    { "--left-ctrl",    "ControlLeft",      0xE0 },
+    { "--left-shift",   "ShiftLeft",        0xE1 },
+    { "--left-alt",     "AltLeft",          0xE2 },
+    { "--left-meta",    "MetaLeft",         0xE3 },
+    { "--right-ctrl",   "ControlRight",     0xE4 },
+    { "--right-shift",  "ShiftRight",       0xE5 },
+    { "--right-alt",    "AltRight",         0xE6 },
+    { "--right-meta",   "MetaRight",        0xE7 },
+    // kval
+    { "--return",       "Enter",            0x28 },
+    { "--esc",          "Escape",           0x29 },
+    { "--bckspc",       "Backspace",        0x2A },
+    { "--tab",          "Tab",              0x2B },
+    { "--spacebar",     "Space",            0x2C },
+    { "--caps-lock",    "CapsLock",         0x39 },
+    { "--f1",           "F1",               0x3A },
+    { "--f2",           "F2",               0x3B },
+    { "--f3",           "F3",               0x3C },
+    { "--f4",           "F4",               0x3D },
+    { "--f5",           "F5",               0x3E },
+    { "--f6",           "F6",               0x3F },
+    { "--f7",           "F7",               0x40 },
+    { "--f8",           "F8",               0x41 },
+    { "--f9",           "F9",               0x42 },
+    { "--f10",          "F10",              0x43 },
+    { "--f11",          "F11",              0x44 },
+    { "--f12",          "F12",              0x45 },
+    { "--insert",       "Insert",           0x49 },
+    { "--home",         "Home",             0x4A },
+    { "--pageup",       "PageUp",           0x4B },
+    { "--del",          "Delete",           0x4C },
+    { "--end",          "End",              0x4D },
+    { "--pagedown",     "PageDown",         0x4E },
+    { "--right",        "ArrowRight",       0x4F },
+    { "--left",         "ArrowLeft",        0x50 },
+    { "--down",         "ArrowDown",        0x51 },
+    { "--up",           "ArrowUp",          0x52 },
+    { "--num-lock",     "NumLock",          0x53 },
+    { "--kp-enter",     "NumpadEnter",      0x58 },
+    // [a-z] of hidgadgettest: 'a' - 0x04
+    { "a", "KeyA", 0x04 }, { "b", "KeyB", 0x05 }, { "c", "KeyC", 0x06 }, { "d", "KeyD", 0x07 },
+    { "e", "KeyE", 0x08 }, { "f", "KeyF", 0x09 }, { "g", "KeyG", 0x0A }, { "h", "KeyH", 0x0B },
+    { "i", "KeyI", 0x0C }, { "j", "KeyJ", 0x0D }, { "k", "KeyK", 0x0E }, { "l", "KeyL", 0x0F },
+    { "m", "KeyM", 0x10 }, { "n", "KeyN", 0x11 }, { "o", "KeyO", 0x12 }, { "p", "KeyP", 0x13 },
+    { "q", "KeyQ", 0x14 }, { "r", "KeyR", 0x15 }, { "s", "KeyS", 0x16 }, { "t", "KeyT", 0x17 },
+    { "u", "KeyU", 0x18 }, { "v", "KeyV", 0x19 }, { "w", "KeyW", 0x1A }, { "x", "KeyX", 0x1B },
+    { "y", "KeyY", 0x1C }, { "z", "KeyZ", 0x1D },
+    // the rest of the 104 key layout
+    { nullptr, "Digit1",        0x1E },
+    { nullptr, "Digit2",        0x1F },
+    { nullptr, "Digit3",        0x20 },
+    { nullptr, "Digit4",        0x21 },
+    { nullptr, "Digit5",        0x22 },
+    { nullptr, "Digit6",        0x23 },
+    { nullptr, "Digit7",        0x24 },
+    { nullptr, "Digit8",        0x25 },
+    { nullptr, "Digit9",        0x26 },
+    { nullptr, "Digit0",        0x27 },
+    { nullptr, "Minus",         0x2D },
+    { nullptr, "Equal",         0x2E },
+    { nullptr, "BracketLeft",   0x2F },
+    { nullptr, "BracketRight",  0x30 },
+    { nullptr, "Backslash",     0x31 },
+    { nullptr, "Semicolon",     0x33 },
+    { nullptr, "Quote",         0x34 },
+    { nullptr, "Backquote",     0x35 },
+    { nullptr, "Comma",         0x36 },
+    { nullptr, "Period",        0x37 },
+    { nullptr, "Slash",         0x38 },
+    { nullptr, "PrintScreen",   0x46 },
+    { nullptr, "ScrollLock",    0x47 },
+    { nullptr, "Pause",         0x48 },
+    { nullptr, "NumpadDivide",  0x54 },
+    { nullptr, "NumpadMultiply", 0x55 },
+    { nullptr, "NumpadSubtract", 0x56 },
+    { nullptr, "NumpadAdd",     0x57 },
+    { nullptr, "Numpad1",       0x59 },
+    { nullptr, "Numpad2",       0x5A },
+    { nullptr, "Numpad3",       0x5B },
+    { nullptr, "Numpad4",       0x5C },
+    { nullptr, "Numpad5",       0x5D },
+    { nullptr, "Numpad6",       0x5E },
+    { nullptr, "Numpad7",       0x5F },
+    { nullptr, "Numpad8",       0x60 },
+    { nullptr, "Numpad9",       0x61 },
+    { nullptr, "Numpad0",       0x62 },
+    { nullptr, "NumpadDecimal", 0x63 },
+    { nullptr, "IntlBackslash", 0x64 },
+    { nullptr, "ContextMenu",   0x65 },
+};
+
+const int kNumKeyNames = sizeof(kKeyNames) / sizeof(kKeyNames[0]);
+
+namespace {
+
+// US English
+const CharKey kUsKeys[] = {
+    { 'a',    0x04, 0,              false },
+    { 'A',    0x04, kModifierShift, false },
+    { 'b',    0x05, 0,              false },
+    { 'B',    0x05, kModifierShift, false },
+    { 'c',    0x06, 0,              false },
+    { 'C',    0x06, kModifierShift, false },
+    { 'd',    0x07, 0,              false },
+    { 'D',    0x07, kModifierShift, false },
+    { 'e',    0x08, 0,              false },
+    { 'E',    0x08, kModifierShift, false },
+    { 'f',    0x09, 0,              false },
+    { 'F',    0x09, kModifierShift, false },
+    { 'g',    0x0A, 0,              false },
+    { 'G',    0x0A, kModifierShift, false },
+    { 'h',    0x0B, 0,              false },
+    { 'H',    0x0B, kModifierShift, false },
+    { 'i',    0x0C, 0,              false },
+    { 'I',    0x0C, kModifierShift, false },
+    { 'j',    0x0D, 0,              false },
+    { 'J',    0x0D, kModifierShift, false },
+    { 'k',    0x0E, 0,              false },
+    { 'K',    0x0E, kModifierShift, false },
+    { 'l',    0x0F, 0,              false },
+    { 'L',    0x0F, kModifierShift, false },
+    { 'm',    0x10, 0,              false },
+    { 'M',    0x10, kModifierShift, false },
+    { 'n',    0x11, 0,              false },
+    { 'N',    0x11, kModifierShift, false },
+    { 'o',    0x12, 0,              false },
+    { 'O',    0x12, kModifierShift, false },
+    { 'p',    0x13, 0,              false },
+    { 'P',    0x13, kModifierShift, false },
+    { 'q',    0x14, 0,              false },
+    { 'Q',    0x14, kModifierShift, false },
+    { 'r',    0x15, 0,              false },
+    { 'R',    0x15, kModifierShift, false },
+    { 's',    0x16, 0,              false },
+    { 'S',    0x16, kModifierShift, false },
+    { 't',    0x17, 0,              false },
+    { 'T',    0x17, kModifierShift, false },
+    { 'u',    0x18, 0,              false },
+    { 'U',    0x18, kModifierShift, false },
+    { 'v',    0x19, 0,              false },
+    { 'V',    0x19, kModifierShift, false },
+    { 'w',    0x1A, 0,              false },
+    { 'W',    0x1A, kModifierShift, false },
+    { 'x',    0x1B, 0,              false },
+    { 'X',    0x1B, kModifierShift, false },
+    { 'y',    0x1C, 0,              false },
+    { 'Y',    0x1C, kModifierShift, false },
+    { 'z',    0x1D, 0,              false },
+    { 'Z',    0x1D, kModifierShift, false },
+    { '1',    0x1E, 0,              false },
+    { '2',    0x1F, 0,              false },
+    { '3',    0x20, 0,              false },
+    { '4',    0x21, 0,              false },
+    { '5',    0x22, 0,              false },
+    { '6',    0x23, 0,              false },
+    { '7',    0x24, 0,              false },
+    { '8',    0x25, 0,              false },
+    { '9',    0x26, 0,              false },
+    { '0',    0x27, 0,              false },
+    { '!',    0x1E, kModifierShift, false },
+    { '@',    0x1F, kModifierShift, false },
+    { '#',    0x20, kModifierShift, false },
+    { '$',    0x21, kModifierShift, false },
+    { '%',    0x22, kModifierShift, false },
+    { '^',    0x23, kModifierShift, false },
+    { '&',    0x24, kModifierShift, false },
+    { '*',    0x25, kModifierShift, false },
+    { '(',    0x26, kModifierShift, false },
+    { ')',    0x27, kModifierShift, false },
+    { '-',    0x2D, 0,              false },
+    { '_',    0x2D, kModifierShift, false },
+    { '=',    0x2E, 0,              false },
+    { '+',    0x2E, kModifierShift, false },
+    { '[',    0x2F, 0,              false },
+    { '{',    0x2F, kModifierShift, false },
+    { ']',    0x30, 0,              false },
+    { '}',    0x30, kModifierShift, false },
+    { '\\',   0x31, 0,              false },
+    { '|',    0x31, kModifierShift, false },
+    { ';',    0x33, 0,              false },
+    { ':',    0x33, kModifierShift, false },
+    { '\'',   0x34, 0,              false },
+    { '"',    0x34, kModifierShift, false },
+    { '`',    0x35, 0,              false },
+    { '~',    0x35, kModifierShift, false },
+    { ',',    0x36, 0,              false },
+    { '<',    0x36, kModifierShift, false },
+    { '.',    0x37, 0,              false },
+    { '>',    0x37, kModifierShift, false },
+    { '/',    0x38, 0,              false },
+    { '?',    0x38, kModifierShift, false },
+    { ' ',    0x2C, 0,              false },
+    { '\n',   0x28, 0,              false },
+    { '\t',   0x2B, 0,              false },
+};
+
+// German (T1), with AltGr and the dead accent keys
+const CharKey kDeKeys[] = {
+    { 'a',    0x04, 0,              false },
+    { 'A',    0x04, kModifierShift, false },
+    { 'b',    0x05, 0,              false },
+    { 'B',    0x05, kModifierShift, false },
+    { 'c',    0x06, 0,              false },
+    { 'C',    0x06, kModifierShift, false },
+    { 'd',    0x07, 0,              false },
+    { 'D',    0x07, kModifierShift, false },
+    { 'e',    0x08, 0,              false },
+    { 'E',    0x08, kModifierShift, false },
+    { 'f',    0x09, 0,              false },
+    { 'F',    0x09, kModifierShift, false },
+    { 'g',    0x0A, 0,              false },
+    { 'G',    0x0A, kModifierShift, false },
+    { 'h',    0x0B, 0,              false },
+    { 'H',    0x0B, kModifierShift, false },
+    { 'i',    0x0C, 0,              false },
+    { 'I',    0x0C, kModifierShift, false },
+    { 'j',    0x0D, 0,              false },
+    { 'J',    0x0D, kModifierShift, false },
+    { 'k',    0x0E, 0,              false },
+    { 'K',    0x0E, kModifierShift, false },
+    { 'l',    0x0F, 0,              false },
+    { 'L',    0x0F, kModifierShift, false },
+    { 'm',    0x10, 0,              false },
+    { 'M',    0x10, kModifierShift, false },
+    { 'n',    0x11, 0,              false },
+    { 'N',    0x11, kModifierShift, false },
+    { 'o',    0x12, 0,              false },
+    { 'O',    0x12, kModifierShift, false },
+    { 'p',    0x13, 0,              false },
+    { 'P',    0x13, kModifierShift, false },
+    { 'q',    0x14, 0,              false },
+    { 'Q',    0x14, kModifierShift, false },
+    { 'r',    0x15, 0,              false },
+    { 'R',    0x15, kModifierShift, false },
+    { 's',    0x16, 0,              false },
+    { 'S',    0x16, kModifierShift, false },
+    { 't',    0x17, 0,              false },
+    { 'T',    0x17, kModifierShift, false },
+    { 'u',    0x18, 0,              false },
+    { 'U',    0x18, kModifierShift, false },
+    { 'v',    0x19, 0,              false },
+    { 'V',    0x19, kModifierShift, false },
+    { 'w',    0x1A, 0,              false },
+    { 'W',    0x1A, kModifierShift, false },
+    { 'x',    0x1B, 0,              false },
+    { 'X',    0x1B, kModifierShift, false },
+    { 'y',    0x1D, 0,              false },
+    { 'Y',    0x1D, kModifierShift, false },
+    { 'z',    0x1C, 0,              false },
+    { 'Z',    0x1C, kModifierShift, false },
+    { '1',    0x1E, 0,              false },
+    { '2',    0x1F, 0,              false },
+    { '3',    0x20, 0,              false },
+    { '4',    0x21, 0,              false },
+    { '5',    0x22, 0,              false },
+    { '6',    0x23, 0,              false },
+    { '7',    0x24, 0,              false },
+    { '8',    0x25, 0,              false },
+    { '9',    0x26, 0,              false },
+    { '0',    0x27, 0,              false },
+    { '!',    0x1E, kModifierShift, false },
+    { '"',    0x1F, kModifierShift, false },
+    { 0x00A7, 0x20, kModifierShift, false },  // §
+    { '$',    0x21, kModifierShift, false },
+    { '%',    0x22, kModifierShift, false },
+    { '&',    0x23, kModifierShift, false },
+    { '/',    0x24, kModifierShift, false },
+    { '(',    0x25, kModifierShift, false },
+    { ')',    0x26, kModifierShift, false },
+    { '=',    0x27, kModifierShift, false },
+    { 0x00DF, 0x2D, 0,              false },  // ß
+    { '?',    0x2D, kModifierShift, false },
+    { 0x00FC, 0x2F, 0,              false },  // ü
+    { 0x00DC, 0x2F, kModifierShift, false },  // Ü
+    { '+',    0x30, 0,              false },
+    { '*',    0x30, kModifierShift, false },
+    { '#',    0x32, 0,              false },
+    { '\'',   0x32, kModifierShift, false },
+    { 0x00F6, 0x33, 0,              false },  // ö
+    { 0x00D6, 0x33, kModifierShift, false },  // Ö
+    { 0x00E4, 0x34, 0,              false },  // ä
+    { 0x00C4, 0x34, kModifierShift, false },  // Ä
+    { ',',    0x36, 0,              false },
+    { ';',    0x36, kModifierShift, false },
+    { '.',    0x37, 0,              false },
+    { ':',    0x37, kModifierShift, false },
+    { '-',    0x38, 0,              false },
+    { '_',    0x38, kModifierShift, false },
+    { '<',    0x64, 0,              false },
+    { '>',    0x64, kModifierShift, false },
+    { '^',    0x35, 0,              true  },
+    { 0x00B0, 0x35, kModifierShift, false },  // °
+    { 0x00B4, 0x2E, 0,              true  },  // ´
+    { '`',    0x2E, kModifierShift, true  },
+    { '@',    0x14, kModifierAltGr, false },
+    { 0x20AC, 0x08, kModifierAltGr, false },  // €
+    { 0x00B5, 0x10, kModifierAltGr, false },  // µ
+    { 0x00B2, 0x1F, kModifierAltGr, false },  // ²
+    { 0x00B3, 0x20, kModifierAltGr, false },  // ³
+    { '{',    0x24, kModifierAltGr, false },
+    { '[',    0x25, kModifierAltGr, false },
+    { ']',    0x26, kModifierAltGr, false },
+    { '}',    0x27, kModifierAltGr, false },
+    { '\\',   0x2D, kModifierAltGr, false },
+    { '~',    0x30, kModifierAltGr, false },
+    { '|',    0x64, kModifierAltGr, false },
+    { ' ',    0x2C, 0,              false },
+    { '\n',   0x28, 0,              false },
+    { '\t',   0x2B, 0,              false },
+};
+
+const KeyLayout kLayouts[] = {
+    { "us", kUsKeys, sizeof(kUsKeys) / sizeof(kUsKeys[0]) },
+    { "de", kDeKeys, sizeof(kDeKeys) / sizeof(kDeKeys[0]) },
+};
+
+}
+
+uint8_t keyUsage(const std::string & name)
+{
+    for (int i = 0; i < kNumKeyNames; i++) {
+        if (name == kKeyNames[i].code || (kKeyNames[i].option != nullptr && name == kKeyNames[i].option)) {
+            return kKeyNames[i].usage;
+        }
+    }
+    return 0;
+}
+
+std::string keymapJson()
+{
+    std::string json = "{";
+    for (int i = 0; i < kNumKeyNames; i++) {
+        json += (i > 0 ? ",\"" : "\"") + std::string(kKeyNames[i].code) + "\":" + std::to_string(kKeyNames[i].usage);
+    }
+    return json + "}";
+}
+
+const KeyLayout * keyLayout(const std::string & name)
+{
+    for (const KeyLayout & layout : kLayouts) {
+        if (name == layout.name) {
+            return &layout;
+        }
+    }
+    return nullptr;
+}
+
+const CharKey * layoutKey(const KeyLayout & layout, uint32_t codepoint)
+{
+    for (int i = 0; i < layout.count; i++) {
+        if (layout.keys[i].codepoint == codepoint) {
+            return &layout.keys[i];
+        }
+    }
+    return nullptr;
+}
+
+bool decodeUtf8(const std::string & text, size_t & pos, uint32_t & codepoint)
+{
+    uint8_t lead = text[pos++];
+    int more = lead < 0x80 ? 0 : (lead & 0xE0) == 0xC0 ? 1 : (lead & 0xF0) == 0xE0 ? 2 : (lead & 0xF8) == 0xF0 ? 3 : -1;
+    if (more < 0) {
+        return false;
+    }
+    codepoint = more == 0 ? lead : lead & (0x3F >> more);
+    for (int i = 0; i < more; i++) {
+        if (pos >= text.size() || (text[pos] & 0xC0) != 0x80) {
+            return false;
+        }
+        codepoint = codepoint << 6 | (text[pos++] & 0x3F);
+    }
+    return true;
+}
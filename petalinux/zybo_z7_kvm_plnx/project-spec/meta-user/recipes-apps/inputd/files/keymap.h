@@ -0,0 +1,65 @@
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+#include <cstdint>
+#include <string>
+
+/*
+ * HID keyboard usages (HUT page 0x07) by name: the kval and kmod names of
+ * hidgadgettest where it has one (its modifier bits are usage 0xE0 + bit),
+ * and the KeyboardEvent.code the browser gives the key. kvm.js fetches the
+ * code -> usage map from inputd, so this is the only copy of the table.
+ */
+
+struct KeyName
+{
+    const char *option;     // hidgadgettest name, nullptr if it has none
+    const char *code;       // KeyboardEvent.code
+    uint8_t usage;
+};
+
+static const uint8_t kUsageErrorRollOver = 0x01;
+static const uint8_t kUsageFirstModifier = 0xE0;    // left ctrl .. right meta: 0xE0 .. 0xE7
+
+extern const KeyName kKeyNames[];
+extern const int kNumKeyNames;
+
+// usage of a KeyboardEvent.code or hidgadgettest name, 0 if unknown
+uint8_t keyUsage(const std::string & name);
+
+// {"KeyA":4,...}
+std::string keymapJson();
+
+static const uint8_t kModifierShift = 0x02;     // left shift, in the modifier byte of a report
+static const uint8_t kModifierAltGr = 0x40;     // right alt
+
+/*
+ * What types a character on a host with a given keyboard layout: the key's
+ * usage and the modifiers held for it. A dead key types nothing by itself,
+ * the space after it types the accent.
+ */
+struct CharKey
+{
+    uint32_t codepoint;
+    uint8_t usage;
+    uint8_t modifiers;
+    bool dead;
+};
+
+struct KeyLayout
+{
+    const char *name;       // "us", "de"
+    const CharKey *keys;
+    int count;
+};
+
+// nullptr for a layout there is no table for
+const KeyLayout * keyLayout(const std::string & name);
+
+// nullptr if the layout cannot type codepoint
+const CharKey * layoutKey(const KeyLayout & layout, uint32_t codepoint);
+
+// next code point of UTF-8 text at pos, advancing it; false on a malformed sequence (skipped)
+bool decodeUtf8(const std::string & text, size_t & pos, uint32_t & codepoint);
+
+#endif
@@ -0,0 +1,366 @@
+#include "loopback.h"
+
+#include <iostream>
+#include <cerrno>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <linux/input.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "hid_report.h"
+
+namespace {
+
+const int kReadTimeoutMs = 2000;
+const int kEnumerateTimeoutMs = 3000;
+const char *kGadgetDir = "/sys/kernel/config/usb_gadget/kvm_loopback";
+const char *kUdc = "dummy_udc.0";
+
+// the functions of initmouse.sh, in the order it links them (interfaces 0, 1, 2)
+struct FunctionConfig
+{
+    const char *name;
+    const char *protocol;
+    const char *subclass;
+    uint32_t reportLength;
+    const uint8_t *descriptor;
+    size_t descriptorLength;
+};
+
+const uint8_t kMouseDescriptor[] = {
+    0x05, 0x01, 0x09, 0x02, 0xa1, 0x01, 0x09, 0x01, 0xa1, 0x00, 0x05, 0x09,
+    0x19, 0x01, 0x29, 0x05, 0x15, 0x00, 0x25, 0x01, 0x95, 0x05, 0x75, 0x01,
+    0x81, 0x02, 0x95, 0x01, 0x75, 0x03, 0x81, 0x03, 0x05, 0x01, 0x09, 0x30,
+    0x09, 0x31, 0x16, 0x01, 0x80, 0x26, 0xff, 0x7f, 0x75, 0x10, 0x95, 0x02,
+    0x81, 0x06, 0x09, 0x38, 0x15, 0x81, 0x25, 0x7f, 0x75, 0x08, 0x95, 0x01,
+    0x81, 0x06, 0xc0, 0xc0,
+};
+
+const uint8_t kKeyboardDescriptor[] = {
+    0x05, 0x01, 0x09, 0x06, 0xa1, 0x01, 0x05, 0x07, 0x19, 0xe0, 0x29, 0xe7,
+    0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x75, 0x08,
+    0x95, 0x07, 0x81, 0x01, 0x05, 0x08, 0x19, 0x01, 0x29, 0x05, 0x95, 0x05,
+    0x75, 0x01, 0x91, 0x02, 0x95, 0x01, 0x75, 0x03, 0x91, 0x01, 0x05, 0x07,
+    0x19, 0x00, 0x29, 0x7f, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x96, 0x80,
+    0x00, 0x81, 0x02, 0xc0,
+};
+
+const uint8_t kPointerDescriptor[] = {
+    0x05, 0x01, 0x09, 0x02, 0xa1, 0x01, 0x09, 0x01, 0xa1, 0x00, 0x05, 0x09,
+    0x19, 0x01, 0x29, 0x03, 0x15, 0x00, 0x25, 0x01, 0x95, 0x03, 0x75, 0x01,
+    0x81, 0x02, 0x95, 0x01, 0x75, 0x05, 0x81, 0x03, 0x05, 0x01, 0x09, 0x30,
+    0x09, 0x31, 0x15, 0x00, 0x26, 0xff, 0x7f, 0x75, 0x10, 0x95, 0x02, 0x81,
+    0x02, 0xc0, 0xc0,
+};
+
+const FunctionConfig kFunctionConfigs[LoopbackGadget::kFunctions] = {
+    { "hid.usb0", "0", "0", HidMouse::kReportLength, kMouseDescriptor, sizeof(kMouseDescriptor) },
+    { "hid.usb1", "1", "1", HidKeyboard::kReportLength, kKeyboardDescriptor, sizeof(kKeyboardDescriptor) },
+    { "hid.usb2", "0", "0", HidPointer::kReportLength, kPointerDescriptor, sizeof(kPointerDescriptor) },
+};
+
+bool writeFile(const std::string & path, const void *data, size_t length)
+{
+    int fd = open(path.c_str(), O_WRONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = write(fd, data, length) == static_cast<ssize_t>(length);
+    close(fd);
+    return ok;
+}
+
+bool writeFile(const std::string & path, const std::string & value)
+{
+    return writeFile(path, value.data(), value.size());
+}
+
+std::string readFile(const std::string & path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return std::string();
+    }
+    char buf[512];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    close(fd);
+    return n > 0 ? std::string(buf, n) : std::string();
+}
+
+bool exists(const std::string & path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+std::vector<std::string> listDir(const std::string & path)
+{
+    std::vector<std::string> names;
+    DIR *dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        return names;
+    }
+    while (struct dirent *entry = readdir(dir)) {
+        if (entry->d_name[0] != '.') {
+            names.push_back(entry->d_name);
+        }
+    }
+    closedir(dir);
+    return names;
+}
+
+// "/dev/hidg3" for the "244:3" of a function's dev attribute
+std::string charDevice(const std::string & majorMinor)
+{
+    std::string uevent = readFile("/sys/dev/char/" + majorMinor.substr(0, majorMinor.find('\n')) + "/uevent");
+    size_t pos = uevent.find("DEVNAME=");
+    if (pos == std::string::npos) {
+        return std::string();
+    }
+    pos += 8;
+    return "/dev/" + uevent.substr(pos, uevent.find('\n', pos) - pos);
+}
+
+}
+
+LoopbackDevice::LoopbackDevice() :
+    m_host { -1 },
+    m_slave { -1 }
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        std::cerr << "Could not open a pseudo terminal, errno " << errno << std::endl;
+        if (master >= 0) {
+            close(master);
+        }
+        return;
+    }
+    m_host = master;
+    std::string path = ptsname(master);
+    // keeps the terminal raw (no newline mapping) while the writers come and go
+    m_slave = open(path.c_str(), O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if (m_slave < 0 || tcgetattr(m_slave, &tio) != 0) {
+        std::cerr << "Could not set up " << path << ", errno " << errno << std::endl;
+        return;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(m_slave, TCSANOW, &tio);
+    m_path = path;
+}
+
+LoopbackDevice::LoopbackDevice(const std::string & devicePath, const std::string & hostPath) :
+    m_host { -1 },
+    m_slave { -1 }
+{
+    m_host = open(hostPath.c_str(), O_RDONLY);
+    if (m_host < 0) {
+        std::cerr << "Could not open " << hostPath << ", errno " << errno << std::endl;
+        return;
+    }
+    m_path = devicePath;
+}
+
+LoopbackDevice::~LoopbackDevice()
+{
+    if (m_slave >= 0) {
+        close(m_slave);
+    }
+    if (m_host >= 0) {
+        close(m_host);
+    }
+}
+
+bool LoopbackDevice::read(uint8_t *report, uint32_t length)
+{
+    uint32_t done = 0;
+    while (done < length) {
+        struct pollfd pfd = { m_host, POLLIN, 0 };
+        if (poll(&pfd, 1, kReadTimeoutMs) <= 0) {
+            return false;
+        }
+        ssize_t n = ::read(m_host, report + done, length - done);
+        if (n <= 0) {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+void LoopbackDevice::drain(std::vector<uint8_t> & out)
+{
+    uint8_t buf[4096];
+    struct pollfd pfd = { m_host, POLLIN, 0 };
+    while (poll(&pfd, 1, 0) > 0) {
+        ssize_t n = ::read(m_host, buf, sizeof(buf));
+        if (n <= 0) {
+            return;
+        }
+        out.insert(out.end(), buf, buf + n);
+    }
+}
+
+LoopbackGadget::LoopbackGadget() :
+    m_bound { false }
+{
+    if (!exists(std::string("/sys/class/udc/") + kUdc) || !exists("/sys/kernel/config/usb_gadget")) {
+        if (system("(modprobe -q dummy_hcd && modprobe -q libcomposite && modprobe -q usb_f_hid) 2>/dev/null") != 0) {
+            return;
+        }
+    }
+    if (!exists(std::string("/sys/class/udc/") + kUdc) || !exists("/sys/kernel/config/usb_gadget")) {
+        return;
+    }
+    // left over by a run that did not get to clean up
+    remove();
+    if (!create()) {
+        std::cerr << "Could not set up the gadget on " << kUdc << ", errno " << errno << std::endl;
+        return;
+    }
+    if (!findHost()) {
+        std::cerr << "The host did not enumerate the gadget on " << kUdc << std::endl;
+    }
+}
+
+LoopbackGadget::~LoopbackGadget()
+{
+    remove();
+}
+
+bool LoopbackGadget::create()
+{
+    std::string gadget = kGadgetDir;
+    if (mkdir(gadget.c_str(), 0755) != 0) {
+        return false;
+    }
+    bool ok = mkdir((gadget + "/configs/c.1").c_str(), 0755) == 0;
+    for (int i = 0; i < kFunctions && ok; i++) {
+        const FunctionConfig & config = kFunctionConfigs[i];
+        std::string function = gadget + "/functions/" + config.name;
+        ok = mkdir(function.c_str(), 0755) == 0 &&
+             writeFile(function + "/protocol", config.protocol) &&
+             writeFile(function + "/subclass", config.subclass) &&
+             writeFile(function + "/report_length", std::to_string(config.reportLength)) &&
+             writeFile(function + "/report_desc", config.descriptor, config.descriptorLength);
+        m_devicePath[i] = ok ? charDevice(readFile(function + "/dev")) : std::string();
+        ok = ok && !m_devicePath[i].empty();
+    }
+    ok = ok && mkdir((gadget + "/strings/0x409").c_str(), 0755) == 0 &&
+         mkdir((gadget + "/configs/c.1/strings/0x409").c_str(), 0755) == 0 &&
+         writeFile(gadget + "/bcdDevice", "0x0100") &&
+         writeFile(gadget + "/bcdUSB", "0x0200") &&
+         writeFile(gadget + "/idProduct", "0x201c") &&
+         writeFile(gadget + "/idVendor", "0x03eb") &&
+         writeFile(gadget + "/strings/0x409/serialnumber", "loopback") &&
+         writeFile(gadget + "/strings/0x409/manufacturer", "manufacturer") &&
+         writeFile(gadget + "/strings/0x409/product", "HID Mouse and Keyboard") &&
+         writeFile(gadget + "/configs/c.1/strings/0x409/configuration", "Conf 1") &&
+         writeFile(gadget + "/configs/c.1/MaxPower", "120");
+    for (int i = 0; i < kFunctions && ok; i++) {
+        std::string name = kFunctionConfigs[i].name;
+        ok = symlink((gadget + "/functions/" + name).c_str(), (gadget + "/configs/c.1/" + name).c_str()) == 0;
+    }
+    m_bound = ok && writeFile(gadget + "/UDC", kUdc);
+    return m_bound;
+}
+
+// hidraw and evdev nodes of the interfaces under dummy_hcd's root hub
+bool LoopbackGadget::findHost()
+{
+    for (int wait = 0; wait < kEnumerateTimeoutMs; wait += 10) {
+        std::string found[kFunctions];
+        std::vector<std::string> inputDirs;
+        for (const std::string & name : listDir("/sys/class/hidraw")) {
+            char real[PATH_MAX];
+            if (realpath(("/sys/class/hidraw/" + name + "/device").c_str(), real) == nullptr) {
+                continue;
+            }
+            std::string device = real;
+            std::string interface = device.substr(0, device.rfind('/'));
+            size_t dot = interface.rfind('.');
+            if (device.find("/dummy_hcd.") == std::string::npos || dot == std::string::npos) {
+                continue;
+            }
+            int index = atoi(interface.c_str() + dot + 1);
+            if (index >= 0 && index < kFunctions && exists("/dev/" + name)) {
+                found[index] = "/dev/" + name;
+                inputDirs.push_back(device + "/input");
+            }
+        }
+        bool all = true;
+        for (int i = 0; i < kFunctions; i++) {
+            all = all && !found[i].empty();
+        }
+        if (all) {
+            for (const std::string & dir : inputDirs) {
+                for (const std::string & input : listDir(dir)) {
+                    for (const std::string & event : listDir(dir + "/" + input)) {
+                        if (event.compare(0, 5, "event") != 0) {
+                            continue;
+                        }
+                        int fd = open(("/dev/input/" + event).c_str(), O_RDONLY | O_NONBLOCK);
+                        if (fd >= 0 && ioctl(fd, EVIOCGRAB, 1) == 0) {
+                            m_grabbed.push_back(fd);
+                        } else if (fd >= 0) {
+                            close(fd);
+                        }
+                    }
+                }
+            }
+            for (int i = 0; i < kFunctions; i++) {
+                m_hostPath[i] = found[i];
+            }
+            return true;
+        }
+        usleep(10000);
+    }
+    return false;
+}
+
+void LoopbackGadget::remove()
+{
+    for (int fd : m_grabbed) {
+        close(fd);
+    }
+    m_grabbed.clear();
+    std::string gadget = kGadgetDir;
+    if (!exists(gadget)) {
+        return;
+    }
+    writeFile(gadget + "/UDC", "\n");
+    for (int i = 0; i < kFunctions; i++) {
+        unlink((gadget + "/configs/c.1/" + kFunctionConfigs[i].name).c_str());
+    }
+    rmdir((gadget + "/configs/c.1/strings/0x409").c_str());
+    rmdir((gadget + "/configs/c.1").c_str());
+    for (int i = 0; i < kFunctions; i++) {
+        rmdir((gadget + "/functions/" + kFunctionConfigs[i].name).c_str());
+    }
+    rmdir((gadget + "/strings/0x409").c_str());
+    rmdir(gadget.c_str());
+    m_bound = false;
+}
+
+TempDir::TempDir()
+{
+    char path[] = "/tmp/inputd.XXXXXX";
+    if (mkdtemp(path) == nullptr) {
+        std::cerr << "Could not make a directory, errno " << errno << std::endl;
+        return;
+    }
+    m_path = path;
+}
+
+TempDir::~TempDir()
+{
+    if (!m_path.empty()) {
+        rmdir(m_path.c_str());
+    }
+}
@@ -0,0 +1,136 @@
+#ifndef LOOPBACK_H
+#define LOOPBACK_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * One HID function with the host's end of it, for the checks and
+ * benchmarks to read back what was written: either a pseudo terminal
+ * standing in for /dev/hidgN (a FIFO would not do, hidgadgettest reads back
+ * its own reports), or a function of LoopbackGadget and the hidraw node
+ * the host made of it. A pseudo terminal hands out a byte stream, hidraw
+ * one report per read(); read() and drain() take either.
+ */
+class LoopbackDevice
+{
+public:
+    // a raw pseudo terminal
+    LoopbackDevice();
+
+    // writers open devicePath, the reports come out of hostPath
+    LoopbackDevice(const std::string & devicePath, const std::string & hostPath);
+
+    LoopbackDevice(const LoopbackDevice&) = delete;
+    LoopbackDevice& operator=(const LoopbackDevice&) = delete;
+
+    ~LoopbackDevice();
+
+    bool isOpen() const
+    {
+        return m_host >= 0 && !m_path.empty();
+    }
+
+    // for the writer
+    const std::string & path() const
+    {
+        return m_path;
+    }
+
+    // readable when a report came in
+    int fd() const
+    {
+        return m_host;
+    }
+
+    // the next report, false on timeout
+    bool read(uint8_t *report, uint32_t length);
+
+    // appends what was written so far
+    void drain(std::vector<uint8_t> & out);
+
+private:
+    int m_host;
+    int m_slave;                // keeps the pseudo terminal raw
+    std::string m_path;
+};
+
+/*
+ * The gadget of initmouse.sh (mouse, keyboard, absolute pointer) on
+ * dummy_hcd, a UDC whose host side is a USB bus of the same kernel, so
+ * the input path can be tested end to end on any Linux box with
+ * CONFIG_USB_DUMMY_HCD and configfs. The host binds usbhid to it as to the
+ * board; its input devices are grabbed so the reports move nothing on the
+ * box running the test. Needs root; torn down by the destructor.
+ */
+class LoopbackGadget
+{
+public:
+    enum Function { kMouse, kKeyboard, kPointer, kFunctions };
+
+    LoopbackGadget();
+
+    LoopbackGadget(const LoopbackGadget&) = delete;
+    LoopbackGadget& operator=(const LoopbackGadget&) = delete;
+
+    ~LoopbackGadget();
+
+    // false without dummy_hcd or configfs, or if the host did not enumerate it
+    bool isOpen() const
+    {
+        return m_bound && !m_hostPath[kFunctions - 1].empty();
+    }
+
+    // /dev/hidgN
+    const std::string & devicePath(Function function) const
+    {
+        return m_devicePath[function];
+    }
+
+    // /dev/hidrawN of the host
+    const std::string & hostPath(Function function) const
+    {
+        return m_hostPath[function];
+    }
+
+private:
+    bool create();
+    bool findHost();
+    void remove();
+
+    bool m_bound;
+    std::string m_devicePath[kFunctions];
+    std::string m_hostPath[kFunctions];
+    std::vector<int> m_grabbed;     // evdev nodes of the host
+};
+
+/*
+ * A directory of its own under /tmp for the FIFOs and sockets of a check,
+ * removed by the destructor; what was put in it has to be taken out first.
+ */
+class TempDir
+{
+public:
+    TempDir();
+
+    TempDir(const TempDir&) = delete;
+    TempDir& operator=(const TempDir&) = delete;
+
+    ~TempDir();
+
+    bool isOpen() const
+    {
+        return !m_path.empty();
+    }
+
+    const std::string & path() const
+    {
+        return m_path;
+    }
+
+private:
+    std::string m_path;
+};
+
+#endif
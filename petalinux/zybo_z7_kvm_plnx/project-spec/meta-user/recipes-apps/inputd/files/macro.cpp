@@ -0,0 +1,285 @@
+#include "macro.h"
+
+#include <iostream>
+#include <cerrno>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+
+#include "stripe_store.h"
+
+namespace {
+
+inline uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+}
+
+bool saveMacro(const std::string & path, const std::vector<MacroStep> & steps)
+{
+    // in place only once complete, a macro being played is not cut short
+    std::string temp = path + ".tmp";
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Could not open " << temp << ", errno " << errno << std::endl;
+        return false;
+    }
+    size_t length = steps.size() * sizeof(MacroStep);
+    bool ok = write(fd, steps.data(), length) == static_cast<ssize_t>(length);
+    close(fd);
+    if (!ok || rename(temp.c_str(), path.c_str()) != 0) {
+        std::cerr << "Could not write " << path << ", errno " << errno << std::endl;
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool loadMacro(const std::string & path, std::vector<MacroStep> & steps)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    steps.clear();
+    MacroStep step;
+    ssize_t n;
+    while ((n = read(fd, &step, sizeof(step))) == sizeof(step)) {
+        steps.push_back(step);
+    }
+    close(fd);
+    return n == 0;
+}
+
+MacroRecorder::MacroRecorder() :
+    m_recording { false },
+    m_lastNs { 0 },
+    m_waitMs { 0 }
+{
+}
+
+void MacroRecorder::start(uint64_t nowNs)
+{
+    m_recording = true;
+    m_lastNs = nowNs;
+    m_waitMs = 0;
+    m_steps.clear();
+}
+
+void MacroRecorder::add(const InputEvent & event, uint64_t receivedNs)
+{
+    uint64_t delayUs = (receivedNs - m_lastNs) / 1000;
+    m_steps.push_back({ static_cast<uint32_t>(delayUs < UINT32_MAX ? delayUs : UINT32_MAX), m_waitMs, event });
+    m_lastNs = receivedNs;
+    m_waitMs = 0;
+}
+
+void MacroRecorder::wait(uint32_t timeoutMs, uint64_t nowNs)
+{
+    // two waits in a row: the first one becomes a step of its own
+    if (m_waitMs != 0) {
+        add({ static_cast<uint8_t>(EventType::kNone), 0, 0, 0, 0 }, nowNs);
+    }
+    m_lastNs = nowNs;
+    m_waitMs = timeoutMs;
+}
+
+std::vector<MacroStep> MacroRecorder::stop()
+{
+    m_recording = false;
+    std::vector<MacroStep> steps;
+    steps.swap(m_steps);
+    return steps;
+}
+
+MacroPlayer::MacroPlayer(Deliver deliver, ScreenHash screenHash) :
+    m_deliver { deliver },
+    m_screenHash { screenHash },
+    m_timerFd { -1 },
+    m_next { 0 },
+    m_dueNs { 0 },
+    m_waiting { false },
+    m_hashKnown { false },
+    m_hash { 0 },
+    m_waitEndNs { 0 },
+    m_counters {}
+{
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timerFd < 0) {
+        std::cerr << "Could not create a timer, errno " << errno << std::endl;
+    }
+}
+
+MacroPlayer::~MacroPlayer()
+{
+    if (m_timerFd >= 0) {
+        close(m_timerFd);
+    }
+}
+
+void MacroPlayer::play(const std::vector<MacroStep> & steps, uint64_t nowNs)
+{
+    stop();
+    if (steps.empty()) {
+        return;
+    }
+    m_steps = steps;
+    m_counters.plays++;
+    begin(nowNs, nowNs);
+    arm(nowNs);
+}
+
+void MacroPlayer::stop()
+{
+    m_steps.clear();
+    m_next = 0;
+    m_waiting = false;
+    struct itimerspec spec = {};
+    timerfd_settime(m_timerFd, 0, &spec, nullptr);
+}
+
+void MacroPlayer::flush()
+{
+    uint64_t expirations;
+    if (read(m_timerFd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;
+    }
+    uint64_t now = nowNs();
+    while (playing()) {
+        if (m_waiting && !waitDone(now)) {
+            return;
+        }
+        if (m_dueNs > now) {
+            arm(m_dueNs);
+            return;
+        }
+        const MacroStep & step = m_steps[m_next];
+        if (step.event.type != static_cast<uint8_t>(EventType::kNone)) {
+            m_counters.steps++;
+            m_counters.jitter.add(now - m_dueNs);
+            m_deliver(step.event, m_dueNs, now);
+        }
+        m_next++;
+        if (playing()) {
+            begin(m_dueNs, now);
+        } else {
+            m_counters.completed++;
+            stop();
+        }
+    }
+}
+
+void MacroPlayer::begin(uint64_t previousDueNs, uint64_t now)
+{
+    const MacroStep & step = m_steps[m_next];
+    if (step.waitMs == 0) {
+        m_dueNs = previousDueNs + step.delayUs * 1000ull;
+        return;
+    }
+    m_counters.waits++;
+    m_waiting = true;
+    m_hashKnown = m_screenHash(m_hash);
+    m_waitEndNs = now + step.waitMs * 1000000ull;
+}
+
+bool MacroPlayer::waitDone(uint64_t now)
+{
+    uint64_t hash;
+    if (m_screenHash(hash)) {
+        if (m_hashKnown && hash != m_hash) {
+            m_waiting = false;
+            m_dueNs = now + m_steps[m_next].delayUs * 1000ull;
+            return true;
+        }
+        m_hash = hash;
+        m_hashKnown = true;
+    }
+    if (now >= m_waitEndNs) {
+        m_counters.waitTimeouts++;
+        stop();
+        return false;
+    }
+    arm(now + kScreenPollNs < m_waitEndNs ? now + kScreenPollNs : m_waitEndNs);
+    return false;
+}
+
+void MacroPlayer::arm(uint64_t atNs)
+{
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = atNs / 1000000000ull;
+    spec.it_value.tv_nsec = atNs % 1000000000ull;
+    timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+ScreenWatch::ScreenWatch()
+{
+    for (int i = 0; i < kNumStripes; i++) {
+        m_fds[i] = -1;
+        m_states[i] = nullptr;
+    }
+}
+
+ScreenWatch::~ScreenWatch()
+{
+    for (int i = 0; i < kNumStripes; i++) {
+        if (m_states[i] != nullptr) {
+            munmap(m_states[i], StripeStore::kStateSize);
+        }
+        if (m_fds[i] >= 0) {
+            close(m_fds[i]);
+        }
+    }
+}
+
+// getimg may come up after inputd, tried until it did
+bool ScreenWatch::open()
+{
+    for (int i = 0; i < kNumStripes; i++) {
+        if (m_states[i] != nullptr) {
+            continue;
+        }
+        std::string path = "/dev/shm/kvm_stripe" + std::to_string(i);  // StripeStore::path()
+        if (m_fds[i] < 0) {
+            m_fds[i] = ::open(path.c_str(), O_RDONLY);
+        }
+        if (m_fds[i] < 0) {
+            return false;
+        }
+        void *mem = mmap(NULL, StripeStore::kStateSize, PROT_READ, MAP_SHARED, m_fds[i], 0);
+        if (mem == MAP_FAILED) {
+            return false;
+        }
+        m_states[i] = mem;
+    }
+    return true;
+}
+
+bool ScreenWatch::hash(uint64_t & out)
+{
+    if (!open()) {
+        return false;
+    }
+    // shared with each other, never waiting for getimg's exclusive lock
+    int locked = 0;
+    while (locked < kNumStripes && flock(m_fds[locked], LOCK_SH | LOCK_NB) == 0) {
+        locked++;
+    }
+    bool ok = locked == kNumStripes;
+    out = 0;
+    for (int i = 0; i < kNumStripes && ok; i++) {
+        const StripeState *state = static_cast<const StripeState *>(m_states[i]);
+        ok = state->magic == kStripeMagic && state->goodLength != 0;
+        out = (out ^ state->goodHash) * 0x100000001b3ull;
+    }
+    while (locked > 0) {
+        flock(m_fds[--locked], LOCK_UN);
+    }
+    return ok;
+}
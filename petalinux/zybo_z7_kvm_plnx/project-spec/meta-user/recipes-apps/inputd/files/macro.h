@@ -0,0 +1,172 @@
+#ifndef MACRO_H
+#define MACRO_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "delay_histogram.h"
+#include "input_event.h"
+
+/*
+ * Timed input macros: what the operator typed and clicked, with the time
+ * between events, played back later at the same pace (a BIOS hotkey held
+ * through POST, a GRUB entry picked). A step may first wait for the screen
+ * to change, e.g. for the menu to come up, before its event and the time
+ * of the steps after it count on from there. Macro files are the steps as
+ * they are in memory, little endian like the wire format.
+ */
+
+struct __attribute__((packed)) MacroStep
+{
+    uint32_t delayUs;       // after the previous step, or after the screen changed
+    uint32_t waitMs;        // 0, or wait up to this long for a stripe to change first
+    InputEvent event;       // EventType::kNone: nothing to send, just the wait
+};
+
+static_assert(sizeof(MacroStep) == 16, "MacroStep is 16 bytes in a macro file");
+
+bool saveMacro(const std::string & path, const std::vector<MacroStep> & steps);
+bool loadMacro(const std::string & path, std::vector<MacroStep> & steps);
+
+class MacroRecorder
+{
+public:
+    MacroRecorder();
+
+    MacroRecorder(const MacroRecorder&) = delete;
+    MacroRecorder& operator=(const MacroRecorder&) = delete;
+
+    // drops what was recorded so far
+    void start(uint64_t nowNs);
+
+    bool recording() const
+    {
+        return m_recording;
+    }
+
+    void add(const InputEvent & event, uint64_t receivedNs);
+
+    // the next step waits for the screen to change, up to timeoutMs
+    void wait(uint32_t timeoutMs, uint64_t nowNs);
+
+    std::vector<MacroStep> stop();
+
+private:
+    bool m_recording;
+    uint64_t m_lastNs;
+    uint32_t m_waitMs;
+    std::vector<MacroStep> m_steps;
+};
+
+struct MacroCounters
+{
+    uint64_t plays;         // macros started
+    uint64_t completed;     // played to the end
+    uint64_t steps;         // events sent
+    uint64_t waits;         // screen changes waited for
+    uint64_t waitTimeouts;  // the screen did not change in time, the macro was stopped
+    DelayHistogram jitter;  // a step sent after the time it was due
+};
+
+/*
+ * Plays a macro on a timerfd set to the absolute time the next step is
+ * due, so it neither drifts nor busy-waits: steps are due at their delays
+ * after the one before was due (not after it was sent), and all that are
+ * due when the timer fires go out at once, for ReportScheduler to merge
+ * into the reports of the poll interval. While a step waits, the timer
+ * samples the screen hash every kScreenPollNs.
+ */
+class MacroPlayer
+{
+public:
+    static const uint64_t kScreenPollNs = 10000000ull;
+
+    // event is due at dueNs, late by nowNs - dueNs
+    typedef std::function<void(const InputEvent & event, uint64_t dueNs, uint64_t nowNs)> Deliver;
+
+    // a hash of what is on screen, false if it cannot be told now
+    typedef std::function<bool(uint64_t & hash)> ScreenHash;
+
+    MacroPlayer(Deliver deliver, ScreenHash screenHash);
+
+    MacroPlayer(const MacroPlayer&) = delete;
+    MacroPlayer& operator=(const MacroPlayer&) = delete;
+
+    ~MacroPlayer();
+
+    bool isOpen() const
+    {
+        return m_timerFd >= 0;
+    }
+
+    // timerfd to poll for, call flush() when it is readable
+    int timerFd() const
+    {
+        return m_timerFd;
+    }
+
+    // stops the one playing, if any
+    void play(const std::vector<MacroStep> & steps, uint64_t nowNs);
+
+    void stop();
+
+    bool playing() const
+    {
+        return m_next < m_steps.size();
+    }
+
+    void flush();
+
+    const MacroCounters & counters() const
+    {
+        return m_counters;
+    }
+
+private:
+    void begin(uint64_t previousDueNs, uint64_t now);
+    bool waitDone(uint64_t now);
+    void arm(uint64_t atNs);
+
+    Deliver m_deliver;
+    ScreenHash m_screenHash;
+    int m_timerFd;
+    std::vector<MacroStep> m_steps;
+    size_t m_next;
+    uint64_t m_dueNs;           // of m_steps[m_next], unless it waits
+    bool m_waiting;             // for the screen, before m_steps[m_next]
+    bool m_hashKnown;
+    uint64_t m_hash;            // when the wait began
+    uint64_t m_waitEndNs;
+    MacroCounters m_counters;
+};
+
+/*
+ * Hash over the good stripes getimg keeps in /dev/shm/kvm_stripe0..3,
+ * which change when the screen does. They are refreshed when served, so
+ * this follows the screen while someone watches it (the browser or getimg).
+ */
+class ScreenWatch
+{
+public:
+    ScreenWatch();
+
+    ScreenWatch(const ScreenWatch&) = delete;
+    ScreenWatch& operator=(const ScreenWatch&) = delete;
+
+    ~ScreenWatch();
+
+    // false if getimg made no stripes yet or holds one of them locked
+    bool hash(uint64_t & out);
+
+private:
+    bool open();
+
+    static const int kNumStripes = 4;
+
+    int m_fds[kNumStripes];
+    void *m_states[kNumStripes];
+};
+
+#endif
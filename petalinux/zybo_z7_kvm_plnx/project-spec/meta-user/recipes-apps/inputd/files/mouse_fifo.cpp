@@ -0,0 +1,105 @@
+#include "mouse_fifo.h"
+
+#include <iostream>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace {
+
+inline int16_t clampInt16(long v)
+{
+    return v < -32767 ? -32767 : v > 32767 ? 32767 : v;
+}
+
+}
+
+MouseFifo::MouseFifo(const std::string & path, Handler handler) :
+    m_fd { -1 },
+    m_handler { handler },
+    m_length { 0 },
+    m_lines { 0 },
+    m_bad { 0 }
+{
+    if (mkfifo(path.c_str(), 0666) != 0 && errno != EEXIST) {
+        std::cerr << "Could not make " << path << ", errno " << errno << std::endl;
+        return;
+    }
+    // read/write, so it is not at EOF while no CGI has it open
+    m_fd = open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (m_fd < 0) {
+        std::cerr << "Could not open " << path << ", errno " << errno << std::endl;
+    }
+}
+
+MouseFifo::~MouseFifo()
+{
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+void MouseFifo::read()
+{
+    for (;;) {
+        ssize_t n = ::read(m_fd, m_line + m_length, kMaxLine - 1 - m_length);
+        if (n <= 0) {
+            return;
+        }
+        m_length += n;
+        char *p;
+        while ((p = static_cast<char *>(memchr(m_line, '\n', m_length))) != nullptr) {
+            *p = '\0';
+            take(m_line);
+            m_length -= p + 1 - m_line;
+            memmove(m_line, p + 1, m_length);
+        }
+        // no newline in a full buffer: drop the overlong line
+        if (m_length == kMaxLine - 1) {
+            m_length = 0;
+            m_bad++;
+        }
+    }
+}
+
+void MouseFifo::take(char *line)
+{
+    if (line[strspn(line, " \t\r")] == '\0') {
+        return;
+    }
+    long values[3] = {};
+    int numbers = 0;
+    uint8_t buttons = 0;
+    bool hold = false;
+    bool bad = false;
+    char *save = nullptr;
+    for (char *tok = strtok_r(line, " \t\r", &save); tok != nullptr; tok = strtok_r(nullptr, " \t\r", &save)) {
+        if (strcmp(tok, "--hold") == 0) {
+            hold = true;
+        } else if (strncmp(tok, "--b", 3) == 0 && tok[3] >= '1' && tok[3] <= '5' && tok[4] == '\0') {
+            buttons |= 1 << (tok[3] - '1');
+        } else if (tok[0] != '-' || tok[1] != '-') {
+            char *end;
+            long v = strtol(tok, &end, 0);
+            if (*end != '\0' || numbers == 3) {
+                bad = true;
+            } else {
+                values[numbers++] = v;
+            }
+        } else {
+            bad = true;
+        }
+    }
+    m_lines++;
+    if (bad) {
+        m_bad++;
+    }
+    m_handler({ static_cast<uint8_t>(EventType::kMouse), buttons,
+                clampInt16(values[0]), clampInt16(values[1]), clampInt16(values[2]) });
+    if (!hold && buttons != 0) {
+        m_handler({ static_cast<uint8_t>(EventType::kMouse), 0, 0, 0, 0 });
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef MOUSE_FIFO_H
+#define MOUSE_FIFO_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "input_event.h"
+
+/*
+ * The FIFO cgi-bin/mouse writes to (webmouse > web_to_mouse), read by
+ * inputd so that /dev/hidg0 has a single writer. Takes the lines of
+ * hidgadgettest's mouse mode, "DX DY [WHEEL] [--b1 .. --b5] [--hold]", each
+ * as one kMouse event holding those buttons; a line with buttons but
+ * without --hold is a click, an event releasing them follows. The FIFO is
+ * kept open for writing too, so it never reads as closed between writers.
+ */
+class MouseFifo
+{
+public:
+    typedef std::function<void(const InputEvent &)> Handler;
+
+    static const uint32_t kMaxLine = 512;     // hidgadgettest's BUF_LEN
+
+    // made if it does not exist
+    MouseFifo(const std::string & path, Handler handler);
+
+    MouseFifo(const MouseFifo&) = delete;
+    MouseFifo& operator=(const MouseFifo&) = delete;
+
+    ~MouseFifo();
+
+    bool isOpen() const
+    {
+        return m_fd >= 0;
+    }
+
+    // readable when a writer wrote
+    int fd() const
+    {
+        return m_fd;
+    }
+
+    // takes the lines written so far
+    void read();
+
+    uint64_t lines() const
+    {
+        return m_lines;
+    }
+
+    // lines with a token it does not know, taken without it
+    uint64_t bad() const
+    {
+        return m_bad;
+    }
+
+private:
+    void take(char *line);
+
+    int m_fd;
+    Handler m_handler;
+    char m_line[kMaxLine];
+    uint32_t m_length;
+    uint64_t m_lines;
+    uint64_t m_bad;
+};
+
+#endif
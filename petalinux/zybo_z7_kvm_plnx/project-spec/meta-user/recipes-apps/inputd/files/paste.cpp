@@ -0,0 +1,172 @@
+#include "paste.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+namespace {
+
+inline uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+}
+
+PasteTyper::PasteTyper(HidKeyboard & keyboard, uint32_t intervalUs) :
+    m_keyboard { keyboard },
+    m_minGapNs { intervalUs * 500ull },
+    m_timerFd { -1 },
+    m_typing { false },
+    m_next { 0 },
+    m_modifiers { 0 },
+    m_refused { 0 },
+    m_gapNs { m_minGapNs },
+    m_startNs { 0 },
+    m_chars { 0 },
+    m_lastChars { 0 },
+    m_lastNs { 0 },
+    m_counters {}
+{
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timerFd < 0) {
+        std::cerr << "Could not create a timer, errno " << errno << std::endl;
+    }
+}
+
+PasteTyper::~PasteTyper()
+{
+    if (m_timerFd >= 0) {
+        close(m_timerFd);
+    }
+}
+
+bool PasteTyper::type(const std::string & text, const std::string & layoutName, uint64_t nowNs)
+{
+    const KeyLayout *layout = keyLayout(layoutName);
+    if (layout == nullptr) {
+        return false;
+    }
+    stop(nowNs);
+    const CharKey *space = layoutKey(*layout, ' ');
+    size_t pos = 0;
+    while (pos < text.size()) {
+        uint32_t codepoint;
+        if (!decodeUtf8(text, pos, codepoint)) {
+            m_counters.skipped++;
+            continue;
+        }
+        // CR LF and a lone CR are one Enter
+        if (codepoint == '\r') {
+            codepoint = '\n';
+            if (pos < text.size() && text[pos] == '\n') {
+                pos++;
+            }
+        }
+        const CharKey *key = layoutKey(*layout, codepoint);
+        if (key == nullptr) {
+            m_counters.skipped++;
+            continue;
+        }
+        m_strokes.push_back({ key->usage, key->modifiers, true });
+        if (key->dead) {
+            m_strokes.push_back({ space->usage, 0, false });
+        }
+    }
+    // keys the browser held down would change what the strokes type
+    m_keyboard.releaseAll(nowNs);
+    m_counters.pastes++;
+    m_typing = true;
+    m_refused = m_keyboard.scheduler().counters().refused;
+    m_gapNs = m_minGapNs;
+    m_startNs = nowNs;
+    m_chars = 0;
+    arm(nowNs);
+    return true;
+}
+
+void PasteTyper::stop(uint64_t nowNs)
+{
+    if (m_typing) {
+        m_keyboard.releaseAll(nowNs);
+        m_counters.typingNs += nowNs - m_startNs;
+        m_typing = false;
+    }
+    m_strokes.clear();
+    m_next = 0;
+    m_modifiers = 0;
+    struct itimerspec spec = {};
+    timerfd_settime(m_timerFd, 0, &spec, nullptr);
+}
+
+void PasteTyper::flush()
+{
+    uint64_t expirations;
+    if (read(m_timerFd, &expirations, sizeof(expirations)) != sizeof(expirations) || !m_typing) {
+        return;
+    }
+    uint64_t now = nowNs();
+    ReportScheduler & scheduler = m_keyboard.scheduler();
+    if (scheduler.counters().refused != m_refused) {
+        m_refused = scheduler.counters().refused;
+        m_gapNs = std::min(m_gapNs * 2, kMaxGapNs);
+        m_counters.backoffs++;
+    } else {
+        m_gapNs = std::max(m_gapNs - m_gapNs / 16, m_minGapNs);
+    }
+    while (m_next < m_strokes.size() && scheduler.backlog() < kWindow) {
+        press(m_strokes[m_next++], now);
+    }
+    if (m_next == m_strokes.size()) {
+        if (m_modifiers != 0) {
+            press({ 0, 0, false }, now);
+        }
+        if (!scheduler.busy()) {
+            finish(now);
+            return;
+        }
+    }
+    arm(now + m_gapNs);
+}
+
+void PasteTyper::press(const Stroke & stroke, uint64_t now)
+{
+    for (uint32_t bit = 0; bit < 8; bit++) {
+        uint8_t mask = 1 << bit;
+        if ((m_modifiers ^ stroke.modifiers) & mask) {
+            m_keyboard.key(kUsageFirstModifier + bit, (stroke.modifiers & mask) != 0, now);
+        }
+    }
+    m_modifiers = stroke.modifiers;
+    if (stroke.usage != 0) {
+        m_keyboard.key(stroke.usage, true, now);
+        m_keyboard.key(stroke.usage, false, now);
+    }
+    if (stroke.character) {
+        m_chars++;
+        m_counters.chars++;
+    }
+}
+
+void PasteTyper::finish(uint64_t now)
+{
+    m_lastChars = m_chars;
+    m_lastNs = now - m_startNs;
+    m_counters.typingNs += m_lastNs;
+    m_typing = false;
+    m_strokes.clear();
+    m_next = 0;
+}
+
+void PasteTyper::arm(uint64_t atNs)
+{
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = atNs / 1000000000ull;
+    spec.it_value.tv_nsec = atNs % 1000000000ull;
+    timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
@@ -0,0 +1,118 @@
+#ifndef PASTE_H
+#define PASTE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "hid_report.h"
+#include "keymap.h"
+
+struct PasteCounters
+{
+    uint64_t pastes;        // texts typed or being typed
+    uint64_t chars;         // characters typed
+    uint64_t skipped;       // characters the layout has no key for, and malformed UTF-8
+    uint64_t backoffs;      // times the gap was doubled as the host fell behind
+    uint64_t typingNs;      // time spent typing, for chars/s
+};
+
+/*
+ * Types text into the host as key presses and releases, for pasting into
+ * a console or a BIOS field that has no clipboard. Each character goes
+ * through the table of the host's keyboard layout (keymap.h): the
+ * modifiers it needs are pressed (and kept down for the characters after
+ * that need them too), then its key is pressed and released.
+ *
+ * HidKeyboard merges the changes into one report per poll interval, so
+ * the typer only keeps a few changes ahead of the scheduler (kWindow) on a
+ * timerfd: each report carries one character, the release of the one
+ * before and the press of the next, which is as fast as the host takes
+ * them. A host that is slower than its poll interval (a write refused as
+ * the last report was not fetched yet) doubles the gap between the ticks,
+ * up to kMaxGapNs; ticks without refusals shorten it again by a sixteenth.
+ */
+class PasteTyper
+{
+public:
+    static const uint32_t kWindow = 4;                  // changes queued and not yet written
+    static const uint64_t kMaxGapNs = 32000000ull;
+
+    PasteTyper(HidKeyboard & keyboard, uint32_t intervalUs);
+
+    PasteTyper(const PasteTyper&) = delete;
+    PasteTyper& operator=(const PasteTyper&) = delete;
+
+    ~PasteTyper();
+
+    bool isOpen() const
+    {
+        return m_timerFd >= 0;
+    }
+
+    // timerfd to poll for, call flush() when it is readable
+    int timerFd() const
+    {
+        return m_timerFd;
+    }
+
+    // UTF-8 text, stops the paste typed before; false for an unknown layout
+    bool type(const std::string & text, const std::string & layoutName, uint64_t nowNs);
+
+    // releases the keys held for the text
+    void stop(uint64_t nowNs);
+
+    // until the last report of the text is written
+    bool typing() const
+    {
+        return m_typing;
+    }
+
+    void flush();
+
+    // between ticks, now
+    uint64_t gapNs() const
+    {
+        return m_gapNs;
+    }
+
+    // of the last text typed to the end, 0 before
+    double charsPerSecond() const
+    {
+        return m_lastNs > 0 ? m_lastChars * 1e9 / m_lastNs : 0.0;
+    }
+
+    const PasteCounters & counters() const
+    {
+        return m_counters;
+    }
+
+private:
+    struct Stroke
+    {
+        uint8_t usage;          // 0: just the modifiers
+        uint8_t modifiers;
+        bool character;         // false for the space after a dead key
+    };
+
+    void press(const Stroke & stroke, uint64_t now);
+    void finish(uint64_t now);
+    void arm(uint64_t atNs);
+
+    HidKeyboard & m_keyboard;
+    uint64_t m_minGapNs;
+    int m_timerFd;
+    bool m_typing;
+    std::vector<Stroke> m_strokes;
+    size_t m_next;
+    uint8_t m_modifiers;        // held for the strokes
+    uint64_t m_refused;         // of the scheduler, at the last tick
+    uint64_t m_gapNs;
+    uint64_t m_startNs;
+    uint64_t m_chars;           // in the text being typed
+    uint64_t m_lastChars;
+    uint64_t m_lastNs;
+    PasteCounters m_counters;
+};
+
+#endif
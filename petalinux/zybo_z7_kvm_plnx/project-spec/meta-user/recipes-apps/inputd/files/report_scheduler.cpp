@@ -0,0 +1,122 @@
+#include "report_scheduler.h"
+
+#include <iostream>
+#include <cerrno>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "hid_report.h"
+
+namespace {
+
+inline uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+}
+
+ReportScheduler::ReportScheduler(HidDevice & device, uint32_t length, uint32_t intervalUs, Builder builder) :
+    m_device(device),
+    m_intervalNs { intervalUs * 1000ull },
+    m_builder { builder },
+    m_timerFd { -1 },
+    m_armed { false },
+    m_pending { false },
+    m_pendingEvents { 0 },
+    m_lastSendNs { 0 },
+    m_report(length),
+    m_counters {}
+{
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timerFd < 0) {
+        std::cerr << "Could not create a timer, errno " << errno << std::endl;
+    }
+}
+
+ReportScheduler::~ReportScheduler()
+{
+    if (m_timerFd >= 0) {
+        close(m_timerFd);
+    }
+}
+
+bool ReportScheduler::queued(uint64_t receivedNs)
+{
+    m_received.push_back(receivedNs);
+    m_counters.events++;
+    if (m_received.size() > m_counters.maxBacklog) {
+        m_counters.maxBacklog = m_received.size();
+    }
+    if (m_armed) {
+        return true;
+    }
+    bool ok = true;
+    uint64_t now = nowNs();
+    if (now - m_lastSendNs >= m_intervalNs) {
+        ok = sendNext(now);
+    }
+    if (busy()) {
+        arm(m_lastSendNs + m_intervalNs);
+    }
+    return ok;
+}
+
+bool ReportScheduler::flush()
+{
+    uint64_t expirations;
+    if (read(m_timerFd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return true;
+    }
+    m_armed = false;
+    bool ok = busy() ? sendNext(nowNs()) : true;
+    if (busy()) {
+        arm(m_lastSendNs + m_intervalNs);
+    }
+    return ok;
+}
+
+bool ReportScheduler::sendNext(uint64_t now)
+{
+    if (!m_pending) {
+        uint32_t covered = 0;
+        if (!m_builder(m_report.data(), covered)) {
+            m_received.clear();
+            return true;
+        }
+        m_pending = true;
+        m_pendingEvents = covered < m_received.size() ? covered : m_received.size();
+    }
+    m_lastSendNs = now;
+    bool ok = m_device.send(m_report.data(), m_report.size());
+    if (!ok && errno == EAGAIN) {
+        // the host polls for the last one first, try again on the next tick
+        m_counters.refused++;
+        return true;
+    }
+    uint64_t written = nowNs();
+    if (ok && m_written && m_pendingEvents > 0) {
+        m_written(m_received.front(), written);
+    }
+    for (uint32_t i = 0; i < m_pendingEvents; i++) {
+        if (ok) {
+            m_counters.delay.add(written - m_received.front());
+        }
+        m_received.pop_front();
+    }
+    m_pending = false;
+    m_counters.reports += ok ? 1 : 0;
+    return ok;
+}
+
+void ReportScheduler::arm(uint64_t atNs)
+{
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = atNs / 1000000000ull;
+    spec.it_value.tv_nsec = atNs % 1000000000ull;
+    timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    m_armed = true;
+}
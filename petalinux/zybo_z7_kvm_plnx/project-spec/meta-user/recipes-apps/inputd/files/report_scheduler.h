@@ -0,0 +1,103 @@
+#ifndef REPORT_SCHEDULER_H
+#define REPORT_SCHEDULER_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "delay_histogram.h"
+#include "ring_buffer.h"
+
+class HidDevice;
+
+struct SchedulerCounters
+{
+    uint64_t events;            // events queued
+    uint64_t reports;           // reports written
+    uint64_t refused;           // writes refused as the host had not fetched the last report
+    uint64_t maxBacklog;        // most events queued at once
+    DelayHistogram delay;       // event received to its report written
+};
+
+/*
+ * Paces the reports of one HID function to the poll interval of its
+ * endpoint (bInterval): f_hid holds one report until the host polls for
+ * it, so reports written faster only wait in the driver (or block the
+ * writer) and add latency. The source queues its events and calls queued()
+ * with the time it got each; the scheduler asks the builder for one report
+ * of what is due, at once if the last one went out an interval ago, else
+ * on the timerfd at the next interval. The builder merges whatever came in
+ * meanwhile and says how many events the report covers, so the delay of
+ * each event to its report is measured. The device is non-blocking: a
+ * report the driver refuses stays built and goes on the next tick, the
+ * events after it merging into the one after.
+ */
+class ReportScheduler
+{
+public:
+    // fills report and sets covered to the number of queued events it holds;
+    // false: nothing to send, the queued events changed nothing
+    typedef std::function<bool(uint8_t *report, uint32_t & covered)> Builder;
+
+    // a report was written, holding the event received at receivedNs first
+    typedef std::function<void(uint64_t receivedNs, uint64_t writtenNs)> Written;
+
+    ReportScheduler(HidDevice & device, uint32_t length, uint32_t intervalUs, Builder builder);
+
+    ReportScheduler(const ReportScheduler&) = delete;
+    ReportScheduler& operator=(const ReportScheduler&) = delete;
+
+    ~ReportScheduler();
+
+    // timerfd to poll for, call flush() when it is readable
+    int timerFd() const
+    {
+        return m_timerFd;
+    }
+
+    // the source queued an event it got at receivedNs
+    bool queued(uint64_t receivedNs);
+
+    void setWritten(Written written)
+    {
+        m_written = written;
+    }
+
+    bool flush();
+
+    // events or a report are waiting
+    bool busy() const
+    {
+        return m_pending || !m_received.empty();
+    }
+
+    // events queued and not yet in a written report
+    uint64_t backlog() const
+    {
+        return m_received.size();
+    }
+
+    const SchedulerCounters & counters() const
+    {
+        return m_counters;
+    }
+
+private:
+    bool sendNext(uint64_t now);
+    void arm(uint64_t atNs);
+
+    HidDevice & m_device;
+    uint64_t m_intervalNs;
+    Builder m_builder;
+    Written m_written;
+    int m_timerFd;
+    bool m_armed;
+    bool m_pending;             // m_report was refused, send it again
+    uint32_t m_pendingEvents;   // events it covers
+    uint64_t m_lastSendNs;
+    RingBuffer<uint64_t> m_received;
+    std::vector<uint8_t> m_report;
+    SchedulerCounters m_counters;
+};
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <cstddef>
+#include <vector>
+
+/*
+ * First in, first out queue in storage allocated up front, for the queues
+ * the input path fills and drains on every event: std::deque allocates
+ * and frees a block every few dozen entries as the queue moves along. It
+ * only grows, doubling, when more than kCapacity entries are queued at
+ * once, which the poll interval keeps from happening in practice.
+ */
+template <typename T>
+class RingBuffer
+{
+public:
+    static const size_t kCapacity = 1024;     // a power of two
+
+    RingBuffer() :
+        m_items(kCapacity),
+        m_head { 0 },
+        m_size { 0 }
+    {
+    }
+
+    bool empty() const
+    {
+        return m_size == 0;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    // i-th from the front
+    T & operator[](size_t i)
+    {
+        return m_items[(m_head + i) & (m_items.size() - 1)];
+    }
+
+    const T & operator[](size_t i) const
+    {
+        return m_items[(m_head + i) & (m_items.size() - 1)];
+    }
+
+    T & front()
+    {
+        return (*this)[0];
+    }
+
+    T & back()
+    {
+        return (*this)[m_size - 1];
+    }
+
+    void push_back(const T & item)
+    {
+        if (m_size == m_items.size()) {
+            grow();
+        }
+        m_size++;
+        back() = item;
+    }
+
+    void pop_front()
+    {
+        m_head = (m_head + 1) & (m_items.size() - 1);
+        m_size--;
+    }
+
+    void clear()
+    {
+        m_head = 0;
+        m_size = 0;
+    }
+
+private:
+    void grow()
+    {
+        std::vector<T> items(m_items.size() * 2);
+        for (size_t i = 0; i < m_size; i++) {
+            items[i] = (*this)[i];
+        }
+        m_items.swap(items);
+        m_head = 0;
+    }
+
+    std::vector<T> m_items;
+    size_t m_head;
+    size_t m_size;
+};
+
+#endif
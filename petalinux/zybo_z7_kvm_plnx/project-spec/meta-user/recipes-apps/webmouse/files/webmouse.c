@@ -1,59 +1,85 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* the frame rate governor of getimg goes back to full rate on input */
+static void signal_input(void)
+{
+    int fd = open("/dev/shm/kvm_input", O_WRONLY | O_CREAT, 0666);
+    if(fd >= 0)
+    {
+        futimens(fd, NULL);
+        close(fd);
+    }
+}
+
+/* one line for the mouse FIFO (inputd -f, or hidgadgettest): the motion
+   and the buttons held, kept held (--hold) until the next line says
+   otherwise */
+static void print_line(long dx, long dy, long buttons)
+{
+    int i;
+
+    fprintf(stdout, "%li %li", dx, dy);
+    for(i = 0; i < 5; i++)
+    {
+        if(buttons & (1 << i))
+            fprintf(stdout, " --b%d", i + 1);
+    }
+    fprintf(stdout, " --hold\n");
+}
+
+static long clamp16(long v)
+{
+    return v < -32767 ? -32767 : v > 32767 ? 32767 : v;
+}
 
 int main(int argc, char **argv)
 {
-    const char* query = getenv("QUERY_STRING");
+    char* query = getenv("QUERY_STRING");
     const char* delim = "&";
     char *token;
     char *fix;
-    long dx, dy, lc, rc, cdx, cdy;
+    long dx = 0, dy = 0, buttons = 0, clicked = 0;
 
     if(query)
     {
+        signal_input();
 
         token = strtok(query, delim);
 
         while(token != NULL)
         {
             fix = strchr(token, '=');
-            *fix = '\0';
-            if(strcmp(token, "dx") == 0)
-                dx = atol(fix+1);
-            else if(strcmp(token, "dy") == 0)
-                dy = atol(fix+1);
-            else if(strcmp(token, "lc") == 0)
-                lc = atol(fix+1);
-            else if(strcmp(token, "rc") == 0)
-                rc = atol(fix+1);
+            if(fix != NULL)
+            {
+                *fix = '\0';
+                if(strcmp(token, "dx") == 0)
+                    dx = atol(fix+1);
+                else if(strcmp(token, "dy") == 0)
+                    dy = atol(fix+1);
+                else if(strcmp(token, "b") == 0)
+                    buttons = atol(fix+1) & 0x1f;
+                else if(strcmp(token, "c") == 0)
+                    clicked = atol(fix+1) & 0x1f;
+            }
             token = strtok(NULL, delim);
         }
 
-        while(dx || dy)
+        /* a button pressed and released since the last request is
+           pressed with the motion and released by a second line */
+        if(clicked & ~buttons)
         {
-            if(dx <= -127)
-                cdx = -127;
-            else if(dx >= 127)
-                cdx = 127;
-            else
-                cdx = dx;
-            if(dy <= -127)
-                cdy = -127;
-            else if(dy >= 127)
-                cdy = 127;
-            else
-                cdy = dy;
-            dx -= cdx;
-            dy -= cdy;
-            fprintf(stdout, "%li %li\n", cdx, cdy);
+            print_line(clamp16(dx), clamp16(dy), buttons | clicked);
+            print_line(0, 0, buttons);
+        }
+        else
+        {
+            print_line(clamp16(dx), clamp16(dy), buttons);
         }
-
-        if(lc)
-            fprintf(stdout, "--b1\n");
-
-        if(rc)
-            fprintf(stdout, "--b2\n");
-
     }
 
     return 0;